@@ -0,0 +1,12 @@
+function survive(n, kept) {
+    if (n == 0) return kept;
+    typeof n;
+    typeof kept;
+    typeof false;
+    return survive(n - 1, typeof kept);
+}
+
+let first = typeof 1;
+let result = survive(4000000, "seed");
+first
+result
@@ -0,0 +1,10 @@
+function add(a, b) {
+    return a + b;
+}
+
+function loop(n, acc) {
+    if (n == 0) return acc;
+    return loop(n - 1, add(acc, 1));
+}
+
+loop(5000000, 0)
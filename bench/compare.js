@@ -0,0 +1,24 @@
+function strings(i, n, list) {
+    if (i == n) return list;
+    if (i % 3 == 0) list.push("" + i);
+    else if (i % 3 == 1) list.push(i + ".5");
+    else list.push("item" + i);
+    return strings(i + 1, n, list);
+}
+
+function matches(list, i, n, acc) {
+    if (i == n) return acc;
+    let s = list[i];
+    if (s == i) return matches(list, i + 1, n, acc + 1);
+    if (s == i + 0.5) return matches(list, i + 1, n, acc + 2);
+    if (s == true) return matches(list, i + 1, n, acc + 3);
+    return matches(list, i + 1, n, acc);
+}
+
+function passes(list, n, left, acc) {
+    if (left == 0) return acc;
+    return passes(list, n, left - 1, acc + matches(list, 0, n, 0));
+}
+
+let list = strings(0, 10000, []);
+passes(list, 10000, 200, 0)
@@ -0,0 +1,8 @@
+function build(n, s) {
+    if (n == 0) return s;
+    return build(n - 1, s + "0123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789");
+}
+
+let text = build(1000000, "");
+text == 0
+typeof text
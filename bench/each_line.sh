@@ -0,0 +1,60 @@
+#!/bin/sh
+# Lines per second through --each-line on a generated log file of
+# [megabytes] (10 GB by default), and through --each-number on a file
+# of numbers a tenth its size. Each file is a 64 MB block repeated, so
+# generating it is quick; output goes to /dev/null. Throughput is from
+# the time and line count --stats reports, which leave out startup.
+# Usage: each_line.sh [jank] [megabytes]
+
+jank=${1:-build/jank}
+megabytes=${2:-10240}
+dir=build/lines
+mkdir -p $dir
+
+# repeats 'block' until 'file' has 'megabytes' of whole lines
+fill() {
+    rm -f $2
+    copies=$(( $3 / 64 ))
+    [ $copies -lt 1 ] && copies=1
+    for i in $(seq 1 $copies); do cat $1; done > $2
+}
+
+awk 'BEGIN { srand(1); size = 0
+    while (size < 64 * 1048576) {
+        line = sprintf("2024-01-%02d %06d GET /api/v1/items/%d?user=%d status=%d bytes=%d",
+                       i % 28 + 1, i % 1000000, int(rand() * 100000), int(rand() * 5000),
+                       (rand() < 0.9 ? 200 : 404), int(rand() * 65536))
+        print line; size += length(line) + 1; i++ } }' > $dir/log_block.txt
+awk 'BEGIN { srand(2); size = 0
+    while (size < 64 * 1048576) {
+        line = sprintf("%.3f", rand() * 100000)
+        print line; size += length(line) + 1 } }' > $dir/number_block.txt
+
+fill $dir/log_block.txt $dir/log.txt $megabytes
+fill $dir/number_block.txt $dir/numbers.txt $(( megabytes / 10 ))
+
+cat > $dir/log.js <<JS
+line.length
+JS
+cat > $dir/fields.js <<JS
+let ok = line.length > 60;
+if (ok) line.length * 2;
+JS
+cat > $dir/numbers.js <<JS
+line * 2 + 1
+JS
+
+run() {
+    bytes=$(wc -c < $3)
+    $jank $1 $2 $3 --stats 2>&1 >/dev/null | awk -v name="$4" -v bytes=$bytes '
+        /^time/  { ms = $3 }
+        /^lines/ { lines = $3 }
+        END { printf "%-14s %14d %10.1f %14.0f %10.1f\n", name, lines, ms / 1e3, lines * 1e3 / ms, bytes / 1048576 * 1e3 / ms }'
+}
+
+printf "%-14s %14s %10s %14s %10s\n" "script" "lines" "seconds" "lines/s" "MB/s"
+run --each-line $dir/log.js $dir/log.txt "length"
+run --each-line $dir/fields.js $dir/log.txt "condition"
+run --each-number $dir/numbers.js $dir/numbers.txt "numbers"
+
+rm -f $dir/log.txt $dir/numbers.txt
@@ -0,0 +1,8 @@
+function churn(n, last) {
+    if (n == 0) return last;
+    typeof n;
+    typeof last;
+    return churn(n - 1, typeof true);
+}
+
+churn(3000000, "start")
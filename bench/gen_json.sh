@@ -0,0 +1,48 @@
+#!/bin/sh
+# Writes a JSON corpus of three kinds of document into a directory:
+# records.json (an array of small objects with the same keys, like an
+# API response), numbers.json (nested arrays of coordinates) and
+# text.json (long strings full of escapes and non-ASCII text). Each is
+# about 'size' bytes. See json.sh, which parses whatever is there.
+# Usage: gen_json.sh [dir] [size]
+
+dir=${1:-build/json}
+size=${2:-4000000}
+
+mkdir -p $dir
+
+awk -v size=$size 'BEGIN {
+    srand(1)
+    printf "["
+    for (i = 0; bytes < size; i++) {
+        line = sprintf("%s\n  {\"id\": %d, \"name\": \"user%d\", \"email\": \"user%d@example.com\", \"active\": %s, \"score\": %.2f, \"tags\": [\"a\", \"b%d\"], \"manager\": null}", i ? "," : "", i, i, i, i % 3 ? "true" : "false", rand() * 1000, i % 10)
+        printf "%s", line
+        bytes += length(line)
+    }
+    print "\n]"
+}' > $dir/records.json
+
+awk -v size=$size 'BEGIN {
+    srand(2)
+    printf "{\"type\": \"FeatureCollection\", \"coordinates\": ["
+    for (i = 0; bytes < size; i++) {
+        line = sprintf("%s[%.6f, %.6f, %d]", i ? ", " : "", rand() * 360 - 180, rand() * 180 - 90, int(rand() * 9000))
+        printf "%s", line
+        bytes += length(line)
+    }
+    print "]}"
+}' > $dir/numbers.json
+
+awk -v size=$size 'BEGIN {
+    srand(3)
+    split("plain words here|tab\\tand\\nnewline|quote \\\"inside\\\"|back\\\\slash|caf\\u00e9 na\\u00efve|\\ud83d\\ude00 emoji|héllo wörld|日本語のテキスト", parts, "|")
+    printf "["
+    for (i = 0; bytes < size; i++) {
+        text = ""
+        for (j = 0; j < 20; j++) text = text parts[int(rand() * 8) + 1] " "
+        line = sprintf("%s\n  {\"id\": %d, \"body\": \"%s\"}", i ? "," : "", i, text)
+        printf "%s", line
+        bytes += length(line)
+    }
+    print "\n]"
+}' > $dir/text.json
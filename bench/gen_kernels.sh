@@ -0,0 +1,42 @@
+#!/bin/sh
+# Prints a script that builds an array of doubles and runs the numeric
+# array builtins over it. Run it under --kernels scalar, sse2 and avx2 to
+# compare the variants; with 0 repeats it times the setup alone.
+# Usage: gen_kernels.sh [elements] [repeats] [ops]
+
+count=${1:-1000000}
+repeats=${2:-100}
+ops=${3:-"sum min max dot add mul map"}
+
+expr=""
+for op in $ops; do
+    case $op in
+        dot) call="a.dot(a)" ;;
+        add|mul) call="a.$op(a).length" ;;
+        map) call="a.map(twice).length" ;;
+        *) call="a.$op()" ;;
+    esac
+    expr="$expr + $call"
+done
+
+cat <<JS
+function build(n) {
+    if (n == 0) return [];
+    let half = build(n / 2);
+    if (n % 2 == 1) return half.concat(half.concat([n * 0.25]));
+    return half.concat(half);
+}
+
+function twice(x) {
+    return x * 2;
+}
+
+function run(a, times, acc) {
+    if (times == 0) return acc;
+    return run(a, times - 1, acc$expr);
+}
+
+let a = build($count);
+a.length
+run(a, $repeats, 0)
+JS
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Prints a script with a large, long-lived old generation (the constants
+# of one function) and a workload that keeps promoting short-lived
+# strings, so major collections run while the heap is big. Compare the
+# pause histograms of --gc-mode stw and --gc-mode concurrent.
+# Usage: gen_latency.sh [live strings]
+
+count=${1:-200000}
+
+echo "function live() {"
+awk -v n="$count" 'BEGIN { for (i = 0; i < n; i++) printf "    \"long-lived string number %d\";\n", i }'
+echo "}"
+
+cat <<'JS'
+
+function deep(n) {
+    if (n == 0) return 0;
+    let s = typeof n;
+    typeof s;
+    typeof s;
+    return deep(n - 1) + 1;
+}
+
+function work(i) {
+    if (i == 0) return 0;
+    deep(200);
+    return work(i - 1);
+}
+
+let warm = live();
+work(20000)
+JS
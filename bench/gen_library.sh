@@ -0,0 +1,28 @@
+#!/bin/sh
+# Prints a library-sized script: many non-trivial functions, of which the
+# script itself only calls a handful. Usage: gen_library.sh [functions]
+
+count=${1:-5000}
+
+i=0
+while [ $i -lt $count ]; do
+    cat <<FN
+function helper$i(a, b, c) {
+    let x = a * $i + b;
+    let y = (x - c) % 7;
+    if (y < 0) {
+        return -y + helper$i(a, b + 1, c);
+    }
+    if (x > b) {
+        return x + y * 2 - helper$i(a - 1, b, c);
+    } else {
+        if (a == 0) return b;
+        return (x & 255) ^ (y << 2) ^ (c >> 1);
+    }
+}
+
+FN
+    i=$((i + 1))
+done
+
+echo "helper0(0, 3, 5) + helper1(0, 4, 6) + helper$((count - 1))(0, 1, 2)"
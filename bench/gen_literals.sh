@@ -0,0 +1,22 @@
+#!/bin/sh
+# Prints a script made mostly of number literals: integers, decimals
+# with up to 17 digits and exponents, in arrays of ten. Its startup
+# time is the cost of lexing and parsing them.
+# Usage: gen_literals.sh [literals]
+
+count=${1:-1000000}
+
+awk -v n="$count" 'BEGIN {
+    srand(1)
+    for (i = 0; i < n; i += 10) {
+        line = ""
+        for (j = 0; j < 10; j++) {
+            if (j % 3 == 0) value = sprintf("%d", int(rand() * 100000000))
+            else if (j % 3 == 1) value = sprintf("%.17g", rand() * 1000)
+            else value = sprintf("%.6e", rand() * 1e30)
+            line = line (j ? ", " : "") value
+        }
+        printf "let a%d = [%s];\n", i / 10, line
+    }
+    print "a0.length"
+}'
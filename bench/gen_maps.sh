@@ -0,0 +1,61 @@
+#!/bin/sh
+# Prints a script that fills a Map with distinct keys, then looks each
+# one up and deletes it, over as many rounds as asked. 'phase' stops the
+# rounds early: 0 only builds the keys, 1 inserts, 2 also looks them up
+# and 3 deletes them too, so the time a phase takes is the difference
+# between two runs. See maps.sh.
+# Usage: gen_maps.sh [keys] [rounds] [phase] [number|string]
+
+count=${1:-1000000}
+rounds=${2:-1}
+phase=${3:-3}
+kind=${4:-number}
+
+case $kind in
+    string) key='"key" + i' ;;
+    *) key='i * 7' ;;
+esac
+
+cat <<JS
+function fillKeys(keys, i, n) {
+    if (i === n) return keys;
+    keys.push($key);
+    return fillKeys(keys, i + 1, n);
+}
+
+function insert(m, keys, i, n) {
+    if (i === n) return m;
+    m.set(keys[i], i);
+    return insert(m, keys, i + 1, n);
+}
+
+function lookup(m, keys, i, n, found) {
+    if (i === n) return found;
+    if (m.get(keys[i]) === i) return lookup(m, keys, i + 1, n, found + 1);
+    return lookup(m, keys, i + 1, n, found);
+}
+
+function remove(m, keys, i, n) {
+    if (i === n) return m.size;
+    m.delete(keys[i]);
+    return remove(m, keys, i + 1, n);
+}
+
+function round(keys, n, phase) {
+    if (phase < 1) return 0;
+    let m = insert(new Map(), keys, 0, n);
+    if (phase < 2) return m.size;
+    let found = lookup(m, keys, 0, n, 0);
+    if (phase < 3) return found;
+    return remove(m, keys, 0, n);
+}
+
+function rounds(keys, n, phase, left, acc) {
+    if (left === 0) return acc;
+    return rounds(keys, n, phase, left - 1, acc + round(keys, n, phase));
+}
+
+let keys = fillKeys([], 0, $count);
+keys.length
+rounds(keys, $count, $phase, $rounds, 0)
+JS
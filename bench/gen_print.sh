@@ -0,0 +1,16 @@
+#!/bin/sh
+# Prints a script of one number per statement, so running it prints as
+# many lines: integers, short decimals and doubles that need all 17
+# digits, in turn. Only top-level statements print, hence the size.
+# Usage: gen_print.sh [lines]
+
+count=${1:-10000000}
+
+awk -v n="$count" 'BEGIN {
+    srand(1)
+    for (i = 0; i < n; i++) {
+        if (i % 3 == 0) printf "%d;\n", int(rand() * 1000000)
+        else if (i % 3 == 1) printf "%.2f;\n", rand() * 1000
+        else printf "%.17f;\n", rand()
+    }
+}'
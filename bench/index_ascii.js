@@ -0,0 +1,14 @@
+function build(n, s) {
+    if (n == 0) return s;
+    return build(n - 1, s + "The quick brown fox jumps over the lazy dog, then naps beside the riverbank until dusk falls.");
+}
+
+function probe(s, i, n, hits) {
+    if (i == 0) return hits;
+    return probe(s, i - 1, n, hits + (s[(i * 7919) % n] == "o"));
+}
+
+let text = build(100000, "");
+let n = text.length;
+n
+probe(text, 2000000, n, 0)
@@ -0,0 +1,14 @@
+function build(n, s) {
+    if (n == 0) return s;
+    return build(n - 1, s + "Der schnelle braune Fuchs springt über den faulen Hund — 素早い茶色の狐が怠け者の犬を飛び越える ✓");
+}
+
+function probe(s, i, n, hits) {
+    if (i == 0) return hits;
+    return probe(s, i - 1, n, hits + (s[(i * 7919) % n] == "ü"));
+}
+
+let text = build(100000, "");
+let n = text.length;
+n
+probe(text, 2000000, n, 0)
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Isolates run side by side through libjank on 1 to 64 threads, each
+# checking its results (see test/isolates.c, which 'make tsan' runs
+# under ThreadSanitizer).
+# Usage: isolates.sh (after make lib)
+
+gcc -O2 test/isolates.c build/libjank.a -o build/isolates -pthread -lm || exit 1
+
+printf "%-8s %8s %10s %12s %10s\n" "threads" "isolates" "ms" "isolates/s" "failures"
+for threads in 1 4 16 64; do
+    ./build/isolates $threads $((256 / threads)) 2000
+done
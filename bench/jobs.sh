@@ -0,0 +1,66 @@
+#!/bin/sh
+# Batch runs with --jobs on 1 to 32 threads, next to forking one jank
+# process per job as scripts do today. 'scripts' runs 256 small
+# generated scripts, each its own job; 'inputs' runs one script for
+# each of 20000 lines of JSON. Every batch's output is checked against
+# the forked runs' (or the single-threaded batch's), job for job.
+# Usage: jobs.sh [jank]
+
+jank=${1:-build/jank}
+dir=build/jobs
+rm -rf $dir
+mkdir -p $dir
+
+for i in $(seq 1 256); do
+    cat > $dir/$i.js <<JS
+function build(i, n, list) {
+    if (i == n) return list;
+    list.push({ id: i, name: 'item' + i, seed: $i });
+    return build(i + 1, n, list);
+}
+let records = JSON.parse(JSON.stringify(build(0, 200, [])));
+"job $i: " + records.length + " " + records[199].name
+JS
+done
+
+cat > $dir/score.js <<JS
+function total(list, i, acc) {
+    if (i == list.length) return acc;
+    return total(list, i + 1, acc + list[i]);
+}
+input.name + ": " + total(input.scores, 0, 0)
+JS
+awk 'BEGIN { for (i = 0; i < 20000; i++) {
+    printf "{\"name\":\"user%d\",\"scores\":[", i
+    for (j = 0; j < i % 20; j++) printf (j ? ",%d" : "%d"), j
+    printf "]}\n" } }' > $dir/inputs.jsonl
+
+scripts=$(seq 1 256 | sed "s|.*|$dir/&.js|")
+
+ms() {
+    echo $(( ($(date +%s%N) - $1) / 1000000 ))
+}
+
+start=$(date +%s%N)
+for script in $scripts; do $jank $script; done > $dir/forked.txt
+forked=$(ms $start)
+
+printf "%-10s %8s %8s %10s %10s %8s\n" "mode" "threads" "jobs" "ms" "jobs/s" "speedup"
+echo forked 1 256 $forked | awk '{ printf "%-10s %8s %8d %10d %10.0f %7.1fx\n", $1, $2, $3, $4, $3 * 1000 / ($4 > 0 ? $4 : 1), 1 }'
+
+for threads in 1 2 4 8 16 32; do
+    start=$(date +%s%N)
+    $jank --jobs $threads $scripts > $dir/batch.txt
+    elapsed=$(ms $start)
+    cmp -s $dir/batch.txt $dir/forked.txt || echo "scripts on $threads threads: output differs"
+    echo scripts $threads 256 $elapsed $forked | awk '{ printf "%-10s %8d %8d %10d %10.0f %7.1fx\n", $1, $2, $3, $4, $3 * 1000 / ($4 > 0 ? $4 : 1), $5 / ($4 > 0 ? $4 : 1) }'
+done
+
+for threads in 1 2 4 8 16 32; do
+    start=$(date +%s%N)
+    $jank --jobs $threads $dir/score.js --inputs $dir/inputs.jsonl > $dir/batch.txt
+    elapsed=$(ms $start)
+    if [ $threads = 1 ]; then cp $dir/batch.txt $dir/inputs.txt; fi
+    cmp -s $dir/batch.txt $dir/inputs.txt || echo "inputs on $threads threads: output differs"
+    echo inputs $threads 20000 $elapsed | awk '{ printf "%-10s %8d %8d %10d %10.0f\n", $1, $2, $3, $4, $3 * 1000 / ($4 > 0 ? $4 : 1) }'
+done
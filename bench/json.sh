@@ -0,0 +1,56 @@
+#!/bin/sh
+# JSON.parse and JSON.stringify throughput, in GB/s of JSON text, on
+# every .json file in a directory (gen_json.sh fills build/json if it is
+# empty). Each file becomes a single-quoted string literal, with any
+# quote in it written as '. Parsing and stringifying are each timed
+# as the difference from a run that only does the setup, and stringify
+# is measured against the length of its own output.
+# Usage: json.sh [jank] [dir] [repeats]
+
+jank=${1:-build/jank}
+dir=${2:-build/json}
+repeats=${3:-10}
+script=build/json_bench.js
+
+ls $dir/*.json >/dev/null 2>&1 || sh bench/gen_json.sh $dir
+
+# prints the run time in ms, or with 'written' the stringified text
+measure() {
+    {
+        printf "let text = '"
+        sed "s/'/\\\\u0027/g" $1
+        printf "';\n"
+        cat <<JS
+function parse(left, value) {
+    if (left === 0) return value;
+    return parse(left - 1, JSON.parse(text));
+}
+
+function write(value, left, out) {
+    if (left === 0) return out;
+    return write(value, left - 1, JSON.stringify(value));
+}
+
+let value = JSON.parse(text);
+let written = JSON.stringify(value);
+JS
+        [ $2 = parse ] && echo "parse($repeats, value).length"
+        [ $2 = stringify ] && echo "write(value, $repeats, written).length"
+        [ $2 = written ] && echo "written"
+    } > $script
+
+    if [ $2 = written ]; then
+        $jank $script
+    else
+        $jank $script --stats 2>&1 | awk '/^time/ { print $3 }'
+    fi
+}
+
+printf "%-16s %12s %14s %14s\n" "file" "bytes" "parse GB/s" "stringify GB/s"
+for file in $dir/*.json; do
+    bytes=$(wc -c < $file)
+    written=$(measure $file written | wc -c)
+    echo $(basename $file) $bytes $written $(measure $file setup) $(measure $file parse) $(measure $file stringify) | awk -v r=$repeats '
+        function rate(bytes, ms) { return ms > 0 ? sprintf("%14.3f", bytes * r / ms / 1e6) : sprintf("%14s", "-") }
+        { printf "%-16s %12d %s %s\n", $1, $2, rate($2, $5 - $4), rate($3 - 1, $6 - $4) }'
+done
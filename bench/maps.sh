@@ -0,0 +1,38 @@
+#!/bin/sh
+# Map throughput from 1K to 10M keys. Each phase of gen_maps.sh is timed
+# as the difference between the runs that stop before and after it, with
+# small maps refilled over enough rounds for a million operations. The
+# memory per entry is the growth in peak RSS over one round of inserts,
+# so it is only printed where the map dwarfs the rest of the process.
+# Usage: maps.sh [jank] [number|string] [sizes]
+
+jank=${1:-build/jank}
+kind=${2:-number}
+sizes=${3:-"1000 10000 100000 1000000 10000000"}
+script=build/maps.js
+
+# prints the run time in ms and the peak RSS in KB
+measure() {
+    sh bench/gen_maps.sh $1 $2 $3 $kind > $script
+    $jank $script --stats 2>&1 >/dev/null | awk '/^time/ { t = $3 } /^peak rss/ { r = $4 } END { print t, r }'
+}
+
+printf "%-12s %12s %12s %12s %12s\n" "$kind keys" "insert/s" "lookup/s" "delete/s" "bytes/entry"
+for n in $sizes; do
+    rounds=$((1000000 / n))
+    [ $rounds -lt 1 ] && rounds=1
+
+    set -- $(measure $n $rounds 0) $(measure $n $rounds 1) $(measure $n $rounds 2) $(measure $n $rounds 3)
+    times="$1 $3 $5 $7"
+
+    memory=-
+    if [ $n -ge 100000 ]; then
+        inserted=$4
+        [ $rounds -gt 1 ] && inserted=$(measure $n 1 1 | cut -d' ' -f2)
+        memory=$(awk -v n=$n -v before=$2 -v after=$inserted 'BEGIN { printf "%.1f", (after - before) * 1024 / n }')
+    fi
+
+    echo $n $rounds $times $memory | awk '
+        function rate(ms) { return ms > 0 ? sprintf("%12.0f", $1 * $2 / ms * 1000) : sprintf("%12s", "-") }
+        { printf "%-12s %s %s %s %12s\n", $1, rate($4 - $3), rate($5 - $4), rate($6 - $5), $7 }'
+done
@@ -0,0 +1,67 @@
+#!/bin/sh
+# parallelMap(), parallelFilter() and parallelReduce() over a packed
+# array of [elements] (100M by default), on one thread and then on twice
+# as many each time up to every core. An op's time is the --stats time of
+# a run making the array and doing it, less that of a run only making the
+# array; the speedups are over one thread.
+# Usage: parallel.sh [jank] [elements]
+
+jank=${1:-build/jank}
+count=${2:-100000000}
+dir=build/parallel
+mkdir -p $dir
+cores=$(getconf _NPROCESSORS_ONLN)
+
+# script.js: makes the array of ints and then does 'op'
+script() {
+    cat > $dir/$1.js <<JS
+function build(n) {
+    if (n == 0) return [];
+    let half = build((n - n % 2) / 2);
+    if (n % 2 == 1) return half.concat(half.concat([n % 1000]));
+    return half.concat(half);
+}
+function score(x, i) {
+    return (x * 31 + i) % 1000 / 7;
+}
+function keep(x, i) {
+    return (x + i) % 3 == 0;
+}
+function add(a, b) {
+    return a + b;
+}
+let a = build($count);
+$2;
+JS
+}
+
+script base "a.length"
+script map "a.parallelMap(score).length"
+script filter "a.parallelFilter(keep).length"
+script reduce "a.parallelReduce(add, 0)"
+
+ms() {
+    $jank $dir/$1.js --threads $2 --stats 2>&1 >/dev/null | awk '/^time/ { print $3 }'
+}
+
+threads=1
+list=""
+while [ $threads -lt $cores ]; do
+    list="$list $threads"
+    threads=$((threads * 2))
+done
+list="$list $cores"
+
+base=$(ms base 1)
+printf "%-8s %10s %10s %10s %8s %8s %8s\n" "threads" "map ms" "filter ms" "reduce ms" "map x" "filter x" "reduce x"
+for threads in $list; do
+    map=$(ms map $threads)
+    filter=$(ms filter $threads)
+    reduce=$(ms reduce $threads)
+    [ $threads -eq 1 ] && { map1=$map; filter1=$filter; reduce1=$reduce; }
+
+    echo "$threads $map $filter $reduce" | awk -v base=$base -v m=$map1 -v f=$filter1 -v r=$reduce1 '
+        { map = $2 - base; filter = $3 - base; reduce = $4 - base
+          printf "%-8d %10.1f %10.1f %10.1f %8.2f %8.2f %8.2f\n", $1, map, filter, reduce,
+                 (m - base) / map, (f - base) / filter, (r - base) / reduce }'
+done
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Lines printed per second by a script of gen_print.sh, with stdout sent
+# to /dev/null and to a pipe. The time to compile the script is taken
+# out using the startup time --stats reports.
+# Usage: print.sh [jank] [lines]
+
+jank=${1:-build/jank}
+lines=${2:-10000000}
+script=build/print.js
+
+sh bench/gen_print.sh $lines > $script
+
+rate() {
+    awk -v n=$lines '/^time/ { t = $3 } /^startup/ { s = $3 } END { printf "%12.0f\n", (t > s ? n / (t - s) * 1000 : 0) }'
+}
+
+printf "%-12s %12s\n" "stdout" "lines/s"
+printf "%-12s " "/dev/null"; $jank $script --stats 2>&1 >/dev/null | rate
+printf "%-12s " "pipe"; $jank $script --stats 2>build/print.stats | cat >/dev/null; rate < build/print.stats
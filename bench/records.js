@@ -0,0 +1,36 @@
+function record(i, next) {
+    return {id: i, price: i % 100, qty: i % 7, region: "r" + i % 4, next: next};
+}
+
+function variant(i, next) {
+    if (i % 4 == 0) return {id: i, price: i % 100, qty: i % 7, next: next};
+    if (i % 4 == 1) return {price: i % 100, qty: i % 7, id: i, next: next};
+    if (i % 4 == 2) return {qty: i % 7, next: next, id: i, price: i % 100};
+    return {next: next, qty: i % 7, price: i % 100, id: i, discount: 1};
+}
+
+function build(i, n, list) {
+    if (i == n) return list;
+    return build(i + 1, n, record(i, list));
+}
+
+function buildMixed(i, n, list) {
+    if (i == n) return list;
+    return buildMixed(i + 1, n, variant(i, list));
+}
+
+function revenue(node, acc) {
+    if (node == undefined) return acc;
+    node.total = node.price * node.qty;
+    return revenue(node.next, acc + node.total % 10);
+}
+
+function passes(list, n, acc) {
+    if (n == 0) return acc;
+    return passes(list, n - 1, acc + revenue(list, 0));
+}
+
+let records = build(0, 100000, undefined);
+let mixed = buildMixed(0, 100000, undefined);
+passes(records, 20, 0)
+passes(mixed, 20, 0)
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Per-line latency of a REPL session after a number of earlier entries,
+# each of which defines a function and an object. The probe lines that
+# follow them define another function and call an early one, so the
+# session has to keep every definition. Latency is the time the probe
+# lines add over the definitions alone, divided by their count, the best
+# of three runs.
+# Usage: repl.sh [jank] [counts]
+
+jank=${1:-build/jank}
+counts=${2:-"0 1000 10000"}
+probes=2000
+input=build/repl
+
+mkdir -p $input
+
+define() {
+    awk -v n=$1 'BEGIN {
+        for (i = 0; i < n; i++) {
+            printf "let f%d = function(x) { return x + %d; };\n", i, i
+            printf "let o%d = { id: %d, name: \x27item%d\x27 };\n", i, i, i
+        }
+    }'
+}
+
+probe() {
+    awk -v n=$probes 'BEGIN {
+        for (i = 0; i < n; i++) {
+            printf "let p%d = function(x) {\n  return x * %d;\n};\n", i, i
+            printf "p%d(2) + (typeof f0 == \x27function\x27 ? 1 : 0);\n", i
+        }
+    }'
+}
+
+best() {
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        $jank --repl < $1 > /dev/null
+        echo $(( $(date +%s%N) - start ))
+    done | sort -n | head -1
+}
+
+printf "%-12s %12s %14s\n" "definitions" "session ms" "us per line"
+for count in $counts; do
+    define $count > $input/defs.txt
+    { cat $input/defs.txt; probe; } > $input/probes.txt
+
+    echo $count $(best $input/defs.txt) $(best $input/probes.txt) $probes | awk '
+        { printf "%-12d %12.1f %14.2f\n", $1, $3 / 1e6, ($3 - $2) / 1e3 / ($4 * 2) }'
+done
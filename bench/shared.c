@@ -0,0 +1,136 @@
+// Executions per second of one script, compiled once into a frozen
+// program and run by an isolate per thread against a different input
+// each time, next to compiling it afresh for every execution. Results
+// are checked, so a ThreadSanitizer build (see shared.sh) finds any
+// write to the shared program.
+// Usage: shared [threads] [executions]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/jank.h"
+
+static const char *script =
+    "function score(name, i, n, acc) {\n"
+    "    if (i == n) return acc;\n"
+    "    return score(name, i + 1, n, acc + name.length * i);\n"
+    "}\n"
+    "function bonus(record, text) {\n"
+    "    if (record.tags[1] == 'paid') return text.length;\n"
+    "    return 0;\n"
+    "}\n"
+    "let record = { id: input, name: 'user' + input, tags: ['new', 'paid', 'trial'] };\n"
+    "let text = JSON.stringify(record);\n"
+    "let result = score(record.name, 0, 50, input) + bonus(record, text);\n";
+
+typedef struct {
+    JankProgram *program;
+    int          first;
+    int          count;
+    long         failures;
+} Worker;
+
+// What the script leaves in 'result' for 'input'.
+static double expected(int input) {
+    char text[96];
+    int name = snprintf(text, sizeof(text), "user%d", input);
+    int json = snprintf(text, sizeof(text), "{\"id\":%d,\"name\":\"user%d\",\"tags\":[\"new\",\"paid\",\"trial\"]}", input, input);
+
+    return input + name * 1225.0 + json;
+}
+
+static bool execute(Worker *worker, JankIsolate *isolate, int input) {
+    JankValue value = { JANK_NUMBER, false, input, NULL, 0 };
+    jankSetGlobal(isolate, "input", &value);
+
+    JankStatus status = worker->program ? jankRunProgram(isolate, worker->program)
+                                        : jankCompile(isolate, script);
+    if (!worker->program && status == JANK_OK) status = jankRun(isolate);
+    if (status != JANK_OK) {
+        fprintf(stderr, "input %d: %s\n", input, jankError(isolate));
+        return false;
+    }
+
+    jankGetGlobal(isolate, "result", &value);
+    return value.type == JANK_NUMBER && value.number == expected(input);
+}
+
+static void *workerMain(void *arg) {
+    Worker *worker = arg;
+
+    JankIsolate *isolate;
+    if (jankCreateIsolate(&isolate) != JANK_OK) {
+        worker->failures = worker->count;
+        return NULL;
+    }
+
+    for (int i = 0; i < worker->count; i++) {
+        if (!execute(worker, isolate, worker->first + i)) worker->failures++;
+    }
+
+    jankDestroyIsolate(isolate);
+    return NULL;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Splits 'executions' over 'threads' and returns the executions per second.
+static double measure(JankProgram *program, int threads, int executions, long *failures) {
+    pthread_t *ids = malloc(sizeof(pthread_t) * threads);
+    Worker *workers = calloc(threads, sizeof(Worker));
+    int share = executions / threads;
+
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (Worker){ program, i * share, share, 0 };
+        pthread_create(&ids[i], NULL, workerMain, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        *failures += workers[i].failures;
+    }
+    double elapsed = now() - start;
+
+    free(ids);
+    free(workers);
+
+    return share * threads / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 8;
+    int executions = argc > 2 ? atoi(argv[2]) : 20000;
+
+    JankIsolate *compiler;
+    JankProgram *program;
+    jankCreateIsolate(&compiler);
+    if (jankCompileProgram(compiler, script, &program) != JANK_OK) {
+        fprintf(stderr, "%s\n", jankError(compiler));
+        return 1;
+    }
+
+    long failures = 0;
+    double compiled = measure(NULL, 1, executions / 10, &failures);
+
+    printf("%-8s %14s %14s %10s\n", "threads", "executions/s", "vs compiling", "failures");
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        long failed = 0;
+        double rate = measure(program, threads, executions, &failed);
+        printf("%-8d %14.0f %13.1fx %10ld\n", threads, rate, rate / compiled, failed);
+        failures += failed;
+    }
+
+    // the program may only go once no isolate that ran it is left
+    jankFreeProgram(program);
+    jankDestroyIsolate(compiler);
+
+    return failures > 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Executions per second of one frozen program shared by 1 to 32 threads,
+# each running it in its own isolate (see shared.c). With 'tsan' the
+# program and the library sources are built with ThreadSanitizer and
+# run on 8 threads instead, failing on any race over the shared code.
+# Usage: shared.sh [tsan] (after make lib)
+
+if [ "$1" = tsan ]; then
+    gcc -O1 -g -fsanitize=thread $(ls src/*.c | grep -v main.c) bench/shared.c -o build/shared_tsan -pthread -lm || exit 1
+    TSAN_OPTIONS=halt_on_error=1 ./build/shared_tsan 8 4000
+    exit $?
+fi
+
+gcc -O2 bench/shared.c build/libjank.a -o build/shared -pthread -lm || exit 1
+./build/shared 32 64000
@@ -0,0 +1,24 @@
+function fill(array, i, n, a, b, scale) {
+    if (i == n) return array;
+    array.push((a * 30000 + b - 1000000000) * scale);
+    return fill(array, i + 1, n, (a * 75 + 74) % 65537, (b * 171) % 30269, scale);
+}
+
+function descending(a, b) {
+    return b - a;
+}
+
+function sortThree(array) {
+    array.sort();
+    array.sort();
+    array.sort(descending);
+    return array.sort().length;
+}
+
+let ints = fill([], 0, 10000000, 1, 1, 1);
+let doubles = fill([], 0, 10000000, 7, 3, 0.001);
+let generic = fill([true], 0, 10000000, 9, 5, 0.5);
+
+sortThree(ints)
+sortThree(doubles)
+sortThree(generic)
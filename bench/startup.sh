@@ -0,0 +1,32 @@
+#!/bin/sh
+# Startup time from source and from a bytecode cache file, for the
+# generated library (many functions, few called) and literal scripts.
+# 'cold' compiles lazily as a normal run does, 'eager' compiles every
+# body as writing a cache file does, and 'cached' maps the file that
+# --compile-only wrote. Times are the startup --stats reports, the
+# best of three runs.
+# Usage: startup.sh [jank]
+
+jank=${1:-build/jank}
+cache=build/cache
+
+sh bench/gen_library.sh > build/library.js
+sh bench/gen_literals.sh > build/literals.js
+rm -rf $cache
+mkdir -p $cache
+
+startup() {
+    for run in 1 2 3; do
+        $jank "$@" --stats 2>&1 >/dev/null | awk '/^startup/ { print $3 }'
+    done | sort -n | head -1
+}
+
+printf "%-20s %12s %12s %12s %12s %10s\n" "script" "cold ms" "eager ms" "cached ms" "file KB" "speedup"
+for script in build/library.js build/literals.js; do
+    $jank $script --compile-only --cache-dir $cache
+    size=$(cat $cache/*.jbc | wc -c)
+
+    echo $script $(startup $script) $(startup $script --eager) $(startup $script --cache-dir $cache) $size | awk '
+        { printf "%-20s %12.3f %12.3f %12.3f %12.0f %9.1fx\n", $1, $2, $3, $4, $5 / 1024, ($4 > 0 ? $2 / $4 : 0) }'
+    rm -f $cache/*.jbc
+done
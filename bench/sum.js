@@ -0,0 +1,23 @@
+function fill(array, i, n, step) {
+    if (i == n) return array;
+    array.push(i * step);
+    return fill(array, i + 1, n, step);
+}
+
+function sum(array, i, n, acc) {
+    if (i == n) return acc;
+    return sum(array, i + 1, n, acc + array[i]);
+}
+
+function repeat(array, times, acc) {
+    if (times == 0) return acc;
+    return repeat(array, times - 1, acc + sum(array, 0, array.length, 0));
+}
+
+let ints = fill([], 0, 1000000, 1);
+let doubles = fill([], 0, 1000000, 0.5);
+let generic = fill([true], 0, 1000000, 1);
+
+repeat(ints, 10, 0)
+repeat(doubles, 10, 0)
+repeat(generic, 10, 0)
@@ -0,0 +1,6 @@
+function count(n, acc) {
+    if (n == 0) return acc;
+    return count(n - 1, acc + 1);
+}
+
+count(10000000, 0)
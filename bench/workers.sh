@@ -0,0 +1,93 @@
+#!/bin/sh
+# Message passing between a script and its workers. Round trips sends a
+# number to an echoing worker and waits for it back, [trips] times
+# (100000 by default). The transfers send the same value to a worker
+# that answers each with its length: big packed arrays and strings go
+# by reference, a generic array and strings under the sharing threshold
+# are copied. Times are from --stats, which leaves out startup; each
+# transfer is the quickest of three runs.
+# Usage: workers.sh [jank] [trips]
+
+jank=${1:-build/jank}
+trips=${2:-100000}
+dir=build/workers
+mkdir -p $dir
+
+cat > $dir/echo.js <<JS
+function loop() {
+    let message = self.receive();
+    if (message == undefined) return 0;
+    self.postMessage(message);
+    return loop();
+}
+loop();
+JS
+cat > $dir/length.js <<JS
+function loop() {
+    let message = self.receive();
+    if (message == undefined) return 0;
+    self.postMessage(message.length);
+    return loop();
+}
+loop();
+JS
+
+cat > $dir/trips.js <<JS
+let worker = new Worker("$dir/echo.js");
+function trip(i) {
+    if (i == $trips) return 0;
+    worker.postMessage(i);
+    self.receive();
+    return trip(i + 1);
+}
+trip(0);
+JS
+
+# the quickest of three runs' times, in ms
+best() {
+    for i in 1 2 3; do
+        $jank $1 --stats 2>&1 >/dev/null | awk '/^time/ { print $3 }'
+    done | sort -n | head -1
+}
+
+# send.js: 'count' messages of 'value', each answered before the next;
+# a run sending none is taken off, leaving out making the value
+transfer() {
+    cat > $dir/send.js <<JS
+let worker = new Worker("$dir/length.js");
+function fill(array, i, n) {
+    if (i == n) return array;
+    array.push(i * 0.5);
+    return fill(array, i + 1, n);
+}
+function repeat(text, n) {
+    if (n == 0) return text;
+    return repeat(text + text, n - 1);
+}
+let value = $3;
+let count = COUNT;
+function send(i) {
+    if (i == count) return 0;
+    worker.postMessage(value);
+    self.receive();
+    return send(i + 1);
+}
+send(0);
+JS
+    sed "s/COUNT/0/" $dir/send.js > $dir/base.js
+    sed -i "s/COUNT/$2/" $dir/send.js
+    base=$(best $dir/base.js)
+    best $dir/send.js | awk -v name="$1" -v count=$2 -v bytes=$4 -v base=$base '
+        { ms = $1 - base }
+        END { printf "%-24s %10d %10.1f %12.1f\n", name, count, ms, bytes * count / 1048576 * 1e3 / ms }'
+}
+
+$jank $dir/trips.js --stats 2>&1 >/dev/null | awk -v trips=$trips '
+    /^time/ { ms = $3 }
+    END { printf "round trips: %d in %.1f ms, %.2f us each\n\n", trips, ms, ms * 1e3 / trips }'
+
+printf "%-24s %10s %10s %12s\n" "transfer" "messages" "ms" "MB/s"
+transfer "packed array (shared)" 1000 'fill([], 0, 1000000)' 8000000
+transfer "generic array (copied)" 20 'fill(["x"], 0, 1000000)' 9000000
+transfer "string (shared)" 1000 'repeat("abcdefgh", 20)' 8388608
+transfer "small string (copied)" 100000 'repeat("abcdefgh", 8)' 2048
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+
+// Converts the elements to 'kind' in a new buffer. Called with the store
+// lock held, since the marker reads the kind and the generic elements.
+static void convertElements(Heap *heap, Object *object, ElementKind kind) {
+    ObjArray *array = &object->as.array;
+    void *elements = malloc(elementSize(kind) * (array->capacity > 0 ? array->capacity : 1));
+    accountStorage(heap, object, (long)(elementSize(kind) - elementSize(array->kind)) * array->capacity);
+
+    for (int i = 0; i < array->count; i++) {
+        Value value = arrayElement(array, i);
+
+        if (kind == ELEMENTS_DOUBLE) {
+            ((double *)elements)[i] = value.as.number;
+        } else {
+            ((Value *)elements)[i] = value;
+        }
+    }
+
+    free(array->elements.any);
+    array->elements.any = elements;
+    array->kind = kind;
+}
+
+void ownElements(Object *object) {
+    ObjArray *array = &object->as.array;
+    SharedElements *shared = array->shared;
+    if (!shared) return;
+
+    // with no other holder left the elements are simply this array's
+    if (__atomic_load_n(&shared->refs, __ATOMIC_ACQUIRE) == 1) {
+        free(shared);
+    } else {
+        void *elements = malloc(elementSize(array->kind) * (array->capacity > 0 ? array->capacity : 1));
+        memcpy(elements, array->elements.any, elementSize(array->kind) * array->count);
+        releaseElements(shared);
+        array->elements.any = elements;
+    }
+
+    array->shared = NULL;
+}
+
+// Stores 'value' at 'index', widening the kind if it has to. Storing at
+// or past the end grows the array; any gap is filled with undefined.
+void setElement(Heap *heap, Object *object, int index, Value value) {
+    ObjArray *array = &object->as.array;
+
+    ElementKind kind = elementKind(value);
+    if (index > array->count) kind = ELEMENTS_GENERIC;
+
+    bool locked = lockForStore(heap);
+
+    ownElements(object);
+    if (kind > array->kind) convertElements(heap, object, kind);
+
+    if (index >= array->capacity) {
+        int capacity = array->capacity < 8 ? 8 : array->capacity * 2;
+        if (capacity <= index) capacity = index + 1;
+
+        array->elements.any = realloc(array->elements.any, elementSize(array->kind) * capacity);
+        accountStorage(heap, object, (long)elementSize(array->kind) * (capacity - array->capacity));
+        array->capacity = capacity;
+    }
+
+    switch (array->kind) {
+        case ELEMENTS_INT: {
+            array->elements.ints[index] = (int32_t)value.as.number;
+            break;
+        }
+        case ELEMENTS_DOUBLE: {
+            array->elements.doubles[index] = value.as.number;
+            break;
+        }
+        case ELEMENTS_GENERIC: {
+            Value undefined;
+            undefined.type = TYPE_UNDEFINED;
+
+            for (int i = array->count; i < index; i++) {
+                array->elements.values[i] = undefined;
+            }
+
+            if (index < array->count) logOverwrite(heap, array->elements.values[index]);
+            array->elements.values[index] = value;
+            rememberStore(heap, object, value);
+            break;
+        }
+    }
+
+    if (index >= array->count) array->count = index + 1;
+
+    unlockForStore(heap, locked);
+}
+
+// Removes and returns the last element, or undefined if there is none.
+Value popElement(Heap *heap, Object *object) {
+    ObjArray *array = &object->as.array;
+
+    Value value;
+    value.type = TYPE_UNDEFINED;
+    if (array->count == 0) return value;
+
+    bool locked = lockForStore(heap);
+    value = arrayElement(array, array->count - 1);
+    if (array->kind == ELEMENTS_GENERIC) logOverwrite(heap, value);
+    array->count--;
+    unlockForStore(heap, locked);
+
+    return value;
+}
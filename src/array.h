@@ -0,0 +1,49 @@
+#ifndef array_h
+#define array_h
+
+#include <math.h>
+
+#include "memory.h"
+#include "value.h"
+
+// The narrowest kind of array that can hold 'value'. Negative zero needs
+// a double to keep its sign.
+static inline ElementKind elementKind(Value value) {
+    if (value.type != TYPE_NUMBER) return ELEMENTS_GENERIC;
+
+    double number = value.as.number;
+    if (number >= INT32_MIN && number <= INT32_MAX && number == (int32_t)number &&
+        !(number == 0 && signbit(number))) {
+        return ELEMENTS_INT;
+    }
+
+    return ELEMENTS_DOUBLE;
+}
+
+static inline Value arrayElement(ObjArray *array, int index) {
+    Value value;
+
+    switch (array->kind) {
+        case ELEMENTS_INT:
+            value.type = TYPE_NUMBER;
+            value.as.number = array->elements.ints[index];
+            break;
+        case ELEMENTS_DOUBLE:
+            value.type = TYPE_NUMBER;
+            value.as.number = array->elements.doubles[index];
+            break;
+        default:
+            value = array->elements.values[index];
+            break;
+    }
+
+    return value;
+}
+
+// Makes the elements the array's alone before they are written in
+// place, copying them if they are still shared.
+void  ownElements(Object *object);
+void  setElement(Heap *heap, Object *object, int index, Value value);
+Value popElement(Heap *heap, Object *object);
+
+#endif
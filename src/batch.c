@@ -0,0 +1,206 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "batch.h"
+#include "deque.h"
+
+// What a job printed, held until every job before it has been written.
+typedef struct {
+    TextBuffer output;
+    bool       done;
+} JobResult;
+
+typedef struct Worker Worker;
+
+typedef struct {
+    BatchJob  *jobs;
+    JobResult *results;
+    int        count;
+    Program   *program;
+
+    Worker    *workers;
+    int        worker_count;
+
+    // the reorder buffer: jobs before 'next' are written, and whichever
+    // worker finishes 'next' writes it and every finished job after it
+    pthread_mutex_t lock;
+    int        next;
+    int        failures;
+} Batch;
+
+struct Worker {
+    Batch     *batch;
+    int        id;
+    pthread_t  thread;
+    Deque      deque;
+    JankyVm   *vm;
+    ErrorSink  errors;
+    long       steals;
+};
+
+static void writeResults(Batch *batch, long job, TextBuffer *output, bool failed) {
+    pthread_mutex_lock(&batch->lock);
+
+    batch->results[job].output = *output;
+    batch->results[job].done = true;
+    if (failed) batch->failures++;
+
+    while (batch->next < batch->count && batch->results[batch->next].done) {
+        TextBuffer *text = &batch->results[batch->next].output;
+        fwrite(text->chars, 1, text->length, stdout);
+        free(text->chars);
+        batch->next++;
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+// The job runs on a VM left as its last job left it but for the
+// globals, which it starts without, as a script of its own would.
+static void runJob(Worker *worker, long job) {
+    Batch *batch = worker->batch;
+    JankyVm *vm = worker->vm;
+    BatchJob *entry = &batch->jobs[job];
+
+    worker->errors.failed = false;
+    vm->output.length = 0;
+    resetGlobals(vm);
+
+    VmResult result;
+    if (batch->program) {
+        result = defineJsonGlobal(vm, "input", entry->input, entry->input_length);
+        if (result == VM_OK) result = runProgram(vm, batch->program);
+    } else {
+        Bytecode *chunk;
+        result = compileScript(vm, entry->source, &chunk);
+        if (result == VM_OK) result = runChunk(vm, chunk);
+    }
+
+    TextBuffer output = { NULL, 0, 0 };
+    appendText(&output, vm->output.chars, vm->output.length);
+    if (result != VM_OK) {
+        char line[ERROR_MESSAGE_MAX + 64];
+        int length = snprintf(line, sizeof(line), "Error: %s\n%s\n", worker->errors.message,
+                              result == VM_COMPILE_ERROR ? "Compile time error." : "Runtime error.");
+        appendText(&output, line, length);
+    }
+
+    writeResults(batch, job, &output, result != VM_OK);
+}
+
+// Tries every other worker once, starting with the next one along. A
+// deque found empty stays empty, as jobs are only pushed before the
+// workers start.
+static bool stealJob(Worker *worker, long *job) {
+    Batch *batch = worker->batch;
+
+    for (int i = 1; i < batch->worker_count; i++) {
+        Worker *victim = &batch->workers[(worker->id + i) % batch->worker_count];
+        if (stealDeque(&victim->deque, job)) {
+            worker->steals++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void *workerMain(void *arg) {
+    Worker *worker = arg;
+
+    long job;
+    while (popDeque(&worker->deque, &job) || stealJob(worker, &job)) {
+        runJob(worker, job);
+    }
+
+    return NULL;
+}
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static JankyVm *newWorkerVm(VmSettings *settings, ErrorSink *errors) {
+    JankyVm *vm = calloc(1, sizeof(JankyVm));
+    vm->settings = *settings;
+    vm->errors = errors;
+    vm->keep_output = true;
+    startSession(vm);
+
+    return vm;
+}
+
+bool runBatch(VmSettings *settings, char *script, BatchJob *jobs, int count, int threads, BatchStats *stats) {
+    double start = seconds();
+
+    Batch batch;
+    batch.jobs = jobs;
+    batch.results = calloc(count, sizeof(JobResult));
+    batch.count = count;
+    batch.program = NULL;
+    batch.worker_count = threads;
+    batch.workers = calloc(threads, sizeof(Worker));
+    batch.next = 0;
+    batch.failures = 0;
+    pthread_mutex_init(&batch.lock, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        Worker *worker = &batch.workers[i];
+        worker->batch = &batch;
+        worker->id = i;
+        worker->vm = newWorkerVm(settings, &worker->errors);
+        initDeque(&worker->deque, count / threads + 1);
+    }
+
+    // printed as a normal run prints it, before any worker starts
+    bool compiled = true;
+    if (script) {
+        JankyVm *vm = batch.workers[0].vm;
+        vm->errors = NULL;
+        compiled = compileProgram(vm, script, &batch.program) == VM_OK;
+        vm->errors = &batch.workers[0].errors;
+    }
+
+    if (compiled) {
+        // dealt out in turn, last first so that each worker pops its own
+        // in order; jobs then finish close to their order and the reorder
+        // buffer stays short
+        for (long job = count - 1; job >= 0; job--) {
+            pushDeque(&batch.workers[job % threads].deque, job);
+        }
+
+        for (int i = 0; i < threads; i++) {
+            pthread_create(&batch.workers[i].thread, NULL, workerMain, &batch.workers[i]);
+        }
+        for (int i = 0; i < threads; i++) {
+            pthread_join(batch.workers[i].thread, NULL);
+        }
+        fflush(stdout);
+    }
+
+    stats->steals = 0;
+    for (int i = 0; i < threads; i++) {
+        Worker *worker = &batch.workers[i];
+        stats->steals += worker->steals;
+        endSession(worker->vm);
+        free(worker->vm);
+        freeDeque(&worker->deque);
+    }
+
+    // the program goes after every VM that ran it
+    if (batch.program) freeProgram(batch.program);
+
+    stats->failures = batch.failures;
+    stats->elapsed = seconds() - start;
+
+    pthread_mutex_destroy(&batch.lock);
+    free(batch.workers);
+    free(batch.results);
+
+    return compiled;
+}
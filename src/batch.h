@@ -0,0 +1,28 @@
+#ifndef batch_h
+#define batch_h
+
+#include "vm.h"
+
+// One execution in a batch: a script of its own, or one line of JSON
+// input for the batch's shared script.
+typedef struct {
+    char       *source;
+    const char *input;
+    int         input_length;
+} BatchJob;
+
+typedef struct {
+    double elapsed;
+    long   steals;
+    int    failures;
+} BatchStats;
+
+// Runs every job on a pool of 'threads' workers, each with one VM it
+// keeps from job to job, and writes what each printed to stdout in job
+// order, as separate runs one after another would. Errors end only the
+// job they happen in. With a 'script' it is compiled once, frozen, and
+// run for each job with its input parsed into the global 'input';
+// without one each job compiles its own source.
+bool runBatch(VmSettings *settings, char *script, BatchJob *jobs, int count, int threads, BatchStats *stats);
+
+#endif
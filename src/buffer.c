@@ -0,0 +1,14 @@
+#include <stdlib.h>
+
+#include "buffer.h"
+
+// Doubles the capacity until 'needed' bytes fit.
+void growText(TextBuffer *text, int needed) {
+    int capacity = text->capacity == 0 ? 64 : text->capacity;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    text->chars = realloc(text->chars, capacity);
+    text->capacity = capacity;
+}
@@ -0,0 +1,37 @@
+#ifndef buffer_h
+#define buffer_h
+
+#include <string.h>
+
+// A growable run of bytes, always NUL-terminated once anything has been
+// appended.
+typedef struct {
+    char *chars;
+    int   length;
+    int   capacity;
+} TextBuffer;
+
+void growText(TextBuffer *text, int needed);
+
+// Room for 'length' more bytes and the terminator; the caller writes
+// them at chars + length and moves 'length' on.
+static inline char *reserveText(TextBuffer *text, int length) {
+    if (text->length + length + 1 > text->capacity) growText(text, text->length + length + 1);
+
+    return text->chars + text->length;
+}
+
+static inline void appendText(TextBuffer *text, const char *chars, int length) {
+    memcpy(reserveText(text, length), chars, length);
+    text->length += length;
+    text->chars[text->length] = '\0';
+}
+
+static inline void appendChar(TextBuffer *text, char c) {
+    char *at = reserveText(text, 1);
+    at[0] = c;
+    at[1] = '\0';
+    text->length++;
+}
+
+#endif
@@ -0,0 +1,634 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "buffer.h"
+#include "cache.h"
+#include "number.h"
+#include "symbols.h"
+
+uint64_t cacheKey(const char *source, int inline_threshold) {
+    // FNV-1a over the source, then the settings
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char *c = source; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 0x100000001b3ull;
+    }
+    hash = (hash ^ (uint32_t)inline_threshold) * 0x100000001b3ull;
+
+    return hash;
+}
+
+// FNV-1a over the file after its header, a word at a time, as the file
+// can be megabytes and is read on every start. It only has to catch
+// damage, not tampering.
+static uint64_t checksum(const char *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// Numbers the objects a script reaches in the order they are met, so
+// shared strings and functions are written once and stay shared.
+typedef struct {
+    Object **objects;
+    int      count;
+    int      capacity;
+
+    Object **slots;
+    int     *indexes;
+    int      slot_count;
+} ObjectIndex;
+
+static void initObjectIndex(ObjectIndex *index) {
+    index->objects = NULL;
+    index->count = 0;
+    index->capacity = 0;
+
+    index->slot_count = 64;
+    index->slots = calloc(index->slot_count, sizeof(Object *));
+    index->indexes = malloc(sizeof(int) * index->slot_count);
+}
+
+static void freeObjectIndex(ObjectIndex *index) {
+    free(index->objects);
+    free(index->slots);
+    free(index->indexes);
+}
+
+static int slotOf(ObjectIndex *index, Object *object) {
+    uint32_t mask = index->slot_count - 1;
+    uint32_t slot = (uint32_t)(((uintptr_t)object >> 4) * 0x9E3779B1u) & mask;
+
+    while (index->slots[slot] && index->slots[slot] != object) slot = (slot + 1) & mask;
+    return slot;
+}
+
+// The object's number, given it now if it had none ('added' says so).
+static int indexObject(ObjectIndex *index, Object *object, bool *added) {
+    int slot = slotOf(index, object);
+    *added = !index->slots[slot];
+    if (!*added) return index->indexes[slot];
+
+    if (index->count >= index->capacity) {
+        index->capacity = index->capacity == 0 ? 16 : index->capacity * 2;
+        index->objects = realloc(index->objects, sizeof(Object *) * index->capacity);
+    }
+    index->objects[index->count] = object;
+    index->slots[slot] = object;
+    index->indexes[slot] = index->count;
+
+    // kept at most half full
+    if (index->count * 2 >= index->slot_count) {
+        free(index->slots);
+        free(index->indexes);
+
+        index->slot_count *= 2;
+        index->slots = calloc(index->slot_count, sizeof(Object *));
+        index->indexes = malloc(sizeof(int) * index->slot_count);
+        for (int i = 0; i <= index->count; i++) {
+            slot = slotOf(index, index->objects[i]);
+            index->slots[slot] = index->objects[i];
+            index->indexes[slot] = i;
+        }
+    }
+
+    return index->count++;
+}
+
+static void pad(TextBuffer *out) {
+    static const char zeros[8] = { 0 };
+    appendText(out, zeros, (8 - out->length % 8) % 8);
+}
+
+static uint32_t addText(TextBuffer *text, const char *chars, int length) {
+    uint32_t offset = text->length;
+    appendText(text, chars, length);
+    appendChar(text, '\0');
+
+    return offset;
+}
+
+static bool writeChunk(TextBuffer *out, TextBuffer *text, Bytecode *chunk, ObjectIndex *strings, ObjectIndex *functions) {
+    ChunkRecord record = { chunk->code_count, chunk->const_count, chunk->cache_count, chunk->local_count };
+    appendText(out, (char *)&record, sizeof(record));
+
+    for (int i = 0; i < chunk->code_count; i++) {
+        uint32_t code = chunk->code[i];
+        appendText(out, (char *)&code, sizeof(code));
+    }
+    pad(out);
+
+    for (int i = 0; i < chunk->const_count; i++) {
+        Value constant = chunk->constants[i];
+        ConstantRecord record = { constant.type, 0, 0 };
+        bool added;
+
+        switch (constant.type) {
+            case TYPE_NUMBER:
+                memcpy(&record.payload, &constant.as.number, sizeof(double));
+                break;
+            case TYPE_BOOL:
+                record.payload = constant.as.boolean;
+                break;
+            case TYPE_IDENTIFIER:
+                record.payload = addText(text, constant.as.identifier, strlen(constant.as.identifier));
+                break;
+            case TYPE_STRING:
+                if (constant.as.object->type != OBJ_STRING) return false;
+                record.payload = indexObject(strings, constant.as.object, &added);
+                break;
+            case TYPE_FUNCTION:
+                // a body still deferred has nothing to write
+                if (!constant.as.object->as.function.chunk) return false;
+                record.payload = indexObject(functions, constant.as.object, &added);
+                break;
+            default:
+                break;
+        }
+
+        appendText(out, (char *)&record, sizeof(record));
+    }
+
+    return true;
+}
+
+// Lays out 'script' and everything it reaches as a cache image.
+static bool encodeImage(uint64_t key, Bytecode *script, TextBuffer *out) {
+    ObjectIndex strings, functions;
+    initObjectIndex(&strings);
+    initObjectIndex(&functions);
+
+    TextBuffer chunks = { NULL, 0, 0 };
+    TextBuffer text = { NULL, 0, 0 };
+    appendText(&chunks, "", 0);
+    appendText(&text, "", 0);
+
+    // functions are numbered as they are met, and their chunks written
+    // in that order after the script's
+    bool ok = writeChunk(&chunks, &text, script, &strings, &functions);
+    for (int i = 0; ok && i < functions.count; i++) {
+        ok = writeChunk(&chunks, &text, functions.objects[i]->as.function.chunk, &strings, &functions);
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    appendText(out, (char *)&header, sizeof(header));
+
+    for (int i = 0; ok && i < strings.count; i++) {
+        ObjString *string = &strings.objects[i]->as.string;
+        StringRecord record = { addText(&text, string->chars, string->length), string->length, string->count };
+        appendText(out, (char *)&record, sizeof(record));
+    }
+    pad(out);
+
+    for (int i = 0; ok && i < functions.count; i++) {
+        ObjFunction *function = &functions.objects[i]->as.function;
+        uint32_t name = function->name ? addText(&text, function->name, strlen(function->name)) : NO_NAME;
+        FunctionRecord record = { function->arity, name };
+        appendText(out, (char *)&record, sizeof(record));
+    }
+    pad(out);
+
+    appendText(out, chunks.chars, chunks.length);
+
+    memcpy(header.magic, "JANK", 4);
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.opcode_count = OP_END + 1;
+    header.opcode_size = sizeof(OpCode);
+    header.text_offset = out->length;
+    header.text_size = text.length;
+    header.string_count = strings.count;
+    header.function_count = functions.count;
+    header.chunk_count = functions.count + 1;
+    appendText(out, text.chars, text.length);
+    header.file_size = out->length;
+    header.checksum = checksum(out->chars + sizeof(header), out->length - sizeof(header));
+    memcpy(out->chars, &header, sizeof(header));
+
+    free(chunks.chars);
+    free(text.chars);
+    freeObjectIndex(&strings);
+    freeObjectIndex(&functions);
+
+    return ok;
+}
+
+bool writeCache(const char *path, uint64_t key, Bytecode *script) {
+    TextBuffer out = { NULL, 0, 0 };
+    bool ok = encodeImage(key, script, &out);
+
+    if (ok) {
+        char *temporary = malloc(strlen(path) + 16);
+        sprintf(temporary, "%s.%d", path, (int)getpid());
+
+        FILE *file = fopen(temporary, "wb");
+        ok = file && fwrite(out.chars, 1, out.length, file) == (size_t)out.length;
+        if (file && fclose(file) != 0) ok = false;
+
+        ok = ok && rename(temporary, path) == 0;
+        if (!ok) remove(temporary);
+        free(temporary);
+    }
+
+    free(out.chars);
+
+    return ok;
+}
+
+// Reads the mapped file front to back, failing on anything that would
+// run past its end.
+typedef struct {
+    const char *base;
+    size_t      at;
+    size_t      end;
+    bool        failed;
+} CacheReader;
+
+static const void *take(CacheReader *reader, size_t size) {
+    if (reader->failed || size > reader->end - reader->at) {
+        reader->failed = true;
+        return NULL;
+    }
+
+    const void *data = reader->base + reader->at;
+    reader->at += (size + 7) & ~(size_t)7;
+    if (reader->at > reader->end) reader->at = reader->end;
+
+    return data;
+}
+
+static void freeChunks(Bytecode **chunks, int count) {
+    for (int i = 0; i < count; i++) {
+        if (chunks[i]) freeBytecode(chunks[i]);
+    }
+    free(chunks);
+}
+
+static bool isName(Bytecode *chunk, OpCode index) {
+    return index < (OpCode)chunk->const_count && chunk->constants[index].type == TYPE_IDENTIFIER;
+}
+
+// Whether the VM can run the chunk without reading outside it: every
+// instruction is one it knows, with all its operands there; constants
+// exist and names are identifiers; locals are in the frame and inline
+// caches in the chunk; jumps land on an instruction; and the code ends
+// in a return or a tail call. Counts are bounded by what the code could
+// have pushed. The compiler never writes anything else, so a file that
+// fails this is damaged.
+static bool checkCode(Bytecode *chunk) {
+    int count = chunk->code_count;
+    if (count == 0 || chunk->local_count < 1 || chunk->local_count > LOCALS_MAX) return false;
+
+    // what each position is: the start of an instruction, a jump's
+    // target, or both; most chunks are small enough for the stack
+    uint8_t small[1024];
+    uint8_t *marks = count <= (int)sizeof(small) ? small : malloc(count);
+    memset(marks, 0, count);
+
+    bool ok = true;
+    int last = 0;
+
+    // the widths are operandCount()'s, worked out in the one switch
+    for (int i = 0; ok && i < count; ) {
+        OpCode op = chunk->code[i];
+        const OpCode *operands = chunk->code + i + 1;
+        int left = count - i - 1;
+        int width = 1;
+
+        marks[i] |= 1;
+        last = i;
+
+        switch (op) {
+            case OP_CONSTANT:
+                width = 2;
+                ok = left >= 1 && operands[0] < (OpCode)chunk->const_count &&
+                     chunk->constants[operands[0]].type != TYPE_IDENTIFIER;
+                break;
+            case OP_DEFINE_GLOBAL:
+            case OP_GET_GLOBAL:
+                width = 2;
+                ok = left >= 1 && isName(chunk, operands[0]);
+                break;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                width = 2;
+                ok = left >= 1 && operands[0] < (OpCode)chunk->local_count;
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE: {
+                width = 2;
+                long target = (long)i + 2 + (left >= 1 ? operands[0] : 0);
+                ok = left >= 1 && target < count;
+                if (ok) marks[target] |= 2;
+                break;
+            }
+            case OP_CALL:
+            case OP_TAIL_CALL:
+            case OP_NEW_OBJECT:
+                width = 2;
+                ok = left >= 1 && operands[0] < (OpCode)count;
+                break;
+            case OP_NEW_ARRAY:
+            case OP_APPEND_ARRAY:
+                width = 2;
+                ok = left >= 1 && operands[0] <= ARRAY_LITERAL_BATCH;
+                break;
+            case OP_NEW_MAP:
+                width = 3;
+                ok = left >= 2 && operands[0] <= 1 && operands[1] <= 1;
+                break;
+            case OP_GET_PROPERTY:
+            case OP_INIT_PROPERTY:
+            case OP_SET_PROPERTY:
+                width = 3;
+                ok = left >= 2 && isName(chunk, operands[0]) && operands[1] < (OpCode)chunk->cache_count;
+                break;
+            case OP_INVOKE:
+                width = 4;
+                ok = left >= 3 && isName(chunk, operands[0]) && operands[1] < (OpCode)count &&
+                     operands[2] < (OpCode)chunk->cache_count;
+                break;
+            default:
+                ok = op <= OP_END;
+                break;
+        }
+
+        i += width;
+    }
+
+    // a jump landing inside an instruction
+    for (int i = 0; ok && i < count; i++) {
+        if (marks[i] == 2) ok = false;
+    }
+
+    OpCode end = chunk->code[last];
+    ok = ok && (end == OP_RETURN || end == OP_TAIL_CALL || end == OP_END);
+    if (marks != small) free(marks);
+
+    return ok;
+}
+
+static Bytecode *readChunk(CacheReader *reader, const CacheHeader *header, const char *text,
+                           Object **strings, Object **functions, Program *program) {
+    const ChunkRecord *record = take(reader, sizeof(ChunkRecord));
+    if (!record) return NULL;
+
+    const OpCode *code = take(reader, sizeof(OpCode) * record->code_count);
+    const ConstantRecord *constants = take(reader, sizeof(ConstantRecord) * record->const_count);
+    // every inline cache belongs to an instruction
+    if (record->cache_count > record->code_count) reader->failed = true;
+    if (reader->failed) return NULL;
+
+    Bytecode *chunk = malloc(sizeof(Bytecode));
+    chunk->code = (OpCode *)code;
+    chunk->code_capacity = record->code_count;
+    chunk->code_count = record->code_count;
+    chunk->mapped = true;
+
+    chunk->constants = malloc(sizeof(Value) * (record->const_count + 1));
+    chunk->const_capacity = record->const_count + 1;
+    chunk->const_count = 0;
+
+    // a program's VMs each keep their own caches
+    chunk->caches = record->cache_count && !program ? calloc(record->cache_count, sizeof(PropertyCache)) : NULL;
+    chunk->cache_capacity = record->cache_count;
+    chunk->cache_count = record->cache_count;
+    chunk->program = program;
+    chunk->cache_base = program ? program->cache_count : 0;
+    if (program) program->cache_count += record->cache_count;
+
+    chunk->local_count = record->local_count;
+
+    for (uint32_t i = 0; i < record->const_count; i++) {
+        Value constant;
+        constant.type = constants[i].type;
+        uint64_t payload = constants[i].payload;
+
+        switch (constant.type) {
+            case TYPE_NUMBER:
+                memcpy(&constant.as.number, &payload, sizeof(double));
+                break;
+            case TYPE_BOOL:
+                constant.as.boolean = payload != 0;
+                break;
+            case TYPE_IDENTIFIER:
+                if (payload >= header->text_size) reader->failed = true;
+                else constant.as.identifier = strdup(text + payload);
+                break;
+            case TYPE_STRING:
+                if (payload >= header->string_count) reader->failed = true;
+                else constant.as.object = strings[payload];
+                break;
+            case TYPE_FUNCTION:
+                if (payload >= header->function_count) reader->failed = true;
+                else constant.as.object = functions[payload];
+                break;
+            default:
+                reader->failed = true;
+                break;
+        }
+
+        if (reader->failed) break;
+        chunk->constants[chunk->const_count++] = constant;
+    }
+
+    if (!reader->failed && !checkCode(chunk)) reader->failed = true;
+
+    if (reader->failed) {
+        freeBytecode(chunk);
+        return NULL;
+    }
+
+    return chunk;
+}
+
+// Rebuilds the strings, the functions and then their chunks. Nothing is
+// collected meanwhile, and anything made before a failure is left to the
+// next collection, except the chunks, which no function owns yet. With a
+// program instead of a heap the objects are frozen and the program owns
+// them, and the chunks too once all of them are read.
+static Bytecode *readCache(CacheReader *reader, const CacheHeader *header, Heap *heap, Program *program) {
+    const char *text = reader->base + header->text_offset;
+    reader->end = header->text_offset;
+
+    Object **strings = malloc(sizeof(Object *) * (header->string_count + 1));
+    Object **functions = malloc(sizeof(Object *) * (header->function_count + 1));
+    Bytecode **chunks = calloc(header->chunk_count, sizeof(Bytecode *));
+    Bytecode *script = NULL;
+
+    const StringRecord *stringRecords = take(reader, sizeof(StringRecord) * header->string_count);
+    for (uint32_t i = 0; !reader->failed && i < header->string_count; i++) {
+        const StringRecord *record = &stringRecords[i];
+        if (record->offset > header->text_size || record->length >= header->text_size - record->offset) {
+            reader->failed = true;
+            break;
+        }
+
+        strings[i] = reserveString(heap, record->length);
+        memcpy(strings[i]->as.string.chars, text + record->offset, record->length);
+        strings[i]->as.string.count = record->count;
+
+        if (program) {
+            // filled in now, since a frozen string is never written to
+            ObjString *string = &strings[i]->as.string;
+            uint32_t hash = hashString(string->chars, string->length);
+            string->hash = hash == 0 ? 1 : hash;
+            string->number = stringToNumber(string->chars, string->length);
+            string->has_number = true;
+            program->objects[program->object_count++] = strings[i];
+        }
+    }
+
+    const FunctionRecord *functionRecords = take(reader, sizeof(FunctionRecord) * header->function_count);
+    for (uint32_t i = 0; !reader->failed && i < header->function_count; i++) {
+        const FunctionRecord *record = &functionRecords[i];
+        if (record->name != NO_NAME && record->name >= header->text_size) {
+            reader->failed = true;
+            break;
+        }
+
+        functions[i] = newFunctionObject(heap);
+        functions[i]->as.function.arity = record->arity;
+        functions[i]->as.function.name = record->name == NO_NAME ? NULL : strdup(text + record->name);
+        if (program) program->objects[program->object_count++] = functions[i];
+    }
+
+    for (uint32_t i = 0; !reader->failed && i < header->chunk_count; i++) {
+        chunks[i] = readChunk(reader, header, text, strings, functions, program);
+    }
+
+    if (!reader->failed) {
+        for (uint32_t i = 0; i < header->function_count; i++) {
+            functions[i]->as.function.chunk = chunks[i + 1];
+        }
+        script = chunks[0];
+
+        if (program) {
+            program->chunks = chunks;
+            program->chunk_count = header->chunk_count;
+        } else {
+            free(chunks);
+        }
+    } else {
+        freeChunks(chunks, header->chunk_count);
+    }
+
+    free(strings);
+    free(functions);
+
+    return script;
+}
+
+Bytecode *loadCache(const char *path, uint64_t key, Heap *heap, CacheMapping *mapping) {
+    mapping->base = NULL;
+    mapping->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    CacheHeader header;
+    memcpy(&header, base, sizeof(header));
+
+    bool valid = memcmp(header.magic, "JANK", 4) == 0 &&
+                 header.version == CACHE_VERSION &&
+                 header.key == key &&
+                 header.opcode_count == OP_END + 1 &&
+                 header.opcode_size == sizeof(OpCode) &&
+                 header.file_size == (uint64_t)info.st_size &&
+                 header.chunk_count == header.function_count + 1 &&
+                 (uint64_t)header.text_offset + header.text_size == header.file_size &&
+                 (header.text_size == 0 || ((char *)base)[header.file_size - 1] == '\0') &&
+                 header.checksum == checksum((char *)base + sizeof(header), header.file_size - sizeof(header));
+
+    Bytecode *script = NULL;
+    if (valid) {
+        CacheReader reader = { base, sizeof(CacheHeader), info.st_size, false };
+        script = readCache(&reader, &header, heap, NULL);
+    }
+
+    if (!script) {
+        munmap(base, info.st_size);
+        return NULL;
+    }
+
+    mapping->base = base;
+    mapping->size = info.st_size;
+
+    return script;
+}
+
+void unmapCache(CacheMapping *mapping) {
+    if (mapping->base) munmap(mapping->base, mapping->size);
+
+    mapping->base = NULL;
+    mapping->size = 0;
+}
+
+Program *newProgram(Bytecode *script) {
+    TextBuffer image = { NULL, 0, 0 };
+    if (!encodeImage(0, script, &image)) {
+        free(image.chars);
+        return NULL;
+    }
+
+    CacheHeader header;
+    memcpy(&header, image.chars, sizeof(header));
+
+    Program *program = calloc(1, sizeof(Program));
+    program->image = image.chars;
+    // and one for the script's own function
+    program->objects = malloc(sizeof(Object *) * (header.string_count + header.function_count + 1));
+
+    CacheReader reader = { image.chars, sizeof(CacheHeader), image.length, false };
+    program->script = readCache(&reader, &header, NULL, program);
+    if (!program->script) {
+        freeProgram(program);
+        return NULL;
+    }
+
+    program->function = newFunctionObject(NULL);
+    program->function->as.function.chunk = program->script;
+    program->objects[program->object_count++] = program->function;
+
+    return program;
+}
+
+void freeProgram(Program *program) {
+    // the functions look at their chunks to see they belong here
+    for (int i = 0; i < program->object_count; i++) {
+        freeFrozen(program->objects[i]);
+    }
+    for (int i = 0; i < program->chunk_count; i++) {
+        freeBytecode(program->chunks[i]);
+    }
+
+    free(program->chunks);
+    free(program->objects);
+    free(program->image);
+    free(program);
+}
@@ -0,0 +1,112 @@
+#ifndef cache_h
+#define cache_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compiler.h"
+#include "memory.h"
+
+// Bumped whenever the layout below or the meaning of the bytecode
+// changes; a cache file from any other version is ignored.
+#define CACHE_VERSION 3
+
+// A cache file holds a compiled script and every function reachable
+// from it, so running it needs no lexing, parsing or compiling:
+//
+//   header | strings | functions | chunks | text
+//
+// 'text' holds every string, identifier and function name, each ended
+// by a NUL. Chunk 0 is the script and chunk i + 1 the body of function
+// i; each is a ChunkRecord, its code, then its constants, every part
+// padded to eight bytes. The code is used straight from the mapped file,
+// so it is checked once when the file is loaded, after 'checksum', which
+// covers everything after the header.
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t opcode_count;
+    uint32_t opcode_size;
+    uint32_t text_offset;
+    uint32_t text_size;
+    uint32_t string_count;
+    uint32_t function_count;
+    uint32_t chunk_count;
+    uint64_t file_size;
+    uint64_t checksum;
+} CacheHeader;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t count;
+} StringRecord;
+
+typedef struct {
+    uint32_t arity;
+    uint32_t name;
+} FunctionRecord;
+
+typedef struct {
+    uint32_t code_count;
+    uint32_t const_count;
+    uint32_t cache_count;
+    uint32_t local_count;
+} ChunkRecord;
+
+// A constant's payload is the bits of its number or boolean, or the
+// index of its string or function; identifiers give a text offset.
+typedef struct {
+    uint32_t type;
+    uint32_t unused;
+    uint64_t payload;
+} ConstantRecord;
+
+#define NO_NAME UINT32_MAX
+
+// A loaded cache file stays mapped for as long as its chunks are used.
+typedef struct {
+    void  *base;
+    size_t size;
+} CacheMapping;
+
+// What a cache file is keyed by: the source and the settings that
+// change the code compiled from it.
+uint64_t cacheKey(const char *source, int inline_threshold);
+
+// Writes 'script' and everything it reaches to 'path', through a
+// temporary file renamed into place. Every function must be compiled.
+bool writeCache(const char *path, uint64_t key, Bytecode *script);
+
+// The script chunk from 'path', with its strings and functions created
+// in 'heap', or NULL if the file is missing, damaged or for another key.
+Bytecode *loadCache(const char *path, uint64_t key, Heap *heap, CacheMapping *mapping);
+void      unmapCache(CacheMapping *mapping);
+
+// A compiled script frozen to be shared: any number of VMs on any
+// threads can run it at once (see runProgram()). It is a cache image
+// kept in memory, its code used in place, and its strings and functions
+// are frozen with their hashes and numbers worked out, so running it
+// never writes to it. A program must outlive every VM that ran it.
+struct Program {
+    char      *image;
+    Bytecode  *script;
+    // the frozen function every run of the script has in slot zero
+    Object    *function;
+
+    // chunk 0 is the script; 'cache_count' is their inline caches
+    Bytecode **chunks;
+    int        chunk_count;
+    int        cache_count;
+
+    Object   **objects;
+    int        object_count;
+};
+
+// NULL if some function in 'script' has not been compiled.
+Program  *newProgram(Bytecode *script);
+void      freeProgram(Program *program);
+
+#endif
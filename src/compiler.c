@@ -1,19 +1,93 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "compiler.h"
+#include "symbols.h"
+
+Bytecode *newBytecode() {
+    Bytecode *bytecode = malloc(sizeof(Bytecode));
+    
+    bytecode->code = malloc(sizeof(OpCode));
+    bytecode->code_capacity = 1;
+    bytecode->code_count = 0;
+
+    bytecode->constants = malloc(sizeof(Value));
+    bytecode->const_capacity = 1;
+    bytecode->const_count = 0;
+
+    bytecode->caches = NULL;
+    bytecode->cache_capacity = 0;
+    bytecode->cache_count = 0;
+
+    bytecode->local_count = 1;
+    bytecode->mapped = false;
+    bytecode->program = NULL;
+    bytecode->cache_base = 0;
+
+    return bytecode;
+}
+
+void freeBytecode(Bytecode *bytecode) {
+    for (int i = 0; i < bytecode->const_count; i++) {
+        Value constant = bytecode->constants[i];
+
+        // objects in the pool belong to the heap
+        if (constant.type == TYPE_IDENTIFIER) {
+            free(constant.as.identifier);
+        }
+    }
+
+    if (!bytecode->mapped) free(bytecode->code);
+    free(bytecode->constants);
+    free(bytecode->caches);
+    free(bytecode);
+}
 
 void initCompiler(Compiler *compiler, Ast *ast) {
     compiler->ast = ast;
-    compiler->bytecode = malloc(sizeof(Bytecode));
-    
-    compiler->bytecode->code = malloc(sizeof(OpCode));
-    compiler->bytecode->code_capacity = 1;
-    compiler->bytecode->code_count = 0;
+    compiler->bytecode = newBytecode();
+    compiler->enclosing = NULL;
+    compiler->name = NULL;
+    compiler->heap = NULL;
+
+    // slot zero holds the callee (or the script) and is never named
+    compiler->locals[0].name = "";
+    compiler->locals[0].depth = 0;
+    compiler->local_count = 1;
+    compiler->scope_depth = 0;
+
+    initSymbolTable(&compiler->identifiers);
 
-    compiler->bytecode->constants = malloc(sizeof(int));
-    compiler->bytecode->const_capacity = 1;
-    compiler->bytecode->const_count = 0;
+    compiler->statics.functions = NULL;
+    compiler->statics.count = 0;
+    initSymbolTable(&compiler->statics.index);
+    compiler->inline_threshold = INLINE_THRESHOLD_DEFAULT;
+    compiler->incremental = false;
+    compiler->errors = NULL;
+    compiler->debug = false;
+
+    compiler->hadError = false;
+}
+
+void freeStaticTable(StaticTable *statics) {
+    free(statics->functions);
+    freeSymbolTable(&statics->index);
+}
+
+void freeCompiler(Compiler *compiler) {
+    freeSymbolTable(&compiler->identifiers);
+    freeStaticTable(&compiler->statics);
+}
+
+static Compiler *rootCompiler(Compiler *compiler) {
+    while (compiler->enclosing) compiler = compiler->enclosing;
+    return compiler;
+}
+
+static void compileError(Compiler *compiler, char *message) {
+    compiler->hadError = true;
+    reportError(rootCompiler(compiler)->errors, message);
 }
 
 static void emitByte(Bytecode *bytecode, OpCode op) {
@@ -35,7 +109,20 @@ static int addConstant(Bytecode *bytecode, Value value) {
     return bytecode->const_count++;
 }
 
-static void emitOperator(Bytecode *bytecode, TokenType op) {
+// A fresh inline cache for one property access site.
+static int addCache(Bytecode *bytecode) {
+    if (bytecode->cache_count >= bytecode->cache_capacity) {
+        bytecode->cache_capacity = bytecode->cache_capacity == 0 ? 4 : bytecode->cache_capacity * 2;
+        bytecode->caches = realloc(bytecode->caches, sizeof(PropertyCache) * bytecode->cache_capacity);
+    }
+    memset(&bytecode->caches[bytecode->cache_count], 0, sizeof(PropertyCache));
+
+    return bytecode->cache_count++;
+}
+
+static void emitOperator(Compiler *compiler, TokenType op) {
+    Bytecode *bytecode = compiler->bytecode;
+
     switch (op) {
         case PLUS: {
             emitByte(bytecode, OP_PLUS);
@@ -122,13 +209,462 @@ static void emitOperator(Bytecode *bytecode, TokenType op) {
             break;
         }
         default: {
-            fprintf(stderr, "Unknown operator in compiler, stopping.\n");
-            exit(EXIT_FAILURE);
+            compileError(compiler, "Unknown binary operator.");
+            break;
+        }
+    }
+}
+
+static int identifierConstant(Compiler *compiler, char *name) {
+    Value index;
+    if (getSymbol(&compiler->identifiers, name, &index)) {
+        return index.as.number;
+    }
+
+    Value val;
+    val.type = TYPE_IDENTIFIER;
+    val.as.identifier = strdup(name);
+
+    index.type = TYPE_NUMBER;
+    index.as.number = addConstant(compiler->bytecode, val);
+    setSymbol(&compiler->identifiers, name, index);
+
+    return index.as.number;
+}
+
+static int emitJump(Bytecode *bytecode, OpCode op) {
+    emitByte(bytecode, op);
+    emitByte(bytecode, 0);
+
+    return bytecode->code_count - 1;
+}
+
+static void patchJump(Bytecode *bytecode, int operand) {
+    bytecode->code[operand] = bytecode->code_count - operand - 1;
+}
+
+static int resolveLocal(Compiler *compiler, char *name) {
+    for (int i = compiler->local_count - 1; i > 0; i--) {
+        if (strcmp(compiler->locals[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int declareLocal(Compiler *compiler, char *name) {
+    if (compiler->local_count >= LOCALS_MAX) {
+        compileError(compiler, "Too many local variables in function.");
+        return 0;
+    }
+
+    int slot = compiler->local_count++;
+    compiler->locals[slot].name = name;
+    compiler->locals[slot].depth = compiler->scope_depth;
+
+    if (compiler->local_count > compiler->bytecode->local_count) {
+        compiler->bytecode->local_count = compiler->local_count;
+    }
+
+    return slot;
+}
+
+static void beginScope(Compiler *compiler) {
+    compiler->scope_depth++;
+}
+
+static void endScope(Compiler *compiler) {
+    compiler->scope_depth--;
+
+    // locals live in slots reserved at call time, so leaving a scope only
+    // releases the names; the slots are reused by the next declaration
+    while (compiler->local_count > 1 && compiler->locals[compiler->local_count - 1].depth > compiler->scope_depth) {
+        compiler->local_count--;
+    }
+}
+
+static void compileExpr(Compiler *compiler, AstExpression *expr);
+static void compileStatement(Compiler *compiler, AstExpression *stmt);
+
+static Bytecode *compileBody(Compiler *enclosing, AstFunction *function) {
+    Compiler compiler;
+    initCompiler(&compiler, enclosing->ast);
+    compiler.enclosing = enclosing;
+    compiler.name = function->name;
+    compiler.heap = enclosing->heap;
+    compiler.scope_depth = 1;
+
+    for (int i = 0; i < function->paramCount; i++) {
+        declareLocal(&compiler, function->params[i]);
+    }
+
+    AstBlock *body = &function->body->as.block;
+    for (int i = 0; i < body->count; i++) {
+        compileStatement(&compiler, body->exprs[i]);
+    }
+
+    // a body ending in a return statement never falls off its end
+    if (body->count == 0 || body->exprs[body->count - 1]->type != AST_RETURN) {
+        emitByte(compiler.bytecode, OP_UNDEFINED);
+        emitByte(compiler.bytecode, OP_RETURN);
+    }
+
+    if (compiler.hadError) enclosing->hadError = true;
+    freeCompiler(&compiler);
+
+    return compiler.bytecode;
+}
+
+static Object *newFunction(Compiler *enclosing, AstFunction *function) {
+    Object *obj = newFunctionObject(enclosing->heap);
+    obj->as.function.arity = function->paramCount;
+    obj->as.function.name = function->name ? strdup(function->name) : NULL;
+    obj->as.function.tokens = function->tokens;
+    obj->as.function.start = function->start;
+    obj->as.function.chunk = function->body ? compileBody(enclosing, function) : NULL;
+
+    return obj;
+}
+
+// Parses and compiles a function whose body the parser deferred. Nested
+// functions inside it are pre-parsed in turn, so they stay deferred.
+bool compileDeferred(Compiler *root, Object *function) {
+    ObjFunction *fn = &function->as.function;
+
+    Parser parser;
+    initParser(&parser, fn->tokens);
+    parser.lazy = true;
+    parser.heap = root->heap;
+    parser.errors = root->errors;
+
+    AstExpression *expr = parseFunctionAt(&parser, fn->start);
+    if (expr && !parser.hadError) {
+        // published with release order: a concurrent marker may trace it
+        Bytecode *chunk = compileBody(root, &expr->as.function);
+        __atomic_store_n(&fn->chunk, chunk, __ATOMIC_RELEASE);
+    }
+
+    freeExpr(expr);
+    freeParser(&parser);
+
+    return fn->chunk && !parser.hadError && !root->hadError;
+}
+
+static void emitFunction(Compiler *compiler, Object *function) {
+    Value val;
+    val.type = TYPE_FUNCTION;
+    val.as.object = function;
+
+    int index = addConstant(compiler->bytecode, val);
+    emitByte(compiler->bytecode, OP_CONSTANT);
+    emitByte(compiler->bytecode, index);
+}
+
+static StaticFunction *findStatic(Compiler *root, char *name) {
+    Value index;
+    if (!getSymbol(&root->statics.index, name, &index)) return NULL;
+
+    return &root->statics.functions[(int)index.as.number];
+}
+
+static Object *compileStatic(Compiler *root, StaticFunction *target) {
+    if (!target->function && target->ast) {
+        target->compiling = true;
+        target->function = newFunction(root, target->ast);
+        target->compiling = false;
+    }
+
+    return target->function;
+}
+
+int operandCount(OpCode op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_NEW_OBJECT:
+        case OP_NEW_ARRAY:
+        case OP_APPEND_ARRAY:
+            return 1;
+        case OP_GET_PROPERTY:
+        case OP_INIT_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_NEW_MAP:
+            return 2;
+        case OP_INVOKE:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+// Returns why 'chunk' can't be inlined, or NULL if it can. Only leaf
+// functions qualify, which also rules out direct and mutual recursion.
+static char *inlineBlocker(Bytecode *chunk, int threshold) {
+    if (chunk->code_count > threshold) return "too large";
+
+    for (int i = 0; i < chunk->code_count; i += 1 + operandCount(chunk->code[i])) {
+        OpCode op = chunk->code[i];
+
+        if (op == OP_CALL || op == OP_TAIL_CALL) return "not a leaf";
+        if (op == OP_CONSTANT && chunk->constants[chunk->code[i + 1]].type == TYPE_FUNCTION) {
+            return "creates functions";
+        }
+    }
+
+    return NULL;
+}
+
+// Methods that change the array or Map they are called on.
+static const char *mutators[] = { "push", "pop", "sort", "set", "add", "delete", "clear" };
+
+const char *sideEffect(Bytecode *chunk) {
+    for (int i = 0; i < chunk->code_count; i += 1 + operandCount(chunk->code[i])) {
+        switch (chunk->code[i]) {
+            case OP_DEFINE_GLOBAL:
+                return "defines a global";
+            case OP_SET_PROPERTY:
+                return "writes a property";
+            case OP_SET_INDEX:
+                return "writes an element";
+            case OP_NEW_WORKER:
+                return "starts a worker";
+            case OP_PRINT:
+                return "prints";
+            case OP_INVOKE: {
+                char *name = chunk->constants[chunk->code[i + 1]].as.identifier;
+                for (size_t m = 0; m < sizeof(mutators) / sizeof(mutators[0]); m++) {
+                    if (strcmp(name, mutators[m]) == 0) return "calls a method that changes its receiver";
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+Bytecode *bindingChunk(Object *function, char **names, Object **bound, int count) {
+    Bytecode *chunk = newBytecode();
+
+    Value value;
+    value.type = TYPE_FUNCTION;
+    value.as.object = function;
+    addConstant(chunk, value);
+
+    for (int i = 0; i < count; i++) {
+        value.as.object = bound[i];
+        emitByte(chunk, OP_CONSTANT);
+        emitByte(chunk, addConstant(chunk, value));
+
+        Value name;
+        name.type = TYPE_IDENTIFIER;
+        name.as.identifier = strdup(names[i]);
+        emitByte(chunk, OP_DEFINE_GLOBAL);
+        emitByte(chunk, addConstant(chunk, name));
+    }
+    emitByte(chunk, OP_END);
+
+    return chunk;
+}
+
+// Copies the callee's code into the current chunk. Callee slot n maps to
+// caller slot 'slotBase + n - 1', constants are re-added to the caller's
+// pool, and every return becomes a jump past the spliced code (the final
+// one is dropped), so relative jumps are relocated as instructions grow.
+// Property accesses get caches of their own in the caller.
+static void spliceChunk(Compiler *compiler, Bytecode *callee, int slotBase) {
+    Bytecode *bytecode = compiler->bytecode;
+
+    int end = callee->code_count - 1;
+    int *positions = calloc(end + 1, sizeof(int));
+
+    int pos = 0;
+    for (int i = 0; i < end; i += 1 + operandCount(callee->code[i])) {
+        OpCode op = callee->code[i];
+
+        positions[i] = pos;
+        pos += op == OP_RETURN ? 2 : 1 + operandCount(op);
+    }
+    positions[end] = pos;
+
+    int start = bytecode->code_count;
+    for (int i = 0; i < end; i += 1 + operandCount(callee->code[i])) {
+        OpCode op = callee->code[i];
+
+        switch (op) {
+            case OP_RETURN: {
+                emitByte(bytecode, OP_JUMP);
+                emitByte(bytecode, start + positions[end] - (bytecode->code_count + 1));
+                break;
+            }
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE: {
+                int target = i + 2 + callee->code[i + 1];
+
+                emitByte(bytecode, op);
+                emitByte(bytecode, positions[target] - (positions[i] + 2));
+                break;
+            }
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL: {
+                emitByte(bytecode, op);
+                emitByte(bytecode, slotBase + callee->code[i + 1] - 1);
+                break;
+            }
+            case OP_CONSTANT: {
+                emitByte(bytecode, op);
+                emitByte(bytecode, addConstant(bytecode, callee->constants[callee->code[i + 1]]));
+                break;
+            }
+            case OP_GET_GLOBAL:
+            case OP_DEFINE_GLOBAL: {
+                emitByte(bytecode, op);
+                emitByte(bytecode, identifierConstant(compiler, callee->constants[callee->code[i + 1]].as.identifier));
+                break;
+            }
+            case OP_GET_PROPERTY:
+            case OP_INIT_PROPERTY:
+            case OP_SET_PROPERTY: {
+                emitByte(bytecode, op);
+                emitByte(bytecode, identifierConstant(compiler, callee->constants[callee->code[i + 1]].as.identifier));
+                emitByte(bytecode, addCache(bytecode));
+                break;
+            }
+            case OP_INVOKE: {
+                emitByte(bytecode, op);
+                emitByte(bytecode, identifierConstant(compiler, callee->constants[callee->code[i + 1]].as.identifier));
+                emitByte(bytecode, callee->code[i + 2]);
+                emitByte(bytecode, addCache(bytecode));
+                break;
+            }
+            default: {
+                emitByte(bytecode, op);
+                for (int j = 1; j <= operandCount(op); j++) {
+                    emitByte(bytecode, callee->code[i + j]);
+                }
+                break;
+            }
+        }
+    }
+
+    free(positions);
+}
+
+static bool tryInline(Compiler *compiler, AstCall *call) {
+    AstExpression *callee = call->callee;
+    if (callee->type != AST_CONSTANT || callee->as.constant.type != TYPE_IDENTIFIER) return false;
+
+    char *name = callee->as.constant.as.identifier;
+    if (resolveLocal(compiler, name) != -1) return false;
+
+    Compiler *root = rootCompiler(compiler);
+    if (root->inline_threshold <= 0) return false;
+
+    StaticFunction *target = findStatic(root, name);
+    if (!target) return false;
+
+    char *caller = compiler->name ? compiler->name : "<script>";
+    if (target->compiling) {
+        if (root->debug) printf("inline: skipped '%s' in '%s' (recursive)\n", name, caller);
+        return false;
+    }
+
+    if (!compileStatic(root, target)) return false;
+
+    Bytecode *chunk = target->function->as.function.chunk;
+    int arity = target->function->as.function.arity;
+
+    if (!chunk) {
+        if (root->debug) printf("inline: skipped '%s' in '%s' (deferred)\n", name, caller);
+        return false;
+    }
+
+    char *reason = inlineBlocker(chunk, root->inline_threshold);
+    if (reason) {
+        if (root->debug) printf("inline: skipped '%s' in '%s' (%s)\n", name, caller, reason);
+        return false;
+    }
+
+    for (int i = 0; i < call->argCount; i++) {
+        compileExpr(compiler, call->args[i]);
+    }
+
+    int slotBase = compiler->local_count;
+    int slotCount = chunk->local_count - 1;
+    for (int i = 0; i < slotCount; i++) {
+        declareLocal(compiler, "");
+    }
+
+    Bytecode *bytecode = compiler->bytecode;
+    for (int i = call->argCount - 1; i >= 0; i--) {
+        if (i < arity) {
+            emitByte(bytecode, OP_SET_LOCAL);
+            emitByte(bytecode, slotBase + i);
+        }
+        emitByte(bytecode, OP_POP);
+    }
+    for (int i = call->argCount; i < arity; i++) {
+        emitByte(bytecode, OP_UNDEFINED);
+        emitByte(bytecode, OP_SET_LOCAL);
+        emitByte(bytecode, slotBase + i);
+        emitByte(bytecode, OP_POP);
+    }
+
+    spliceChunk(compiler, chunk, slotBase);
+    compiler->local_count -= slotCount;
+
+    if (root->debug) printf("inline: '%s' into '%s' (%d ops)\n", name, caller, chunk->code_count);
+
+    return true;
+}
+
+// Returns true if the call was inlined or is a method call, rather than
+// emitted as 'op'; either way its result is left on the stack.
+static bool compileCall(Compiler *compiler, AstCall *call, OpCode op) {
+    if (tryInline(compiler, call)) return true;
+
+    // a method call keeps the receiver below the arguments and looks the
+    // method up by name, so no function value is ever materialised
+    if (call->callee->type == AST_PROPERTY) {
+        AstProperty *property = &call->callee->as.property;
+        compileExpr(compiler, property->object);
+
+        for (int i = 0; i < call->argCount; i++) {
+            compileExpr(compiler, call->args[i]);
         }
+
+        emitByte(compiler->bytecode, OP_INVOKE);
+        emitByte(compiler->bytecode, identifierConstant(compiler, property->property));
+        emitByte(compiler->bytecode, call->argCount);
+        emitByte(compiler->bytecode, addCache(compiler->bytecode));
+        return true;
+    }
+
+    compileExpr(compiler, call->callee);
+
+    for (int i = 0; i < call->argCount; i++) {
+        compileExpr(compiler, call->args[i]);
     }
+
+    emitByte(compiler->bytecode, op);
+    emitByte(compiler->bytecode, call->argCount);
+
+    return false;
 }
 
-static void compileExpr(Bytecode *bytecode, AstExpression *expr) {
+static void compileExpr(Compiler *compiler, AstExpression *expr) {
+    Bytecode *bytecode = compiler->bytecode;
+
     switch (expr->type) {
         case AST_CONSTANT: {
             Value val;
@@ -140,10 +676,21 @@ static void compileExpr(Bytecode *bytecode, AstExpression *expr) {
             } else if (val.type == TYPE_STRING) {
                 val.as.object = expr->as.constant.as.object;
             } else if (val.type == TYPE_IDENTIFIER) {
-                val.as.identifier = expr->as.constant.as.identifier;
+                int slot = resolveLocal(compiler, expr->as.constant.as.identifier);
+                if (slot != -1) {
+                    emitByte(bytecode, OP_GET_LOCAL);
+                    emitByte(bytecode, slot);
+                } else {
+                    emitByte(bytecode, OP_GET_GLOBAL);
+                    emitByte(bytecode, identifierConstant(compiler, expr->as.constant.as.identifier));
+                }
+                break;
+            } else if (val.type == TYPE_UNDEFINED) {
+                emitByte(bytecode, OP_UNDEFINED);
+                break;
             } else {
-                fprintf(stderr, "Unknown constant type in compiler.\n");
-                exit(EXIT_FAILURE);
+                compileError(compiler, "Unknown constant type.");
+                break;
             }
 
             int index = addConstant(bytecode, val);
@@ -152,7 +699,7 @@ static void compileExpr(Bytecode *bytecode, AstExpression *expr) {
             break;
         }
         case AST_UNARY: {
-            compileExpr(bytecode, expr->as.unary.right);
+            compileExpr(compiler, expr->as.unary.right);
             if (expr->as.unary.op == MINUS) {
                 emitByte(bytecode, OP_NEGATE);
             } else if (expr->as.unary.op == LOGICAL_NOT) {
@@ -162,31 +709,276 @@ static void compileExpr(Bytecode *bytecode, AstExpression *expr) {
             } else if (expr->as.unary.op == TYPEOF) {
                 emitByte(bytecode, OP_TYPEOF);
             } else {
-                fprintf(stderr, "Unknown unary op.\n");
-                exit(EXIT_FAILURE);
+                compileError(compiler, "Unknown unary operator.");
+            }
+            break;
+        }
+        case AST_BINARY: {
+            compileExpr(compiler, expr->as.binary.right);
+            compileExpr(compiler, expr->as.binary.left);
+            emitOperator(compiler, expr->as.binary.op);
+            break;
+        }
+        case AST_CALL: {
+            compileCall(compiler, &expr->as.call, OP_CALL);
+            break;
+        }
+        case AST_NEW: {
+            // only the built-in collections can be constructed, from at
+            // most one array of initial contents, and workers, from the
+            // path of their script
+            AstCall *call = &expr->as.call;
+            char *name = call->callee->as.constant.as.identifier;
+            bool isMap = strcmp(name, "Map") == 0;
+
+            if (strcmp(name, "Worker") == 0) {
+                if (call->argCount != 1) {
+                    compileError(compiler, "A Worker takes the path of its script.");
+                    break;
+                }
+
+                compileExpr(compiler, call->args[0]);
+                emitByte(bytecode, OP_NEW_WORKER);
+                break;
+            }
+
+            if ((!isMap && strcmp(name, "Set") != 0) || call->argCount > 1) {
+                compileError(compiler, "Unknown constructor.");
+                break;
+            }
+
+            for (int i = 0; i < call->argCount; i++) {
+                compileExpr(compiler, call->args[i]);
+            }
+            emitByte(bytecode, OP_NEW_MAP);
+            emitByte(bytecode, isMap ? 0 : 1);
+            emitByte(bytecode, call->argCount);
+            break;
+        }
+        case AST_FUNCTION: {
+            emitFunction(compiler, newFunction(compiler, &expr->as.function));
+            break;
+        }
+        case AST_PROPERTY: {
+            compileExpr(compiler, expr->as.property.object);
+            emitByte(bytecode, OP_GET_PROPERTY);
+            emitByte(bytecode, identifierConstant(compiler, expr->as.property.property));
+            emitByte(bytecode, addCache(bytecode));
+            break;
+        }
+        case AST_SET_PROPERTY: {
+            compileExpr(compiler, expr->as.setProperty.object);
+            compileExpr(compiler, expr->as.setProperty.value);
+            emitByte(bytecode, OP_SET_PROPERTY);
+            emitByte(bytecode, identifierConstant(compiler, expr->as.setProperty.property));
+            emitByte(bytecode, addCache(bytecode));
+            break;
+        }
+        case AST_SET_INDEX: {
+            compileExpr(compiler, expr->as.setIndex.object);
+            compileExpr(compiler, expr->as.setIndex.index);
+            compileExpr(compiler, expr->as.setIndex.value);
+            emitByte(bytecode, OP_SET_INDEX);
+            break;
+        }
+        case AST_ARRAY: {
+            // the elements are gathered on the stack in order, a batch at
+            // a time, and each batch after the first is appended to the
+            // array below it
+            int count = expr->as.array.count;
+            for (int start = 0; start == 0 || start < count; start += ARRAY_LITERAL_BATCH) {
+                int end = count - start > ARRAY_LITERAL_BATCH ? start + ARRAY_LITERAL_BATCH : count;
+
+                for (int i = start; i < end; i++) {
+                    compileExpr(compiler, expr->as.array.values[i]);
+                }
+                emitByte(bytecode, start == 0 ? OP_NEW_ARRAY : OP_APPEND_ARRAY);
+                emitByte(bytecode, end - start);
+            }
+            break;
+        }
+        case AST_OBJECT: {
+            // the object stays on the stack while its properties are added
+            emitByte(bytecode, OP_NEW_OBJECT);
+            emitByte(bytecode, expr->as.object.count);
+            for (int i = 0; i < expr->as.object.count; i++) {
+                compileExpr(compiler, expr->as.object.values[i]);
+                emitByte(bytecode, OP_INIT_PROPERTY);
+                emitByte(bytecode, identifierConstant(compiler, expr->as.object.keys[i]));
+                emitByte(bytecode, addCache(bytecode));
             }
             break;
         }
+        case AST_INDEX: {
+            compileExpr(compiler, expr->as.index.object);
+            compileExpr(compiler, expr->as.index.index);
+            emitByte(bytecode, OP_GET_INDEX);
+            break;
+        }
+        default: {
+            compileError(compiler, "Unknown expression.");
+            break;
+        }
+    }
+}
+
+static void compileVariableDeclaration(Compiler *compiler, VariableDeclaration *variable) {
+    Bytecode *bytecode = compiler->bytecode;
+
+    StaticFunction *target = NULL;
+    if (compiler->scope_depth == 0 && !compiler->enclosing) {
+        target = findStatic(compiler, variable->identifier);
+    }
+
+    if (target && target->ast == &variable->initializer->as.function) {
+        emitFunction(compiler, compileStatic(compiler, target));
+    } else if (variable->initializer) {
+        compileExpr(compiler, variable->initializer);
+    } else {
+        emitByte(bytecode, OP_UNDEFINED);
+    }
+
+    if (compiler->scope_depth == 0) {
+        emitByte(bytecode, OP_DEFINE_GLOBAL);
+        emitByte(bytecode, identifierConstant(compiler, variable->identifier));
+        return;
+    }
+
+    int slot = declareLocal(compiler, variable->identifier);
+    emitByte(bytecode, OP_SET_LOCAL);
+    emitByte(bytecode, slot);
+    emitByte(bytecode, OP_POP);
+}
+
+static void compileReturn(Compiler *compiler, AstReturn *ret) {
+    Bytecode *bytecode = compiler->bytecode;
+
+    if (!compiler->enclosing) {
+        compileError(compiler, "Can't return from top-level code.");
+        return;
+    }
+
+    // a call in tail position replaces the current frame instead of
+    // stacking a new one, so tail recursion runs in constant frame space;
+    // an inlined or method call instead leaves its result on the stack
+    if (ret->value && ret->value->type == AST_CALL) {
+        if (!compileCall(compiler, &ret->value->as.call, OP_TAIL_CALL)) return;
+    } else if (ret->value) {
+        compileExpr(compiler, ret->value);
+    } else {
+        emitByte(bytecode, OP_UNDEFINED);
+    }
+    emitByte(bytecode, OP_RETURN);
+}
+
+static void compileIf(Compiler *compiler, AstIf *conditional) {
+    Bytecode *bytecode = compiler->bytecode;
+
+    compileExpr(compiler, conditional->condition);
+    int thenJump = emitJump(bytecode, OP_JUMP_IF_FALSE);
+
+    compileStatement(compiler, conditional->thenBranch);
+
+    if (conditional->elseBranch) {
+        int elseJump = emitJump(bytecode, OP_JUMP);
+        patchJump(bytecode, thenJump);
+
+        compileStatement(compiler, conditional->elseBranch);
+        patchJump(bytecode, elseJump);
+    } else {
+        patchJump(bytecode, thenJump);
+    }
+}
+
+static void compileStatement(Compiler *compiler, AstExpression *stmt) {
+    switch (stmt->type) {
         case AST_VARIABLE_DECLARATION: {
-            
+            compileVariableDeclaration(compiler, &stmt->as.variable);
             break;
         }
-        case AST_BINARY: {
-            compileExpr(bytecode, expr->as.binary.right);
-            compileExpr(bytecode, expr->as.binary.left);
-            emitOperator(bytecode, expr->as.binary.op);
+        case AST_RETURN: {
+            compileReturn(compiler, &stmt->as.ret);
+            break;
+        }
+        case AST_IF: {
+            compileIf(compiler, &stmt->as.conditional);
+            break;
+        }
+        case AST_BLOCK: {
+            beginScope(compiler);
+            for (int i = 0; i < stmt->as.block.count; i++) {
+                compileStatement(compiler, stmt->as.block.exprs[i]);
+            }
+            endScope(compiler);
             break;
         }
         default: {
-            printf("Unable to compile expression as it is unknown.\n");
-            exit(EXIT_FAILURE);
+            compileExpr(compiler, stmt);
+
+            // top-level expression statements print their result, apart
+            // from assignments
+            bool echo = !compiler->enclosing && stmt->type != AST_SET_PROPERTY && stmt->type != AST_SET_INDEX;
+            emitByte(compiler->bytecode, echo ? OP_PRINT : OP_POP);
+            break;
         }
     }
 }
 
+// Records the top-level function declarations whose name is never bound
+// by any other top-level declaration; calls to those resolve statically.
+static void collectStatics(Compiler *compiler) {
+    Ast *ast = compiler->ast;
+
+    SymbolTable bindings;
+    initSymbolTable(&bindings);
+
+    for (int i = 0; i < ast->expr_count; i++) {
+        if (ast->exprs[i]->type != AST_VARIABLE_DECLARATION) continue;
+
+        Value count;
+        count.type = TYPE_NUMBER;
+        count.as.number = 0;
+
+        char *name = ast->exprs[i]->as.variable.identifier;
+        getSymbol(&bindings, name, &count);
+        count.as.number++;
+        setSymbol(&bindings, name, count);
+    }
+
+    StaticTable *statics = &compiler->statics;
+    statics->functions = malloc(sizeof(StaticFunction) * (ast->expr_count + 1));
+
+    for (int i = 0; i < ast->expr_count; i++) {
+        AstExpression *expr = ast->exprs[i];
+        if (expr->type != AST_VARIABLE_DECLARATION) continue;
+
+        AstExpression *initializer = expr->as.variable.initializer;
+        if (!initializer || initializer->type != AST_FUNCTION) continue;
+
+        Value count;
+        getSymbol(&bindings, expr->as.variable.identifier, &count);
+        if (count.as.number != 1) continue;
+
+        Value index;
+        index.type = TYPE_NUMBER;
+        index.as.number = statics->count;
+        setSymbol(&statics->index, expr->as.variable.identifier, index);
+
+        StaticFunction *target = &statics->functions[statics->count++];
+        target->name = expr->as.variable.identifier;
+        target->ast = &initializer->as.function;
+        target->function = NULL;
+        target->compiling = false;
+    }
+
+    freeSymbolTable(&bindings);
+}
+
 void compile(Compiler *compiler) {
+    if (!compiler->incremental) collectStatics(compiler);
+
     for (int i = 0; i < compiler->ast->expr_count; i++) {
-        compileExpr(compiler->bytecode, compiler->ast->exprs[i]);
+        compileStatement(compiler, compiler->ast->exprs[i]);
     }
 
     emitByte(compiler->bytecode, OP_END);
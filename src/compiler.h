@@ -2,6 +2,8 @@
 #define compiler_h
 
 #include "parser.h"
+#include "shape.h"
+#include "symbols.h"
 
 typedef enum {
   VM_OK,
@@ -46,12 +48,57 @@ typedef enum {
     OP_DEFINE_GLOBAL,
     OP_GET_GLOBAL,
 
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+
+    OP_UNDEFINED,
+    OP_POP,
+
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+
+    OP_CALL,
+    OP_TAIL_CALL,
+    OP_RETURN,
+
+    OP_GET_PROPERTY,
+    OP_GET_INDEX,
+    OP_INVOKE,
+
+    OP_NEW_OBJECT,
+    OP_INIT_PROPERTY,
+    OP_SET_PROPERTY,
+
+    OP_NEW_ARRAY,
+    OP_APPEND_ARRAY,
+    OP_SET_INDEX,
+
+    OP_NEW_MAP,
+    OP_NEW_WORKER,
+
     OP_PRINT,
 
     OP_END,
 } OpCode;
 
+#define PROPERTY_CACHE_WAYS 4
+
+// What one property access site has seen: for each receiver shape, the
+// slot holding the property (-1 if it has none) and, where a store adds
+// the property, the shape the object moves to. A site that meets more
+// shapes than it has ways goes megamorphic and stops caching.
 typedef struct {
+    Shape *shapes[PROPERTY_CACHE_WAYS];
+    Shape *transitions[PROPERTY_CACHE_WAYS];
+    int    slots[PROPERTY_CACHE_WAYS];
+    int    count;
+    bool   megamorphic;
+} PropertyCache;
+
+// A chunk of compiled code. The top-level script and every function body
+// each get their own. 'local_count' is the number of frame slots (callee,
+// parameters and locals) the VM reserves when it enters the chunk.
+struct Bytecode {
     OpCode *code;
     int     code_capacity;
     int     code_count;
@@ -59,14 +106,101 @@ typedef struct {
     Value  *constants;
     int     const_capacity;
     int     const_count;
-} Bytecode;
+
+    PropertyCache *caches;
+    int            cache_capacity;
+    int            cache_count;
+
+    int     local_count;
+
+    // 'code' points into a mapped cache file, which owns it
+    bool    mapped;
+
+    // set on a chunk of a frozen Program, which owns it; the chunk is
+    // shared, so each VM keeps its inline caches, from 'cache_base' in
+    // the VM's block for the program
+    Program *program;
+    int      cache_base;
+};
+
+#define LOCALS_MAX 256
+
+// Elements of an array literal gathered on the stack at once; a longer
+// literal is built a batch at a time, so it needs no more stack than this.
+#define ARRAY_LITERAL_BATCH 256
 
 typedef struct {
-    Ast *ast;
+    char *name;
+    int   depth;
+} Local;
+
+#define INLINE_THRESHOLD_DEFAULT 24
+
+// A top-level function declaration whose name is bound exactly once, so
+// calls to it can be resolved while compiling. 'function' is filled in
+// the first time the body is compiled, which may be before the
+// declaration itself is reached.
+typedef struct {
+    char        *name;
+    AstFunction *ast;
+    Object      *function;
+    bool         compiling;
+} StaticFunction;
+
+typedef struct {
+    StaticFunction *functions;
+    int             count;
+    SymbolTable     index;
+} StaticTable;
+
+typedef struct Compiler Compiler;
+
+struct Compiler {
+    Ast      *ast;
     Bytecode *bytecode;
-} Compiler;
+    Compiler *enclosing;
+    char     *name;
+    Heap     *heap;
+
+    Local       locals[LOCALS_MAX];
+    int         local_count;
+    int         scope_depth;
+    SymbolTable identifiers;
+
+    // only used on the top-level compiler
+    StaticTable statics;
+    int         inline_threshold;
+    bool        debug;
+    // set for REPL lines: a later line may rebind any top-level name, so
+    // none of them resolve statically
+    bool        incremental;
+    ErrorSink  *errors;
+
+    bool      hadError;
+};
+
+Bytecode *newBytecode();
+void      freeBytecode(Bytecode *bytecode);
+
+void freeStaticTable(StaticTable *statics);
 
 void initCompiler(Compiler *compiler, Ast *ast);
+void freeCompiler(Compiler *compiler);
 void compile(Compiler *compiler);
+bool compileDeferred(Compiler *root, Object *function);
+
+// The operands an instruction takes after its opcode.
+int  operandCount(OpCode op);
+
+// Returns what in 'chunk' could be seen outside a call to it, or NULL if
+// nothing can: it defines no globals, writes no properties or elements,
+// prints nothing and starts no workers. Reading a global, and the
+// functions the chunk calls, are left to the caller to check.
+const char *sideEffect(Bytecode *chunk);
+
+// A script that defines each of 'names' as a global bound to the function
+// beside it, with 'function' as its first constant. Frozen, it carries a
+// function and the ones it calls by name to another VM.
+Bytecode   *bindingChunk(Object *function, char **names, Object **bound, int count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+
+#include "deque.h"
+
+// After Lê, Pop, Cohen and Zappa Nardelli, "Correct and Efficient
+// Work-Stealing for Weak Memory Models", with their fences folded into
+// sequentially consistent accesses to top and bottom, which
+// ThreadSanitizer can follow.
+
+static DequeRing *newRing(long size) {
+    DequeRing *ring = malloc(sizeof(DequeRing));
+    ring->size = size;
+    ring->items = malloc(sizeof(long) * size);
+
+    return ring;
+}
+
+void initDeque(Deque *deque, long capacity) {
+    long size = 16;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->ring = newRing(size);
+    deque->retired = NULL;
+    deque->retired_count = 0;
+}
+
+void freeDeque(Deque *deque) {
+    for (int i = 0; i < deque->retired_count; i++) {
+        free(deque->retired[i]->items);
+        free(deque->retired[i]);
+    }
+    free(deque->retired);
+
+    free(deque->ring->items);
+    free(deque->ring);
+}
+
+// Copies the live items into a ring twice the size. Only the owner
+// writes items, so the old ring stays valid for thieves as it is.
+static DequeRing *growDeque(Deque *deque, DequeRing *ring, long top, long bottom) {
+    DequeRing *grown = newRing(ring->size * 2);
+    for (long i = top; i < bottom; i++) {
+        long item = __atomic_load_n(&ring->items[i & (ring->size - 1)], __ATOMIC_RELAXED);
+        __atomic_store_n(&grown->items[i & (grown->size - 1)], item, __ATOMIC_RELAXED);
+    }
+
+    deque->retired = realloc(deque->retired, sizeof(DequeRing *) * (deque->retired_count + 1));
+    deque->retired[deque->retired_count++] = ring;
+    __atomic_store_n(&deque->ring, grown, __ATOMIC_RELEASE);
+
+    return grown;
+}
+
+void pushDeque(Deque *deque, long item) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    DequeRing *ring = __atomic_load_n(&deque->ring, __ATOMIC_RELAXED);
+
+    if (bottom - top > ring->size - 1) ring = growDeque(deque, ring, top, bottom);
+
+    __atomic_store_n(&ring->items[bottom & (ring->size - 1)], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+// Takes the newest item. Bottom is moved first so that a thief can see
+// the claim, and the last item goes to whichever of the two wins the CAS
+// on top.
+bool popDeque(Deque *deque, long *item) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    DequeRing *ring = __atomic_load_n(&deque->ring, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    *item = __atomic_load_n(&ring->items[bottom & (ring->size - 1)], __ATOMIC_RELAXED);
+    if (top < bottom) return true;
+
+    bool won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+
+    return won;
+}
+
+// Takes the oldest item. A thief that loses the CAS to another thief or
+// to the owner tries again, so false always means the deque was empty.
+bool stealDeque(Deque *deque, long *item) {
+    for (;;) {
+        long top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+        long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST);
+        if (top >= bottom) return false;
+
+        DequeRing *ring = __atomic_load_n(&deque->ring, __ATOMIC_ACQUIRE);
+        long stolen = __atomic_load_n(&ring->items[top & (ring->size - 1)], __ATOMIC_RELAXED);
+
+        if (__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            *item = stolen;
+            return true;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef deque_h
+#define deque_h
+
+#include <stdbool.h>
+
+// A Chase-Lev work-stealing deque of indices. Its owner pushes and pops
+// at the bottom without locking; any other thread steals from the top,
+// and only a steal racing the owner for the last item needs a CAS.
+typedef struct {
+    long  size;
+    long *items;
+} DequeRing;
+
+typedef struct {
+    long       top;
+    long       bottom;
+    DequeRing *ring;
+
+    // rings outgrown by the owner, which a thief may still be reading;
+    // they go with the deque
+    DequeRing **retired;
+    int         retired_count;
+} Deque;
+
+void initDeque(Deque *deque, long capacity);
+void freeDeque(Deque *deque);
+
+// Owner only.
+void pushDeque(Deque *deque, long item);
+bool popDeque(Deque *deque, long *item);
+
+// Any thread. False once the deque is empty.
+bool stealDeque(Deque *deque, long *item);
+
+#endif
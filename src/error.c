@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+#include "error.h"
+
+void reportError(ErrorSink *sink, const char *message) {
+    if (!sink) {
+        printf("Error: %s\n", message);
+        return;
+    }
+
+    if (sink->failed) return;
+
+    snprintf(sink->message, sizeof(sink->message), "%s", message);
+    sink->failed = true;
+}
@@ -0,0 +1,18 @@
+#ifndef error_h
+#define error_h
+
+#include <stdbool.h>
+
+#define ERROR_MESSAGE_MAX 256
+
+// Where lexer, parser, compiler and runtime errors go. Without a sink
+// each one is printed as "Error: ..." when it happens; an embedder's
+// sink keeps the first one for it to read back instead.
+typedef struct {
+    bool failed;
+    char message[ERROR_MESSAGE_MAX];
+} ErrorSink;
+
+void reportError(ErrorSink *sink, const char *message);
+
+#endif
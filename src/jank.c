@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jank.h"
+#include "json.h"
+#include "rope.h"
+#include "vm.h"
+
+// An isolate is a REPL session that keeps its errors and output to
+// itself. The whole struct is the only state it has.
+struct JankIsolate {
+    JankyVm    vm;
+    ErrorSink  errors;
+
+    // compiled by jankCompile() and not run yet
+    Bytecode  *script;
+
+    // the JSON text of the last object read back
+    TextBuffer text;
+};
+
+JankStatus jankCreateIsolate(JankIsolate **out) {
+    JankIsolate *isolate = calloc(1, sizeof(JankIsolate));
+    if (!isolate) return JANK_NO_MEMORY;
+
+    defaultSettings(&isolate->vm.settings);
+    isolate->vm.errors = &isolate->errors;
+    isolate->vm.keep_output = true;
+    startSession(&isolate->vm);
+
+    *out = isolate;
+    return JANK_OK;
+}
+
+void jankDestroyIsolate(JankIsolate *isolate) {
+    if (!isolate) return;
+
+    if (isolate->script) freeBytecode(isolate->script);
+    endSession(&isolate->vm);
+    free(isolate->text.chars);
+    free(isolate);
+}
+
+static JankStatus status(VmResult result) {
+    switch (result) {
+        case VM_OK:            return JANK_OK;
+        case VM_COMPILE_ERROR: return JANK_COMPILE_ERROR;
+        default:               return JANK_RUNTIME_ERROR;
+    }
+}
+
+JankStatus jankCompile(JankIsolate *isolate, const char *source) {
+    isolate->errors.failed = false;
+
+    if (isolate->script) {
+        freeBytecode(isolate->script);
+        isolate->script = NULL;
+    }
+
+    // the lexer works on a copy of the source
+    return status(compileLine(&isolate->vm, (char *)source, 0, &isolate->script));
+}
+
+JankStatus jankRun(JankIsolate *isolate) {
+    isolate->errors.failed = false;
+    if (!isolate->script) return JANK_NO_SCRIPT;
+
+    Bytecode *script = isolate->script;
+    isolate->script = NULL;
+    isolate->vm.output.length = 0;
+
+    return status(runChunk(&isolate->vm, script));
+}
+
+JankStatus jankCompileProgram(JankIsolate *isolate, const char *source, JankProgram **program) {
+    isolate->errors.failed = false;
+
+    return status(compileProgram(&isolate->vm, (char *)source, program));
+}
+
+JankStatus jankRunProgram(JankIsolate *isolate, JankProgram *program) {
+    isolate->errors.failed = false;
+    isolate->vm.output.length = 0;
+
+    return status(runProgram(&isolate->vm, program));
+}
+
+void jankFreeProgram(JankProgram *program) {
+    if (program) freeProgram(program);
+}
+
+JankStatus jankGetGlobal(JankIsolate *isolate, const char *name, JankValue *value) {
+    isolate->errors.failed = false;
+
+    Value global;
+    if (!getSymbol(&isolate->vm.globals, (char *)name, &global)) return JANK_NOT_FOUND;
+
+    Heap *heap = &isolate->vm.heap;
+    memset(value, 0, sizeof(JankValue));
+
+    switch (global.type) {
+        case TYPE_BOOL:
+            value->type = JANK_BOOL;
+            value->boolean = global.as.boolean;
+            break;
+        case TYPE_NUMBER:
+            value->type = JANK_NUMBER;
+            value->number = global.as.number;
+            break;
+        case TYPE_STRING: {
+            ObjString *string = asFlatString(heap, global.as.object);
+            value->type = JANK_STRING;
+            value->chars = string->chars;
+            value->length = string->length;
+            break;
+        }
+        case TYPE_FUNCTION:
+            value->type = JANK_FUNCTION;
+            break;
+        case TYPE_OBJECT:
+        case TYPE_ARRAY:
+        case TYPE_MAP: {
+            isolate->text.length = 0;
+            const char *error = stringifyJson(heap, global, &isolate->text);
+            if (error) {
+                reportError(&isolate->errors, error);
+                return JANK_RUNTIME_ERROR;
+            }
+
+            value->type = global.type == TYPE_ARRAY ? JANK_ARRAY : JANK_OBJECT;
+            value->chars = isolate->text.chars;
+            value->length = isolate->text.length;
+            break;
+        }
+        default:
+            value->type = JANK_UNDEFINED;
+            break;
+    }
+
+    return JANK_OK;
+}
+
+JankStatus jankSetGlobal(JankIsolate *isolate, const char *name, const JankValue *value) {
+    isolate->errors.failed = false;
+
+    Value global;
+    switch (value->type) {
+        case JANK_UNDEFINED:
+            global.type = TYPE_UNDEFINED;
+            break;
+        case JANK_BOOL:
+            global.type = TYPE_BOOL;
+            global.as.boolean = value->boolean;
+            break;
+        case JANK_NUMBER:
+            global.type = TYPE_NUMBER;
+            global.as.number = value->number;
+            break;
+        case JANK_STRING:
+            // old, so the globals need no write barrier for it
+            global.type = TYPE_STRING;
+            global.as.object = newStringObject(&isolate->vm.heap, value->chars, value->length);
+            break;
+        default:
+            return JANK_BAD_VALUE;
+    }
+
+    setSymbol(&isolate->vm.globals, (char *)name, global);
+
+    return JANK_OK;
+}
+
+const char *jankError(JankIsolate *isolate) {
+    return isolate->errors.failed ? isolate->errors.message : NULL;
+}
+
+const char *jankOutput(JankIsolate *isolate, int *length) {
+    TextBuffer *output = &isolate->vm.output;
+    reserveText(output, 0)[0] = '\0';
+
+    *length = output->length;
+    return output->chars;
+}
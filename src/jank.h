@@ -0,0 +1,81 @@
+#ifndef jank_h
+#define jank_h
+
+#include <stdbool.h>
+
+// The embedding API, built as build/libjank.a and build/libjank.so. An
+// isolate is a VM with its own heap, globals and collector thread, and
+// shares nothing with any other, so isolates can run on different
+// threads at once. A single isolate must only be used by one thread at
+// a time. Nothing is printed: errors come back as a status, with the
+// message from jankError(), and printed results collect in jankOutput().
+//
+// Scripts compiled into an isolate share its globals, as the lines of a
+// REPL session do.
+
+typedef struct JankIsolate JankIsolate;
+
+// A script compiled once and frozen. It is read-only from then on, so
+// any number of isolates on any threads can run it at once; it must
+// outlive every isolate that ran it.
+typedef struct Program JankProgram;
+
+typedef enum {
+    JANK_OK,
+    JANK_COMPILE_ERROR,
+    JANK_RUNTIME_ERROR,
+    JANK_NO_MEMORY,
+    // jankRun() with nothing compiled
+    JANK_NO_SCRIPT,
+    // jankGetGlobal() of a name no script has defined
+    JANK_NOT_FOUND,
+    // jankSetGlobal() of a function, object or array
+    JANK_BAD_VALUE,
+} JankStatus;
+
+typedef enum {
+    JANK_UNDEFINED,
+    JANK_BOOL,
+    JANK_NUMBER,
+    JANK_STRING,
+    JANK_FUNCTION,
+    JANK_OBJECT,
+    JANK_ARRAY,
+} JankType;
+
+// A global read back from an isolate. Strings hold their characters,
+// and objects and arrays their JSON text; either stays valid until the
+// isolate next compiles, runs or reads a value.
+typedef struct {
+    JankType    type;
+    bool        boolean;
+    double      number;
+    const char *chars;
+    int         length;
+} JankValue;
+
+JankStatus  jankCreateIsolate(JankIsolate **isolate);
+void        jankDestroyIsolate(JankIsolate *isolate);
+
+// Compiles 'source' for the next jankRun(), replacing a script that was
+// compiled but never run.
+JankStatus  jankCompile(JankIsolate *isolate, const char *source);
+JankStatus  jankRun(JankIsolate *isolate);
+
+JankStatus  jankCompileProgram(JankIsolate *isolate, const char *source, JankProgram **program);
+JankStatus  jankRunProgram(JankIsolate *isolate, JankProgram *program);
+void        jankFreeProgram(JankProgram *program);
+
+JankStatus  jankGetGlobal(JankIsolate *isolate, const char *name, JankValue *value);
+
+// Defines a global the next script can read, such as its input. Only
+// undefined, booleans, numbers and strings can be set.
+JankStatus  jankSetGlobal(JankIsolate *isolate, const char *name, const JankValue *value);
+
+// The message of the error behind the last failed call, or NULL.
+const char *jankError(JankIsolate *isolate);
+
+// Everything printed since the last jankRun() started.
+const char *jankOutput(JankIsolate *isolate, int *length);
+
+#endif
@@ -0,0 +1,566 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "json.h"
+#include "number.h"
+#include "rope.h"
+#include "shape.h"
+
+#define JSON_BLOCK 64
+
+// One bit per byte of a 64-byte block for each class stage one cares
+// about. Structural characters are the six JSON punctuators.
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+    uint64_t space;
+} BlockMasks;
+
+static void classifyBlock(const char *block, BlockMasks *masks) {
+#ifdef __SSE2__
+    uint64_t quote = 0, backslash = 0, op = 0, space = 0;
+
+    for (int i = 0; i < JSON_BLOCK; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(block + i));
+
+        // '[' and ']' are '{' and '}' with the 0x20 bit clear
+        __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+        __m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}')));
+        __m128i separators = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(':')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8(',')));
+        __m128i blanks = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))),
+                                      _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'))));
+
+        quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'))) << i;
+        backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))) << i;
+        op |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(brackets, separators)) << i;
+        space |= (uint64_t)(uint16_t)_mm_movemask_epi8(blanks) << i;
+    }
+
+    masks->quote = quote;
+    masks->backslash = backslash;
+    masks->op = op;
+    masks->space = space;
+#else
+    memset(masks, 0, sizeof(BlockMasks));
+
+    for (int i = 0; i < JSON_BLOCK; i++) {
+        uint64_t bit = 1ull << i;
+
+        switch (block[i]) {
+            case '"':  masks->quote |= bit; break;
+            case '\\': masks->backslash |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',': masks->op |= bit; break;
+            case ' ': case '\t': case '\n': case '\r': masks->space |= bit; break;
+            default: break;
+        }
+    }
+#endif
+}
+
+// The bytes escaped by a backslash. A run of backslashes escapes every
+// other byte, so they are walked one escape at a time; most blocks have
+// none. 'carry' is set when the block ends on an unescaped backslash.
+static uint64_t findEscaped(uint64_t backslash, bool *carry) {
+    uint64_t escaped = 0;
+    if (*carry) {
+        escaped = 1;
+        backslash &= ~1ull;
+    }
+    *carry = false;
+
+    while (backslash) {
+        int i = __builtin_ctzll(backslash);
+        if (i == 63) {
+            *carry = true;
+            break;
+        }
+
+        escaped |= 1ull << (i + 1);
+        backslash &= i + 2 < 64 ? ~0ull << (i + 2) : 0;
+    }
+
+    return escaped;
+}
+
+// Bit i becomes the XOR of bits 0 to i, turning quotes into the spans
+// between them.
+static uint64_t prefixXor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+
+    return bits;
+}
+
+// Fails only on a string left open; everything else is left to stage two.
+bool buildJsonIndex(const char *text, int length, JsonIndex *index) {
+    index->positions = malloc(sizeof(uint32_t) * ((size_t)length + 1));
+    int count = 0;
+
+    uint64_t inStringCarry = 0;
+    uint64_t scalarCarry = 0;
+    bool escapeCarry = false;
+    char padded[JSON_BLOCK];
+
+    for (int base = 0; base < length; base += JSON_BLOCK) {
+        const char *block = text + base;
+        if (length - base < JSON_BLOCK) {
+            memset(padded, ' ', JSON_BLOCK);
+            memcpy(padded, block, length - base);
+            block = padded;
+        }
+
+        BlockMasks masks;
+        classifyBlock(block, &masks);
+
+        uint64_t escaped = masks.backslash || escapeCarry ? findEscaped(masks.backslash, &escapeCarry) : 0;
+        uint64_t quote = masks.quote & ~escaped;
+
+        // set from each opening quote up to its closing one
+        uint64_t inString = prefixXor(quote) ^ inStringCarry;
+        inStringCarry = (uint64_t)((int64_t)inString >> 63);
+
+        // numbers and literals start where a run of other bytes does
+        uint64_t scalar = ~(masks.op | masks.space | quote | inString);
+        uint64_t scalarStart = scalar & ~((scalar << 1) | scalarCarry);
+        scalarCarry = scalar >> 63;
+
+        uint64_t structural = (masks.op & ~inString) | (quote & inString) | scalarStart;
+        while (structural) {
+            index->positions[count++] = base + __builtin_ctzll(structural);
+            structural &= structural - 1;
+        }
+    }
+
+    index->positions[count] = length;
+    index->count = count;
+
+    return inStringCarry == 0;
+}
+
+void freeJsonIndex(JsonIndex *index) {
+    free(index->positions);
+    index->positions = NULL;
+    index->count = 0;
+}
+
+// The number of leading bytes that can go in a JSON string as they are:
+// anything but a quote, a backslash or a control character.
+static int plainRun(const char *chars, int length) {
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(chars + i));
+        __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(chunk, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+
+        int mask = _mm_movemask_epi8(_mm_or_si128(control, special));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; i < length; i++) {
+        unsigned char c = chars[i];
+        if (c == '"' || c == '\\' || c < 0x20) break;
+    }
+
+    return i;
+}
+
+// 'start' is the opening quote. Escapes are only skipped here, and
+// checked when the string is unescaped.
+int scanJsonString(const char *text, int length, int start, bool *escaped) {
+    *escaped = false;
+
+    for (int i = start + 1; i < length;) {
+        i += plainRun(text + i, length - i);
+        if (i >= length) break;
+
+        if (text[i] == '"') return i + 1;
+        if (text[i] != '\\') return -1;
+
+        *escaped = true;
+        i += 2;
+    }
+
+    return -1;
+}
+
+static int hexValue(const char *chars) {
+    int value = 0;
+
+    for (int i = 0; i < 4; i++) {
+        char c = chars[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' :
+                    c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) return -1;
+
+        value = value * 16 + digit;
+    }
+
+    return value;
+}
+
+static int encodeUtf8(int codepoint, char *out) {
+    if (codepoint < 0x80) {
+        out[0] = codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = 0xc0 | (codepoint >> 6);
+        out[1] = 0x80 | (codepoint & 0x3f);
+        return 2;
+    }
+    if (codepoint < 0x10000) {
+        out[0] = 0xe0 | (codepoint >> 12);
+        out[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        out[2] = 0x80 | (codepoint & 0x3f);
+        return 3;
+    }
+
+    out[0] = 0xf0 | (codepoint >> 18);
+    out[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+    out[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+    out[3] = 0x80 | (codepoint & 0x3f);
+    return 4;
+}
+
+// Writes the body of a string with its escapes replaced; 'out' needs no
+// more room than the escaped form. Strings are UTF-8, so a surrogate
+// without its other half becomes U+FFFD.
+int unescapeJson(const char *chars, int length, char *out) {
+    int written = 0;
+
+    for (int i = 0; i < length;) {
+        int run = i;
+        while (run < length && chars[run] != '\\') run++;
+
+        memcpy(out + written, chars + i, run - i);
+        written += run - i;
+        i = run;
+        if (i >= length) break;
+
+        if (i + 1 >= length) return -1;
+        char c = chars[i + 1];
+        i += 2;
+
+        switch (c) {
+            case '"':  out[written++] = '"'; break;
+            case '\\': out[written++] = '\\'; break;
+            case '/':  out[written++] = '/'; break;
+            case 'b':  out[written++] = '\b'; break;
+            case 'f':  out[written++] = '\f'; break;
+            case 'n':  out[written++] = '\n'; break;
+            case 'r':  out[written++] = '\r'; break;
+            case 't':  out[written++] = '\t'; break;
+            case 'u': {
+                int codepoint = i + 4 <= length ? hexValue(chars + i) : -1;
+                if (codepoint < 0) return -1;
+                i += 4;
+
+                if (codepoint >= 0xd800 && codepoint <= 0xdbff) {
+                    int low = i + 6 <= length && chars[i] == '\\' && chars[i + 1] == 'u' ? hexValue(chars + i + 2) : -1;
+                    if (low >= 0xdc00 && low <= 0xdfff) {
+                        codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+                        i += 6;
+                    } else {
+                        codepoint = 0xfffd;
+                    }
+                } else if (codepoint >= 0xdc00 && codepoint <= 0xdfff) {
+                    codepoint = 0xfffd;
+                }
+
+                written += encodeUtf8(codepoint, out + written);
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+
+    return written;
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Checks the JSON number grammar while gathering up to 19 significant
+// digits for decimalToDouble(), whose rare fallback to strtod() needs
+// 'text' NUL-terminated.
+int parseJsonNumber(const char *text, int length, int start, double *number) {
+    int i = start;
+    bool negative = i < length && text[i] == '-';
+    if (negative) i++;
+
+    if (i >= length || !isDigit(text[i])) return -1;
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool truncated = false;
+
+    if (text[i] == '0') {
+        i++;
+    } else {
+        for (; i < length && isDigit(text[i]); i++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (text[i] - '0');
+                digits++;
+            } else {
+                exponent++;
+                truncated |= text[i] != '0';
+            }
+        }
+    }
+
+    if (i < length && text[i] == '.') {
+        i++;
+        if (i >= length || !isDigit(text[i])) return -1;
+
+        for (; i < length && isDigit(text[i]); i++) {
+            if (mantissa == 0 && text[i] == '0') {
+                exponent--;
+            } else if (digits < 19) {
+                mantissa = mantissa * 10 + (text[i] - '0');
+                digits++;
+                exponent--;
+            } else {
+                truncated |= text[i] != '0';
+            }
+        }
+    }
+
+    if (i < length && (text[i] == 'e' || text[i] == 'E')) {
+        i++;
+        bool negativeExponent = i < length && text[i] == '-';
+        if (i < length && (text[i] == '-' || text[i] == '+')) i++;
+        if (i >= length || !isDigit(text[i])) return -1;
+
+        int value = 0;
+        for (; i < length && isDigit(text[i]); i++) {
+            if (value < 100000) value = value * 10 + (text[i] - '0');
+        }
+        exponent += negativeExponent ? -value : value;
+    }
+
+    *number = decimalToDouble(mantissa, exponent, truncated, negative, text + start);
+    return i;
+}
+
+static void appendInteger(TextBuffer *out, int64_t value) {
+    char digits[24];
+    int length = 0;
+
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    do {
+        digits[sizeof(digits) - 1 - length++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0) digits[sizeof(digits) - 1 - length++] = '-';
+
+    appendText(out, digits + sizeof(digits) - length, length);
+}
+
+// Numbers are written as JS writes them, except that JSON has no word
+// for NaN or the infinities.
+void appendJsonNumber(TextBuffer *out, double number) {
+    if (!isfinite(number)) {
+        appendText(out, "null", 4);
+        return;
+    }
+
+    out->length += formatNumber(number, reserveText(out, NUMBER_BUFFER_SIZE));
+}
+
+static void appendJsonString(TextBuffer *out, const char *chars, int length) {
+    appendChar(out, '"');
+
+    for (int i = 0; i < length;) {
+        int run = plainRun(chars + i, length - i);
+        appendText(out, chars + i, run);
+        i += run;
+        if (i >= length) break;
+
+        char c = chars[i++];
+        switch (c) {
+            case '"':  appendText(out, "\\\"", 2); break;
+            case '\\': appendText(out, "\\\\", 2); break;
+            case '\b': appendText(out, "\\b", 2); break;
+            case '\f': appendText(out, "\\f", 2); break;
+            case '\n': appendText(out, "\\n", 2); break;
+            case '\r': appendText(out, "\\r", 2); break;
+            case '\t': appendText(out, "\\t", 2); break;
+            default: {
+                char escape[8];
+                int written = snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+                appendText(out, escape, written);
+                break;
+            }
+        }
+    }
+
+    appendChar(out, '"');
+}
+
+// The objects being written, to catch cycles, and a stack of the keys of
+// each, gathered from its shape in slot order.
+typedef struct {
+    Heap       *heap;
+    TextBuffer *out;
+
+    Object     *path[JSON_DEPTH_MAX];
+    int         depth;
+
+    Shape     **keys;
+    int         key_count;
+    int         key_capacity;
+} Stringifier;
+
+static bool isOmitted(Value value) {
+    return value.type == TYPE_UNDEFINED || value.type == TYPE_FUNCTION;
+}
+
+static const char *writeValue(Stringifier *writer, Value value);
+
+static const char *enterObject(Stringifier *writer, Object *object) {
+    if (writer->depth >= JSON_DEPTH_MAX) return "Maximum nesting depth exceeded.";
+
+    for (int i = 0; i < writer->depth; i++) {
+        if (writer->path[i] == object) return "Converting circular structure to JSON.";
+    }
+
+    writer->path[writer->depth++] = object;
+    return NULL;
+}
+
+static const char *writeObject(Stringifier *writer, Object *object) {
+    const char *error = enterObject(writer, object);
+    if (error) return error;
+
+    ObjInstance *instance = &object->as.instance;
+    int count = instance->shape->count;
+
+    int base = writer->key_count;
+    if (base + count > writer->key_capacity) {
+        while (base + count > writer->key_capacity) {
+            writer->key_capacity = writer->key_capacity == 0 ? 64 : writer->key_capacity * 2;
+        }
+        writer->keys = realloc(writer->keys, sizeof(Shape *) * writer->key_capacity);
+    }
+    for (Shape *shape = instance->shape; shape->key; shape = shape->parent) {
+        writer->keys[base + shape->count - 1] = shape;
+    }
+    writer->key_count += count;
+
+    appendChar(writer->out, '{');
+    bool first = true;
+    for (int i = 0; i < count && !error; i++) {
+        Value field = *instanceSlot(instance, i);
+        if (isOmitted(field)) continue;
+
+        if (!first) appendChar(writer->out, ',');
+        first = false;
+
+        char *key = writer->keys[base + i]->key;
+        appendJsonString(writer->out, key, strlen(key));
+        appendChar(writer->out, ':');
+        error = writeValue(writer, field);
+    }
+    appendChar(writer->out, '}');
+
+    writer->key_count = base;
+    writer->depth--;
+
+    return error;
+}
+
+static const char *writeArray(Stringifier *writer, Object *object) {
+    const char *error = enterObject(writer, object);
+    if (error) return error;
+
+    ObjArray *array = &object->as.array;
+
+    appendChar(writer->out, '[');
+    for (int i = 0; i < array->count && !error; i++) {
+        if (i > 0) appendChar(writer->out, ',');
+
+        switch (array->kind) {
+            case ELEMENTS_INT:
+                appendInteger(writer->out, array->elements.ints[i]);
+                break;
+            case ELEMENTS_DOUBLE:
+                appendJsonNumber(writer->out, array->elements.doubles[i]);
+                break;
+            case ELEMENTS_GENERIC: {
+                Value element = array->elements.values[i];
+                if (isOmitted(element)) {
+                    appendText(writer->out, "null", 4);
+                } else {
+                    error = writeValue(writer, element);
+                }
+                break;
+            }
+        }
+    }
+    appendChar(writer->out, ']');
+
+    writer->depth--;
+
+    return error;
+}
+
+static const char *writeValue(Stringifier *writer, Value value) {
+    switch (value.type) {
+        case TYPE_NUMBER:
+            appendJsonNumber(writer->out, value.as.number);
+            return NULL;
+        case TYPE_BOOL:
+            if (value.as.boolean) appendText(writer->out, "true", 4);
+            else appendText(writer->out, "false", 5);
+            return NULL;
+        case TYPE_STRING: {
+            ObjString *string = asFlatString(writer->heap, value.as.object);
+            appendJsonString(writer->out, string->chars, string->length);
+            return NULL;
+        }
+        case TYPE_OBJECT:
+            return writeObject(writer, value.as.object);
+        case TYPE_ARRAY:
+            return writeArray(writer, value.as.object);
+        case TYPE_MAP:
+            appendText(writer->out, "{}", 2);
+            return NULL;
+        default:
+            appendText(writer->out, "null", 4);
+            return NULL;
+    }
+}
+
+const char *stringifyJson(Heap *heap, Value value, TextBuffer *out) {
+    Stringifier writer;
+    writer.heap = heap;
+    writer.out = out;
+    writer.depth = 0;
+    writer.keys = NULL;
+    writer.key_count = 0;
+    writer.key_capacity = 0;
+
+    const char *error = writeValue(&writer, value);
+    free(writer.keys);
+
+    return error;
+}
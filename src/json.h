@@ -0,0 +1,46 @@
+#ifndef json_h
+#define json_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "memory.h"
+#include "value.h"
+
+// Objects and arrays nested deeper than this are rejected either way.
+#define JSON_DEPTH_MAX 512
+
+// Stage one of parsing: the offset of every token, found 64 bytes at a
+// time. Structural characters, the opening quote of each string and the
+// first byte of each number or literal are listed in order, followed by
+// 'length' as a sentinel. Quotes and structural characters inside
+// strings are masked out using the escapes and a prefix XOR of the
+// quotes, so stage two never looks at a byte that is not a token.
+typedef struct {
+    uint32_t *positions;
+    int       count;
+} JsonIndex;
+
+bool buildJsonIndex(const char *text, int length, JsonIndex *index);
+void freeJsonIndex(JsonIndex *index);
+
+// The pieces stage two builds values from. Each returns the offset just
+// past what it read, or -1 if the text there is not valid JSON.
+int  scanJsonString(const char *text, int length, int start, bool *escaped);
+int  unescapeJson(const char *chars, int length, char *out);
+int  parseJsonNumber(const char *text, int length, int start, double *number);
+
+static inline bool isJsonDelimiter(char c) {
+    return c == '\0' || c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+           c == ',' || c == ':' || c == ']' || c == '}' || c == '"' || c == '[' || c == '{';
+}
+
+// Appends 'value' as JSON, or returns the error that stopped it. Values
+// JSON has no room for (undefined and functions) are left out of
+// objects and written as null in arrays; the caller handles them at the
+// top. Maps and Sets have no enumerable properties, so they are {}.
+const char *stringifyJson(Heap *heap, Value value, TextBuffer *out);
+void        appendJsonNumber(TextBuffer *out, double number);
+
+#endif
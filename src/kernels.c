@@ -0,0 +1,372 @@
+#include <math.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+// The scalar variants must stay scalar, or there is nothing to compare
+// the vector ones against.
+#define SCALAR __attribute__((optimize("no-tree-vectorize")))
+
+static SCALAR double scalarSum(const double *x, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) sum += x[i];
+    return sum;
+}
+
+static SCALAR double scalarMin(const double *x, size_t n) {
+    double min = INFINITY;
+    for (size_t i = 0; i < n; i++) min = x[i] < min ? x[i] : min;
+    return min;
+}
+
+static SCALAR double scalarMax(const double *x, size_t n) {
+    double max = -INFINITY;
+    for (size_t i = 0; i < n; i++) max = x[i] > max ? x[i] : max;
+    return max;
+}
+
+static SCALAR double scalarDot(const double *x, const double *y, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) sum += x[i] * y[i];
+    return sum;
+}
+
+static SCALAR void scalarAdd(double *out, const double *x, const double *y, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = x[i] + y[i];
+}
+
+static SCALAR void scalarMul(double *out, const double *x, const double *y, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = x[i] * y[i];
+}
+
+static SCALAR void scalarAffine(double *out, const double *x, size_t n, double scale, double offset) {
+    for (size_t i = 0; i < n; i++) out[i] = x[i] * scale + offset;
+}
+
+static SCALAR int64_t scalarSumI32(const int32_t *x, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += x[i];
+    return sum;
+}
+
+static SCALAR int32_t scalarMinI32(const int32_t *x, size_t n) {
+    int32_t min = INT32_MAX;
+    for (size_t i = 0; i < n; i++) min = x[i] < min ? x[i] : min;
+    return min;
+}
+
+static SCALAR int32_t scalarMaxI32(const int32_t *x, size_t n) {
+    int32_t max = INT32_MIN;
+    for (size_t i = 0; i < n; i++) max = x[i] > max ? x[i] : max;
+    return max;
+}
+
+static const Kernels scalarKernels = {
+    "scalar",
+    scalarSum, scalarMin, scalarMax, scalarDot, scalarAdd, scalarMul, scalarAffine,
+    scalarSumI32, scalarMinI32, scalarMaxI32,
+};
+
+#ifdef HAVE_X86
+
+// SSE2 is part of x86-64, so these need no check. Two accumulators per
+// reduction keep the adds from waiting on each other.
+
+static double sse2Sum(const double *x, size_t n) {
+    __m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a = _mm_add_pd(a, _mm_loadu_pd(x + i));
+        b = _mm_add_pd(b, _mm_loadu_pd(x + i + 2));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(a, b));
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) sum += x[i];
+    return sum;
+}
+
+static double sse2Min(const double *x, size_t n) {
+    __m128d m = _mm_set1_pd(INFINITY);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) m = _mm_min_pd(_mm_loadu_pd(x + i), m);
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    double min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    for (; i < n; i++) min = x[i] < min ? x[i] : min;
+    return min;
+}
+
+static double sse2Max(const double *x, size_t n) {
+    __m128d m = _mm_set1_pd(-INFINITY);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) m = _mm_max_pd(_mm_loadu_pd(x + i), m);
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    double max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    for (; i < n; i++) max = x[i] > max ? x[i] : max;
+    return max;
+}
+
+static double sse2Dot(const double *x, const double *y, size_t n) {
+    __m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a = _mm_add_pd(a, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+        b = _mm_add_pd(b, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(a, b));
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) sum += x[i] * y[i];
+    return sum;
+}
+
+static void sse2Add(double *out, const double *x, const double *y, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    for (; i < n; i++) out[i] = x[i] + y[i];
+}
+
+static void sse2Mul(double *out, const double *x, const double *y, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    for (; i < n; i++) out[i] = x[i] * y[i];
+}
+
+static void sse2Affine(double *out, const double *x, size_t n, double scale, double offset) {
+    __m128d s = _mm_set1_pd(scale), o = _mm_set1_pd(offset);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(x + i), s), o));
+    for (; i < n; i++) out[i] = x[i] * scale + offset;
+}
+
+static int64_t sse2SumI32(const int32_t *x, size_t n) {
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(v, sign));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(v, sign));
+    }
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    int64_t total = lanes[0] + lanes[1];
+    for (; i < n; i++) total += x[i];
+    return total;
+}
+
+// SSE2 has no 32-bit min or max, so they are a compare and a select.
+static int32_t sse2MinI32(const int32_t *x, size_t n) {
+    __m128i m = _mm_set1_epi32(INT32_MAX);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i less = _mm_cmplt_epi32(v, m);
+        m = _mm_or_si128(_mm_and_si128(less, v), _mm_andnot_si128(less, m));
+    }
+
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, m);
+    int32_t min = INT32_MAX;
+    for (int j = 0; j < 4; j++) min = lanes[j] < min ? lanes[j] : min;
+    for (; i < n; i++) min = x[i] < min ? x[i] : min;
+    return min;
+}
+
+static int32_t sse2MaxI32(const int32_t *x, size_t n) {
+    __m128i m = _mm_set1_epi32(INT32_MIN);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i greater = _mm_cmpgt_epi32(v, m);
+        m = _mm_or_si128(_mm_and_si128(greater, v), _mm_andnot_si128(greater, m));
+    }
+
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, m);
+    int32_t max = INT32_MIN;
+    for (int j = 0; j < 4; j++) max = lanes[j] > max ? lanes[j] : max;
+    for (; i < n; i++) max = x[i] > max ? x[i] : max;
+    return max;
+}
+
+static const Kernels sse2Kernels = {
+    "sse2",
+    sse2Sum, sse2Min, sse2Max, sse2Dot, sse2Add, sse2Mul, sse2Affine,
+    sse2SumI32, sse2MinI32, sse2MaxI32,
+};
+
+// AVX2 is only used when the CPU reports it. Four accumulators of four
+// lanes each cover the latency of the adds.
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 double avx2Horizontal(__m256d v) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+static AVX2 double avx2Sum(const double *x, size_t n) {
+    __m256d a = _mm256_setzero_pd(), b = a, c = a, d = a;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        a = _mm256_add_pd(a, _mm256_loadu_pd(x + i));
+        b = _mm256_add_pd(b, _mm256_loadu_pd(x + i + 4));
+        c = _mm256_add_pd(c, _mm256_loadu_pd(x + i + 8));
+        d = _mm256_add_pd(d, _mm256_loadu_pd(x + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) a = _mm256_add_pd(a, _mm256_loadu_pd(x + i));
+
+    double sum = avx2Horizontal(_mm256_add_pd(_mm256_add_pd(a, b), _mm256_add_pd(c, d)));
+    for (; i < n; i++) sum += x[i];
+    return sum;
+}
+
+static AVX2 double avx2Min(const double *x, size_t n) {
+    __m256d a = _mm256_set1_pd(INFINITY), b = a;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = _mm256_min_pd(_mm256_loadu_pd(x + i), a);
+        b = _mm256_min_pd(_mm256_loadu_pd(x + i + 4), b);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_min_pd(a, b));
+    double min = INFINITY;
+    for (int j = 0; j < 4; j++) min = lanes[j] < min ? lanes[j] : min;
+    for (; i < n; i++) min = x[i] < min ? x[i] : min;
+    return min;
+}
+
+static AVX2 double avx2Max(const double *x, size_t n) {
+    __m256d a = _mm256_set1_pd(-INFINITY), b = a;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = _mm256_max_pd(_mm256_loadu_pd(x + i), a);
+        b = _mm256_max_pd(_mm256_loadu_pd(x + i + 4), b);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_max_pd(a, b));
+    double max = -INFINITY;
+    for (int j = 0; j < 4; j++) max = lanes[j] > max ? lanes[j] : max;
+    for (; i < n; i++) max = x[i] > max ? x[i] : max;
+    return max;
+}
+
+static AVX2 double avx2Dot(const double *x, const double *y, size_t n) {
+    __m256d a = _mm256_setzero_pd(), b = a, c = a, d = a;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        a = _mm256_add_pd(a, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+        b = _mm256_add_pd(b, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(x + i + 8), _mm256_loadu_pd(y + i + 8)));
+        d = _mm256_add_pd(d, _mm256_mul_pd(_mm256_loadu_pd(x + i + 12), _mm256_loadu_pd(y + i + 12)));
+    }
+    for (; i + 4 <= n; i += 4) a = _mm256_add_pd(a, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+
+    double sum = avx2Horizontal(_mm256_add_pd(_mm256_add_pd(a, b), _mm256_add_pd(c, d)));
+    for (; i < n; i++) sum += x[i] * y[i];
+    return sum;
+}
+
+static AVX2 void avx2Add(double *out, const double *x, const double *y, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    for (; i < n; i++) out[i] = x[i] + y[i];
+}
+
+static AVX2 void avx2Mul(double *out, const double *x, const double *y, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    for (; i < n; i++) out[i] = x[i] * y[i];
+}
+
+static AVX2 void avx2Affine(double *out, const double *x, size_t n, double scale, double offset) {
+    __m256d s = _mm256_set1_pd(scale), o = _mm256_set1_pd(offset);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i), s), o));
+    for (; i < n; i++) out[i] = x[i] * scale + offset;
+}
+
+static AVX2 int64_t avx2SumI32(const int32_t *x, size_t n) {
+    __m256i a = _mm256_setzero_si256(), b = a;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = _mm256_add_epi64(a, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(x + i))));
+        b = _mm256_add_epi64(b, _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(x + i + 4))));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(a, b));
+    int64_t total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; i++) total += x[i];
+    return total;
+}
+
+static AVX2 int32_t avx2MinI32(const int32_t *x, size_t n) {
+    __m256i m = _mm256_set1_epi32(INT32_MAX);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) m = _mm256_min_epi32(m, _mm256_loadu_si256((const __m256i *)(x + i)));
+
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, m);
+    int32_t min = INT32_MAX;
+    for (int j = 0; j < 8; j++) min = lanes[j] < min ? lanes[j] : min;
+    for (; i < n; i++) min = x[i] < min ? x[i] : min;
+    return min;
+}
+
+static AVX2 int32_t avx2MaxI32(const int32_t *x, size_t n) {
+    __m256i m = _mm256_set1_epi32(INT32_MIN);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) m = _mm256_max_epi32(m, _mm256_loadu_si256((const __m256i *)(x + i)));
+
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, m);
+    int32_t max = INT32_MIN;
+    for (int j = 0; j < 8; j++) max = lanes[j] > max ? lanes[j] : max;
+    for (; i < n; i++) max = x[i] > max ? x[i] : max;
+    return max;
+}
+
+static const Kernels avx2Kernels = {
+    "avx2",
+    avx2Sum, avx2Min, avx2Max, avx2Dot, avx2Add, avx2Mul, avx2Affine,
+    avx2SumI32, avx2MinI32, avx2MaxI32,
+};
+
+#endif
+
+// The widest variant this CPU runs.
+const Kernels *bestKernels() {
+#ifdef HAVE_X86
+    if (__builtin_cpu_supports("avx2")) return &avx2Kernels;
+    return &sse2Kernels;
+#else
+    return &scalarKernels;
+#endif
+}
+
+// A variant by name, or NULL if it is unknown or this CPU lacks it.
+const Kernels *findKernels(const char *name) {
+    if (strcmp(name, "scalar") == 0) return &scalarKernels;
+#ifdef HAVE_X86
+    if (strcmp(name, "sse2") == 0) return &sse2Kernels;
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) return &avx2Kernels;
+#endif
+
+    return NULL;
+}
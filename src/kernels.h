@@ -0,0 +1,30 @@
+#ifndef kernels_h
+#define kernels_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Loops over packed numeric elements, in one variant per instruction set.
+// Every variant gives the same answers apart from the rounding of double
+// sums, which are accumulated in several lanes at once. min and max skip
+// NaNs; with no elements they return +/-Infinity, or the int32 limits.
+typedef struct {
+    const char *name;
+
+    double  (*sum)(const double *x, size_t n);
+    double  (*min)(const double *x, size_t n);
+    double  (*max)(const double *x, size_t n);
+    double  (*dot)(const double *x, const double *y, size_t n);
+    void    (*add)(double *out, const double *x, const double *y, size_t n);
+    void    (*mul)(double *out, const double *x, const double *y, size_t n);
+    void    (*affine)(double *out, const double *x, size_t n, double scale, double offset);
+
+    int64_t (*sum_i32)(const int32_t *x, size_t n);
+    int32_t (*min_i32)(const int32_t *x, size_t n);
+    int32_t (*max_i32)(const int32_t *x, size_t n);
+} Kernels;
+
+const Kernels *bestKernels();
+const Kernels *findKernels(const char *name);
+
+#endif
@@ -3,12 +3,14 @@
 #include <stdio.h>
 
 #include "lexer.h"
+#include "utf8.h"
 
 void initLexer(Lexer *lexer, char *source) {
     lexer->source = strdup(source);
     lexer->current = lexer->source;
     lexer->start = lexer->source;
     lexer->hadError = false;
+    lexer->error = NULL;
 
     lexer->token_capacity = 1;
     lexer->token_count = 0;
@@ -32,7 +34,7 @@ static int isDigit(char c) {
 }
 
 static int isLetter(char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 }
 
 static int isEnd(Lexer *lexer) {
@@ -58,18 +60,22 @@ static Token newToken(Lexer *lexer, TokenType type) {
 
 static Token compileErrorToken(Lexer *lexer, char *message) {
     lexer->hadError = true;
+    lexer->error = message;
 
     Token token;
-    token.lexeme = message;
+    token.lexeme = strdup(message);
     token.type = BAD;
     return token;
 }
 
+// Strings are quoted with either kind of quote, and hold the other kind
+// as it is.
 static Token tokenizeString(Lexer *lexer) {
+    char quote = peek(lexer);
     advance(lexer);
 
     lexer->start = lexer->current;
-    while (!isEnd(lexer) && peek(lexer) != '\"') {
+    while (!isEnd(lexer) && peek(lexer) != quote) {
         advance(lexer);
     }
     if (isEnd(lexer)) {
@@ -77,6 +83,10 @@ static Token tokenizeString(Lexer *lexer) {
     }
 
     size_t length = lexer->current - lexer->start;
+    if (!isValidUtf8(lexer->start, length)) {
+        return compileErrorToken(lexer, "Invalid UTF-8 in string literal.");
+    }
+
     Token token;
     token.lexeme = malloc(length + 1);
     memcpy(token.lexeme, lexer->start, length);
@@ -99,6 +109,18 @@ static Token tokenizeNumber(Lexer *lexer) {
 
         advance(lexer);
     }
+
+    // an exponent, as in 1e-7, when digits follow the 'e'
+    if (peek(lexer) == 'e' || peek(lexer) == 'E') {
+        const char *after = lexer->current + 1;
+        if (*after == '+' || *after == '-') after++;
+
+        if (isDigit(*after)) {
+            while (lexer->current < after) advance(lexer);
+            while (!isEnd(lexer) && isDigit(peek(lexer))) advance(lexer);
+        }
+    }
+
     return newToken(lexer, NUMBER);
 }
 
@@ -108,27 +130,41 @@ static TokenType getIdentifierType(Lexer *lexer) {
     memcpy(lexeme, lexer->start, length);
     lexeme[length] = '\0';
     
+    TokenType type = IDENTIFIER;
+
     if (strcmp("let", lexeme) == 0) {
-        return LET;
+        type = LET;
     } else if (strcmp("true", lexeme) == 0) {
-        return TRUE;
+        type = TRUE;
     } else if (strcmp("false", lexeme) == 0) {
-        return FALSE;
+        type = FALSE;
     } else if (strcmp("typeof", lexeme) == 0) {
-        return TYPEOF;
+        type = TYPEOF;
+    } else if (strcmp("new", lexeme) == 0) {
+        type = NEW;
     } else if (strcmp("var", lexeme) == 0) {
-        return VAR;
+        type = VAR;
     } else if (strcmp("const", lexeme) == 0) {
-        return CONST;
+        type = CONST;
+    } else if (strcmp("function", lexeme) == 0) {
+        type = FUNCTION;
+    } else if (strcmp("return", lexeme) == 0) {
+        type = RETURN;
+    } else if (strcmp("if", lexeme) == 0) {
+        type = IF;
+    } else if (strcmp("else", lexeme) == 0) {
+        type = ELSE;
+    } else if (strcmp("undefined", lexeme) == 0) {
+        type = UNDEFINED;
     }
 
     free(lexeme);
 
-    return IDENTIFIER;
+    return type;
 }
 
 static Token tokenizeIdentifier(Lexer *lexer) {
-    while (!isEnd(lexer) && isLetter(peek(lexer))) {
+    while (!isEnd(lexer) && (isLetter(peek(lexer)) || isDigit(peek(lexer)))) {
         advance(lexer);
     }
 
@@ -142,7 +178,7 @@ static Token nextToken(Lexer *lexer) {
     char c = *lexer->current;
 
     if (isDigit(c)) return tokenizeNumber(lexer);
-    if (c == '\"') return tokenizeString(lexer);
+    if (c == '\"' || c == '\'') return tokenizeString(lexer);
     if (isLetter(c)) return tokenizeIdentifier(lexer);
 
     switch (c) {
@@ -262,6 +298,30 @@ static Token nextToken(Lexer *lexer) {
             advance(lexer);
             return newToken(lexer, RIGHT_PAREN);
         }
+        case '{': {
+            advance(lexer);
+            return newToken(lexer, LEFT_BRACE);
+        }
+        case '}': {
+            advance(lexer);
+            return newToken(lexer, RIGHT_BRACE);
+        }
+        case '[': {
+            advance(lexer);
+            return newToken(lexer, LEFT_BRACKET);
+        }
+        case ']': {
+            advance(lexer);
+            return newToken(lexer, RIGHT_BRACKET);
+        }
+        case ',': {
+            advance(lexer);
+            return newToken(lexer, COMMA);
+        }
+        case ':': {
+            advance(lexer);
+            return newToken(lexer, COLON);
+        }
         default: {
             advance(lexer);
             return compileErrorToken(lexer, "Unexpected character.");
@@ -289,8 +349,11 @@ void addToken(Lexer *lexer, Token token) {
         lexer->token_capacity *= 2;
         Token *newTokens = realloc(lexer->tokens, lexer->token_capacity * sizeof(Token));
         if (!newTokens) {
-            fprintf(stderr, "Memory allocation failed\n");
-            exit(EXIT_FAILURE);
+            lexer->token_capacity /= 2;
+            lexer->hadError = true;
+            lexer->error = "Out of memory.";
+            free(token.lexeme);
+            return;
         }
         lexer->tokens = newTokens;
     }
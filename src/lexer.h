@@ -13,6 +13,8 @@ typedef struct {
     int    token_capacity;
     Token *tokens;
     bool   hadError;
+    // what stopped the lexer, once 'hadError' is set
+    char  *error;
 } Lexer;
 
 void initLexer(Lexer *lexer, char *source);
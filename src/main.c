@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
+#include "batch.h"
 #include "lexer.h"
 #include "parser.h"
 #include "compiler.h"
@@ -33,18 +38,106 @@ char *readFile(char *path) {
     return buffer;
 }
 
-void repl(int debug) {
-    char line[1024];
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// One line per non-empty power-of-two bucket of the pause histogram.
+static void printPauses(Heap *heap) {
+    fprintf(stderr, "pauses    : %ld, max %.3f ms\n", heap->pause_count, heap->max_pause * 1e3);
+
+    for (int i = 0; i < PAUSE_BUCKETS; i++) {
+        if (heap->pause_histogram[i] == 0) continue;
+
+        long low = i == 0 ? 0 : 1L << (i - 1);
+        fprintf(stderr, "  %8ld us  : %ld\n", low, heap->pause_histogram[i]);
+    }
+}
+
+static void printStats(JankyVm *vm, double elapsed) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "\nSTATS:\n");
+    fprintf(stderr, "time      : %.3f ms\n", elapsed * 1e3);
+    fprintf(stderr, "startup   : %.3f ms\n", vm->startup_time * 1e3);
+    fprintf(stderr, "peak rss  : %ld KB\n", usage.ru_maxrss);
+    fprintf(stderr, "deferred  : %ld compiled on call\n", vm->deferred_count);
+    if (vm->settings.cache_path) {
+        fprintf(stderr, "cache     : %s %s\n", vm->cache_hit ? "loaded from" : "written to", vm->settings.cache_path);
+    }
+    fprintf(stderr, "gc        : %ld collections, %.3f ms paused\n", vm->heap.gc_count, vm->heap.gc_pause * 1e3);
+    fprintf(stderr, "live heap : %zu bytes after last collection\n", vm->heap.live_bytes);
+    fprintf(stderr, "minor gc  : %ld collections, p50 %.1f us, p99 %.1f us, %zu bytes promoted\n",
+            vm->heap.minor_count, vm->heap.minor_p50 * 1e6, vm->heap.minor_p99 * 1e6, vm->heap.promoted_bytes);
+    printPauses(&vm->heap);
+    if (vm->heap.old_strings > 0) {
+        double overhead = (double)(vm->heap.old_string_bytes - vm->heap.old_string_chars) / vm->heap.old_strings;
+        fprintf(stderr, "strings   : %ld old, %.1f bytes overhead each\n", vm->heap.old_strings, overhead);
+    }
+    fprintf(stderr, "allocs    : %ld (%.0f/sec)\n", vm->heap.allocations, elapsed > 0 ? vm->heap.allocations / elapsed : 0);
+    long lookups = vm->property_hits + vm->megamorphic_hits + vm->property_misses;
+    if (lookups > 0) {
+        fprintf(stderr, "props     : %ld lookups, %.2f%% inline cache hits, %.2f%% megamorphic hits (%ld sites)\n",
+                lookups, 100.0 * vm->property_hits / lookups, 100.0 * vm->megamorphic_hits / lookups, vm->megamorphic_sites);
+    }
+    if (vm->kernel_calls > 0) {
+        fprintf(stderr, "kernels   : %ld calls (%s)\n", vm->kernel_calls, vm->settings.kernels->name);
+    }
+    if (vm->parallel_calls > 0) {
+        fprintf(stderr, "parallel  : %ld calls, %ld tasks stolen\n", vm->parallel_calls, vm->parallel_steals);
+    }
+    fprintf(stderr, "calls     : %ld\n", vm->call_count);
+    fprintf(stderr, "calls/sec : %.0f\n", elapsed > 0 ? vm->call_count / elapsed : 0);
+}
+
+// Carries the open brackets and any open string of an entry through one
+// more line of it. The entry is complete once both are closed.
+static void scanLine(const char *line, int *depth, char *quote) {
+    for (const char *c = line; *c; c++) {
+        if (*quote) {
+            if (*c == *quote) *quote = 0;
+        } else if (*c == '"' || *c == '\'') {
+            *quote = *c;
+        } else if (*c == '(' || *c == '[' || *c == '{') {
+            (*depth)++;
+        } else if (*c == ')' || *c == ']' || *c == '}') {
+            (*depth)--;
+        }
+    }
+}
+
+// Every entry runs in the same session, so what one defines the next
+// can use. An entry goes on over as many lines as it has brackets or a
+// string left open, and a line can be of any length.
+void repl(VmSettings *settings, int debug) {
+    static JankyVm vm;
+    vm.settings = *settings;
+    startSession(&vm);
+
+    TextBuffer entry = { NULL, 0, 0 };
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    int depth = 0;
+    char quote = 0;
 
     for (;;) {
-        printf("janky-vm>  ");
-        if (!fgets(line, sizeof(line), stdin)) {
+        printf(entry.length == 0 ? "janky-vm>  " : "...        ");
+
+        ssize_t length = getline(&line, &lineCapacity, stdin);
+        if (length < 0) {
             printf("\n");
             break;
         }
 
-        JankyVm vm;
-        VmResult result = run(&vm, line, debug);
+        appendText(&entry, line, (int)length);
+        scanLine(line, &depth, &quote);
+        if (quote || depth > 0) continue;
+
+        VmResult result = runLine(&vm, entry.chars, debug);
 
         if (result == VM_COMPILE_ERROR) {
             printf("Compile time error.\n");
@@ -52,7 +145,196 @@ void repl(int debug) {
         else if (result == VM_RUNTIME_ERROR) {
             printf("Runtime error.\n");
         }
+
+        entry.length = 0;
+        depth = 0;
+    }
+
+    free(line);
+    free(entry.chars);
+    endSession(&vm);
+}
+
+#define LINE_BUFFER_SIZE (1 << 22)
+
+// Writes what the script printed and, if it failed, why.
+static void writeLineOutput(JankyVm *vm, VmResult result) {
+    fwrite(vm->output.chars, 1, vm->output.length, stdout);
+    vm->output.length = 0;
+
+    if (result != VM_OK) {
+        printf("Error: %s\n%s\n", vm->errors->message,
+               result == VM_COMPILE_ERROR ? "Compile time error." : "Runtime error.");
+    }
+}
+
+// --each-line: the script is compiled once, then run for every line of
+// the input with the line in the global 'line', as a string or with
+// --each-number as a number. Lines are read through one big buffer and
+// bound straight from it, and printed results collect in the VM's
+// output until there is a buffer's worth to write. The first error
+// stops the run.
+static int eachLine(VmSettings *settings, char *scriptPath, char *inputPath, bool numbers, int stats) {
+    char *source = readFile(scriptPath);
+    if (!source) return 1;
+
+    int fd = inputPath ? open(inputPath, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) {
+        fprintf(stderr, "Error opening input file\n");
+        free(source);
+        return 1;
+    }
+
+    static JankyVm vm;
+    ErrorSink errors = { false, "" };
+    vm.settings = *settings;
+    vm.keep_output = true;
+    startSession(&vm);
+
+    double start = now();
+    Program *program;
+    VmResult result = compileProgram(&vm, source, &program);
+    free(source);
+    if (result != VM_OK) {
+        printf("Compile time error.\n");
+        endSession(&vm);
+        if (fd != STDIN_FILENO) close(fd);
+        return 1;
+    }
+    vm.errors = &errors;
+
+    size_t capacity = LINE_BUFFER_SIZE;
+    char *buffer = malloc(capacity);
+    size_t begin = 0;
+    size_t end = 0;
+    long lines = 0;
+    bool done = false;
+
+    while (!done && result == VM_OK) {
+        char *newline = memchr(buffer + begin, '\n', end - begin);
+
+        char *line = buffer + begin;
+        size_t length;
+        if (newline) {
+            length = newline - line;
+            begin += length + 1;
+        } else {
+            // the partial line goes to the front, and a line longer than
+            // the buffer grows it
+            memmove(buffer, line, end - begin);
+            end -= begin;
+            begin = 0;
+            if (end == capacity) {
+                capacity *= 2;
+                buffer = realloc(buffer, capacity);
+            }
+
+            ssize_t got = read(fd, buffer + end, capacity - end);
+            if (got > 0) {
+                end += got;
+                continue;
+            }
+
+            // the last line may have no newline
+            done = true;
+            if (end == 0) break;
+            line = buffer;
+            length = end;
+        }
+
+        if (length > 0 && line[length - 1] == '\r') length--;
+        defineTextGlobal(&vm, "line", line, (int)length, numbers);
+        result = runProgram(&vm, program);
+        lines++;
+
+        if (vm.output.length >= OUTPUT_BUFFER_SIZE) writeLineOutput(&vm, VM_OK);
+    }
+    writeLineOutput(&vm, result);
+    fflush(stdout);
+
+    double elapsed = now() - start;
+    if (stats) {
+        printStats(&vm, elapsed);
+        fprintf(stderr, "lines     : %ld (%.0f/sec)\n", lines, elapsed > 0 ? lines / elapsed : 0);
     }
+
+    free(buffer);
+    if (fd != STDIN_FILENO) close(fd);
+    endSession(&vm);
+    freeProgram(program);
+
+    return result != VM_OK;
+}
+
+// Each path is a job of its own, or with an inputs file the one path is
+// a script run once for each of its lines.
+static int runJobs(VmSettings *settings, char **paths, int pathCount, char *inputsPath, int threads, int stats) {
+    if (pathCount == 0 || (inputsPath && pathCount != 1)) {
+        printf("Usage: ./jank --jobs <n> <source_path.js>... | --jobs <n> <source_path.js> --inputs <inputs.jsonl>\n");
+        return 1;
+    }
+
+    char *script = NULL;
+    char *inputs = NULL;
+    BatchJob *jobs = NULL;
+    int count = 0;
+    int status = 1;
+
+    if (inputsPath) {
+        script = readFile(paths[0]);
+        inputs = readFile(inputsPath);
+        if (!script || !inputs) goto done;
+
+        // a line of JSON per job, with blank lines left out
+        int capacity = 64;
+        jobs = malloc(sizeof(BatchJob) * capacity);
+        for (char *line = inputs; *line;) {
+            char *end = strchr(line, '\n');
+            if (!end) end = line + strlen(line);
+
+            int length = (int)(end - line);
+            if (length > 0 && line[length - 1] == '\r') length--;
+            if (length > 0) {
+                if (count == capacity) {
+                    capacity *= 2;
+                    jobs = realloc(jobs, sizeof(BatchJob) * capacity);
+                }
+                jobs[count++] = (BatchJob){ NULL, line, length };
+            }
+
+            line = *end ? end + 1 : end;
+        }
+    } else {
+        jobs = calloc(pathCount, sizeof(BatchJob));
+        for (; count < pathCount; count++) {
+            jobs[count].source = readFile(paths[count]);
+            if (!jobs[count].source) goto done;
+        }
+    }
+
+    BatchStats batch;
+    if (!runBatch(settings, script, jobs, count, threads, &batch)) {
+        printf("Compile time error.\n");
+        goto done;
+    }
+
+    if (stats) {
+        fprintf(stderr, "\nSTATS:\n");
+        fprintf(stderr, "time      : %.3f ms\n", batch.elapsed * 1e3);
+        fprintf(stderr, "jobs      : %d on %d threads, %d failed, %ld stolen\n", count, threads, batch.failures, batch.steals);
+        fprintf(stderr, "jobs/sec  : %.0f\n", batch.elapsed > 0 ? count / batch.elapsed : 0);
+    }
+    status = batch.failures > 0;
+
+done:
+    if (!inputsPath) {
+        for (int i = 0; i < count; i++) free(jobs[i].source);
+    }
+    free(jobs);
+    free(script);
+    free(inputs);
+
+    return status;
 }
 
 int main(int argc, char *argv[]) {
@@ -63,28 +345,132 @@ int main(int argc, char *argv[]) {
 
     int replMode = 0;
     int debug = 0;
+    int stats = 0;
+    int cache = 0;
+    char *cacheDir = NULL;
+    char *path = NULL;
+    int eachLineMode = 0;
+    bool numbers = false;
+    int jobs = 0;
+    char *inputsPath = NULL;
+    char **paths = malloc(sizeof(char *) * argc);
+    int pathCount = 0;
+
+    VmSettings settings;
+    defaultSettings(&settings);
 
     for (int i = 1; i < argc; i++) {
         if (strcmp("--repl", argv[i]) == 0) replMode = 1;
         else if (strcmp("--debug", argv[i]) == 0) debug = 1;
-        else {
-            if (replMode) {
-                printf("Unknown flag '%s'", argv[i]);
+        else if (strcmp("--stats", argv[i]) == 0) stats = 1;
+        else if (strcmp("--eager", argv[i]) == 0) settings.lazy_compile = false;
+        else if (strcmp("--cache", argv[i]) == 0) cache = 1;
+        else if (strcmp("--compile-only", argv[i]) == 0) settings.compile_only = true;
+        else if (strcmp("--cache-dir", argv[i]) == 0 && i + 1 < argc) {
+            cacheDir = argv[++i];
+        }
+        else if (strcmp("--each-line", argv[i]) == 0) eachLineMode = 1;
+        else if (strcmp("--each-number", argv[i]) == 0) {
+            eachLineMode = 1;
+            numbers = true;
+        }
+        else if (strcmp("--jobs", argv[i]) == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            if (jobs < 1) {
+                printf("--jobs needs at least one thread.\n");
                 return 1;
             }
         }
+        else if (strcmp("--threads", argv[i]) == 0 && i + 1 < argc) {
+            settings.threads = atoi(argv[++i]);
+            if (settings.threads < 1) {
+                printf("--threads needs at least one thread.\n");
+                return 1;
+            }
+        }
+        else if (strcmp("--inputs", argv[i]) == 0 && i + 1 < argc) {
+            inputsPath = argv[++i];
+        }
+        else if (strcmp("--gc-threshold", argv[i]) == 0 && i + 1 < argc) {
+            settings.gc_threshold = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp("--nursery-size", argv[i]) == 0 && i + 1 < argc) {
+            settings.nursery_size = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp("--gc-mode", argv[i]) == 0 && i + 1 < argc) {
+            settings.concurrent_gc = strcmp("stw", argv[++i]) != 0;
+        }
+        else if (strcmp("--inline-threshold", argv[i]) == 0 && i + 1 < argc) {
+            settings.inline_threshold = atoi(argv[++i]);
+        }
+        else if (strcmp("--kernels", argv[i]) == 0 && i + 1 < argc) {
+            settings.kernels = findKernels(argv[++i]);
+            if (!settings.kernels) {
+                printf("Kernels '%s' are not available on this CPU.\n", argv[i]);
+                return 1;
+            }
+        }
+        else {
+            paths[pathCount++] = argv[i];
+            path = argv[i];
+        }
+    }
+
+    if (jobs > 0) {
+        int status = runJobs(&settings, paths, pathCount, inputsPath, jobs, stats);
+        free(paths);
+        return status;
     }
 
+    if (eachLineMode) {
+        if (pathCount == 0 || pathCount > 2) {
+            printf("Usage: ./jank --each-line <source_path.js> [input_path]\n");
+            return 1;
+        }
+
+        int status = eachLine(&settings, paths[0], pathCount == 2 ? paths[1] : NULL, numbers, stats);
+        free(paths);
+        return status;
+    }
+
+    if ((replMode && pathCount > 0) || pathCount > 1) {
+        printf("Unknown flag '%s'", paths[pathCount - 1]);
+        return 1;
+    }
+    free(paths);
+
     if (replMode) {
-        repl(debug);
+        repl(&settings, debug);
     } else {
-        char *buffer = readFile(argv[1]);
+        if (!path) {
+            printf("Usage: ./jank <source_path.js>\n");
+            return 1;
+        }
+
+        char *buffer = readFile(path);
         if (!buffer) return 1;
 
-        JankyVm vm;
+        // next to the script, or named by the key in a cache directory
+        char cachePath[4096];
+        if (cacheDir) {
+            snprintf(cachePath, sizeof(cachePath), "%s/%016llx.jbc", cacheDir,
+                     (unsigned long long)cacheKey(buffer, settings.inline_threshold));
+            settings.cache_path = cachePath;
+        } else if (cache || settings.compile_only) {
+            snprintf(cachePath, sizeof(cachePath), "%s.jbc", path);
+            settings.cache_path = cachePath;
+        }
+
+        static JankyVm vm;
+        vm.settings = settings;
+
+        double start = now();
         VmResult result = run(&vm, buffer, debug);
+        double elapsed = now() - start;
         free(buffer);
 
+        if (stats) printStats(&vm, elapsed);
+
         if (result == VM_COMPILE_ERROR) {
             printf("Compile time error.\n");
         } 
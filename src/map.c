@@ -0,0 +1,315 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "map.h"
+#include "rope.h"
+#include "symbols.h"
+
+// A slot's control byte is the low seven bits of its entry's hash, or
+// one of the two markers, which have the high bit set. The rest of the
+// hash picks the group a probe starts from.
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7f))
+
+// The slots of the group whose control byte is 'byte', one bit each.
+static inline uint32_t matchByte(const uint8_t *group, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i control = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < MAP_GROUP; i++) {
+        mask |= (uint32_t)(group[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+// The slots that are empty or deleted: those with the high bit set.
+static inline uint32_t matchFree(const uint8_t *group) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < MAP_GROUP; i++) {
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+static uint32_t mixBits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ull;
+    bits ^= bits >> 33;
+
+    return (uint32_t)bits;
+}
+
+uint32_t hashKey(Heap *heap, Value key) {
+    switch (key.type) {
+        case TYPE_STRING: {
+            // a string shared with another isolate may be hashed there
+            // at the same time, to the same value
+            ObjString *string = asFlatString(heap, key.as.object);
+            uint32_t hash = __atomic_load_n(&string->hash, __ATOMIC_RELAXED);
+            if (hash == 0) {
+                hash = hashString(string->chars, string->length);
+                if (hash == 0) hash = 1;
+                __atomic_store_n(&string->hash, hash, __ATOMIC_RELAXED);
+            }
+            return hash;
+        }
+        case TYPE_NUMBER: {
+            // equal keys hash alike: -0 as 0 and every NaN as one
+            double number = key.as.number;
+            if (number == 0) number = 0;
+            if (isnan(number)) number = NAN;
+
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            return mixBits(bits);
+        }
+        case TYPE_BOOL:
+            return mixBits(key.as.boolean ? 2 : 1);
+        case TYPE_UNDEFINED:
+            return mixBits(0);
+        default:
+            return mixBits((uint64_t)(uintptr_t)key.as.object);
+    }
+}
+
+bool keysEqual(Heap *heap, Value a, Value b) {
+    if (a.type != b.type) return false;
+
+    switch (a.type) {
+        case TYPE_NUMBER:
+            return a.as.number == b.as.number || (isnan(a.as.number) && isnan(b.as.number));
+        case TYPE_BOOL:
+            return a.as.boolean == b.as.boolean;
+        case TYPE_UNDEFINED:
+            return true;
+        case TYPE_STRING: {
+            if (a.as.object == b.as.object) return true;
+            if (stringLength(a.as.object) != stringLength(b.as.object)) return false;
+
+            ObjString *x = asFlatString(heap, a.as.object);
+            ObjString *y = asFlatString(heap, b.as.object);
+            return memcmp(x->chars, y->chars, x->length) == 0;
+        }
+        default:
+            return a.as.object == b.as.object;
+    }
+}
+
+// Keys are stored flat and with -0 as 0, as JS does.
+static Value normalizeKey(Heap *heap, Value key) {
+    if (key.type == TYPE_STRING) key.as.object = flatten(heap, key.as.object);
+    if (key.type == TYPE_NUMBER && key.as.number == 0) key.as.number = 0;
+
+    return key;
+}
+
+// The slot holding 'key', or -1. Triangular probing over a power of two
+// groups visits each of them, and at least one slot in eight is empty.
+static int findSlot(Heap *heap, ObjMap *map, Value key, uint32_t hash) {
+    if (map->capacity == 0) return -1;
+
+    uint32_t mask = map->capacity / MAP_GROUP - 1;
+    uint32_t group = H1(hash) & mask;
+
+    for (uint32_t step = 1;; step++) {
+        const uint8_t *control = map->control + group * MAP_GROUP;
+
+        for (uint32_t match = matchByte(control, H2(hash)); match; match &= match - 1) {
+            int slot = group * MAP_GROUP + __builtin_ctz(match);
+            MapEntry *entry = &map->entries[map->slots[slot]];
+
+            if (entry->hash == hash && keysEqual(heap, entry->key, key)) return slot;
+        }
+
+        if (matchByte(control, CONTROL_EMPTY)) return -1;
+
+        group = (group + step) & mask;
+    }
+}
+
+// Indexes entry 'index' in the first free slot along its probe.
+static void placeEntry(ObjMap *map, uint32_t hash, int index) {
+    uint32_t mask = map->capacity / MAP_GROUP - 1;
+    uint32_t group = H1(hash) & mask;
+
+    for (uint32_t step = 1;; step++) {
+        uint32_t free = matchFree(map->control + group * MAP_GROUP);
+
+        if (free) {
+            int slot = group * MAP_GROUP + __builtin_ctz(free);
+            map->control[slot] = H2(hash);
+            map->slots[slot] = index;
+            return;
+        }
+
+        group = (group + step) & mask;
+    }
+}
+
+// Indexes the live entries afresh, dropping the deleted slots.
+static void rebuildIndex(ObjMap *map) {
+    memset(map->control, CONTROL_EMPTY, map->capacity);
+
+    for (int i = 0; i < map->entry_count; i++) {
+        if (map->entries[i].live) placeEntry(map, map->entries[i].hash, i);
+    }
+}
+
+// Makes room for another entry once the entries reach the limit: the
+// live ones are compacted in order, into a table twice the size unless
+// deletions have left it at most half full. Called with the store lock
+// held, since the marker reads the entries.
+static void growMap(Heap *heap, Object *object) {
+    ObjMap *map = &object->as.map;
+
+    int capacity = map->capacity == 0 ? MAP_MIN_SLOTS : map->capacity;
+    if (map->count * 2 >= mapEntryLimit(capacity)) capacity *= 2;
+
+    uint8_t *block = map->control;
+    if (capacity != map->capacity) {
+        if (!block) ownStorage(heap, object);
+
+        block = malloc(mapStorageSize(capacity));
+        accountStorage(heap, object, (long)mapStorageSize(capacity) - (long)mapStorageSize(map->capacity));
+    }
+
+    MapEntry *entries = (MapEntry *)(block + capacity * (1 + sizeof(int32_t)));
+    int count = 0;
+    for (int i = 0; i < map->entry_count; i++) {
+        if (map->entries[i].live) entries[count++] = map->entries[i];
+    }
+
+    if (block != map->control) free(map->control);
+
+    map->control = block;
+    map->slots = (int32_t *)(block + capacity);
+    map->entries = entries;
+    map->capacity = capacity;
+    map->entry_count = count;
+
+    rebuildIndex(map);
+}
+
+bool mapGet(Heap *heap, Object *object, Value key, Value *value) {
+    key = normalizeKey(heap, key);
+
+    ObjMap *map = &object->as.map;
+    int slot = findSlot(heap, map, key, hashKey(heap, key));
+    if (slot < 0) return false;
+
+    *value = map->entries[map->slots[slot]].value;
+    return true;
+}
+
+bool mapHas(Heap *heap, Object *object, Value key) {
+    key = normalizeKey(heap, key);
+
+    return findSlot(heap, &object->as.map, key, hashKey(heap, key)) >= 0;
+}
+
+// Overwrites the value of an existing key, or appends a new entry.
+void mapSet(Heap *heap, Object *object, Value key, Value value) {
+    key = normalizeKey(heap, key);
+    uint32_t hash = hashKey(heap, key);
+
+    ObjMap *map = &object->as.map;
+    int slot = findSlot(heap, map, key, hash);
+
+    rememberStore(heap, object, key);
+    rememberStore(heap, object, value);
+    bool locked = lockForStore(heap);
+
+    if (slot >= 0) {
+        MapEntry *entry = &map->entries[map->slots[slot]];
+        logOverwrite(heap, entry->value);
+        entry->value = value;
+    } else {
+        if (map->entry_count == mapEntryLimit(map->capacity)) growMap(heap, object);
+
+        MapEntry *entry = &map->entries[map->entry_count];
+        entry->key = key;
+        entry->value = value;
+        entry->hash = hash;
+        entry->live = true;
+
+        placeEntry(map, hash, map->entry_count);
+        map->entry_count++;
+        map->count++;
+    }
+
+    unlockForStore(heap, locked);
+}
+
+// The entry stays behind, cleared, so later ones keep their order.
+bool mapDelete(Heap *heap, Object *object, Value key) {
+    key = normalizeKey(heap, key);
+
+    ObjMap *map = &object->as.map;
+    int slot = findSlot(heap, map, key, hashKey(heap, key));
+    if (slot < 0) return false;
+
+    bool locked = lockForStore(heap);
+
+    MapEntry *entry = &map->entries[map->slots[slot]];
+    logOverwrite(heap, entry->key);
+    logOverwrite(heap, entry->value);
+    entry->key.type = TYPE_UNDEFINED;
+    entry->value.type = TYPE_UNDEFINED;
+    entry->live = false;
+
+    map->control[slot] = CONTROL_DELETED;
+    map->count--;
+
+    unlockForStore(heap, locked);
+
+    return true;
+}
+
+void mapClear(Heap *heap, Object *object) {
+    ObjMap *map = &object->as.map;
+    if (map->capacity == 0) return;
+
+    bool locked = lockForStore(heap);
+
+    for (int i = 0; i < map->entry_count; i++) {
+        if (!map->entries[i].live) continue;
+
+        logOverwrite(heap, map->entries[i].key);
+        logOverwrite(heap, map->entries[i].value);
+    }
+
+    map->count = 0;
+    map->entry_count = 0;
+    memset(map->control, CONTROL_EMPTY, map->capacity);
+
+    unlockForStore(heap, locked);
+}
+
+// Called by the minor collector after it moved some object keys: their
+// hashes are taken again and the index rebuilt in place.
+void reindexMap(Heap *heap, Object *object) {
+    ObjMap *map = &object->as.map;
+
+    for (int i = 0; i < map->entry_count; i++) {
+        MapEntry *entry = &map->entries[i];
+        if (entry->live && isObjectValue(entry->key) && entry->key.type != TYPE_STRING) {
+            entry->hash = hashKey(heap, entry->key);
+        }
+    }
+
+    rebuildIndex(map);
+}
@@ -0,0 +1,30 @@
+#ifndef map_h
+#define map_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "value.h"
+
+// Slots are probed a group at a time, one SSE2 compare per group.
+#define MAP_GROUP       16
+#define MAP_MIN_SLOTS   16
+
+#define CONTROL_EMPTY   0x80
+#define CONTROL_DELETED 0xFE
+
+// Keys compare with SameValueZero: NaN equals itself and -0 equals 0.
+// Strings hash by content, caching it in the string, and other objects
+// by address, so moving one means reindexing the maps keyed by it.
+uint32_t hashKey(Heap *heap, Value key);
+bool     keysEqual(Heap *heap, Value a, Value b);
+
+bool     mapGet(Heap *heap, Object *object, Value key, Value *value);
+bool     mapHas(Heap *heap, Object *object, Value key);
+void     mapSet(Heap *heap, Object *object, Value key, Value value);
+bool     mapDelete(Heap *heap, Object *object, Value key);
+void     mapClear(Heap *heap, Object *object);
+void     reindexMap(Heap *heap, Object *object);
+
+#endif
@@ -0,0 +1,1255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "compiler.h"
+#include "map.h"
+#include "shape.h"
+#include "utf8.h"
+
+void initHeap(Heap *heap, size_t threshold, size_t nurserySize, bool concurrent) {
+    heap->objects = NULL;
+    heap->bytes_allocated = 0;
+    heap->bytes_since_gc = 0;
+    heap->threshold = threshold;
+
+    heap->nursery = malloc(nurserySize);
+    heap->nursery_top = heap->nursery;
+    heap->nursery_end = heap->nursery + nurserySize;
+
+    memset(heap->free_cells, 0, sizeof(heap->free_cells));
+    heap->slab_top = NULL;
+    heap->slab_end = NULL;
+    heap->slabs = NULL;
+    heap->slab_count = 0;
+    heap->slab_capacity = 0;
+
+    heap->gray = NULL;
+    heap->gray_count = 0;
+    heap->gray_capacity = 0;
+    heap->epoch = 0;
+
+    heap->scan = NULL;
+    heap->scan_count = 0;
+    heap->scan_capacity = 0;
+
+    heap->remembered = NULL;
+    heap->remembered_count = 0;
+    heap->remembered_capacity = 0;
+    heap->young_external = NULL;
+    heap->young_external_count = 0;
+    heap->young_external_capacity = 0;
+    heap->young_external_bytes = 0;
+
+    heap->concurrent = concurrent;
+    heap->marking = false;
+    heap->phase = GC_IDLE;
+    heap->marker_started = false;
+    heap->shutdown = false;
+    heap->satb = NULL;
+    heap->satb_count = 0;
+    heap->satb_capacity = 0;
+    heap->sweep_list = NULL;
+    heap->survivors = NULL;
+    heap->survivors_tail = NULL;
+    heap->swept_bytes = 0;
+    memset(heap->swept_cells, 0, sizeof(heap->swept_cells));
+    memset(heap->swept_tails, 0, sizeof(heap->swept_tails));
+
+    pthread_mutex_init(&heap->adopted_lock, NULL);
+    heap->adopted = NULL;
+    heap->adopted_count = 0;
+    heap->adopted_capacity = 0;
+
+    heap->gc_count = 0;
+    heap->gc_pause = 0;
+    heap->live_bytes = 0;
+
+    heap->allocations = 0;
+    heap->minor_count = 0;
+    heap->promoted_bytes = 0;
+    heap->minor_pauses = NULL;
+    heap->minor_pause_capacity = 0;
+    heap->minor_p50 = 0;
+    heap->minor_p99 = 0;
+
+    heap->old_strings = 0;
+    heap->old_string_bytes = 0;
+    heap->old_string_chars = 0;
+
+    memset(heap->pause_histogram, 0, sizeof(heap->pause_histogram));
+    heap->pause_count = 0;
+    heap->max_pause = 0;
+}
+
+static int comparePauses(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Classes step by 8 bytes up to 64, which covers every function and any
+// string of up to 44 characters, then widen. -1 means malloc.
+static int sizeClass(size_t size) {
+    if (size <= 24)  return 0;
+    if (size <= 64)  return (int)((size + 7) / 8) - 3;
+    if (size <= 96)  return 6;
+    if (size <= 128) return 7;
+    if (size <= 192) return 8;
+    if (size <= 256) return 9;
+
+    return -1;
+}
+
+static const size_t classSizes[SIZE_CLASSES] = { 24, 32, 40, 48, 56, 64, 96, 128, 192, 256 };
+
+static size_t blockSize(size_t size) {
+    int index = sizeClass(size);
+    return index < 0 ? size : classSizes[index];
+}
+
+static size_t objectSize(Object *object) {
+    switch (object->type) {
+        case OBJ_STRING:   return blockSize(STRING_SIZE(object->as.string.length));
+        case OBJ_FUNCTION: return blockSize(sizeof(Object));
+        case OBJ_ROPE:     return blockSize(ROPE_SIZE);
+        case OBJ_INSTANCE: return blockSize(INSTANCE_SIZE(object->as.instance.capacity));
+        case OBJ_ARRAY:    return blockSize(ARRAY_SIZE);
+        case OBJ_MAP:      return blockSize(MAP_SIZE);
+    }
+
+    return sizeof(Object);
+}
+
+// Blocks too big for a size class are malloc'd behind a header naming
+// the heap that made them and counting their holders: that heap until
+// it frees the object, and any message or other heap it was sent to.
+// The owner is cleared when the owning heap lets go, so a later heap at
+// the same address can never take the block for its own.
+typedef struct {
+    Heap *owner;
+    int   refs;
+} BigBlock;
+
+static BigBlock *bigBlock(Object *object) {
+    return (BigBlock *)object - 1;
+}
+
+static bool isBig(Object *object) {
+    return sizeClass(objectSize(object)) < 0;
+}
+
+static void releaseBig(Object *object, bool owner) {
+    BigBlock *block = bigBlock(object);
+    if (owner) __atomic_store_n(&block->owner, NULL, __ATOMIC_RELAXED);
+
+    if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0) free(block);
+}
+
+static void *allocateBlock(Heap *heap, size_t size) {
+    int index = sizeClass(size);
+    if (index < 0) {
+        BigBlock *block = malloc(sizeof(BigBlock) + size);
+        block->owner = heap;
+        block->refs = 1;
+        return block + 1;
+    }
+
+    FreeCell *cell = heap->free_cells[index];
+    if (cell) {
+        heap->free_cells[index] = cell->next;
+        return cell;
+    }
+
+    size = classSizes[index];
+    if (heap->slab_top + size > heap->slab_end) {
+        if (heap->slab_count >= heap->slab_capacity) {
+            heap->slab_capacity = heap->slab_capacity == 0 ? 16 : heap->slab_capacity * 2;
+            heap->slabs = realloc(heap->slabs, sizeof(char *) * heap->slab_capacity);
+        }
+
+        heap->slab_top = malloc(SLAB_SIZE);
+        heap->slab_end = heap->slab_top + SLAB_SIZE;
+        heap->slabs[heap->slab_count++] = heap->slab_top;
+    }
+
+    void *block = heap->slab_top;
+    heap->slab_top += size;
+
+    return block;
+}
+
+// Pushes a block onto 'cells', keeping 'tail' so a whole list can be
+// handed back to the allocator at once. Big blocks are let go of.
+static void releaseBlock(FreeCell **cells, FreeCell **tails, Object *object) {
+    int index = sizeClass(objectSize(object));
+    if (index < 0) {
+        releaseBig(object, true);
+        return;
+    }
+
+    FreeCell *cell = (FreeCell *)object;
+    cell->next = cells[index];
+    if (!cells[index] && tails) tails[index] = cell;
+    cells[index] = cell;
+}
+
+static void freeElements(ObjArray *array) {
+    if (array->shared) releaseElements(array->shared);
+    else free(array->elements.any);
+}
+
+// Frees what an object owns, leaving its block and the byte counts to
+// the caller, since the marker thread frees objects while the mutator is
+// allocating.
+static void clearObject(Object *object) {
+    switch (object->type) {
+        case OBJ_STRING:
+        case OBJ_ROPE: {
+            break;
+        }
+        case OBJ_FUNCTION: {
+            // a program's chunks stay with the program
+            Bytecode *chunk = object->as.function.chunk;
+            if (chunk && !chunk->program) freeBytecode(chunk);
+            free(object->as.function.name);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            free(object->as.instance.overflow);
+            break;
+        }
+        case OBJ_ARRAY: {
+            freeElements(&object->as.array);
+            break;
+        }
+        case OBJ_MAP: {
+            free(object->as.map.control);
+            break;
+        }
+    }
+}
+
+// The bytes an instance, array or map owns outside its header.
+static size_t storageSize(Object *object) {
+    if (object->type == OBJ_INSTANCE) return sizeof(Value) * object->as.instance.overflow_capacity;
+    if (object->type == OBJ_ARRAY) return elementSize(object->as.array.kind) * object->as.array.capacity;
+    if (object->type == OBJ_MAP) return mapStorageSize(object->as.map.capacity);
+
+    return 0;
+}
+
+// What a young object owns outside the nursery.
+static void freeStorage(Object *object) {
+    if (object->type == OBJ_INSTANCE) free(object->as.instance.overflow);
+    if (object->type == OBJ_ARRAY) freeElements(&object->as.array);
+    if (object->type == OBJ_MAP) free(object->as.map.control);
+}
+
+// Slabs go all at once, so only the big malloc'd objects need freeing.
+static void freeList(Object *object) {
+    while (object) {
+        Object *next = object->next;
+        clearObject(object);
+        if (isBig(object)) releaseBig(object, true);
+        object = next;
+    }
+}
+
+void freeHeap(Heap *heap) {
+    if (heap->marker_started) {
+        pthread_mutex_lock(&heap->lock);
+        heap->shutdown = true;
+        pthread_cond_signal(&heap->wake);
+        pthread_mutex_unlock(&heap->lock);
+
+        pthread_join(heap->marker, NULL);
+        pthread_mutex_destroy(&heap->lock);
+        pthread_cond_destroy(&heap->wake);
+        heap->marker_started = false;
+    }
+
+    // a cycle cut short leaves the snapshot split between these lists
+    freeList(heap->objects);
+    freeList(heap->sweep_list);
+    freeList(heap->survivors);
+    heap->objects = heap->sweep_list = heap->survivors = heap->survivors_tail = NULL;
+    heap->phase = GC_IDLE;
+    heap->marking = false;
+
+    for (int i = 0; i < heap->slab_count; i++) {
+        free(heap->slabs[i]);
+    }
+    free(heap->slabs);
+    heap->slabs = NULL;
+    heap->slab_count = heap->slab_capacity = 0;
+    heap->slab_top = heap->slab_end = NULL;
+    memset(heap->free_cells, 0, sizeof(heap->free_cells));
+    memset(heap->swept_cells, 0, sizeof(heap->swept_cells));
+
+    free(heap->satb);
+    heap->satb = NULL;
+    heap->satb_count = 0;
+    heap->satb_capacity = 0;
+
+    free(heap->gray);
+    heap->gray = NULL;
+    heap->gray_capacity = 0;
+
+    free(heap->scan);
+    heap->scan = NULL;
+    heap->scan_capacity = 0;
+
+    // storage moved to the copy of anything promoted
+    for (int i = 0; i < heap->young_external_count; i++) {
+        Object *object = heap->young_external[i];
+        if (!object->next) freeStorage(object);
+    }
+    free(heap->young_external);
+    heap->young_external = NULL;
+    heap->young_external_count = heap->young_external_capacity = 0;
+
+    free(heap->remembered);
+    heap->remembered = NULL;
+    heap->remembered_count = heap->remembered_capacity = 0;
+
+    for (int i = 0; i < heap->adopted_capacity; i++) {
+        if (heap->adopted[i].string) releaseBig(heap->adopted[i].string, false);
+    }
+    free(heap->adopted);
+    heap->adopted = NULL;
+    heap->adopted_count = heap->adopted_capacity = 0;
+    pthread_mutex_destroy(&heap->adopted_lock);
+
+    free(heap->nursery);
+    heap->nursery = heap->nursery_top = heap->nursery_end = NULL;
+
+    // only the percentiles of the minor pauses outlive the heap
+    if (heap->minor_count > 0) {
+        qsort(heap->minor_pauses, heap->minor_count, sizeof(double), comparePauses);
+        heap->minor_p50 = heap->minor_pauses[heap->minor_count / 2];
+        heap->minor_p99 = heap->minor_pauses[(heap->minor_count * 99) / 100];
+    }
+    free(heap->minor_pauses);
+    heap->minor_pauses = NULL;
+    heap->minor_pause_capacity = 0;
+}
+
+static Object *allocateFrozen(ObjectType type, size_t size) {
+    Object *object = malloc(size);
+
+    object->type = type;
+    object->mark = 0;
+    object->remembered = false;
+    object->frozen = true;
+    object->next = NULL;
+
+    return object;
+}
+
+void freeFrozen(Object *object) {
+    clearObject(object);
+    free(object);
+}
+
+static Object *allocateObject(Heap *heap, ObjectType type, size_t size) {
+    if (!heap) return allocateFrozen(type, size);
+
+    Object *object = allocateBlock(heap, size);
+    size = blockSize(size);
+
+    object->type = type;
+    object->mark = heap->epoch;
+    object->remembered = false;
+    object->frozen = false;
+    object->next = heap->objects;
+    heap->objects = object;
+
+    heap->bytes_allocated += size;
+    heap->bytes_since_gc += size;
+    heap->allocations++;
+
+    return object;
+}
+
+// An old string with room for 'length' bytes. The caller fills them in
+// and sets 'count'.
+Object *reserveString(Heap *heap, int length) {
+    Object *object = allocateObject(heap, OBJ_STRING, STRING_SIZE(length));
+
+    object->as.string.chars[length] = '\0';
+    object->as.string.length = length;
+    object->as.string.hash = 0;
+    object->as.string.has_number = false;
+    if (!heap) return object;
+
+    heap->old_strings++;
+    heap->old_string_bytes += blockSize(STRING_SIZE(length));
+    heap->old_string_chars += length;
+
+    return object;
+}
+
+Object *newStringObject(Heap *heap, const char *chars, int length) {
+    Object *object = reserveString(heap, length);
+    memcpy(object->as.string.chars, chars, length);
+    object->as.string.count = countCodepoints(chars, length);
+
+    return object;
+}
+
+Object *newFunctionObject(Heap *heap) {
+    Object *object = allocateObject(heap, OBJ_FUNCTION, sizeof(Object));
+
+    object->as.function.arity = 0;
+    object->as.function.name = NULL;
+    object->as.function.chunk = NULL;
+    object->as.function.tokens = NULL;
+    object->as.function.start = 0;
+
+    return object;
+}
+
+// Bumps 'size' bytes off the nursery, or returns NULL when it is full.
+static Object *allocateYoung(Heap *heap, ObjectType type, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (heap->nursery_top + size > heap->nursery_end) {
+        return NULL;
+    }
+
+    Object *object = (Object *)heap->nursery_top;
+    heap->nursery_top += size;
+    heap->allocations++;
+
+    object->type = type;
+    object->mark = heap->epoch;
+    object->remembered = false;
+    object->frozen = false;
+    object->next = NULL;
+
+    return object;
+}
+
+// Strings are bump-allocated in the nursery. Returns NULL when it is
+// full; strings too big to be worth copying go straight to the old
+// generation.
+Object *newYoungString(Heap *heap, const char *chars, int length) {
+    Object *object = reserveYoungString(heap, length);
+    if (!object) return NULL;
+
+    memcpy(object->as.string.chars, chars, length);
+    object->as.string.count = countCodepoints(chars, length);
+
+    return object;
+}
+
+// Like newYoungString(), but the bytes and 'count' are left to the caller.
+Object *reserveYoungString(Heap *heap, int length) {
+    size_t nurserySize = heap->nursery_end - heap->nursery;
+    if (STRING_SIZE(length) > nurserySize / 8) {
+        return reserveString(heap, length);
+    }
+
+    Object *object = allocateYoung(heap, OBJ_STRING, STRING_SIZE(length));
+    if (!object) return NULL;
+
+    object->as.string.length = length;
+    object->as.string.hash = 0;
+    object->as.string.has_number = false;
+    object->as.string.chars[length] = '\0';
+
+    return object;
+}
+
+Object *newYoungRope(Heap *heap, Object *left, Object *right, int length, int count) {
+    Object *object = allocateYoung(heap, OBJ_ROPE, ROPE_SIZE);
+    if (!object) return NULL;
+
+    object->as.rope.length = length;
+    object->as.rope.count = count;
+    object->as.rope.left = left;
+    object->as.rope.right = right;
+    object->as.rope.flat = NULL;
+
+    return object;
+}
+
+static void pushObject(Object ***list, int *count, int *capacity, Object *object) {
+    if (*count >= *capacity) {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        *list = realloc(*list, sizeof(Object *) * *capacity);
+    }
+
+    (*list)[(*count)++] = object;
+}
+
+static void initArray(Heap *heap, Object *object, ElementKind kind, int capacity) {
+    object->as.array.kind = kind;
+    object->as.array.count = 0;
+    object->as.array.capacity = capacity;
+    object->as.array.elements.any = capacity > 0 ? malloc(elementSize(kind) * capacity) : NULL;
+    object->as.array.shared = NULL;
+
+    accountStorage(heap, object, elementSize(kind) * capacity);
+}
+
+static void initInstance(Object *object, Shape *shape, int capacity) {
+    object->as.instance.shape = shape;
+    object->as.instance.capacity = capacity;
+    object->as.instance.overflow_capacity = 0;
+    object->as.instance.overflow = NULL;
+}
+
+Object *newInstanceObject(Heap *heap, Shape *shape, int capacity) {
+    Object *object = allocateObject(heap, OBJ_INSTANCE, INSTANCE_SIZE(capacity));
+    initInstance(object, shape, capacity);
+
+    return object;
+}
+
+// Room is made for 'capacity' slots inline. Returns NULL when the
+// nursery is full.
+Object *newYoungInstance(Heap *heap, Shape *shape, int capacity) {
+    size_t nurserySize = heap->nursery_end - heap->nursery;
+    if (INSTANCE_SIZE(capacity) > nurserySize / 8) {
+        return newInstanceObject(heap, shape, capacity);
+    }
+
+    Object *object = allocateYoung(heap, OBJ_INSTANCE, INSTANCE_SIZE(capacity));
+    if (!object) return NULL;
+
+    initInstance(object, shape, capacity);
+    return object;
+}
+
+Object *newArrayObject(Heap *heap, ElementKind kind, int capacity) {
+    Object *object = allocateObject(heap, OBJ_ARRAY, ARRAY_SIZE);
+    initArray(heap, object, kind, capacity);
+
+    return object;
+}
+
+// The header is young; the elements are malloc'd either way. Returns
+// NULL when the nursery is full; arrays with more elements than are
+// worth freeing young go straight to the old generation.
+Object *newYoungArray(Heap *heap, ElementKind kind, int capacity) {
+    size_t nurserySize = heap->nursery_end - heap->nursery;
+    if (elementSize(kind) * capacity > nurserySize / 8) {
+        return newArrayObject(heap, kind, capacity);
+    }
+
+    Object *object = allocateYoung(heap, OBJ_ARRAY, ARRAY_SIZE);
+    if (!object) return NULL;
+
+    ownStorage(heap, object);
+    initArray(heap, object, kind, capacity);
+
+    return object;
+}
+
+static void initMap(Object *object, bool isSet) {
+    ObjMap *map = &object->as.map;
+    map->is_set = isSet;
+    map->count = 0;
+    map->entry_count = 0;
+    map->capacity = 0;
+    map->control = NULL;
+    map->slots = NULL;
+    map->entries = NULL;
+}
+
+Object *newMapObject(Heap *heap, bool isSet) {
+    Object *object = allocateObject(heap, OBJ_MAP, MAP_SIZE);
+    initMap(object, isSet);
+
+    return object;
+}
+
+// The table is malloc'd on the first insertion. Returns NULL when the
+// nursery is full.
+Object *newYoungMap(Heap *heap, bool isSet) {
+    Object *object = allocateYoung(heap, OBJ_MAP, MAP_SIZE);
+    if (!object) return NULL;
+
+    initMap(object, isSet);
+    return object;
+}
+
+// The SATB half of a store, called with the lock taken by lockForStore().
+void logOverwrite(Heap *heap, Value old) {
+    if (!heap->marking || !isObjectValue(old) || isYoung(heap, old.as.object)) return;
+
+    pushObject(&heap->satb, &heap->satb_count, &heap->satb_capacity, old.as.object);
+}
+
+// The generational half: an old object given a young value is remembered
+// until the next minor collection forwards what it holds.
+void rememberStore(Heap *heap, Object *object, Value value) {
+    if (!isObjectValue(value) || object->remembered) return;
+    if (!isYoung(heap, value.as.object) || isYoung(heap, object)) return;
+
+    object->remembered = true;
+    pushObject(&heap->remembered, &heap->remembered_count, &heap->remembered_capacity, object);
+}
+
+// Notes a young object that has malloc'd storage of its own, to be freed
+// at the next minor collection unless the object is promoted.
+void ownStorage(Heap *heap, Object *object) {
+    if (!isYoung(heap, object)) return;
+
+    pushObject(&heap->young_external, &heap->young_external_count, &heap->young_external_capacity, object);
+}
+
+// Counts a change in the malloc'd storage an object owns. Young storage
+// brings the next minor collection closer and old storage the next
+// major one.
+void accountStorage(Heap *heap, Object *object, long delta) {
+    if (isYoung(heap, object)) {
+        heap->young_external_bytes += delta;
+        return;
+    }
+
+    heap->bytes_allocated += delta;
+    if (delta > 0) heap->bytes_since_gc += delta;
+}
+
+// Overwrites a slot the instance's shape already has.
+void storeField(Heap *heap, Object *object, int slot, Value value) {
+    rememberStore(heap, object, value);
+
+    Value *field = instanceSlot(&object->as.instance, slot);
+    bool locked = lockForStore(heap);
+    logOverwrite(heap, *field);
+    *field = value;
+    unlockForStore(heap, locked);
+}
+
+// Gives the instance the next slot, holding 'value', and moves it to
+// 'shape'. Slots past the inline ones live in a malloc'd overflow array
+// that doubles as it fills.
+void addField(Heap *heap, Object *object, Shape *shape, Value value) {
+    ObjInstance *instance = &object->as.instance;
+    int slot = shape->count - 1;
+
+    rememberStore(heap, object, value);
+    bool locked = lockForStore(heap);
+
+    int needed = slot + 1 - instance->capacity;
+    if (needed > instance->overflow_capacity) {
+        if (!instance->overflow) ownStorage(heap, object);
+
+        int capacity = instance->overflow_capacity == 0 ? 4 : instance->overflow_capacity * 2;
+        accountStorage(heap, object, (long)sizeof(Value) * (capacity - instance->overflow_capacity));
+
+        instance->overflow_capacity = capacity;
+        instance->overflow = realloc(instance->overflow, sizeof(Value) * instance->overflow_capacity);
+    }
+
+    *instanceSlot(instance, slot) = value;
+    instance->shape = shape;
+
+    unlockForStore(heap, locked);
+}
+
+// Promoted ropes, instances, generic arrays and maps still point into the
+// nursery until finishScavenge() forwards their references; they wait on
+// the scan stack until then.
+static void pushScan(Heap *heap, Object *object) {
+    pushObject(&heap->scan, &heap->scan_count, &heap->scan_capacity, object);
+}
+
+static Object *promote(Heap *heap, Object *object);
+
+static void forwardObject(Heap *heap, Object **slot) {
+    if (*slot && isYoung(heap, *slot)) {
+        *slot = promote(heap, *slot);
+    }
+}
+
+// Copies a nursery object into the old generation, leaving a forwarding
+// pointer in its 'next' field so other references to it follow the copy.
+// Young objects are never linked, so a set 'next' means forwarded.
+static Object *promote(Heap *heap, Object *object) {
+    if (object->next) return object->next;
+
+    Object *copy = NULL;
+    switch (object->type) {
+        case OBJ_STRING: {
+            copy = reserveString(heap, object->as.string.length);
+            memcpy(copy->as.string.chars, object->as.string.chars, object->as.string.length);
+            copy->as.string.count = object->as.string.count;
+            copy->as.string.hash = object->as.string.hash;
+            copy->as.string.has_number = object->as.string.has_number;
+            copy->as.string.number = object->as.string.number;
+            break;
+        }
+        case OBJ_FUNCTION: {
+            // functions are only created by the compiler, never young
+            break;
+        }
+        case OBJ_ROPE: {
+            copy = allocateObject(heap, OBJ_ROPE, ROPE_SIZE);
+            copy->as.rope = object->as.rope;
+            pushScan(heap, copy);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            // the overflow array, if any, now belongs to the copy
+            ObjInstance *instance = &object->as.instance;
+            copy = allocateObject(heap, OBJ_INSTANCE, INSTANCE_SIZE(instance->capacity));
+            memcpy(&copy->as.instance, instance, INSTANCE_SIZE(instance->capacity) - offsetof(Object, as.instance));
+            pushScan(heap, copy);
+            break;
+        }
+        case OBJ_ARRAY: {
+            // unboxed elements hold no references
+            copy = allocateObject(heap, OBJ_ARRAY, ARRAY_SIZE);
+            copy->as.array = object->as.array;
+            if (copy->as.array.kind == ELEMENTS_GENERIC) pushScan(heap, copy);
+            break;
+        }
+        case OBJ_MAP: {
+            copy = allocateObject(heap, OBJ_MAP, MAP_SIZE);
+            copy->as.map = object->as.map;
+            pushScan(heap, copy);
+            break;
+        }
+    }
+
+    // so does any malloc'd storage
+    accountStorage(heap, copy, storageSize(copy));
+
+    heap->allocations--;
+    heap->promoted_bytes += objectSize(copy);
+
+    object->next = copy;
+
+    return copy;
+}
+
+void forwardValue(Heap *heap, Value *slot) {
+    if (!isObjectValue(*slot)) return;
+
+    forwardObject(heap, &slot->as.object);
+}
+
+// Forwards what a promoted or remembered object holds.
+static void forwardContents(Heap *heap, Object *object) {
+    switch (object->type) {
+        case OBJ_ROPE: {
+            forwardObject(heap, &object->as.rope.left);
+            forwardObject(heap, &object->as.rope.right);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance *instance = &object->as.instance;
+            for (int i = 0; i < instance->shape->count; i++) {
+                forwardValue(heap, instanceSlot(instance, i));
+            }
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray *array = &object->as.array;
+            if (array->kind != ELEMENTS_GENERIC) break;
+
+            for (int i = 0; i < array->count; i++) {
+                forwardValue(heap, &array->elements.values[i]);
+            }
+            break;
+        }
+        case OBJ_MAP: {
+            // keys hashed by address have to be indexed again if they moved
+            ObjMap *map = &object->as.map;
+            bool moved = false;
+
+            for (int i = 0; i < map->entry_count; i++) {
+                MapEntry *entry = &map->entries[i];
+                if (!entry->live) continue;
+
+                Object *key = isObjectValue(entry->key) ? entry->key.as.object : NULL;
+                forwardValue(heap, &entry->key);
+                forwardValue(heap, &entry->value);
+
+                if (key && entry->key.type != TYPE_STRING && entry->key.as.object != key) moved = true;
+            }
+
+            if (moved) reindexMap(heap, object);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Ends a minor collection once every root has been forwarded. What
+// remembered objects hold are roots too. Promoted ropes, instances,
+// arrays and maps are then scanned in turn until nothing points into the nursery,
+// which is free again. Flattened copies are always old.
+void finishScavenge(Heap *heap, double pause) {
+    if (heap->remembered_count > 0) {
+        // the marker may be scanning these
+        bool locked = heap->marking;
+        if (locked) pthread_mutex_lock(&heap->lock);
+
+        for (int i = 0; i < heap->remembered_count; i++) {
+            forwardContents(heap, heap->remembered[i]);
+            heap->remembered[i]->remembered = false;
+        }
+        heap->remembered_count = 0;
+
+        if (locked) pthread_mutex_unlock(&heap->lock);
+    }
+
+    while (heap->scan_count > 0) {
+        forwardContents(heap, heap->scan[--heap->scan_count]);
+    }
+
+    for (int i = 0; i < heap->young_external_count; i++) {
+        Object *object = heap->young_external[i];
+        if (!object->next) freeStorage(object);
+    }
+    heap->young_external_count = 0;
+    heap->young_external_bytes = 0;
+
+    heap->nursery_top = heap->nursery;
+    recordPause(heap, pause);
+
+    if (heap->minor_count >= heap->minor_pause_capacity) {
+        heap->minor_pause_capacity = heap->minor_pause_capacity == 0 ? 64 : heap->minor_pause_capacity * 2;
+        heap->minor_pauses = realloc(heap->minor_pauses, sizeof(double) * heap->minor_pause_capacity);
+    }
+    heap->minor_pauses[heap->minor_count++] = pause;
+}
+
+void recordPause(Heap *heap, double pause) {
+    int bucket = 0;
+    for (double us = pause * 1e6; us >= 1 && bucket < PAUSE_BUCKETS - 1; us /= 2) {
+        bucket++;
+    }
+
+    heap->pause_histogram[bucket]++;
+    heap->pause_count++;
+    if (pause > heap->max_pause) heap->max_pause = pause;
+}
+
+static uint32_t addressHash(Object *object) {
+    uint64_t bits = (uint64_t)(uintptr_t)object;
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+
+    return (uint32_t)bits;
+}
+
+// The entry for 'string' in the adopted table, or the empty slot it
+// would go in. The table is at most half full. Called with the lock held.
+static AdoptedString *findAdopted(AdoptedString *table, int capacity, Object *string) {
+    int index = addressHash(string) & (capacity - 1);
+
+    for (;;) {
+        AdoptedString *entry = &table[index];
+        if (!entry->string || entry->string == string) return entry;
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+// Moves the entries marked in 'epoch', or all of them, into a table of
+// 'capacity' slots, letting go of the rest. Returns the bytes let go of.
+static size_t rebuildAdopted(Heap *heap, int capacity, bool all) {
+    AdoptedString *table = calloc(capacity, sizeof(AdoptedString));
+    size_t released = 0;
+    int count = 0;
+
+    for (int i = 0; i < heap->adopted_capacity; i++) {
+        AdoptedString *entry = &heap->adopted[i];
+        if (!entry->string) continue;
+
+        if (all || entry->mark == heap->epoch) {
+            *findAdopted(table, capacity, entry->string) = *entry;
+            count++;
+        } else {
+            released += objectSize(entry->string);
+            releaseBig(entry->string, false);
+        }
+    }
+
+    free(heap->adopted);
+    heap->adopted = table;
+    heap->adopted_capacity = capacity;
+    heap->adopted_count = count;
+
+    return released;
+}
+
+// Lets go of every adopted string the cycle just traced left unmarked.
+static size_t sweepAdopted(Heap *heap) {
+    pthread_mutex_lock(&heap->adopted_lock);
+    size_t released = heap->adopted_count > 0 ? rebuildAdopted(heap, heap->adopted_capacity, false) : 0;
+    pthread_mutex_unlock(&heap->adopted_lock);
+
+    return released;
+}
+
+// A big string made by some other heap, or by one since gone. Nothing
+// else can come from outside but frozen objects.
+static bool isForeign(Heap *heap, Object *object) {
+    if (object->type != OBJ_STRING || !isBig(object)) return false;
+
+    return __atomic_load_n(&bigBlock(object)->owner, __ATOMIC_RELAXED) != heap;
+}
+
+static void markAdopted(Heap *heap, Object *string) {
+    pthread_mutex_lock(&heap->adopted_lock);
+
+    AdoptedString *entry = findAdopted(heap->adopted, heap->adopted_capacity, string);
+    if (entry->string) entry->mark = heap->epoch;
+
+    pthread_mutex_unlock(&heap->adopted_lock);
+}
+
+// 'string' is flat and not frozen. Its mark is left alone, since the
+// marker thread may be writing it.
+bool canShareString(Heap *heap, Object *string) {
+    return !isYoung(heap, string) && isBig(string);
+}
+
+void retainString(Object *string) {
+    __atomic_add_fetch(&bigBlock(string)->refs, 1, __ATOMIC_RELAXED);
+}
+
+void releaseString(Object *string) {
+    releaseBig(string, false);
+}
+
+// Takes over the reference a message held. An adopted string is marked
+// from the start, like anything allocated, and counts towards the next
+// collection as an allocation would.
+Object *adoptString(Heap *heap, Object *string) {
+    if (__atomic_load_n(&bigBlock(string)->owner, __ATOMIC_RELAXED) == heap) {
+        ObjString *chars = &string->as.string;
+        Object *copy = reserveString(heap, chars->length);
+        memcpy(copy->as.string.chars, chars->chars, chars->length);
+        copy->as.string.count = chars->count;
+
+        releaseBig(string, false);
+        return copy;
+    }
+
+    pthread_mutex_lock(&heap->adopted_lock);
+
+    if ((heap->adopted_count + 1) * 2 > heap->adopted_capacity) {
+        rebuildAdopted(heap, heap->adopted_capacity == 0 ? 16 : heap->adopted_capacity * 2, true);
+    }
+
+    AdoptedString *entry = findAdopted(heap->adopted, heap->adopted_capacity, string);
+    if (entry->string) {
+        // held already, which one reference is enough for
+        releaseBig(string, false);
+    } else {
+        entry->string = string;
+        heap->adopted_count++;
+        heap->bytes_allocated += objectSize(string);
+        heap->bytes_since_gc += objectSize(string);
+    }
+    entry->mark = heap->epoch;
+
+    pthread_mutex_unlock(&heap->adopted_lock);
+
+    return string;
+}
+
+SharedElements *shareElements(Object *object) {
+    ObjArray *array = &object->as.array;
+
+    if (!array->shared) {
+        array->shared = malloc(sizeof(SharedElements));
+        array->shared->refs = 1;
+        array->shared->data = array->elements.any;
+    }
+
+    __atomic_add_fetch(&array->shared->refs, 1, __ATOMIC_RELAXED);
+    return array->shared;
+}
+
+void releaseElements(SharedElements *shared) {
+    if (__atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    free(shared->data);
+    free(shared);
+}
+
+// The marker thread and the mutator never mark the same object at the
+// same time: roots are marked before the marker is woken and the remark
+// runs after it has parked, so 'mark' needs no atomics. Young objects are
+// left to the minor collector; an old instance can point at them.
+void markObject(Heap *heap, Object *object) {
+    if (!object || object->frozen || isYoung(heap, object)) return;
+
+    // another heap marks its own, so its strings are marked here by entry
+    if (isForeign(heap, object)) {
+        markAdopted(heap, object);
+        return;
+    }
+
+    if (object->mark == heap->epoch) return;
+    object->mark = heap->epoch;
+
+    // strings hold no references, so only the other types need tracing
+    if (object->type == OBJ_STRING) return;
+
+    pushObject(&heap->gray, &heap->gray_count, &heap->gray_capacity, object);
+}
+
+void markValue(Heap *heap, Value value) {
+    if (isObjectValue(value)) {
+        markObject(heap, value.as.object);
+    }
+}
+
+void markConstants(Heap *heap, Bytecode *chunk) {
+    for (int i = 0; i < chunk->const_count; i++) {
+        markValue(heap, chunk->constants[i]);
+    }
+}
+
+// 'concurrent' is set on the marker thread, which has to take the lock
+// to look inside an instance the mutator may be storing into.
+static void traceGray(Heap *heap, bool concurrent) {
+    while (heap->gray_count > 0) {
+        Object *object = heap->gray[--heap->gray_count];
+
+        // a deferred body can be published by the mutator mid-cycle; its
+        // constants were allocated black, so seeing either value is fine
+        if (object->type == OBJ_FUNCTION) {
+            Bytecode *chunk = __atomic_load_n(&object->as.function.chunk, __ATOMIC_ACQUIRE);
+            if (chunk) markConstants(heap, chunk);
+        }
+
+        // flattening can drop the sides mid-cycle (logging them first)
+        if (object->type == OBJ_ROPE) {
+            markObject(heap, __atomic_load_n(&object->as.rope.left, __ATOMIC_RELAXED));
+            markObject(heap, __atomic_load_n(&object->as.rope.right, __ATOMIC_RELAXED));
+            markObject(heap, __atomic_load_n(&object->as.rope.flat, __ATOMIC_ACQUIRE));
+        }
+
+        if (object->type == OBJ_INSTANCE) {
+            if (concurrent) pthread_mutex_lock(&heap->lock);
+
+            ObjInstance *instance = &object->as.instance;
+            for (int i = 0; i < instance->shape->count; i++) {
+                markValue(heap, *instanceSlot(instance, i));
+            }
+
+            if (concurrent) pthread_mutex_unlock(&heap->lock);
+        }
+
+        if (object->type == OBJ_ARRAY) {
+            if (concurrent) pthread_mutex_lock(&heap->lock);
+
+            ObjArray *array = &object->as.array;
+            if (array->kind == ELEMENTS_GENERIC) {
+                for (int i = 0; i < array->count; i++) {
+                    markValue(heap, array->elements.values[i]);
+                }
+            }
+
+            if (concurrent) pthread_mutex_unlock(&heap->lock);
+        }
+
+        if (object->type == OBJ_MAP) {
+            if (concurrent) pthread_mutex_lock(&heap->lock);
+
+            ObjMap *map = &object->as.map;
+            for (int i = 0; i < map->entry_count; i++) {
+                if (!map->entries[i].live) continue;
+
+                markValue(heap, map->entries[i].key);
+                markValue(heap, map->entries[i].value);
+            }
+
+            if (concurrent) pthread_mutex_unlock(&heap->lock);
+        }
+    }
+}
+
+void traceReferences(Heap *heap) {
+    traceGray(heap, false);
+}
+
+void sweep(Heap *heap) {
+    Object **link = &heap->objects;
+
+    while (*link) {
+        Object *object = *link;
+
+        if (object->mark == heap->epoch) {
+            link = &object->next;
+        } else {
+            *link = object->next;
+            heap->bytes_allocated -= objectSize(object) + storageSize(object);
+            clearObject(object);
+            releaseBlock(heap->free_cells, NULL, object);
+        }
+    }
+
+    heap->bytes_allocated -= sweepAdopted(heap);
+    heap->bytes_since_gc = 0;
+    heap->live_bytes = heap->bytes_allocated;
+}
+
+// Whitens every old object. Roots are marked after this.
+void beginCycle(Heap *heap) {
+    heap->epoch++;
+}
+
+static void setPhase(Heap *heap, GcPhase phase) {
+    __atomic_store_n(&heap->phase, phase, __ATOMIC_RELEASE);
+}
+
+void satbLog(Heap *heap, Object *object) {
+    pthread_mutex_lock(&heap->lock);
+    pushObject(&heap->satb, &heap->satb_count, &heap->satb_capacity, object);
+    pthread_mutex_unlock(&heap->lock);
+}
+
+// Called with the lock held.
+static void drainSatb(Heap *heap) {
+    for (int i = 0; i < heap->satb_count; i++) {
+        markObject(heap, heap->satb[i]);
+    }
+    heap->satb_count = 0;
+}
+
+static void sweepSnapshot(Heap *heap) {
+    Object *object = heap->sweep_list;
+    heap->sweep_list = NULL;
+
+    while (object) {
+        Object *next = object->next;
+
+        if (object->mark == heap->epoch) {
+            object->next = NULL;
+            if (heap->survivors_tail) heap->survivors_tail->next = object;
+            else heap->survivors = object;
+            heap->survivors_tail = object;
+        } else {
+            heap->swept_bytes += objectSize(object) + storageSize(object);
+            clearObject(object);
+            releaseBlock(heap->swept_cells, heap->swept_tails, object);
+        }
+
+        object = next;
+    }
+
+    heap->swept_bytes += sweepAdopted(heap);
+}
+
+// Traces from the roots handed over by startConcurrentMark(), folding in
+// whatever the barrier logged meanwhile, then parks in GC_REMARK for the
+// mutator. Sweeping the snapshot is woken separately by remark().
+static void *markerMain(void *arg) {
+    Heap *heap = arg;
+
+    pthread_mutex_lock(&heap->lock);
+    for (;;) {
+        GcPhase phase = gcPhase(heap);
+
+        if (phase == GC_MARKING) {
+            do {
+                pthread_mutex_unlock(&heap->lock);
+                traceGray(heap, true);
+                pthread_mutex_lock(&heap->lock);
+                drainSatb(heap);
+            } while (heap->gray_count > 0);
+
+            setPhase(heap, GC_REMARK);
+        } else if (phase == GC_SWEEPING) {
+            pthread_mutex_unlock(&heap->lock);
+            sweepSnapshot(heap);
+            pthread_mutex_lock(&heap->lock);
+
+            setPhase(heap, GC_SWEPT);
+        } else if (heap->shutdown) {
+            break;
+        } else {
+            pthread_cond_wait(&heap->wake, &heap->lock);
+        }
+    }
+    pthread_mutex_unlock(&heap->lock);
+
+    return NULL;
+}
+
+// Ends the initial pause. The roots are already marked into the gray
+// stack; everything allocated so far becomes the snapshot to be swept and
+// the marker thread takes over the tracing.
+void startConcurrentMark(Heap *heap) {
+    if (!heap->marker_started) {
+        pthread_mutex_init(&heap->lock, NULL);
+        pthread_cond_init(&heap->wake, NULL);
+        pthread_create(&heap->marker, NULL, markerMain, heap);
+        heap->marker_started = true;
+    }
+
+    heap->sweep_list = heap->objects;
+    heap->objects = NULL;
+    heap->bytes_since_gc = 0;
+    heap->marking = true;
+
+    pthread_mutex_lock(&heap->lock);
+    setPhase(heap, GC_MARKING);
+    pthread_cond_signal(&heap->wake);
+    pthread_mutex_unlock(&heap->lock);
+}
+
+// The second pause: whatever the barrier logged after the marker parked
+// is traced here, after which the snapshot is fully marked and the
+// marker can sweep it while the mutator carries on. Remembered instances
+// about to be swept are forgotten.
+void remark(Heap *heap) {
+    pthread_mutex_lock(&heap->lock);
+    drainSatb(heap);
+    traceReferences(heap);
+    heap->marking = false;
+
+    int kept = 0;
+    for (int i = 0; i < heap->remembered_count; i++) {
+        Object *object = heap->remembered[i];
+        if (object->mark == heap->epoch) heap->remembered[kept++] = object;
+    }
+    heap->remembered_count = kept;
+
+    setPhase(heap, GC_SWEEPING);
+    pthread_cond_signal(&heap->wake);
+    pthread_mutex_unlock(&heap->lock);
+}
+
+// Links the survivors of the snapshot back into the heap.
+void finishCycle(Heap *heap) {
+    pthread_mutex_lock(&heap->lock);
+
+    if (heap->survivors) {
+        heap->survivors_tail->next = heap->objects;
+        heap->objects = heap->survivors;
+    }
+    heap->survivors = heap->survivors_tail = NULL;
+
+    for (int i = 0; i < SIZE_CLASSES; i++) {
+        if (!heap->swept_cells[i]) continue;
+
+        heap->swept_tails[i]->next = heap->free_cells[i];
+        heap->free_cells[i] = heap->swept_cells[i];
+        heap->swept_cells[i] = heap->swept_tails[i] = NULL;
+    }
+
+    heap->bytes_allocated -= heap->swept_bytes;
+    heap->swept_bytes = 0;
+    heap->live_bytes = heap->bytes_allocated;
+    heap->gc_count++;
+
+    setPhase(heap, GC_IDLE);
+    pthread_mutex_unlock(&heap->lock);
+}
@@ -0,0 +1,247 @@
+#ifndef memory_h
+#define memory_h
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "value.h"
+
+#define GC_THRESHOLD_DEFAULT (1024 * 1024)
+#define NURSERY_SIZE_DEFAULT (256 * 1024)
+#define PAUSE_BUCKETS        24
+#define SIZE_CLASSES         10
+#define SLAB_SIZE            (64 * 1024)
+
+// A free block in a size-class pool, threaded through its first word.
+typedef struct FreeCell {
+    struct FreeCell *next;
+} FreeCell;
+
+// A big string from another isolate's heap that this one holds a
+// reference to, and the epoch it was last marked in.
+typedef struct {
+    Object  *string;
+    uint8_t  mark;
+} AdoptedString;
+
+// Where a concurrent major collection is. The mutator starts a cycle and
+// performs the remark and the final hand-back itself; the marker thread
+// owns the gray stack while MARKING and the sweep list while SWEEPING.
+typedef enum {
+    GC_IDLE,
+    GC_MARKING,
+    GC_REMARK,
+    GC_SWEEPING,
+    GC_SWEPT,
+} GcPhase;
+
+// The heap has two generations. Objects the VM creates while running are
+// bump-allocated in the nursery; a minor collection copies the ones still
+// referenced into the old generation and empties the nursery. Old objects
+// (everything the parser and compiler create, and all promoted objects)
+// are carved from size-class pools in large slabs, linked into 'objects'
+// and reclaimed by mark-sweep once 'bytes_since_gc' passes 'threshold',
+// or the live heap if that is bigger. The VM decides when it is safe to
+// collect and supplies the roots.
+//
+// An object is marked when its 'mark' equals 'epoch'. Each major cycle
+// bumps the epoch, which whitens the whole heap at once, and objects are
+// always created with the current epoch, so anything allocated while a
+// concurrent cycle is running is already black.
+typedef struct {
+    Object  *objects;
+    size_t   bytes_allocated;
+    size_t   bytes_since_gc;
+    size_t   threshold;
+
+    char    *nursery;
+    char    *nursery_top;
+    char    *nursery_end;
+
+    // old objects up to 256 bytes come from per-class free lists, refilled
+    // by bumping through the current slab; bigger ones are malloc'd
+    FreeCell *free_cells[SIZE_CLASSES];
+    char     *slab_top;
+    char     *slab_end;
+    char    **slabs;
+    int       slab_count;
+    int       slab_capacity;
+
+    Object **gray;
+    int      gray_count;
+    int      gray_capacity;
+    uint8_t  epoch;
+
+    Object **scan;
+    int      scan_count;
+    int      scan_capacity;
+
+    // old instances and arrays given young values since the last minor
+    // collection, and young objects that own malloc'd storage along with
+    // how many bytes of it they hold
+    Object **remembered;
+    int      remembered_count;
+    int      remembered_capacity;
+    Object **young_external;
+    int      young_external_count;
+    int      young_external_capacity;
+    size_t   young_external_bytes;
+
+    // concurrent marking: the heap as it was when the cycle started is
+    // detached into 'sweep_list', and old references overwritten while
+    // marking are logged in 'satb' so the snapshot stays reachable. The
+    // marker scans instances under 'lock', and stores into them take it
+    // too while 'marking' is set.
+    bool            concurrent;
+    bool            marking;
+    int             phase;
+    bool            marker_started;
+    bool            shutdown;
+    pthread_t       marker;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    Object        **satb;
+    int             satb_count;
+    int             satb_capacity;
+    Object         *sweep_list;
+    Object         *survivors;
+    Object         *survivors_tail;
+    size_t          swept_bytes;
+    FreeCell       *swept_cells[SIZE_CLASSES];
+    FreeCell       *swept_tails[SIZE_CLASSES];
+
+    // big strings other heaps sent here, by address; see adoptString().
+    // The marker reaches them through markObject(), so they have a lock
+    // of their own.
+    pthread_mutex_t adopted_lock;
+    AdoptedString  *adopted;
+    int             adopted_count;
+    int             adopted_capacity;
+
+    long     gc_count;
+    double   gc_pause;
+    size_t   live_bytes;
+
+    long     allocations;
+    long     minor_count;
+    size_t   promoted_bytes;
+    double  *minor_pauses;
+    int      minor_pause_capacity;
+    double   minor_p50;
+    double   minor_p99;
+
+    // footprint of every string placed in the old generation, against
+    // the characters it holds
+    long     old_strings;
+    size_t   old_string_bytes;
+    size_t   old_string_chars;
+
+    // every stop-the-world pause, minor or major, by power of two in us
+    long     pause_histogram[PAUSE_BUCKETS];
+    long     pause_count;
+    double   max_pause;
+} Heap;
+
+void    initHeap(Heap *heap, size_t threshold, size_t nurserySize, bool concurrent);
+void    freeHeap(Heap *heap);
+void    recordPause(Heap *heap, double pause);
+
+// Letting the heap double between cycles keeps the tracing work per
+// byte allocated constant however much stays live, as it does in a long
+// REPL session.
+static inline bool majorCollectionDue(Heap *heap) {
+    size_t budget = heap->live_bytes > heap->threshold ? heap->live_bytes : heap->threshold;
+
+    return heap->bytes_since_gc > budget;
+}
+
+static inline bool isYoung(Heap *heap, Object *object) {
+    return (char *)object >= heap->nursery && (char *)object < heap->nursery_end;
+}
+
+// With no heap, reserveString() and newFunctionObject() make frozen
+// objects, which freeFrozen() frees.
+Object *reserveString(Heap *heap, int length);
+Object *newStringObject(Heap *heap, const char *chars, int length);
+Object *newFunctionObject(Heap *heap);
+void    freeFrozen(Object *object);
+Object *newYoungString(Heap *heap, const char *chars, int length);
+Object *reserveYoungString(Heap *heap, int length);
+Object *newYoungRope(Heap *heap, Object *left, Object *right, int length, int count);
+Object *newInstanceObject(Heap *heap, Shape *shape, int capacity);
+Object *newYoungInstance(Heap *heap, Shape *shape, int capacity);
+Object *newArrayObject(Heap *heap, ElementKind kind, int capacity);
+Object *newYoungArray(Heap *heap, ElementKind kind, int capacity);
+Object *newMapObject(Heap *heap, bool isSet);
+Object *newYoungMap(Heap *heap, bool isSet);
+void    storeField(Heap *heap, Object *object, int slot, Value value);
+
+// Messages between isolates carry big old strings and packed elements
+// by reference rather than copying them. A string's block counts its
+// holders: the sender retains it for the message, and the receiving
+// heap adopts that reference, keeping it for as long as it still marks
+// the string. A string sent back to the heap that made it is copied
+// instead, since that heap may be about to sweep it.
+bool    canShareString(Heap *heap, Object *string);
+void    retainString(Object *string);
+void    releaseString(Object *string);
+Object *adoptString(Heap *heap, Object *string);
+
+// The array's elements, shared from now on with whoever is given the
+// reference this takes.
+SharedElements *shareElements(Object *object);
+void    releaseElements(SharedElements *shared);
+
+void    addField(Heap *heap, Object *object, Shape *shape, Value value);
+
+// Instances, arrays and maps are the objects the mutator stores into. While a
+// concurrent mark runs the marker scans them under the heap lock, so a
+// store takes it too and logs the reference it overwrites.
+static inline bool lockForStore(Heap *heap) {
+    if (!heap->marking) return false;
+
+    pthread_mutex_lock(&heap->lock);
+    return true;
+}
+
+static inline void unlockForStore(Heap *heap, bool locked) {
+    if (locked) pthread_mutex_unlock(&heap->lock);
+}
+
+void    logOverwrite(Heap *heap, Value old);
+void    rememberStore(Heap *heap, Object *object, Value value);
+void    ownStorage(Heap *heap, Object *object);
+void    accountStorage(Heap *heap, Object *object, long delta);
+
+void    forwardValue(Heap *heap, Value *slot);
+void    finishScavenge(Heap *heap, double pause);
+
+void    markObject(Heap *heap, Object *object);
+void    markValue(Heap *heap, Value value);
+void    markConstants(Heap *heap, Bytecode *chunk);
+void    traceReferences(Heap *heap);
+void    sweep(Heap *heap);
+
+static inline GcPhase gcPhase(Heap *heap) {
+    return (GcPhase)__atomic_load_n(&heap->phase, __ATOMIC_ACQUIRE);
+}
+
+void    satbLog(Heap *heap, Object *object);
+
+// Snapshot-at-the-beginning barrier, called with the value a store is
+// about to overwrite. Young objects are never part of the snapshot.
+static inline void satbBarrier(Heap *heap, Value old) {
+    if (!heap->marking) return;
+    if (!isObjectValue(old)) return;
+    if (isYoung(heap, old.as.object)) return;
+
+    satbLog(heap, old.as.object);
+}
+
+void    beginCycle(Heap *heap);
+void    startConcurrentMark(Heap *heap);
+void    remark(Heap *heap);
+void    finishCycle(Heap *heap);
+
+#endif
@@ -0,0 +1,488 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "message.h"
+#include "map.h"
+#include "rope.h"
+
+// A message is a run of records, each a tag and what follows it:
+//
+//   STRING          length, count, the bytes
+//   SHARED_STRING   index into 'strings'
+//   FROZEN_STRING   the object's address
+//   ARRAY           kind, count, then the raw elements when packed or a
+//                   record for each when not
+//   SHARED_ARRAY    kind, count, index into 'elements'
+//   OBJECT          count, the keys with their NULs, then the values
+//   MAP             whether it is a Set, count, then each key and value
+//   BACK            the position of an object written before
+//
+// Objects, arrays and maps are numbered in the order they are written,
+// which is the order they are rebuilt in.
+typedef enum {
+    TAG_UNDEFINED,
+    TAG_TRUE,
+    TAG_FALSE,
+    TAG_NUMBER,
+    TAG_STRING,
+    TAG_SHARED_STRING,
+    TAG_FROZEN_STRING,
+    TAG_ARRAY,
+    TAG_SHARED_ARRAY,
+    TAG_OBJECT,
+    TAG_MAP,
+    TAG_BACK,
+} MessageTag;
+
+typedef struct {
+    Object *object;
+    int     position;
+} SeenObject;
+
+typedef struct {
+    Heap       *heap;
+    Message    *message;
+    int         depth;
+
+    // the objects written so far, by address
+    SeenObject *seen;
+    int         seen_capacity;
+
+    Shape     **keys;
+    int         key_capacity;
+} Packer;
+
+static void writeTag(Packer *packer, MessageTag tag) {
+    appendChar(&packer->message->data, (char)tag);
+}
+
+static void writeInt(Packer *packer, int value) {
+    appendText(&packer->message->data, (const char *)&value, sizeof(value));
+}
+
+static uint32_t addressHash(Object *object) {
+    uint64_t bits = (uint64_t)(uintptr_t)object;
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+
+    return (uint32_t)bits;
+}
+
+static SeenObject *findSeen(SeenObject *table, int capacity, Object *object) {
+    int index = addressHash(object) & (capacity - 1);
+
+    while (table[index].object && table[index].object != object) {
+        index = (index + 1) & (capacity - 1);
+    }
+
+    return &table[index];
+}
+
+// Writes a reference back if the object was written before, and
+// otherwise numbers it. The table is kept at most half full.
+static bool writeSeen(Packer *packer, Object *object) {
+    Message *message = packer->message;
+
+    if (message->object_count > 0) {
+        SeenObject *entry = findSeen(packer->seen, packer->seen_capacity, object);
+        if (entry->object) {
+            writeTag(packer, TAG_BACK);
+            writeInt(packer, entry->position);
+            return true;
+        }
+    }
+
+    if ((message->object_count + 1) * 2 > packer->seen_capacity) {
+        int capacity = packer->seen_capacity == 0 ? 64 : packer->seen_capacity * 2;
+        SeenObject *table = calloc(capacity, sizeof(SeenObject));
+
+        for (int i = 0; i < packer->seen_capacity; i++) {
+            if (packer->seen[i].object) *findSeen(table, capacity, packer->seen[i].object) = packer->seen[i];
+        }
+
+        free(packer->seen);
+        packer->seen = table;
+        packer->seen_capacity = capacity;
+    }
+
+    SeenObject *entry = findSeen(packer->seen, packer->seen_capacity, object);
+    entry->object = object;
+    entry->position = message->object_count++;
+
+    return false;
+}
+
+static void writeString(Packer *packer, Object *object) {
+    Message *message = packer->message;
+    Object *flat = flatten(packer->heap, object);
+    ObjString *string = &flat->as.string;
+
+    if (flat->frozen) {
+        writeTag(packer, TAG_FROZEN_STRING);
+        appendText(&message->data, (const char *)&flat, sizeof(flat));
+        return;
+    }
+
+    if (string->length >= MESSAGE_SHARE_BYTES && canShareString(packer->heap, flat)) {
+        if (message->string_count == message->string_capacity) {
+            message->string_capacity = message->string_capacity == 0 ? 8 : message->string_capacity * 2;
+            message->strings = realloc(message->strings, sizeof(Object *) * message->string_capacity);
+        }
+
+        retainString(flat);
+        writeTag(packer, TAG_SHARED_STRING);
+        writeInt(packer, message->string_count);
+        message->strings[message->string_count++] = flat;
+        return;
+    }
+
+    writeTag(packer, TAG_STRING);
+    writeInt(packer, string->length);
+    writeInt(packer, string->count);
+    appendText(&message->data, string->chars, string->length);
+}
+
+static const char *writeValue(Packer *packer, Value value);
+
+static const char *writeArray(Packer *packer, Object *object) {
+    Message *message = packer->message;
+    ObjArray *array = &object->as.array;
+    size_t bytes = elementSize(array->kind) * array->count;
+
+    if (array->kind != ELEMENTS_GENERIC && bytes >= MESSAGE_SHARE_BYTES) {
+        if (message->element_count == message->element_capacity) {
+            message->element_capacity = message->element_capacity == 0 ? 8 : message->element_capacity * 2;
+            message->elements = realloc(message->elements, sizeof(SharedElements *) * message->element_capacity);
+        }
+
+        writeTag(packer, TAG_SHARED_ARRAY);
+        writeInt(packer, array->kind);
+        writeInt(packer, array->count);
+        writeInt(packer, message->element_count);
+        message->elements[message->element_count++] = shareElements(object);
+        return NULL;
+    }
+
+    writeTag(packer, TAG_ARRAY);
+    writeInt(packer, array->kind);
+    writeInt(packer, array->count);
+
+    if (array->kind != ELEMENTS_GENERIC) {
+        if (bytes > 0) appendText(&message->data, array->elements.any, (int)bytes);
+        return NULL;
+    }
+
+    for (int i = 0; i < array->count; i++) {
+        const char *error = writeValue(packer, array->elements.values[i]);
+        if (error) return error;
+    }
+
+    return NULL;
+}
+
+// The keys go first, so the receiver knows the shape before it makes
+// the object. Slot order is kept.
+static const char *writeObject(Packer *packer, Object *object) {
+    ObjInstance *instance = &object->as.instance;
+    int count = instance->shape->count;
+
+    if (count > packer->key_capacity) {
+        packer->key_capacity = count;
+        packer->keys = realloc(packer->keys, sizeof(Shape *) * packer->key_capacity);
+    }
+    for (Shape *shape = instance->shape; shape->key; shape = shape->parent) {
+        packer->keys[shape->count - 1] = shape;
+    }
+
+    writeTag(packer, TAG_OBJECT);
+    writeInt(packer, count);
+    for (int i = 0; i < count; i++) {
+        char *key = packer->keys[i]->key;
+        appendText(&packer->message->data, key, (int)strlen(key) + 1);
+    }
+
+    for (int i = 0; i < count; i++) {
+        const char *error = writeValue(packer, *instanceSlot(instance, i));
+        if (error) return error;
+    }
+
+    return NULL;
+}
+
+static const char *writeMap(Packer *packer, Object *object) {
+    ObjMap *map = &object->as.map;
+
+    writeTag(packer, TAG_MAP);
+    writeInt(packer, map->is_set);
+    writeInt(packer, map->count);
+
+    for (int i = 0; i < map->entry_count; i++) {
+        MapEntry *entry = &map->entries[i];
+        if (!entry->live) continue;
+
+        const char *error = writeValue(packer, entry->key);
+        if (!error) error = writeValue(packer, entry->value);
+        if (error) return error;
+    }
+
+    return NULL;
+}
+
+static const char *writeValue(Packer *packer, Value value) {
+    switch (value.type) {
+        case TYPE_NUMBER:
+            writeTag(packer, TAG_NUMBER);
+            appendText(&packer->message->data, (const char *)&value.as.number, sizeof(double));
+            return NULL;
+        case TYPE_BOOL:
+            writeTag(packer, value.as.boolean ? TAG_TRUE : TAG_FALSE);
+            return NULL;
+        case TYPE_STRING:
+            writeString(packer, value.as.object);
+            return NULL;
+        case TYPE_FUNCTION:
+            return "Could not clone a function.";
+        case TYPE_WORKER:
+            return "Could not clone a Worker.";
+        case TYPE_OBJECT:
+        case TYPE_ARRAY:
+        case TYPE_MAP:
+            break;
+        default:
+            writeTag(packer, TAG_UNDEFINED);
+            return NULL;
+    }
+
+    if (writeSeen(packer, value.as.object)) return NULL;
+    if (packer->depth >= MESSAGE_DEPTH_MAX) return "Maximum nesting depth exceeded.";
+
+    packer->depth++;
+    const char *error = value.type == TYPE_OBJECT ? writeObject(packer, value.as.object) :
+                        value.type == TYPE_ARRAY  ? writeArray(packer, value.as.object) :
+                                                    writeMap(packer, value.as.object);
+    packer->depth--;
+
+    return error;
+}
+
+const char *packMessage(Heap *heap, Value value, Message *message) {
+    message->data = (TextBuffer){ NULL, 0, 0 };
+    message->object_count = 0;
+    message->strings = NULL;
+    message->string_count = message->string_capacity = 0;
+    message->elements = NULL;
+    message->element_count = message->element_capacity = 0;
+
+    Packer packer;
+    packer.heap = heap;
+    packer.message = message;
+    packer.depth = 0;
+    packer.seen = NULL;
+    packer.seen_capacity = 0;
+    packer.keys = NULL;
+    packer.key_capacity = 0;
+
+    const char *error = writeValue(&packer, value);
+    free(packer.seen);
+    free(packer.keys);
+
+    if (error) freeMessage(message);
+
+    return error;
+}
+
+typedef struct {
+    Heap        *heap;
+    Shape       *root;
+    Message     *message;
+    const char  *at;
+
+    // rebuilt objects by position, for references back
+    Object     **objects;
+    int          object_count;
+} Unpacker;
+
+static int readInt(Unpacker *reader) {
+    int value;
+    memcpy(&value, reader->at, sizeof(value));
+    reader->at += sizeof(value);
+
+    return value;
+}
+
+static Value objectValue(ValueType type, Object *object) {
+    Value value;
+    value.type = type;
+    value.as.object = object;
+
+    return value;
+}
+
+static Value readValue(Unpacker *reader);
+
+static Value readArray(Unpacker *reader, MessageTag tag) {
+    ElementKind kind = (ElementKind)readInt(reader);
+    int count = readInt(reader);
+    size_t bytes = elementSize(kind) * count;
+
+    if (tag == TAG_SHARED_ARRAY) {
+        int index = readInt(reader);
+        SharedElements *shared = reader->message->elements[index];
+        reader->message->elements[index] = NULL;
+
+        Object *object = newArrayObject(reader->heap, kind, 0);
+        ObjArray *array = &object->as.array;
+        array->elements.any = shared->data;
+        array->shared = shared;
+        array->count = array->capacity = count;
+        accountStorage(reader->heap, object, bytes);
+
+        reader->objects[reader->object_count++] = object;
+        return objectValue(TYPE_ARRAY, object);
+    }
+
+    Object *object = newArrayObject(reader->heap, kind, count);
+    ObjArray *array = &object->as.array;
+    reader->objects[reader->object_count++] = object;
+
+    if (kind != ELEMENTS_GENERIC) {
+        if (bytes > 0) memcpy(array->elements.any, reader->at, bytes);
+        reader->at += bytes;
+        array->count = count;
+        return objectValue(TYPE_ARRAY, object);
+    }
+
+    // filled in as they are read, so a reference back sees a whole array
+    for (int i = 0; i < count; i++) {
+        array->elements.values[i].type = TYPE_UNDEFINED;
+    }
+    array->count = count;
+
+    for (int i = 0; i < count; i++) {
+        array->elements.values[i] = readValue(reader);
+    }
+
+    return objectValue(TYPE_ARRAY, object);
+}
+
+static Value readObject(Unpacker *reader) {
+    int count = readInt(reader);
+
+    Shape *shape = reader->root;
+    for (int i = 0; i < count; i++) {
+        shape = shapeTransition(shape, reader->at);
+        reader->at += strlen(reader->at) + 1;
+    }
+
+    Object *object = newInstanceObject(reader->heap, shape, count);
+    ObjInstance *instance = &object->as.instance;
+    reader->objects[reader->object_count++] = object;
+
+    for (int i = 0; i < count; i++) {
+        instance->fields[i].type = TYPE_UNDEFINED;
+    }
+    for (int i = 0; i < count; i++) {
+        instance->fields[i] = readValue(reader);
+    }
+
+    return objectValue(TYPE_OBJECT, object);
+}
+
+static Value readMap(Unpacker *reader) {
+    bool isSet = readInt(reader);
+    int count = readInt(reader);
+
+    Object *object = newMapObject(reader->heap, isSet);
+    reader->objects[reader->object_count++] = object;
+
+    for (int i = 0; i < count; i++) {
+        Value key = readValue(reader);
+        Value value = readValue(reader);
+        mapSet(reader->heap, object, key, value);
+    }
+
+    return objectValue(TYPE_MAP, object);
+}
+
+static Value readValue(Unpacker *reader) {
+    MessageTag tag = (MessageTag)*reader->at++;
+    Value value;
+
+    switch (tag) {
+        case TAG_TRUE:
+        case TAG_FALSE:
+            value.type = TYPE_BOOL;
+            value.as.boolean = tag == TAG_TRUE;
+            return value;
+        case TAG_NUMBER:
+            value.type = TYPE_NUMBER;
+            memcpy(&value.as.number, reader->at, sizeof(double));
+            reader->at += sizeof(double);
+            return value;
+        case TAG_STRING: {
+            int length = readInt(reader);
+            Object *string = reserveString(reader->heap, length);
+            string->as.string.count = readInt(reader);
+            memcpy(string->as.string.chars, reader->at, length);
+            reader->at += length;
+            return objectValue(TYPE_STRING, string);
+        }
+        case TAG_SHARED_STRING: {
+            int index = readInt(reader);
+            Object *string = adoptString(reader->heap, reader->message->strings[index]);
+            reader->message->strings[index] = NULL;
+            return objectValue(TYPE_STRING, string);
+        }
+        case TAG_FROZEN_STRING: {
+            Object *string;
+            memcpy(&string, reader->at, sizeof(string));
+            reader->at += sizeof(string);
+            return objectValue(TYPE_STRING, string);
+        }
+        case TAG_ARRAY:
+        case TAG_SHARED_ARRAY:
+            return readArray(reader, tag);
+        case TAG_OBJECT:
+            return readObject(reader);
+        case TAG_MAP:
+            return readMap(reader);
+        case TAG_BACK: {
+            Object *object = reader->objects[readInt(reader)];
+            ValueType type = object->type == OBJ_INSTANCE ? TYPE_OBJECT :
+                             object->type == OBJ_ARRAY    ? TYPE_ARRAY : TYPE_MAP;
+            return objectValue(type, object);
+        }
+        default:
+            value.type = TYPE_UNDEFINED;
+            return value;
+    }
+}
+
+Value unpackMessage(Heap *heap, Shape *root, Message *message) {
+    Unpacker reader;
+    reader.heap = heap;
+    reader.root = root;
+    reader.message = message;
+    reader.at = message->data.chars;
+    reader.objects = malloc(sizeof(Object *) * (message->object_count > 0 ? message->object_count : 1));
+    reader.object_count = 0;
+
+    Value value = readValue(&reader);
+    free(reader.objects);
+
+    return value;
+}
+
+void freeMessage(Message *message) {
+    for (int i = 0; i < message->string_count; i++) {
+        if (message->strings[i]) releaseString(message->strings[i]);
+    }
+    for (int i = 0; i < message->element_count; i++) {
+        if (message->elements[i]) releaseElements(message->elements[i]);
+    }
+
+    free(message->strings);
+    free(message->elements);
+    free(message->data.chars);
+}
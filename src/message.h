@@ -0,0 +1,47 @@
+#ifndef message_h
+#define message_h
+
+#include "buffer.h"
+#include "memory.h"
+#include "shape.h"
+#include "value.h"
+
+// Strings and packed arrays at least this big are passed by reference
+// rather than copied.
+#define MESSAGE_SHARE_BYTES 4096
+
+// Objects and arrays nested deeper than this cannot be sent.
+#define MESSAGE_DEPTH_MAX 512
+
+// A value on its way from one isolate to another: a structured clone,
+// taken in the sender's heap and rebuilt in the receiver's. Objects,
+// arrays, Maps and Sets are copied with their cycles and shared
+// references intact. Big old strings and big packed elements travel by
+// reference, with the message holding one on each until it is unpacked.
+// Frozen strings belong to a program that outlives every isolate
+// running it, so they are passed as they are.
+typedef struct {
+    TextBuffer       data;
+    int              object_count;
+
+    Object         **strings;
+    int              string_count;
+    int              string_capacity;
+
+    SharedElements **elements;
+    int              element_count;
+    int              element_capacity;
+} Message;
+
+// Returns NULL, or why 'value' cannot be sent: functions and Worker
+// handles cannot. A message that failed is freed all the same.
+const char *packMessage(Heap *heap, Value value, Message *message);
+
+// Rebuilds the value in the old generation of 'heap', so nothing is
+// collected halfway, taking over the references the message held.
+// Objects get their shapes from 'root'.
+Value       unpackMessage(Heap *heap, Shape *root, Message *message);
+
+void        freeMessage(Message *message);
+
+#endif
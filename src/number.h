@@ -0,0 +1,31 @@
+#ifndef number_h
+#define number_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Room for any number formatNumber() writes, and its NUL.
+#define NUMBER_BUFFER_SIZE 32
+
+// Writes a number as JS does: the fewest significant digits that read
+// back as the same double, in fixed notation from 1e-7 up to 1e21 and
+// with an exponent outside it. Returns the length written.
+int formatNumber(double number, char *out);
+
+// The double nearest to significand * 10^exponent, where the significand
+// holds the first 19 significant digits of the decimal at 'text' and
+// 'truncated' says whether any after them were not zero. The text is
+// only read again, by strtod(), in the rare cases that need it.
+double decimalToDouble(uint64_t significand, int exponent, bool truncated, bool negative, const char *text);
+
+// Reads a decimal from the start of 'chars': an optional sign, digits
+// with an optional point, and an optional exponent. Returns how many
+// bytes it took, or 0 if there was no number there.
+int parseNumber(const char *chars, int length, double *number);
+
+// What Number(string) gives in JS: surrounding whitespace is ignored, an
+// empty string is 0, hex, octal and binary literals and Infinity are
+// understood, and anything else that is not a decimal is NaN.
+double stringToNumber(const char *chars, int length);
+
+#endif
@@ -0,0 +1,186 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deque.h"
+#include "parallel.h"
+
+typedef struct PoolThread PoolThread;
+
+struct Pool {
+    PoolThread *threads;
+    int         thread_count;
+
+    // a call starts by bumping 'generation', and is done once 'active'
+    // is back to zero; the deques are only dealt into between calls,
+    // while every thread is waiting on 'start'
+    pthread_mutex_t lock;
+    pthread_cond_t  start;
+    pthread_cond_t  done;
+    long            generation;
+    int             active;
+    bool            closing;
+    ParallelJob    *job;
+};
+
+struct PoolThread {
+    Pool      *pool;
+    int        id;
+    pthread_t  thread;
+    Deque      deque;
+    JankyVm   *vm;
+    ErrorSink  errors;
+    long       steals;
+};
+
+// Tries every other thread once, starting with the next one along. A
+// deque found empty stays empty until the next call.
+static bool stealTask(PoolThread *self, long *task) {
+    Pool *pool = self->pool;
+
+    for (int i = 1; i < pool->thread_count; i++) {
+        PoolThread *victim = &pool->threads[(self->id + i) % pool->thread_count];
+        if (stealDeque(&victim->deque, task)) {
+            self->steals++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void failJob(PoolThread *self, ParallelJob *job) {
+    pthread_mutex_lock(&self->pool->lock);
+    if (!job->failed) {
+        memcpy(job->error, self->errors.message, sizeof(job->error));
+        __atomic_store_n(&job->failed, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&self->pool->lock);
+
+    self->errors.failed = false;
+}
+
+// The program binds the functions the callback calls by name, in place
+// of the last call's. Once a callback has failed the rest of the tasks
+// are only taken, so every deque is empty for the next call.
+static void runTasks(PoolThread *self, ParallelJob *job) {
+    resetGlobals(self->vm);
+    if (runProgram(self->vm, job->program) != VM_OK) failJob(self, job);
+
+    long task;
+    while (popDeque(&self->deque, &task) || stealTask(self, &task)) {
+        if (__atomic_load_n(&job->failed, __ATOMIC_SEQ_CST)) continue;
+
+        if (runParallelTask(self->vm, job, (int)task) != VM_OK) failJob(self, job);
+    }
+
+    forgetProgram(self->vm, job->program);
+}
+
+static void *poolMain(void *arg) {
+    PoolThread *self = arg;
+    Pool *pool = self->pool;
+    long seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->closing) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        seen = pool->generation;
+        ParallelJob *job = pool->job;
+        bool closing = pool->closing;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (closing) return NULL;
+
+        runTasks(self, job);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+Pool *newPool(VmSettings *settings, int threads) {
+    Pool *pool = calloc(1, sizeof(Pool));
+    pool->threads = calloc(threads, sizeof(PoolThread));
+    pool->thread_count = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        PoolThread *thread = &pool->threads[i];
+        thread->pool = pool;
+        thread->id = i;
+        initDeque(&thread->deque, PARALLEL_SPLIT);
+
+        // a parallel call made by a callback runs where it is made
+        thread->vm = calloc(1, sizeof(JankyVm));
+        thread->vm->settings = *settings;
+        thread->vm->settings.threads = 1;
+        thread->vm->errors = &thread->errors;
+        thread->vm->keep_output = true;
+        startSession(thread->vm);
+
+        pthread_create(&thread->thread, NULL, poolMain, thread);
+    }
+
+    return pool;
+}
+
+bool runPool(Pool *pool, ParallelJob *job) {
+    // each thread gets a run of neighbouring tasks, pushed last first so
+    // that it pops them in order and walks the array front to back; the
+    // threads that finish first steal from the far end of the others' runs
+    int threads = pool->thread_count;
+    for (int i = threads - 1; i >= 0; i--) {
+        long first = (long)job->task_count * i / threads;
+        long last = (long)job->task_count * (i + 1) / threads;
+
+        for (long task = last - 1; task >= first; task--) {
+            pushDeque(&pool->threads[i].deque, task);
+        }
+    }
+
+    long before = 0;
+    for (int i = 0; i < threads; i++) before += pool->threads[i].steals;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->active = threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    job->steals = -before;
+    for (int i = 0; i < threads; i++) job->steals += pool->threads[i].steals;
+
+    return !job->failed;
+}
+
+void freePool(Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->closing = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        PoolThread *thread = &pool->threads[i];
+        pthread_join(thread->thread, NULL);
+
+        endSession(thread->vm);
+        free(thread->vm);
+        freeDeque(&thread->deque);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
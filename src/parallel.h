@@ -0,0 +1,60 @@
+#ifndef parallel_h
+#define parallel_h
+
+#include <stdint.h>
+
+#include "vm.h"
+
+// The fewest elements a task is given, so that the calls in it cost well
+// over what handing it out does; an array under two tasks' worth is not
+// worth a pool at all.
+#define PARALLEL_GRAIN 16384
+
+// Tasks a call is cut into per thread, so that a thread that falls
+// behind leaves work for the others to steal.
+#define PARALLEL_SPLIT 8
+
+typedef enum {
+    PARALLEL_MAP,
+    PARALLEL_FILTER,
+    PARALLEL_REDUCE,
+} ParallelOp;
+
+// One parallelMap(), parallelFilter() or parallelReduce() of a packed
+// array, cut into tasks of 'grain' elements each. The array and the
+// map's result are read through the caller's stack slots, which any
+// collection the calling VM makes keeps up to date; the pool's threads
+// only run while it waits.
+struct ParallelJob {
+    ParallelOp op;
+    // for the pool, the callback frozen with the functions it calls by
+    // name (see bindingChunk()); NULL on the calling thread
+    Program   *program;
+    Value     *array;
+    int        count;
+    int        grain;
+    int        task_count;
+
+    // what the op leaves: the map's result array, whether the filter
+    // keeps each element, and each task's fold for the reduce
+    Value     *mapped;
+    uint8_t   *kept;
+    double    *partials;
+
+    // set by the first callback to fail, which ends the call
+    int        failed;
+    char       error[ERROR_MESSAGE_MAX];
+    long       steals;
+};
+
+// Starts 'threads' threads, each with a session VM and a deque of tasks.
+Pool *newPool(VmSettings *settings, int threads);
+
+// Deals the job's tasks out in runs, one run per thread, and returns
+// once all of them are done. False if a callback failed, with why in
+// job->error.
+bool  runPool(Pool *pool, ParallelJob *job);
+
+void  freePool(Pool *pool);
+
+#endif
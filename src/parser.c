@@ -2,14 +2,19 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "number.h"
 #include "parser.h"
 
 static AstExpression *parseExpression(Parser *parser);
+static AstExpression *parseStatement(Parser *parser);
 
 void initParser(Parser *parser, Token *tokens) {
     parser->tokens = tokens;
     parser->current = 0;
     parser->hadError = 0;
+    parser->lazy = false;
+    parser->heap = NULL;
+    parser->errors = NULL;
 
     parser->ast = malloc(sizeof(Ast));
     parser->ast->expr_capacity = 1;
@@ -35,12 +40,71 @@ void freeExpr(AstExpression *expr) {
             break;
         case AST_VARIABLE_DECLARATION:
             free(expr->as.variable.identifier);
-
-            if (expr->as.variable.initializer) {
-                free(expr->as.variable.initializer);
+            freeExpr(expr->as.variable.initializer);
+            break;
+        case AST_PROPERTY:
+            freeExpr(expr->as.property.object);
+            free(expr->as.property.property);
+            break;
+        case AST_INDEX:
+            freeExpr(expr->as.index.object);
+            freeExpr(expr->as.index.index);
+            break;
+        case AST_OBJECT:
+            for (int i = 0; i < expr->as.object.count; i++) {
+                free(expr->as.object.keys[i]);
+                freeExpr(expr->as.object.values[i]);
+            }
+            free(expr->as.object.keys);
+            free(expr->as.object.values);
+            break;
+        case AST_SET_PROPERTY:
+            freeExpr(expr->as.setProperty.object);
+            free(expr->as.setProperty.property);
+            freeExpr(expr->as.setProperty.value);
+            break;
+        case AST_ARRAY:
+            for (int i = 0; i < expr->as.array.count; i++) {
+                freeExpr(expr->as.array.values[i]);
+            }
+            free(expr->as.array.values);
+            break;
+        case AST_SET_INDEX:
+            freeExpr(expr->as.setIndex.object);
+            freeExpr(expr->as.setIndex.index);
+            freeExpr(expr->as.setIndex.value);
+            break;
+        case AST_CALL:
+        case AST_NEW:
+            freeExpr(expr->as.call.callee);
+            for (int i = 0; i < expr->as.call.argCount; i++) {
+                freeExpr(expr->as.call.args[i]);
+            }
+            free(expr->as.call.args);
+            break;
+        case AST_FUNCTION:
+            free(expr->as.function.name);
+            for (int i = 0; i < expr->as.function.paramCount; i++) {
+                free(expr->as.function.params[i]);
+            }
+            free(expr->as.function.params);
+            freeExpr(expr->as.function.body);
+            break;
+        case AST_RETURN:
+            freeExpr(expr->as.ret.value);
+            break;
+        case AST_IF:
+            freeExpr(expr->as.conditional.condition);
+            freeExpr(expr->as.conditional.thenBranch);
+            freeExpr(expr->as.conditional.elseBranch);
+            break;
+        case AST_BLOCK:
+            for (int i = 0; i < expr->as.block.count; i++) {
+                freeExpr(expr->as.block.exprs[i]);
             }
+            free(expr->as.block.exprs);
             break;
-        
+
         default:
             break;
     }
@@ -96,7 +160,7 @@ static Token currentToken(Parser *parser) {
 
 static AstExpression *compileError(Parser *parser, char *message) {
     parser->hadError = 1;
-    printf("Error: %s\n", message);
+    reportError(parser->errors, message);
 
     return NULL;
 }
@@ -122,11 +186,13 @@ static void printExpr(AstExpression expr, int indent) {
     case AST_CONSTANT:
         printIndent(indent);
         switch (expr.as.constant.type) {
-            case TYPE_NUMBER:   printf("NUMBER   : %d\n",  expr.as.constant.as.number);          break;
+            case TYPE_NUMBER:   printf("NUMBER   : %g\n",  expr.as.constant.as.number);          break;
             case TYPE_BOOL:     printf("BOOLEAN  : %s\n",  expr.as.constant.as.boolean ? "true":"false"); break;
             case TYPE_STRING:   printf("STRING   : \"%s\"\n", expr.as.constant.as.object->as.string.chars); break;
             case TYPE_IDENTIFIER:
                                printf("IDENT    : %s\n",   expr.as.constant.as.identifier);     break;
+            case TYPE_UNDEFINED:
+                               printf("UNDEFINED\n");                                           break;
             default:            printf("CONST ?  \n");                                           break;
         }
         break;
@@ -150,8 +216,55 @@ static void printExpr(AstExpression expr, int indent) {
         printExpr(*expr.as.property.object, indent + 4);
         break;
 
+    case AST_INDEX:
+        printIndent(indent); printf("INDEX     :\n");
+        printIndent(indent); printf("OBJECT ->\n");
+        printExpr(*expr.as.index.object, indent + 4);
+        printIndent(indent); printf("AT ->\n");
+        printExpr(*expr.as.index.index, indent + 4);
+        break;
+
+    case AST_OBJECT:
+        printIndent(indent); printf("OBJECT    : (%d propert%s)\n",
+                              expr.as.object.count,
+                              expr.as.object.count == 1 ? "y" : "ies");
+        for (int i = 0; i < expr.as.object.count; ++i) {
+            printIndent(indent); printf("%s ->\n", expr.as.object.keys[i]);
+            printExpr(*expr.as.object.values[i], indent + 4);
+        }
+        break;
+
+    case AST_SET_PROPERTY:
+        printIndent(indent); printf("SET       : .%s\n", expr.as.setProperty.property);
+        printIndent(indent); printf("OBJECT ->\n");
+        printExpr(*expr.as.setProperty.object, indent + 4);
+        printIndent(indent); printf("VALUE ->\n");
+        printExpr(*expr.as.setProperty.value, indent + 4);
+        break;
+
+    case AST_ARRAY:
+        printIndent(indent); printf("ARRAY     : (%d element%s)\n",
+                              expr.as.array.count,
+                              expr.as.array.count == 1 ? "" : "s");
+        for (int i = 0; i < expr.as.array.count; ++i) {
+            printExpr(*expr.as.array.values[i], indent + 2);
+        }
+        break;
+
+    case AST_SET_INDEX:
+        printIndent(indent); printf("SET INDEX :\n");
+        printIndent(indent); printf("OBJECT ->\n");
+        printExpr(*expr.as.setIndex.object, indent + 4);
+        printIndent(indent); printf("AT ->\n");
+        printExpr(*expr.as.setIndex.index, indent + 4);
+        printIndent(indent); printf("VALUE ->\n");
+        printExpr(*expr.as.setIndex.value, indent + 4);
+        break;
+
     case AST_CALL:
-        printIndent(indent); printf("CALL      : (%d arg%s)\n",
+    case AST_NEW:
+        printIndent(indent); printf("%s : (%d arg%s)\n",
+                              expr.type == AST_NEW ? "NEW      " : "CALL     ",
                               expr.as.call.argCount,
                               expr.as.call.argCount == 1 ? "" : "s");
         printIndent(indent); printf("CALLEE ->\n");
@@ -174,6 +287,47 @@ static void printExpr(AstExpression expr, int indent) {
         }
         break;
 
+    case AST_FUNCTION:
+        printIndent(indent); printf("FUNCTION  : %s (", expr.as.function.name ? expr.as.function.name : "<anonymous>");
+        for (int i = 0; i < expr.as.function.paramCount; ++i) {
+            printf("%s%s", i > 0 ? ", " : "", expr.as.function.params[i]);
+        }
+        printf(")\n");
+        if (expr.as.function.body) {
+            printExpr(*expr.as.function.body, indent + 2);
+        } else {
+            printIndent(indent + 2); printf("DEFERRED\n");
+        }
+        break;
+
+    case AST_RETURN:
+        printIndent(indent); printf("RETURN\n");
+        if (expr.as.ret.value) {
+            printExpr(*expr.as.ret.value, indent + 4);
+        }
+        break;
+
+    case AST_IF:
+        printIndent(indent); printf("IF\n");
+        printIndent(indent); printf("COND  ->\n");
+        printExpr(*expr.as.conditional.condition, indent + 4);
+        printIndent(indent); printf("THEN  ->\n");
+        printExpr(*expr.as.conditional.thenBranch, indent + 4);
+        if (expr.as.conditional.elseBranch) {
+            printIndent(indent); printf("ELSE  ->\n");
+            printExpr(*expr.as.conditional.elseBranch, indent + 4);
+        }
+        break;
+
+    case AST_BLOCK:
+        printIndent(indent); printf("BLOCK     : (%d statement%s)\n",
+                              expr.as.block.count,
+                              expr.as.block.count == 1 ? "" : "s");
+        for (int i = 0; i < expr.as.block.count; ++i) {
+            printExpr(*expr.as.block.exprs[i], indent + 2);
+        }
+        break;
+
     case AST_UNKNOWN:
         printIndent(indent); printf("UNKNOWN\n");
         break;
@@ -208,6 +362,245 @@ AstExpression *newBinaryExpr(TokenType op, AstExpression *left, AstExpression *r
     return expr;
 }
 
+static void appendExpr(AstExpression ***exprs, int *count, int *capacity, AstExpression *expr) {
+    if (*count >= *capacity) {
+        *capacity = *capacity == 0 ? 4 : *capacity * 2;
+        *exprs = realloc(*exprs, sizeof(AstExpression *) * *capacity);
+    }
+
+    (*exprs)[(*count)++] = expr;
+}
+
+static AstExpression *parseBlock(Parser *parser) {
+    if (!expect(parser, LEFT_BRACE)) return compileError(parser, "Expected '{'");
+
+    AstExpression **exprs = NULL;
+    int count = 0;
+    int capacity = 0;
+
+    while (!isEnd(parser) && !match(parser, RIGHT_BRACE)) {
+        AstExpression *stmt = parseStatement(parser);
+        if (!stmt) break;
+
+        appendExpr(&exprs, &count, &capacity, stmt);
+    }
+
+    AstExpression *block = newExpr(AST_BLOCK);
+    block->as.block.exprs = exprs;
+    block->as.block.count = count;
+
+    if (parser->hadError) {
+        freeExpr(block);
+        return NULL;
+    }
+
+    if (!expect(parser, RIGHT_BRACE)) {
+        freeExpr(block);
+        return compileError(parser, "Expected '}'");
+    }
+
+    return block;
+}
+
+// Skips a function body by matching braces alone. Returns false, leaving
+// the parser where it was, if the body is too short to be worth deferring.
+static bool skipBody(Parser *parser) {
+    int start = parser->current;
+    int depth = 0;
+
+    do {
+        if (isEnd(parser)) {
+            compileError(parser, "Expected '}'");
+            return true;
+        }
+
+        TokenType type = peek(parser).type;
+        if (type == LEFT_BRACE) depth++;
+        else if (type == RIGHT_BRACE) depth--;
+
+        advance(parser);
+    } while (depth > 0);
+
+    if (parser->current - start < LAZY_MIN_TOKENS) {
+        parser->current = start;
+        return false;
+    }
+
+    return true;
+}
+
+static AstExpression *parseFunction(Parser *parser, bool deferrable) {
+    char *name = NULL;
+    int start = parser->current;
+
+    Token token = currentToken(parser);
+    if (match(parser, IDENTIFIER)) {
+        name = strdup(token.lexeme);
+        advance(parser);
+    }
+
+    AstExpression *expr = newExpr(AST_FUNCTION);
+    expr->as.function.name = name;
+    expr->as.function.params = NULL;
+    expr->as.function.paramCount = 0;
+    expr->as.function.body = NULL;
+    expr->as.function.tokens = parser->tokens;
+    expr->as.function.start = start;
+
+    if (!expect(parser, LEFT_PAREN)) {
+        freeExpr(expr);
+        return compileError(parser, "Expected '(' after function name");
+    }
+
+    int capacity = 0;
+    while (!match(parser, RIGHT_PAREN)) {
+        Token param = currentToken(parser);
+        if (!expectIdentifier(parser)) {
+            freeExpr(expr);
+            return NULL;
+        }
+
+        if (expr->as.function.paramCount >= capacity) {
+            capacity = capacity == 0 ? 4 : capacity * 2;
+            expr->as.function.params = realloc(expr->as.function.params, sizeof(char *) * capacity);
+        }
+        expr->as.function.params[expr->as.function.paramCount++] = strdup(param.lexeme);
+
+        if (!expect(parser, COMMA)) break;
+    }
+
+    if (!expect(parser, RIGHT_PAREN)) {
+        freeExpr(expr);
+        return compileError(parser, "Expected ')' after parameters");
+    }
+
+    if (!match(parser, LEFT_BRACE)) {
+        freeExpr(expr);
+        return compileError(parser, "Expected '{'");
+    }
+
+    if (deferrable && parser->lazy && skipBody(parser)) {
+        if (parser->hadError) {
+            freeExpr(expr);
+            return NULL;
+        }
+
+        return expr;
+    }
+
+    expr->as.function.body = parseBlock(parser);
+    if (!expr->as.function.body) {
+        freeExpr(expr);
+        return NULL;
+    }
+
+    return expr;
+}
+
+AstExpression *parseFunctionAt(Parser *parser, int start) {
+    parser->current = start;
+
+    return parseFunction(parser, false);
+}
+
+// Keys are identifiers or strings, and a trailing comma is allowed.
+static AstExpression *parseObject(Parser *parser) {
+    AstExpression *expr = newExpr(AST_OBJECT);
+    expr->as.object.keys = NULL;
+    expr->as.object.values = NULL;
+    expr->as.object.count = 0;
+
+    int capacity = 0;
+    while (!match(parser, RIGHT_BRACE)) {
+        Token key = currentToken(parser);
+        if (!expect(parser, IDENTIFIER) && !expect(parser, STRING)) {
+            freeExpr(expr);
+            return compileError(parser, "Expected property name");
+        }
+
+        if (!expect(parser, COLON)) {
+            freeExpr(expr);
+            return compileError(parser, "Expected ':' after property name");
+        }
+
+        AstExpression *value = parseExpression(parser);
+        if (!value) {
+            freeExpr(expr);
+            return NULL;
+        }
+
+        int count = expr->as.object.count;
+        if (count >= capacity) {
+            capacity = capacity == 0 ? 4 : capacity * 2;
+            expr->as.object.keys = realloc(expr->as.object.keys, sizeof(char *) * capacity);
+            expr->as.object.values = realloc(expr->as.object.values, sizeof(AstExpression *) * capacity);
+        }
+        expr->as.object.keys[count] = strdup(key.lexeme);
+        expr->as.object.values[count] = value;
+        expr->as.object.count++;
+
+        if (!expect(parser, COMMA)) break;
+    }
+
+    if (!expect(parser, RIGHT_BRACE)) {
+        freeExpr(expr);
+        return compileError(parser, "Expected '}' after properties");
+    }
+
+    return expr;
+}
+
+static AstExpression *parseArray(Parser *parser) {
+    AstExpression **values = NULL;
+    int count = 0;
+    int capacity = 0;
+
+    while (!match(parser, RIGHT_BRACKET)) {
+        AstExpression *value = parseExpression(parser);
+        if (!value) break;
+
+        appendExpr(&values, &count, &capacity, value);
+        if (!expect(parser, COMMA)) break;
+    }
+
+    AstExpression *expr = newExpr(AST_ARRAY);
+    expr->as.array.values = values;
+    expr->as.array.count = count;
+
+    if (parser->hadError) {
+        freeExpr(expr);
+        return NULL;
+    }
+
+    if (!expect(parser, RIGHT_BRACKET)) {
+        freeExpr(expr);
+        return compileError(parser, "Expected ']' after elements");
+    }
+
+    return expr;
+}
+
+static AstExpression *parseCall(Parser *parser, AstExpression *callee);
+
+// 'new Name(args)', which is a call as far as the tree goes.
+static AstExpression *parseNew(Parser *parser) {
+    Token name = currentToken(parser);
+    if (!expectIdentifier(parser)) return NULL;
+
+    if (!expect(parser, LEFT_PAREN)) {
+        return compileError(parser, "Expected '(' after constructor");
+    }
+
+    AstExpression *callee = newExpr(AST_CONSTANT);
+    callee->as.constant.type = TYPE_IDENTIFIER;
+    callee->as.constant.as.identifier = strdup(name.lexeme);
+
+    AstExpression *expr = parseCall(parser, callee);
+    if (expr) expr->type = AST_NEW;
+
+    return expr;
+}
+
 static AstExpression *parsePrimary(Parser *parser) {
     Token token = currentToken(parser);
     advance(parser);
@@ -216,7 +609,7 @@ static AstExpression *parsePrimary(Parser *parser) {
         case NUMBER: {
             AstExpression *expr = newExpr(AST_CONSTANT);
             expr->as.constant.type = TYPE_NUMBER;
-            expr->as.constant.as.number = atoi(token.lexeme);
+            parseNumber(token.lexeme, strlen(token.lexeme), &expr->as.constant.as.number);
             
             return expr;
         }
@@ -232,13 +625,7 @@ static AstExpression *parsePrimary(Parser *parser) {
             AstExpression *expr = newExpr(AST_CONSTANT);
             expr->as.constant.type = TYPE_STRING;
 
-            Object *obj = malloc(sizeof(Object));
-            obj->type = OBJ_STRING;
-
-            expr->as.constant.as.object = obj;
-
-            expr->as.constant.as.object->as.string.chars = strdup(token.lexeme);
-            expr->as.constant.as.object->as.string.length = strlen(token.lexeme);
+            expr->as.constant.as.object = newStringObject(parser->heap, token.lexeme, strlen(token.lexeme));
 
             return expr;
         }
@@ -249,6 +636,35 @@ static AstExpression *parsePrimary(Parser *parser) {
             
             return expr;
         }
+        case UNDEFINED: {
+            AstExpression *expr = newExpr(AST_CONSTANT);
+            expr->as.constant.type = TYPE_UNDEFINED;
+
+            return expr;
+        }
+        case FUNCTION: {
+            return parseFunction(parser, true);
+        }
+        case LEFT_BRACE: {
+            return parseObject(parser);
+        }
+        case LEFT_BRACKET: {
+            return parseArray(parser);
+        }
+        case NEW: {
+            return parseNew(parser);
+        }
+        case LEFT_PAREN: {
+            AstExpression *expr = parseExpression(parser);
+            if (!expr) return NULL;
+
+            if (!expect(parser, RIGHT_PAREN)) {
+                freeExpr(expr);
+                return compileError(parser, "Expected ')' after expression");
+            }
+
+            return expr;
+        }
         default: {
             compileError(parser, "Expected expression");
             return NULL;
@@ -256,20 +672,76 @@ static AstExpression *parsePrimary(Parser *parser) {
     }
 }
 
+static AstExpression *parseCall(Parser *parser, AstExpression *callee) {
+    AstExpression **args = NULL;
+    int argCount = 0;
+    int capacity = 0;
+
+    while (!match(parser, RIGHT_PAREN)) {
+        AstExpression *arg = parseExpression(parser);
+        if (!arg) break;
+
+        appendExpr(&args, &argCount, &capacity, arg);
+        if (!expect(parser, COMMA)) break;
+    }
+
+    AstExpression *call = newExpr(AST_CALL);
+    call->as.call.callee = callee;
+    call->as.call.args = args;
+    call->as.call.argCount = argCount;
+
+    if (parser->hadError) {
+        freeExpr(call);
+        return NULL;
+    }
+
+    if (!expect(parser, RIGHT_PAREN)) {
+        freeExpr(call);
+        return compileError(parser, "Expected ')' after arguments");
+    }
+
+    return call;
+}
+
 static AstExpression *parsePostfix(Parser *parser) {
     AstExpression *expr = parsePrimary(parser);
+    if (!expr) return NULL;
 
     for (;;) {
         if (match(parser, DOT)) {
             advance(parser);
 
             Token name = currentToken(parser);
-            if (!expectIdentifier(parser)) return compileError(parser, "Expected property name after '.");
+            if (!expectIdentifier(parser)) {
+                freeExpr(expr);
+                return compileError(parser, "Expected property name after '.");
+            }
             
             AstExpression *prop = newExpr(AST_PROPERTY);
             prop->as.property.object  = expr;
             prop->as.property.property = strdup(name.lexeme);
             expr = prop;
+        } else if (match(parser, LEFT_PAREN)) {
+            advance(parser);
+
+            expr = parseCall(parser, expr);
+            if (!expr) return NULL;
+        } else if (match(parser, LEFT_BRACKET)) {
+            advance(parser);
+
+            AstExpression *index = parseExpression(parser);
+            if (!index || !expect(parser, RIGHT_BRACKET)) {
+                freeExpr(expr);
+                freeExpr(index);
+                return compileError(parser, "Expected ']' after index");
+            }
+
+            AstExpression *subscript = newExpr(AST_INDEX);
+            subscript->as.index.object = expr;
+            subscript->as.index.index = index;
+            expr = subscript;
+        } else {
+            break;
         }
     }
 
@@ -422,8 +894,43 @@ static AstExpression *parseOr(Parser *parser) {
     return left;
 }
 
+// Only properties and elements can be assigned to. Assignment is
+// right-associative.
+static AstExpression *parseAssignment(Parser *parser) {
+    AstExpression *target = parseOr(parser);
+    if (!target || !match(parser, SINGLE_EQUALS)) return target;
+    advance(parser);
+
+    if (target->type != AST_PROPERTY && target->type != AST_INDEX) {
+        freeExpr(target);
+        return compileError(parser, "Invalid assignment target.");
+    }
+
+    AstExpression *value = parseAssignment(parser);
+    if (!value) {
+        freeExpr(target);
+        return NULL;
+    }
+
+    AstExpression *expr;
+    if (target->type == AST_PROPERTY) {
+        expr = newExpr(AST_SET_PROPERTY);
+        expr->as.setProperty.object = target->as.property.object;
+        expr->as.setProperty.property = target->as.property.property;
+        expr->as.setProperty.value = value;
+    } else {
+        expr = newExpr(AST_SET_INDEX);
+        expr->as.setIndex.object = target->as.index.object;
+        expr->as.setIndex.index = target->as.index.index;
+        expr->as.setIndex.value = value;
+    }
+    free(target);
+
+    return expr;
+}
+
 static AstExpression *parseExpression(Parser *parser) {
-    return parseOr(parser);
+    return parseAssignment(parser);
 }
 
 static inline VariableBinding mapVariableBinding(TokenType type) {
@@ -481,12 +988,89 @@ static AstExpression *parseVariableDeclaration(Parser *parser) {
     return stmt;
 }
 
+static AstExpression *parseFunctionDeclaration(Parser *parser) {
+    advance(parser);
+
+    Token identifier = currentToken(parser);
+    AstExpression *function = parseFunction(parser, true);
+    if (!function) return NULL;
+
+    AstExpression *stmt = newExpr(AST_VARIABLE_DECLARATION);
+
+    stmt->as.variable.binding = VARIABLE_VAR;
+    stmt->as.variable.identifier = strdup(identifier.lexeme);
+    stmt->as.variable.initializer = function;
+
+    return stmt;
+}
+
+static AstExpression *parseReturn(Parser *parser) {
+    advance(parser);
+
+    AstExpression *value = NULL;
+    if (!match(parser, SEMICOLON) && !match(parser, RIGHT_BRACE) && !isEnd(parser)) {
+        value = parseExpression(parser);
+        if (!value) return NULL;
+    }
+    expect(parser, SEMICOLON);
+
+    AstExpression *stmt = newExpr(AST_RETURN);
+    stmt->as.ret.value = value;
+
+    return stmt;
+}
+
+static AstExpression *parseIf(Parser *parser) {
+    advance(parser);
+
+    if (!expect(parser, LEFT_PAREN)) return compileError(parser, "Expected '(' after 'if'");
+
+    AstExpression *condition = parseExpression(parser);
+    if (!condition) return NULL;
+
+    if (!expect(parser, RIGHT_PAREN)) {
+        freeExpr(condition);
+        return compileError(parser, "Expected ')' after condition");
+    }
+
+    AstExpression *stmt = newExpr(AST_IF);
+    stmt->as.conditional.condition = condition;
+    stmt->as.conditional.elseBranch = NULL;
+    stmt->as.conditional.thenBranch = parseStatement(parser);
+
+    if (stmt->as.conditional.thenBranch && expect(parser, ELSE)) {
+        stmt->as.conditional.elseBranch = parseStatement(parser);
+    }
+
+    if (parser->hadError) {
+        freeExpr(stmt);
+        return NULL;
+    }
+
+    return stmt;
+}
+
 static AstExpression *parseStatement(Parser *parser) {
     if (match(parser, LET) || match(parser, CONST) || match(parser, VAR)) {
         return parseVariableDeclaration(parser);
     }
+    if (match(parser, FUNCTION) && parser->tokens[parser->current + 1].type == IDENTIFIER) {
+        return parseFunctionDeclaration(parser);
+    }
+    if (match(parser, RETURN)) {
+        return parseReturn(parser);
+    }
+    if (match(parser, IF)) {
+        return parseIf(parser);
+    }
+    if (match(parser, LEFT_BRACE)) {
+        return parseBlock(parser);
+    }
+
+    AstExpression *expr = parseExpression(parser);
+    expect(parser, SEMICOLON);
 
-    return parseExpression(parser);
+    return expr;
 }
 
 void parse(Parser *parser) {
@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 
+#include "error.h"
 #include "lexer.h"
+#include "memory.h"
 #include "value.h"
 
 typedef enum {
@@ -12,7 +14,17 @@ typedef enum {
     AST_BINARY,
     AST_VARIABLE_DECLARATION,
     AST_PROPERTY,
+    AST_INDEX,
+    AST_OBJECT,
+    AST_SET_PROPERTY,
+    AST_ARRAY,
+    AST_SET_INDEX,
     AST_CALL,
+    AST_NEW,
+    AST_FUNCTION,
+    AST_RETURN,
+    AST_IF,
+    AST_BLOCK,
     
     AST_UNKNOWN,
 } AstType;
@@ -26,7 +38,7 @@ typedef struct {
 typedef struct {
     ValueType type;
     union {
-        int     number;
+        double  number;
         bool    boolean;
         Object *object;
         char   *identifier;
@@ -45,6 +57,36 @@ typedef struct {
     char          *property;
 } AstProperty;
 
+typedef struct {
+    AstExpression *object;
+    AstExpression *index;
+} AstIndex;
+
+// An object literal; the properties are added in source order, so
+// literals written alike get the same shape.
+typedef struct {
+    char          **keys;
+    AstExpression **values;
+    int             count;
+} AstObject;
+
+typedef struct {
+    AstExpression *object;
+    char          *property;
+    AstExpression *value;
+} AstSetProperty;
+
+typedef struct {
+    AstExpression **values;
+    int             count;
+} AstArray;
+
+typedef struct {
+    AstExpression *object;
+    AstExpression *index;
+    AstExpression *value;
+} AstSetIndex;
+
 typedef struct {
     char *identifier;
     VariableBinding binding;
@@ -57,6 +99,33 @@ typedef struct {
     AstExpression  *callee;
 } AstCall;
 
+typedef struct {
+    AstExpression **exprs;
+    int             count;
+} AstBlock;
+
+// 'body' is NULL when the parser deferred it. 'tokens' and 'start' locate
+// the function (its name or parameter list) so it can be parsed later.
+typedef struct {
+    char          *name;
+    char         **params;
+    int            paramCount;
+    AstExpression *body;
+
+    Token         *tokens;
+    int            start;
+} AstFunction;
+
+typedef struct {
+    AstExpression *value;
+} AstReturn;
+
+typedef struct {
+    AstExpression *condition;
+    AstExpression *thenBranch;
+    AstExpression *elseBranch;
+} AstIf;
+
 typedef struct {
     TokenType      op;
     AstExpression *right;
@@ -79,6 +148,15 @@ struct AstExpression {
         VariableDeclaration variable;
         AstCall             call;
         AstProperty         property;
+        AstIndex            index;
+        AstObject           object;
+        AstSetProperty      setProperty;
+        AstArray            array;
+        AstSetIndex         setIndex;
+        AstFunction         function;
+        AstReturn           ret;
+        AstIf               conditional;
+        AstBlock            block;
     } as;
 };
 
@@ -88,17 +166,27 @@ typedef struct {
     int             expr_capacity;
 } Ast;
 
+// Function bodies spanning at least this many tokens are only
+// brace-matched when the parser is lazy, and parsed on first call.
+#define LAZY_MIN_TOKENS 64
+
 typedef struct {
     int    current;
     Token *tokens;
     Ast   *ast;
     bool   hadError;
+    bool   lazy;
+    Heap  *heap;
+    ErrorSink *errors;
 } Parser;
 
 void initParser(Parser *parser, Token *tokens);
 void freeParser(Parser *parser);
+void freeExpr(AstExpression *expr);
 void parse(Parser *Parser);
 
+AstExpression *parseFunctionAt(Parser *parser, int start);
+
 void printAst(Ast *ast);
 
 #endif
\ No newline at end of file
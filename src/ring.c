@@ -0,0 +1,116 @@
+#include <stdlib.h>
+
+#include "ring.h"
+
+static long ringSize(long capacity) {
+    long size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+void initSpsc(SpscRing *ring, long capacity) {
+    ring->size = ringSize(capacity);
+    ring->items = malloc(sizeof(void *) * ring->size);
+    ring->tail = ring->cached_head = 0;
+    ring->head = ring->cached_tail = 0;
+}
+
+void freeSpsc(SpscRing *ring) {
+    free(ring->items);
+}
+
+// The item is written before the release store of 'tail' publishes it,
+// and the slot is only reused once the consumer's release of 'head' says
+// it has been read.
+bool pushSpsc(SpscRing *ring, void *item) {
+    long tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    if (tail - ring->cached_head >= ring->size) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail - ring->cached_head >= ring->size) return false;
+    }
+
+    ring->items[tail & (ring->size - 1)] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+bool popSpsc(SpscRing *ring, void **item) {
+    long head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    if (head == ring->cached_tail) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head == ring->cached_tail) return false;
+    }
+
+    *item = ring->items[head & (ring->size - 1)];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+void initMpsc(MpscRing *ring, long capacity) {
+    ring->size = ringSize(capacity);
+    ring->slots = malloc(sizeof(MpscSlot) * ring->size);
+    for (long i = 0; i < ring->size; i++) {
+        ring->slots[i].sequence = i;
+    }
+
+    ring->tail = 0;
+    ring->head = 0;
+}
+
+void freeMpsc(MpscRing *ring) {
+    free(ring->slots);
+}
+
+// A slot whose sequence equals the position is free to claim at that
+// position; one still a lap behind has not been read yet, so the ring
+// is full. Filling the slot then moves its sequence on by one, which
+// hands it to the consumer.
+bool pushMpsc(MpscRing *ring, void *item) {
+    long position = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    MpscSlot *slot;
+
+    for (;;) {
+        slot = &ring->slots[position & (ring->size - 1)];
+        long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long difference = sequence - position;
+
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&ring->tail, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->item = item;
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// Reading a slot moves its sequence a lap on, freeing it for the
+// producer that reaches it next time round.
+bool popMpsc(MpscRing *ring, void **item) {
+    long position = ring->head;
+    MpscSlot *slot = &ring->slots[position & (ring->size - 1)];
+
+    long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != position + 1) return false;
+
+    *item = slot->item;
+    __atomic_store_n(&slot->sequence, position + ring->size, __ATOMIC_RELEASE);
+    ring->head = position + 1;
+
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef ring_h
+#define ring_h
+
+#include <stdbool.h>
+
+#define CACHE_LINE 64
+
+// Bounded lock-free queues of pointers, for messages between isolates.
+// Both hold a power of two of items and refuse a push when full rather
+// than grow, so a producer that runs ahead of its consumer is held back.
+
+// One producer and one consumer. Each side keeps the other's index as
+// it last read it, and only reads it again when that copy says the ring
+// is full or empty, so the shared indices are rarely touched.
+typedef struct {
+    void **items;
+    long   size;
+
+    _Alignas(CACHE_LINE) long tail;
+    long   cached_head;
+
+    _Alignas(CACHE_LINE) long head;
+    long   cached_tail;
+} SpscRing;
+
+void initSpsc(SpscRing *ring, long capacity);
+void freeSpsc(SpscRing *ring);
+bool pushSpsc(SpscRing *ring, void *item);
+bool popSpsc(SpscRing *ring, void **item);
+
+// Any number of producers and one consumer, after Vyukov's bounded
+// queue: each slot carries a sequence number saying whose turn it is,
+// so producers only contend on the CAS that claims a slot and the
+// consumer never takes part in it.
+typedef struct {
+    long  sequence;
+    void *item;
+} MpscSlot;
+
+typedef struct {
+    MpscSlot *slots;
+    long      size;
+
+    _Alignas(CACHE_LINE) long tail;
+    _Alignas(CACHE_LINE) long head;
+} MpscRing;
+
+void initMpsc(MpscRing *ring, long capacity);
+void freeMpsc(MpscRing *ring);
+bool pushMpsc(MpscRing *ring, void *item);
+bool popMpsc(MpscRing *ring, void **item);
+
+#endif
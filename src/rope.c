@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rope.h"
+
+// Copies the leaves right to left into one old string, using an explicit
+// stack so that a rope a million concatenations deep cannot overflow the
+// C stack. Sides that were flattened before are copied from their cache.
+// The rope keeps the copy and lets go of its sides.
+Object *flattenRope(Heap *heap, Object *rope) {
+    ObjRope *node = &rope->as.rope;
+    if (node->flat) return node->flat;
+
+    Object *flat = reserveString(heap, node->length);
+    flat->as.string.count = node->count;
+    char *chars = flat->as.string.chars;
+    int offset = node->length;
+
+    int capacity = 64;
+    int count = 0;
+    Object **stack = malloc(sizeof(Object *) * capacity);
+    stack[count++] = rope;
+
+    while (count > 0) {
+        Object *object = stack[--count];
+
+        if (object->type == OBJ_ROPE && object->as.rope.flat) {
+            object = object->as.rope.flat;
+        }
+
+        if (object->type == OBJ_STRING) {
+            offset -= object->as.string.length;
+            memcpy(chars + offset, object->as.string.chars, object->as.string.length);
+            continue;
+        }
+
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, sizeof(Object *) * capacity);
+        }
+
+        // the right side is popped, and so copied, first
+        stack[count++] = object->as.rope.left;
+        stack[count++] = object->as.rope.right;
+    }
+
+    free(stack);
+
+    Value side;
+    side.type = TYPE_STRING;
+    side.as.object = node->left;
+    satbBarrier(heap, side);
+    side.as.object = node->right;
+    satbBarrier(heap, side);
+
+    __atomic_store_n(&node->flat, flat, __ATOMIC_RELEASE);
+    __atomic_store_n(&node->left, NULL, __ATOMIC_RELAXED);
+    __atomic_store_n(&node->right, NULL, __ATOMIC_RELAXED);
+
+    return flat;
+}
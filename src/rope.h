@@ -0,0 +1,30 @@
+#ifndef rope_h
+#define rope_h
+
+#include "memory.h"
+#include "value.h"
+
+// Concatenations shorter than this are copied straight away; a rope node
+// costs more than copying a few dozen bytes.
+#define ROPE_MIN_LENGTH 64
+
+Object *flattenRope(Heap *heap, Object *rope);
+
+static inline int stringLength(Object *string) {
+    return string->type == OBJ_ROPE ? string->as.rope.length : string->as.string.length;
+}
+
+static inline int stringCount(Object *string) {
+    return string->type == OBJ_ROPE ? string->as.rope.count : string->as.string.count;
+}
+
+// The flat string behind any TYPE_STRING object, flattening a rope first.
+static inline Object *flatten(Heap *heap, Object *string) {
+    return string->type == OBJ_ROPE ? flattenRope(heap, string) : string;
+}
+
+static inline ObjString *asFlatString(Heap *heap, Object *string) {
+    return &flatten(heap, string)->as.string;
+}
+
+#endif
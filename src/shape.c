@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "shape.h"
+
+Shape *newRootShape() {
+    Shape *root = calloc(1, sizeof(Shape));
+    return root;
+}
+
+void freeShapes(Shape *root) {
+    for (int i = 0; i < root->transition_count; i++) {
+        freeShapes(root->transitions[i]);
+    }
+
+    free(root->transitions);
+    free(root->key);
+    free(root);
+}
+
+// The child adding 'key', if some object has been given it before.
+Shape *findTransition(Shape *shape, const char *key) {
+    for (int i = 0; i < shape->transition_count; i++) {
+        if (strcmp(shape->transitions[i]->key, key) == 0) return shape->transitions[i];
+    }
+
+    return NULL;
+}
+
+// The shape an object of 'shape' has after 'key' is added to it.
+Shape *shapeTransition(Shape *shape, const char *key) {
+    Shape *existing = findTransition(shape, key);
+    if (existing) return existing;
+
+    if (shape->transition_count == shape->transition_capacity) {
+        shape->transition_capacity = shape->transition_capacity == 0 ? 2 : shape->transition_capacity * 2;
+        shape->transitions = realloc(shape->transitions, sizeof(Shape *) * shape->transition_capacity);
+    }
+
+    Shape *child = calloc(1, sizeof(Shape));
+    child->parent = shape;
+    child->key = strdup(key);
+    child->count = shape->count + 1;
+
+    shape->transitions[shape->transition_count++] = child;
+    return child;
+}
+
+// The slot holding 'key', or -1. The last key added is the last slot, so
+// walking up the parents visits slots from the top down.
+int shapeLookup(Shape *shape, const char *key) {
+    for (; shape->key != NULL; shape = shape->parent) {
+        if (strcmp(shape->key, key) == 0) return shape->count - 1;
+    }
+
+    return -1;
+}
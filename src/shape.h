@@ -0,0 +1,26 @@
+#ifndef shape_h
+#define shape_h
+
+#include "value.h"
+
+// A hidden class. Objects given the same properties in the same order
+// share a shape, so a property's slot can be remembered per shape
+// instead of looked up per object. Shapes form a tree from the empty
+// root: each child adds one key, which gets the next slot.
+struct Shape {
+    Shape  *parent;
+    char   *key;
+    int     count;
+
+    Shape **transitions;
+    int     transition_count;
+    int     transition_capacity;
+};
+
+Shape *newRootShape();
+void   freeShapes(Shape *root);
+Shape *findTransition(Shape *shape, const char *key);
+Shape *shapeTransition(Shape *shape, const char *key);
+int    shapeLookup(Shape *shape, const char *key);
+
+#endif
@@ -0,0 +1,482 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sort.h"
+
+// Radix passes cost the same however few keys there are, so short runs
+// are insertion sorted instead.
+#define RADIX_THRESHOLD         256
+#define INSERTION_THRESHOLD     24
+#define NINTHER_THRESHOLD       128
+#define PARTIAL_INSERTION_LIMIT 8
+#define PARTITION_BLOCK         64
+
+#define SIGN_BIT_64 0x8000000000000000ull
+#define SIGN_BIT_32 0x80000000u
+
+// Doubles as unsigned keys in the same order: negative numbers have every
+// bit flipped and the rest only the sign. NaNs are all made the positive
+// quiet one.
+static uint64_t doubleKey(double value) {
+    uint64_t bits;
+    if (isnan(value)) value = NAN;
+    memcpy(&bits, &value, sizeof(bits));
+
+    return bits & SIGN_BIT_64 ? ~bits : bits | SIGN_BIT_64;
+}
+
+static double keyDouble(uint64_t key) {
+    uint64_t bits = key & SIGN_BIT_64 ? key ^ SIGN_BIT_64 : ~key;
+
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// LSD radix sort a byte at a time. The counts for every byte are taken in
+// one pass, and a byte that all the keys share is skipped.
+static void radixSort64(uint64_t *keys, size_t count) {
+    size_t (*counts)[256] = calloc(8, sizeof(*counts));
+    for (size_t i = 0; i < count; i++) {
+        for (int b = 0; b < 8; b++) counts[b][(keys[i] >> (8 * b)) & 0xff]++;
+    }
+
+    uint64_t *from = keys;
+    uint64_t *to = malloc(sizeof(uint64_t) * count);
+    uint64_t *spare = to;
+
+    for (int b = 0; b < 8; b++) {
+        int shift = 8 * b;
+        size_t *offsets = counts[b];
+        if (offsets[(from[0] >> shift) & 0xff] == count) continue;
+
+        size_t offset = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t digits = offsets[d];
+            offsets[d] = offset;
+            offset += digits;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            uint64_t key = from[i];
+            to[offsets[(key >> shift) & 0xff]++] = key;
+        }
+
+        uint64_t *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != keys) memcpy(keys, from, sizeof(uint64_t) * count);
+    free(spare);
+    free(counts);
+}
+
+static void radixSort32(uint32_t *keys, size_t count) {
+    size_t (*counts)[256] = calloc(4, sizeof(*counts));
+    for (size_t i = 0; i < count; i++) {
+        for (int b = 0; b < 4; b++) counts[b][(keys[i] >> (8 * b)) & 0xff]++;
+    }
+
+    uint32_t *from = keys;
+    uint32_t *to = malloc(sizeof(uint32_t) * count);
+    uint32_t *spare = to;
+
+    for (int b = 0; b < 4; b++) {
+        int shift = 8 * b;
+        size_t *offsets = counts[b];
+        if (offsets[(from[0] >> shift) & 0xff] == count) continue;
+
+        size_t offset = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t digits = offsets[d];
+            offsets[d] = offset;
+            offset += digits;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            uint32_t key = from[i];
+            to[offsets[(key >> shift) & 0xff]++] = key;
+        }
+
+        uint32_t *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != keys) memcpy(keys, from, sizeof(uint32_t) * count);
+    free(spare);
+    free(counts);
+}
+
+// Input that is already in order, either way round, is common enough to
+// be worth a look before anything is moved.
+void sortDoubles(double *values, size_t count) {
+    if (count < 2) return;
+
+    uint64_t *keys = malloc(sizeof(uint64_t) * count);
+    bool ascending = true, descending = true;
+
+    keys[0] = doubleKey(values[0]);
+    for (size_t i = 1; i < count; i++) {
+        keys[i] = doubleKey(values[i]);
+        ascending &= keys[i - 1] <= keys[i];
+        descending &= keys[i - 1] >= keys[i];
+    }
+
+    if (descending && !ascending) {
+        for (size_t i = 0, j = count - 1; i < j; i++, j--) {
+            double swap = values[i];
+            values[i] = values[j];
+            values[j] = swap;
+        }
+    } else if (!ascending) {
+        if (count < RADIX_THRESHOLD) {
+            for (size_t i = 1; i < count; i++) {
+                uint64_t key = keys[i];
+                size_t j = i;
+                for (; j > 0 && keys[j - 1] > key; j--) keys[j] = keys[j - 1];
+                keys[j] = key;
+            }
+        } else {
+            radixSort64(keys, count);
+        }
+
+        for (size_t i = 0; i < count; i++) values[i] = keyDouble(keys[i]);
+    }
+
+    free(keys);
+}
+
+void sortInts(int32_t *values, size_t count) {
+    if (count < 2) return;
+
+    uint32_t *keys = malloc(sizeof(uint32_t) * count);
+    bool ascending = true, descending = true;
+
+    keys[0] = (uint32_t)values[0] ^ SIGN_BIT_32;
+    for (size_t i = 1; i < count; i++) {
+        keys[i] = (uint32_t)values[i] ^ SIGN_BIT_32;
+        ascending &= keys[i - 1] <= keys[i];
+        descending &= keys[i - 1] >= keys[i];
+    }
+
+    if (descending && !ascending) {
+        for (size_t i = 0, j = count - 1; i < j; i++, j--) {
+            int32_t swap = values[i];
+            values[i] = values[j];
+            values[j] = swap;
+        }
+    } else if (!ascending) {
+        if (count < RADIX_THRESHOLD) {
+            for (size_t i = 1; i < count; i++) {
+                uint32_t key = keys[i];
+                size_t j = i;
+                for (; j > 0 && keys[j - 1] > key; j--) keys[j] = keys[j - 1];
+                keys[j] = key;
+            }
+        } else {
+            radixSort32(keys, count);
+        }
+
+        for (size_t i = 0; i < count; i++) values[i] = (int32_t)(keys[i] ^ SIGN_BIT_32);
+    }
+
+    free(keys);
+}
+
+typedef struct {
+    ValueComparator compare;
+    void           *context;
+} Order;
+
+static inline bool less(Order *order, Value a, Value b) {
+    return order->compare(a, b, order->context) < 0;
+}
+
+static inline void swapValues(Value *values, size_t a, size_t b) {
+    Value swap = values[a];
+    values[a] = values[b];
+    values[b] = swap;
+}
+
+static void insertionSort(Value *values, size_t begin, size_t end, Order *order) {
+    for (size_t i = begin + 1; i < end; i++) {
+        Value value = values[i];
+        size_t j = i;
+
+        for (; j > begin && less(order, value, values[j - 1]); j--) values[j] = values[j - 1];
+        values[j] = value;
+    }
+}
+
+// Insertion sort that gives up once it has moved too many elements.
+// Returns whether the range ended up sorted.
+static bool partialInsertionSort(Value *values, size_t begin, size_t end, Order *order) {
+    size_t moved = 0;
+
+    for (size_t i = begin + 1; i < end; i++) {
+        if (!less(order, values[i], values[i - 1])) continue;
+
+        Value value = values[i];
+        size_t j = i;
+        for (; j > begin && less(order, value, values[j - 1]); j--) values[j] = values[j - 1];
+        values[j] = value;
+
+        moved += i - j;
+        if (moved > PARTIAL_INSERTION_LIMIT) return false;
+    }
+
+    return true;
+}
+
+static void sort2(Value *values, size_t a, size_t b, Order *order) {
+    if (less(order, values[b], values[a])) swapValues(values, a, b);
+}
+
+static void sort3(Value *values, size_t a, size_t b, size_t c, Order *order) {
+    sort2(values, a, b, order);
+    sort2(values, b, c, order);
+    sort2(values, a, b, order);
+}
+
+static void siftDown(Value *values, size_t begin, size_t root, size_t count, Order *order) {
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= count) return;
+
+        if (child + 1 < count && less(order, values[begin + child], values[begin + child + 1])) child++;
+        if (!less(order, values[begin + root], values[begin + child])) return;
+
+        swapValues(values, begin + root, begin + child);
+        root = child;
+    }
+}
+
+static void heapSort(Value *values, size_t begin, size_t end, Order *order) {
+    size_t count = end - begin;
+
+    for (size_t i = count / 2; i-- > 0;) siftDown(values, begin, i, count, order);
+    for (size_t i = count; i-- > 1;) {
+        swapValues(values, begin, begin + i);
+        siftDown(values, begin, 0, i, order);
+    }
+}
+
+// Moves 'count' misplaced pairs found by partitionRight() across. Equal
+// counts on both sides are swapped pairwise, which keeps descending input
+// linear; otherwise one cyclic permutation does it in fewer moves.
+static void swapOffsets(Value *values, size_t left, size_t right, unsigned char *offsetsLeft,
+                        unsigned char *offsetsRight, size_t count, bool pairwise) {
+    if (pairwise) {
+        for (size_t i = 0; i < count; i++) {
+            swapValues(values, left + offsetsLeft[i], right - offsetsRight[i]);
+        }
+    } else if (count > 0) {
+        size_t l = left + offsetsLeft[0];
+        size_t r = right - offsetsRight[0];
+        Value first = values[l];
+        values[l] = values[r];
+
+        for (size_t i = 1; i < count; i++) {
+            l = left + offsetsLeft[i];
+            values[r] = values[l];
+            r = right - offsetsRight[i];
+            values[l] = values[r];
+        }
+        values[r] = first;
+    }
+}
+
+// Partitions around the pivot at 'begin' with elements equal to it going
+// right. Returns where the pivot ends up; 'partitioned' is set when no
+// element had to move.
+//
+// Comparisons are made a block at a time and only their outcomes are
+// recorded, as offsets of the elements on the wrong side, which keeps
+// mispredicted branches out of the loop (Edelkamp and Weiss's
+// BlockQuicksort). The scans before it are bounded, so a comparator that
+// contradicts itself cannot walk them off the range.
+static size_t partitionRight(Value *values, size_t begin, size_t end, Order *order, bool *partitioned) {
+    Value pivot = values[begin];
+    size_t first = begin;
+    size_t last = end;
+
+    while (++first < end && less(order, values[first], pivot));
+    while (last > first && !less(order, values[--last], pivot));
+
+    *partitioned = first >= last;
+    if (!*partitioned) {
+        swapValues(values, first, last);
+        first++;
+
+        unsigned char offsetsLeft[PARTITION_BLOCK];
+        unsigned char offsetsRight[PARTITION_BLOCK];
+        size_t leftBase = first, rightBase = last;
+        size_t countLeft = 0, countRight = 0, startLeft = 0, startRight = 0;
+
+        while (first < last) {
+            // split what is left between the blocks that need refilling
+            size_t unknown = last - first;
+            size_t leftSplit = countLeft == 0 ? (countRight == 0 ? unknown / 2 : unknown) : 0;
+            size_t rightSplit = countRight == 0 ? unknown - leftSplit : 0;
+            if (leftSplit > PARTITION_BLOCK) leftSplit = PARTITION_BLOCK;
+            if (rightSplit > PARTITION_BLOCK) rightSplit = PARTITION_BLOCK;
+
+            for (size_t i = 0; i < leftSplit; i++) {
+                offsetsLeft[countLeft] = i;
+                countLeft += !less(order, values[first++], pivot);
+            }
+            for (size_t i = 0; i < rightSplit;) {
+                offsetsRight[countRight] = ++i;
+                countRight += less(order, values[--last], pivot);
+            }
+
+            size_t count = countLeft < countRight ? countLeft : countRight;
+            swapOffsets(values, leftBase, rightBase, offsetsLeft + startLeft, offsetsRight + startRight,
+                        count, countLeft == countRight);
+            countLeft -= count;
+            countRight -= count;
+            startLeft += count;
+            startRight += count;
+
+            if (countLeft == 0) {
+                startLeft = 0;
+                leftBase = first;
+            }
+            if (countRight == 0) {
+                startRight = 0;
+                rightBase = last;
+            }
+        }
+
+        // whichever block still has misplaced elements swaps them to the
+        // middle, one by one
+        if (countLeft > 0) {
+            while (countLeft-- > 0) swapValues(values, leftBase + offsetsLeft[startLeft + countLeft], --last);
+            first = last;
+        }
+        if (countRight > 0) {
+            while (countRight-- > 0) swapValues(values, rightBase - offsetsRight[startRight + countRight], first++);
+        }
+    }
+
+    size_t position = first - 1;
+    values[begin] = values[position];
+    values[position] = pivot;
+
+    return position;
+}
+
+// Used when the pivot equals the element just before the range, which is
+// then no greater than anything in it: elements equal to the pivot go
+// left and need no further sorting.
+static size_t partitionLeft(Value *values, size_t begin, size_t end, Order *order) {
+    Value pivot = values[begin];
+    size_t first = begin;
+    size_t last = end;
+
+    while (last > begin + 1 && less(order, pivot, values[--last]));
+    if (last == begin + 1 && less(order, pivot, values[last])) last = begin;
+    while (first < last && !less(order, pivot, values[++first]));
+
+    while (first < last) {
+        swapValues(values, first, last);
+        while (last > begin && less(order, pivot, values[--last]));
+        while (first + 1 < end && !less(order, pivot, values[++first]));
+    }
+
+    values[begin] = values[last];
+    values[last] = pivot;
+
+    return last;
+}
+
+static void pdqsort(Value *values, size_t begin, size_t end, Order *order, int badAllowed, bool leftmost) {
+    for (;;) {
+        size_t size = end - begin;
+
+        if (size < INSERTION_THRESHOLD) {
+            insertionSort(values, begin, end, order);
+            return;
+        }
+
+        // median of three, or the pseudomedian of nine for longer ranges
+        size_t half = size / 2;
+        if (size > NINTHER_THRESHOLD) {
+            sort3(values, begin, begin + half, end - 1, order);
+            sort3(values, begin + 1, begin + half - 1, end - 2, order);
+            sort3(values, begin + 2, begin + half + 1, end - 3, order);
+            sort3(values, begin + half - 1, begin + half, begin + half + 1, order);
+            swapValues(values, begin, begin + half);
+        } else {
+            sort3(values, begin + half, begin, end - 1, order);
+        }
+
+        if (!leftmost && !less(order, values[begin - 1], values[begin])) {
+            begin = partitionLeft(values, begin, end, order) + 1;
+            continue;
+        }
+
+        bool partitioned;
+        size_t pivot = partitionRight(values, begin, end, order, &partitioned);
+
+        size_t leftSize = pivot - begin;
+        size_t rightSize = end - (pivot + 1);
+
+        if (leftSize < size / 8 || rightSize < size / 8) {
+            // too many lopsided partitions: fall back to O(n log n)
+            if (--badAllowed == 0) {
+                heapSort(values, begin, end, order);
+                return;
+            }
+
+            // otherwise shuffle a few elements to break up the pattern
+            if (leftSize >= INSERTION_THRESHOLD) {
+                swapValues(values, begin, begin + leftSize / 4);
+                swapValues(values, pivot - 1, pivot - leftSize / 4);
+
+                if (leftSize > NINTHER_THRESHOLD) {
+                    swapValues(values, begin + 1, begin + leftSize / 4 + 1);
+                    swapValues(values, begin + 2, begin + leftSize / 4 + 2);
+                    swapValues(values, pivot - 2, pivot - (leftSize / 4 + 1));
+                    swapValues(values, pivot - 3, pivot - (leftSize / 4 + 2));
+                }
+            }
+
+            if (rightSize >= INSERTION_THRESHOLD) {
+                swapValues(values, pivot + 1, pivot + 1 + rightSize / 4);
+                swapValues(values, end - 1, end - rightSize / 4);
+
+                if (rightSize > NINTHER_THRESHOLD) {
+                    swapValues(values, pivot + 2, pivot + 2 + rightSize / 4);
+                    swapValues(values, pivot + 3, pivot + 3 + rightSize / 4);
+                    swapValues(values, end - 2, end - (1 + rightSize / 4));
+                    swapValues(values, end - 3, end - (2 + rightSize / 4));
+                }
+            }
+        } else if (partitioned && partialInsertionSort(values, begin, pivot, order) &&
+                   partialInsertionSort(values, pivot + 1, end, order)) {
+            // an already partitioned range was close to sorted
+            return;
+        }
+
+        // recurse into the left side and loop on the right
+        pdqsort(values, begin, pivot, order, badAllowed, leftmost);
+        begin = pivot + 1;
+        leftmost = false;
+    }
+}
+
+void sortValues(Value *values, size_t count, ValueComparator compare, void *context) {
+    if (count < 2) return;
+
+    Order order = { compare, context };
+
+    int badAllowed = 1;
+    for (size_t n = count; n > 1; n >>= 1) badAllowed++;
+
+    pdqsort(values, 0, count, &order, badAllowed, true);
+}
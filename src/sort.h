@@ -0,0 +1,22 @@
+#ifndef sort_h
+#define sort_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "value.h"
+
+// Negative, zero or positive as 'a' sorts before, with or after 'b'.
+typedef int (*ValueComparator)(Value a, Value b, void *context);
+
+// Packed numbers are radix sorted. Doubles sort by their bits, so -0
+// comes before 0 and NaN after Infinity.
+void sortDoubles(double *values, size_t count);
+void sortInts(int32_t *values, size_t count);
+
+// Pattern-defeating quicksort, not stable. A comparator that is not a
+// consistent order leaves the values in some order but never reads or
+// writes outside them.
+void sortValues(Value *values, size_t count, ValueComparator compare, void *context);
+
+#endif
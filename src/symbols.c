@@ -1,15 +1,29 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 
 #include "symbols.h"
 
+#define TABLE_MAX_LOAD 0.75
+
 void initSymbolTable(SymbolTable *table) {
     table->count = 0;
     table->capacity = 0;
     table->symbols = NULL;
 }
 
-static uint32_t hashString(const char* key, int length) {
+void freeSymbolTable(SymbolTable *table) {
+    for (int i = 0; i < table->capacity; i++) {
+        free(table->symbols[i].key);
+    }
+
+    free(table->symbols);
+    initSymbolTable(table);
+}
+
+// FNV-1a, shared with the keys of Maps and Sets.
+uint32_t hashString(const char *key, int length) {
     uint32_t hash = 2166136261u;
     
     for (int i = 0; i < length; i++) {
@@ -18,4 +32,62 @@ static uint32_t hashString(const char* key, int length) {
     }
 
     return hash;
-}
\ No newline at end of file
+}
+
+static Symbol *findSymbol(Symbol *symbols, int capacity, char *key, uint32_t hash) {
+    uint32_t index = hash & (capacity - 1);
+
+    for (;;) {
+        Symbol *symbol = &symbols[index];
+        if (!symbol->key || (symbol->hash == hash && strcmp(symbol->key, key) == 0)) {
+            return symbol;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void growSymbolTable(SymbolTable *table) {
+    int capacity = table->capacity == 0 ? 8 : table->capacity * 2;
+    Symbol *symbols = calloc(capacity, sizeof(Symbol));
+
+    for (int i = 0; i < table->capacity; i++) {
+        Symbol *old = &table->symbols[i];
+        if (!old->key) continue;
+
+        *findSymbol(symbols, capacity, old->key, old->hash) = *old;
+    }
+
+    free(table->symbols);
+    table->symbols = symbols;
+    table->capacity = capacity;
+}
+
+bool getSymbol(SymbolTable *table, char *key, Value *value) {
+    if (table->count == 0) return false;
+
+    Symbol *symbol = findSymbol(table->symbols, table->capacity, key, hashString(key, strlen(key)));
+    if (!symbol->key) return false;
+
+    *value = symbol->value;
+    return true;
+}
+
+bool setSymbol(SymbolTable *table, char *key, Value value) {
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+        growSymbolTable(table);
+    }
+
+    uint32_t hash = hashString(key, strlen(key));
+    Symbol *symbol = findSymbol(table->symbols, table->capacity, key, hash);
+
+    bool isNew = symbol->key == NULL;
+    if (isNew) {
+        symbol->key = strdup(key);
+        symbol->hash = hash;
+        table->count++;
+    }
+
+    symbol->value = value;
+    return isNew;
+}
@@ -1,11 +1,15 @@
 #ifndef symbols_h
 #define symbols_h
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "value.h"
 
 typedef struct {
-    char *key;
-    Value value;
+    char    *key;
+    uint32_t hash;
+    Value    value;
 } Symbol;
 
 typedef struct {
@@ -14,6 +18,11 @@ typedef struct {
     int     capacity;
 } SymbolTable;
 
+uint32_t hashString(const char *key, int length);
+
 void initSymbolTable(SymbolTable *table);
+void freeSymbolTable(SymbolTable *table);
+bool getSymbol(SymbolTable *table, char *key, Value *value);
+bool setSymbol(SymbolTable *table, char *key, Value value);
 
-#endif
\ No newline at end of file
+#endif
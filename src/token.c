@@ -20,8 +20,11 @@ char *token_type_to_str(TokenType type) {
         case RIGHT_PAREN: return "RIGHT_PAREN";
         case LEFT_BRACE: return "LEFT_BRACE";
         case RIGHT_BRACE: return "RIGHT_BRACE";
+        case LEFT_BRACKET: return "LEFT_BRACKET";
+        case RIGHT_BRACKET: return "RIGHT_BRACKET";
         case SEMICOLON: return "SEMICOLON";
         case COMMA: return "COMMA";
+        case COLON: return "COLON";
         case SINGLE_EQUALS: return "SINGLE_EQUALS";
         case DOUBLE_EQUALS: return "DOUBLE_EQUALS";
         case IF: return "IF";
@@ -32,6 +35,7 @@ char *token_type_to_str(TokenType type) {
         case VAR: return "VAR";
         case LET: return "LET";
         case CONST: return "CONST";
+        case NEW: return "NEW";
         case TOKEN_EOF: return "TOKEN_EOF";
         case BAD: return "BAD";
         default: return "UNKNOWN_TOKEN";
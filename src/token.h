@@ -24,9 +24,12 @@ typedef enum {
     RIGHT_PAREN,
     LEFT_BRACE,
     RIGHT_BRACE,
+    LEFT_BRACKET,
+    RIGHT_BRACKET,
     SEMICOLON,
     DOT,
     COMMA,
+    COLON,
     SINGLE_EQUALS,
     DOUBLE_EQUALS,
     TRIPLE_EQUALS,
@@ -55,6 +58,7 @@ typedef enum {
     LET,
     CONST,
     TYPEOF,
+    NEW,
 
     TOKEN_EOF,
     BAD
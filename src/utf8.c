@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "utf8.h"
+
+// Code points are the bytes that are not continuation bytes (10xxxxxx).
+// On valid UTF-8 a count equal to the byte length means pure ASCII, which
+// is the flag the VM checks before taking the O(1) indexing paths.
+int countCodepoints(const char *chars, int length) {
+    int count = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    // continuation bytes are exactly those below -64 as signed chars
+    const __m128i limit = _mm_set1_epi8(-65);
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(chars + i));
+        __m128i leads = _mm_cmpgt_epi8(bytes, limit);
+        count += __builtin_popcount(_mm_movemask_epi8(leads));
+    }
+#endif
+
+    for (; i < length; i++) {
+        if (((unsigned char)chars[i] & 0xC0) != 0x80) count++;
+    }
+
+    return count;
+}
+
+int utf8SequenceLength(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    if ((lead & 0xE0) == 0xC0) return 2;
+    if ((lead & 0xF0) == 0xE0) return 3;
+    if ((lead & 0xF8) == 0xF0) return 4;
+
+    return 0;
+}
+
+// Rejects stray continuation bytes, truncated sequences, overlong forms,
+// surrogates and code points past U+10FFFF.
+bool isValidUtf8(const char *chars, int length) {
+    int i = 0;
+
+    while (i < length) {
+        unsigned char lead = chars[i];
+        if (lead < 0x80) {
+            i++;
+            continue;
+        }
+
+        int size = utf8SequenceLength(lead);
+        if (size == 0 || i + size > length) return false;
+
+        for (int j = 1; j < size; j++) {
+            if (((unsigned char)chars[i + j] & 0xC0) != 0x80) return false;
+        }
+
+        int codepoint;
+        decodeUtf8(chars + i, &codepoint);
+
+        static const int minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (codepoint < minimum[size]) return false;
+        if (codepoint >= 0xD800 && codepoint <= 0xDFFF) return false;
+        if (codepoint > 0x10FFFF) return false;
+
+        i += size;
+    }
+
+    return true;
+}
+
+// Decodes the sequence at 'chars', which must be valid, and returns its
+// length in bytes.
+int decodeUtf8(const char *chars, int *codepoint) {
+    const unsigned char *bytes = (const unsigned char *)chars;
+    int size = utf8SequenceLength(bytes[0]);
+
+    switch (size) {
+        case 1:  *codepoint = bytes[0]; break;
+        case 2:  *codepoint = (bytes[0] & 0x1F) << 6 | (bytes[1] & 0x3F); break;
+        case 3:  *codepoint = (bytes[0] & 0x0F) << 12 | (bytes[1] & 0x3F) << 6 | (bytes[2] & 0x3F); break;
+        default: *codepoint = (bytes[0] & 0x07) << 18 | (bytes[1] & 0x3F) << 12 | (bytes[2] & 0x3F) << 6 | (bytes[3] & 0x3F); break;
+    }
+
+    return size;
+}
+
+void initUtf8Cache(Utf8Cache *cache) {
+    memset(cache, 0, sizeof(Utf8Cache));
+}
+
+void clearUtf8Cache(Utf8Cache *cache, bool youngOnly, char *nursery, char *nurseryEnd) {
+    for (int i = 0; i < UTF8_INDEX_ENTRIES; i++) {
+        Utf8Index *entry = &cache->entries[i];
+        if (!entry->string) continue;
+
+        char *address = (char *)entry->string;
+        if (youngOnly && (address < nursery || address >= nurseryEnd)) continue;
+
+        free(entry->offsets);
+        entry->string = NULL;
+        entry->offsets = NULL;
+    }
+}
+
+static int skipCodepoints(const char *chars, int offset, int steps) {
+    while (steps-- > 0) {
+        offset += utf8SequenceLength(chars[offset]);
+    }
+
+    return offset;
+}
+
+static Utf8Index *buildIndex(Utf8Cache *cache, Object *object) {
+    ObjString *string = &object->as.string;
+
+    Utf8Index *entry = &cache->entries[cache->next];
+    cache->next = (cache->next + 1) % UTF8_INDEX_ENTRIES;
+    free(entry->offsets);
+
+    entry->string = object;
+    entry->offsets = malloc(sizeof(int) * (string->count / UTF8_INDEX_STRIDE + 1));
+    entry->last_index = 0;
+    entry->last_offset = 0;
+
+    int offset = 0;
+    for (int i = 0; i < string->count; i++) {
+        if (i % UTF8_INDEX_STRIDE == 0) entry->offsets[i / UTF8_INDEX_STRIDE] = offset;
+        offset += utf8SequenceLength(string->chars[offset]);
+    }
+
+    return entry;
+}
+
+// The byte offset of code point 'index' in a flat string, which must be
+// in range. ASCII strings need no lookup at all.
+int codepointOffset(Utf8Cache *cache, Object *object, int index) {
+    ObjString *string = &object->as.string;
+
+    if (isAsciiString(string)) return index;
+    if (string->length < UTF8_INDEX_MIN) return skipCodepoints(string->chars, 0, index);
+
+    Utf8Index *entry = NULL;
+    for (int i = 0; i < UTF8_INDEX_ENTRIES; i++) {
+        if (cache->entries[i].string == object) {
+            entry = &cache->entries[i];
+            break;
+        }
+    }
+    if (!entry) entry = buildIndex(cache, object);
+
+    int offset;
+    int distance = index - entry->last_index;
+    if (distance >= 0 && distance < UTF8_INDEX_STRIDE) {
+        offset = skipCodepoints(string->chars, entry->last_offset, distance);
+    } else {
+        int block = index / UTF8_INDEX_STRIDE;
+        offset = skipCodepoints(string->chars, entry->offsets[block], index - block * UTF8_INDEX_STRIDE);
+    }
+
+    entry->last_index = index;
+    entry->last_offset = offset;
+
+    return offset;
+}
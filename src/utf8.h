@@ -0,0 +1,44 @@
+#ifndef utf8_h
+#define utf8_h
+
+#include <stdbool.h>
+
+#include "value.h"
+
+// Non-ASCII strings are indexed through a sparse table holding the byte
+// offset of every UTF8_INDEX_STRIDE-th code point. Strings shorter than
+// UTF8_INDEX_MIN bytes are simply scanned.
+#define UTF8_INDEX_STRIDE  64
+#define UTF8_INDEX_MIN     256
+#define UTF8_INDEX_ENTRIES 8
+
+typedef struct {
+    Object *string;
+    int    *offsets;
+
+    // the last lookup, so walking a string in order costs one step each
+    int     last_index;
+    int     last_offset;
+} Utf8Index;
+
+// A few recently indexed strings. Entries are keyed by address, so the
+// VM drops them whenever the collector may move or free a string.
+typedef struct {
+    Utf8Index entries[UTF8_INDEX_ENTRIES];
+    int       next;
+} Utf8Cache;
+
+int  countCodepoints(const char *chars, int length);
+bool isValidUtf8(const char *chars, int length);
+int  utf8SequenceLength(unsigned char lead);
+int  decodeUtf8(const char *chars, int *codepoint);
+
+void initUtf8Cache(Utf8Cache *cache);
+void clearUtf8Cache(Utf8Cache *cache, bool youngOnly, char *nursery, char *nurseryEnd);
+int  codepointOffset(Utf8Cache *cache, Object *string, int index);
+
+static inline bool isAsciiString(ObjString *string) {
+    return string->count == string->length;
+}
+
+#endif
@@ -2,31 +2,29 @@
 #define value_h
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-typedef struct Object Object;
-
-typedef enum {
-    OBJ_STRING,
-} ObjectType;
-
-typedef struct {
-  int    length;
-  char*  chars;
-} ObjString;
-
-struct Object {
-    ObjectType type;
+#include "token.h"
 
-    union {
-        ObjString string;
-    } as;
-};
+typedef struct Object Object;
+typedef struct Bytecode Bytecode;
+typedef struct Program Program;
+typedef struct Shape Shape;
 
 typedef enum {
     TYPE_BOOL,
     TYPE_NUMBER,
     TYPE_STRING,
     TYPE_IDENTIFIER,
+    TYPE_FUNCTION,
+    TYPE_UNDEFINED,
+    TYPE_OBJECT,
+    TYPE_ARRAY,
+    TYPE_MAP,
+    // a handle on a worker, holding its index among the workers the
+    // isolate has started in 'number'
+    TYPE_WORKER,
 } ValueType;
 
 typedef struct {
@@ -40,4 +38,173 @@ typedef struct {
     } as;
 } Value;
 
+typedef enum {
+    OBJ_STRING,
+    OBJ_FUNCTION,
+    OBJ_ROPE,
+    OBJ_INSTANCE,
+    OBJ_ARRAY,
+    OBJ_MAP,
+} ObjectType;
+
+// The characters follow the length in the same allocation, so a string
+// is a single block sized to fit: see STRING_SIZE(). Strings are UTF-8;
+// 'length' counts bytes and 'count' code points, which is what the
+// language sees as the length. The two are equal exactly when the
+// string is ASCII. 'hash' is filled in the first time the string is
+// used as a Map or Set key, and is 0 until then. 'number' is what the
+// string converts to, NaN if it is not numeric, once 'has_number' says
+// it was worked out.
+typedef struct {
+  int      length;
+  int      count;
+  uint32_t hash;
+  bool     has_number;
+  double   number;
+  char     chars[];
+} ObjString;
+
+// A concatenation not yet copied out. Both sides are strings or ropes
+// and the value is a TYPE_STRING like any other; 'flat' caches the copy
+// once something needs the characters, and the sides are dropped then.
+typedef struct {
+  int     length;
+  int     count;
+  Object *left;
+  Object *right;
+  Object *flat;
+} ObjRope;
+
+// 'chunk' stays NULL until the first call when the body was deferred;
+// 'tokens' and 'start' locate the source to compile it from.
+typedef struct {
+    int       arity;
+    char     *name;
+    Bytecode *chunk;
+
+    Token    *tokens;
+    int       start;
+} ObjFunction;
+
+// An object made by a literal. 'shape' says which property lives in
+// which slot; the first 'capacity' slots follow the header and the rest
+// go in 'overflow', which grows as properties are added.
+typedef struct {
+    Shape *shape;
+    int    capacity;
+    int    overflow_capacity;
+    Value *overflow;
+    Value  fields[];
+} ObjInstance;
+
+// How an array stores its elements. Kinds only ever widen, in this
+// order, and an array stays unboxed for as long as its values allow.
+typedef enum {
+    ELEMENTS_INT,
+    ELEMENTS_DOUBLE,
+    ELEMENTS_GENERIC,
+} ElementKind;
+
+static inline size_t elementSize(ElementKind kind) {
+    return kind == ELEMENTS_INT ? sizeof(int32_t) : kind == ELEMENTS_DOUBLE ? sizeof(double) : sizeof(Value);
+}
+
+// Packed elements shared by arrays in more than one isolate, once one
+// was sent in a message. The last to let go frees them.
+typedef struct {
+    int   refs;
+    void *data;
+} SharedElements;
+
+// A packed list. Small integers are kept as int32_t and other numbers as
+// double; storing anything else turns the elements into full Values.
+// While 'shared' is set the elements are someone else's too, and are
+// copied before anything is stored into them.
+typedef struct {
+    ElementKind kind;
+    int         count;
+    int         capacity;
+
+    union {
+        int32_t *ints;
+        double  *doubles;
+        Value   *values;
+        void    *any;
+    } elements;
+
+    SharedElements *shared;
+} ObjArray;
+
+// An entry of a Map or a Set; sets leave 'value' undefined. A deleted
+// entry stays behind, not 'live', until the table is next rebuilt.
+typedef struct {
+    Value    key;
+    Value    value;
+    uint32_t hash;
+    bool     live;
+} MapEntry;
+
+// A Map or a Set. The entries are kept densely in insertion order, which
+// is the order they are iterated in, and indexed by a Swiss table: a
+// control byte per slot, holding seven bits of the key's hash or marking
+// the slot empty or deleted, is probed sixteen slots at a time, and
+// 'slots' gives the entry behind each. 'capacity' counts the slots; the
+// entries array has room for 7/8 of that.
+typedef struct {
+    bool      is_set;
+    int       count;
+    int       entry_count;
+    int       capacity;
+    uint8_t  *control;
+    int32_t  *slots;
+    MapEntry *entries;
+} ObjMap;
+
+// Entries fill up to 7/8 of the slots, so every probe meets an empty one.
+static inline int mapEntryLimit(int capacity) {
+    return capacity - capacity / 8;
+}
+
+// What a map with 'capacity' slots owns outside its header: a control
+// byte and an entry index per slot, then the entries, in one block.
+static inline size_t mapStorageSize(int capacity) {
+    return (size_t)capacity * (sizeof(uint8_t) + sizeof(int32_t)) + sizeof(MapEntry) * mapEntryLimit(capacity);
+}
+
+// A frozen object belongs to no heap: it is part of a Program, shared by
+// every VM that runs it, and never marked, moved or written to.
+struct Object {
+    ObjectType type;
+    uint8_t    mark;
+    uint8_t    remembered;
+    uint8_t    frozen;
+    Object    *next;
+
+    union {
+        ObjString   string;
+        ObjFunction function;
+        ObjRope     rope;
+        ObjInstance instance;
+        ObjArray    array;
+        ObjMap      map;
+    } as;
+};
+
+#define STRING_SIZE(length) (offsetof(Object, as.string.chars) + (length) + 1)
+#define ROPE_SIZE           (offsetof(Object, as.rope) + sizeof(ObjRope))
+#define INSTANCE_SIZE(n)    (offsetof(Object, as.instance.fields) + (n) * sizeof(Value))
+#define ARRAY_SIZE          (offsetof(Object, as.array) + sizeof(ObjArray))
+#define MAP_SIZE            (offsetof(Object, as.map) + sizeof(ObjMap))
+
+static inline bool isObjectValue(Value value) {
+    return value.type == TYPE_STRING || value.type == TYPE_FUNCTION ||
+           value.type == TYPE_OBJECT || value.type == TYPE_ARRAY || value.type == TYPE_MAP;
+}
+
+// Where slot 'slot' of an instance lives.
+static inline Value *instanceSlot(ObjInstance *instance, int slot) {
+    if (slot < instance->capacity) return &instance->fields[slot];
+    return &instance->overflow[slot - instance->capacity];
+}
+
 #endif
\ No newline at end of file
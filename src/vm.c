@@ -1,27 +1,218 @@
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "vm.h"
+#include "array.h"
+#include "buffer.h"
 #include "compiler.h"
+#include "json.h"
+#include "number.h"
+#include "map.h"
+#include "message.h"
+#include "parallel.h"
+#include "rope.h"
+#include "sort.h"
+#include "worker.h"
+
+// Object literals get at least this many inline slots, so adding a few
+// properties later does not need an overflow array.
+#define INSTANCE_MIN_SLOTS 4
+
+void defaultSettings(VmSettings *settings) {
+    settings->inline_threshold = INLINE_THRESHOLD_DEFAULT;
+    settings->lazy_compile = true;
+    settings->gc_threshold = GC_THRESHOLD_DEFAULT;
+    settings->nursery_size = NURSERY_SIZE_DEFAULT;
+    settings->concurrent_gc = true;
+    settings->kernels = bestKernels();
+    settings->cache_path = NULL;
+    settings->compile_only = false;
+    settings->threads = 0;
+}
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
 void initVm(JankyVm *vm, Bytecode *bytecode) {
     vm->bytecode = bytecode;
+    vm->program_caches = NULL;
+    vm->program_cache_count = 0;
     vm->ip = 0;
     vm->stack_top = vm->stack;
+    vm->base = vm->stack;
+    vm->frame_count = 0;
+    vm->output = (TextBuffer){ NULL, 0, 0 };
+    reserveText(&vm->output, OUTPUT_BUFFER_SIZE);
+    vm->call_count = 0;
+    vm->deferred_count = 0;
+    vm->property_hits = 0;
+    vm->property_misses = 0;
+    vm->megamorphic_sites = 0;
+    vm->megamorphic_hits = 0;
+    vm->kernel_calls = 0;
+    vm->stack_overflow = false;
+    vm->parallel_calls = 0;
+    vm->parallel_steals = 0;
+    vm->pool = NULL;
+    memset(vm->megamorphic, 0, sizeof(vm->megamorphic));
+
+    initSymbolTable(&vm->globals);
+    vm->globals_remembered = false;
+
+    for (int i = 0; i < 128; i++) {
+        char c = (char)i;
+        vm->ascii_chars[i] = newStringObject(&vm->heap, &c, 1);
+    }
+    initUtf8Cache(&vm->utf8_cache);
+    vm->root_shape = newRootShape();
+
+    Value json;
+    json.type = TYPE_OBJECT;
+    json.as.object = newInstanceObject(&vm->heap, vm->root_shape, INSTANCE_MIN_SLOTS);
+    vm->json = json.as.object;
+    setSymbol(&vm->globals, "JSON", json);
+
+    Value self;
+    self.type = TYPE_OBJECT;
+    self.as.object = newInstanceObject(&vm->heap, vm->root_shape, INSTANCE_MIN_SLOTS);
+    vm->self = self.as.object;
+    setSymbol(&vm->globals, "self", self);
 }
 
 void freeVm(JankyVm *vm) {
-    free(vm->bytecode->code);
-    free(vm->bytecode->constants);
-    free(vm->bytecode);
+    // workers may still be posting here, and are waited for first
+    stopWorkers(vm);
+    if (vm->pool) freePool(vm->pool);
+    vm->pool = NULL;
+
+    // the script chunk belongs to the function object in slot zero
+    clearUtf8Cache(&vm->utf8_cache, false, NULL, NULL);
+    freeSymbolTable(&vm->globals);
+    freeStaticTable(&vm->statics);
+    freeHeap(&vm->heap);
+    freeShapes(vm->root_shape);
+    freeLexer(&vm->lexer);
+    free(vm->output.chars);
+    unmapCache(&vm->cache);
+
+    for (int i = 0; i < vm->program_cache_count; i++) {
+        free(vm->program_caches[i].caches);
+    }
+    free(vm->program_caches);
+}
+
+// Young objects can only be referenced from the value stack, from the
+// globals once the write barrier in OP_DEFINE_GLOBAL has flagged them,
+// and from the instances the heap remembers. Constant pools are built by
+// the compiler and only hold old objects.
+static void minorCollect(JankyVm *vm) {
+    double start = seconds();
+    Heap *heap = &vm->heap;
+
+    for (Value *slot = vm->stack; slot < vm->stack_top; slot++) {
+        forwardValue(heap, slot);
+    }
+
+    if (vm->globals_remembered) {
+        for (int i = 0; i < vm->globals.capacity; i++) {
+            Symbol *symbol = &vm->globals.symbols[i];
+            if (symbol->key) forwardValue(heap, &symbol->value);
+        }
+        vm->globals_remembered = false;
+    }
+
+    clearUtf8Cache(&vm->utf8_cache, true, heap->nursery, heap->nursery_end);
+    finishScavenge(heap, seconds() - start);
+}
+
+// Roots are the value stack and the globals. Every frame's function sits
+// in its slot zero, the script included, so the constant pools of running
+// chunks are reached by tracing. The nursery is emptied first so that
+// only old objects are left to mark.
+static void markRoots(JankyVm *vm) {
+    Heap *heap = &vm->heap;
+
+    minorCollect(vm);
+    beginCycle(heap);
+
+    for (Value *slot = vm->stack; slot < vm->stack_top; slot++) {
+        markValue(heap, *slot);
+    }
+
+    for (int i = 0; i < vm->globals.capacity; i++) {
+        Symbol *symbol = &vm->globals.symbols[i];
+        if (symbol->key) markValue(heap, symbol->value);
+    }
+
+    for (int i = 0; i < 128; i++) {
+        markObject(heap, vm->ascii_chars[i]);
+    }
+    markObject(heap, vm->json);
+    markObject(heap, vm->self);
+}
+
+static void collectGarbage(JankyVm *vm) {
+    double start = seconds();
+    Heap *heap = &vm->heap;
+
+    markRoots(vm);
+    traceReferences(heap);
+    sweep(heap);
+    clearUtf8Cache(&vm->utf8_cache, false, NULL, NULL);
+
+    double pause = seconds() - start;
+    heap->gc_count++;
+    heap->gc_pause += pause;
+    recordPause(heap, pause);
+}
+
+// Drives a concurrent major collection from the allocation sites. Only
+// the root scan and the remark stop the mutator; tracing and sweeping
+// happen on the heap's marker thread in between.
+static void collectConcurrently(JankyVm *vm) {
+    Heap *heap = &vm->heap;
+    GcPhase phase = gcPhase(heap);
+
+    if (phase == GC_MARKING || phase == GC_SWEEPING) return;
+    if (phase == GC_SWEPT) {
+        finishCycle(heap);
+        return;
+    }
+
+    if (phase == GC_IDLE && !majorCollectionDue(heap)) return;
+
+    double start = seconds();
+    if (phase == GC_REMARK) {
+        // the sweep that follows may free cached strings
+        remark(heap);
+        clearUtf8Cache(&vm->utf8_cache, false, NULL, NULL);
+    } else {
+        markRoots(vm);
+        startConcurrentMark(heap);
+    }
+
+    double pause = seconds() - start;
+    heap->gc_pause += pause;
+    recordPause(heap, pause);
 }
 
+// A push past STACK_MAX is noted, and the instruction making it fails
+// once it is done (see stackOverflow()); until then it runs on in the
+// reserve, and only pushes beyond that are dropped.
 void push(JankyVm *vm, Value value) {
-    // if (vm->stack_top >= STACK_MAX) {
-    //     fprintf(stderr, "Stack overflow\n");
-    //     exit(EXIT_FAILURE);
-    // }
+    if (vm->stack_top >= vm->stack + STACK_MAX) {
+        vm->stack_overflow = true;
+        if (vm->stack_top >= vm->stack + STACK_MAX + STACK_RESERVE) return;
+    }
     *vm->stack_top = value;
     vm->stack_top++;
 }
@@ -35,7 +226,18 @@ Value pop(JankyVm *vm) {
     return *vm->stack_top;
 }
 
-static bool valuesEqual(Value a, Value b) {
+// Ropes only need flattening when the lengths leave it undecided.
+static bool stringsEqual(Heap *heap, Object *a, Object *b) {
+    if (a == b) return true;
+    if (stringLength(a) != stringLength(b)) return false;
+
+    ObjString *x = asFlatString(heap, a);
+    ObjString *y = asFlatString(heap, b);
+
+    return memcmp(x->chars, y->chars, x->length) == 0;
+}
+
+static bool valuesEqual(JankyVm *vm, Value a, Value b) {
     if (a.type != b.type) return false;
 
     switch (a.type) {
@@ -44,16 +246,42 @@ static bool valuesEqual(Value a, Value b) {
         case TYPE_BOOL:
             return a.as.boolean == b.as.boolean;
         case TYPE_STRING:
-            return strcmp(a.as.object->as.string.chars, b.as.object->as.string.chars) == 0;
+            return stringsEqual(&vm->heap, a.as.object, b.as.object);
+        case TYPE_FUNCTION:
+        case TYPE_OBJECT:
+        case TYPE_ARRAY:
+        case TYPE_MAP:
+            return a.as.object == b.as.object;
+        case TYPE_WORKER:
+            return a.as.number == b.as.number;
+        case TYPE_UNDEFINED:
+            return true;
         default:
-            fprintf(stderr, "Unknown type in valuesEqual, exiting.\n");
-            exit(EXIT_FAILURE);
+            return false;
+    }
+}
+
+// The number a string converts to, worked out once per string. A string
+// that is not numeric is NaN, which equals nothing. One shared with
+// another isolate may be worked out there too, to the same number.
+static double stringNumber(JankyVm *vm, Object *object) {
+    ObjString *string = asFlatString(&vm->heap, object);
+    double number;
+
+    if (__atomic_load_n(&string->has_number, __ATOMIC_ACQUIRE)) {
+        __atomic_load(&string->number, &number, __ATOMIC_RELAXED);
+    } else {
+        number = stringToNumber(string->chars, string->length);
+        __atomic_store(&string->number, &number, __ATOMIC_RELAXED);
+        __atomic_store_n(&string->has_number, true, __ATOMIC_RELEASE);
     }
+
+    return number;
 }
 
-static bool looselyEqual(Value a, Value b) {
+static bool looselyEqual(JankyVm *vm, Value a, Value b) {
     if (a.type == b.type) {
-        return valuesEqual(a, b);
+        return valuesEqual(vm, a, b);
     }
 
     if (a.type == TYPE_BOOL && b.type == TYPE_NUMBER) {
@@ -63,60 +291,2157 @@ static bool looselyEqual(Value a, Value b) {
         return a.as.number == (b.as.boolean ? 1 : 0);
     }
     if (a.type == TYPE_STRING && b.type == TYPE_NUMBER) {
-        return atoi(a.as.object->as.string.chars) == b.as.number;
+        return stringNumber(vm, a.as.object) == b.as.number;
     }
     if (a.type == TYPE_NUMBER && b.type == TYPE_STRING) {
-        return atoi(b.as.object->as.string.chars) == a.as.number;
+        return stringNumber(vm, b.as.object) == a.as.number;
     }
     if (a.type == TYPE_BOOL && b.type == TYPE_STRING) {
-        return atoi(b.as.object->as.string.chars) == a.as.boolean;
+        return stringNumber(vm, b.as.object) == (a.as.boolean ? 1 : 0);
     }
     if (a.type == TYPE_STRING && b.type == TYPE_BOOL) {
-        return atoi(a.as.object->as.string.chars) == b.as.boolean;
+        return stringNumber(vm, a.as.object) == (b.as.boolean ? 1 : 0);
+    }
+
+    return false;
+}
+
+static VmResult runtimeError(JankyVm *vm, char *error) {
+    flushOutput(vm);
+    reportError(vm->errors, error);
+    return VM_RUNTIME_ERROR;
+}
+
+static VmResult stackOverflow(JankyVm *vm) {
+    vm->stack_overflow = false;
+    return runtimeError(vm, "Maximum call stack size exceeded.");
+}
+
+// A frozen chunk is shared, so its inline caches are the VM's own, in a
+// block per program the VM has run. There is rarely more than one.
+static PropertyCache *chunkCaches(JankyVm *vm, Bytecode *chunk) {
+    if (!chunk->program) return chunk->caches;
+
+    for (int i = 0; i < vm->program_cache_count; i++) {
+        if (vm->program_caches[i].program == chunk->program) {
+            return vm->program_caches[i].caches + chunk->cache_base;
+        }
+    }
+
+    int count = vm->program_cache_count++;
+    vm->program_caches = realloc(vm->program_caches, sizeof(ProgramCaches) * vm->program_cache_count);
+    vm->program_caches[count].program = chunk->program;
+    vm->program_caches[count].caches = calloc(chunk->program->cache_count + 1, sizeof(PropertyCache));
+
+    return vm->program_caches[count].caches + chunk->cache_base;
+}
+
+static Value newNumber(double value) {
+    Value number;
+    number.type = TYPE_NUMBER;
+    number.as.number = value;
+
+    return number;
+}
+
+static Value newBoolean(bool value) {
+    Value boolean;
+    boolean.type = TYPE_BOOL;
+    boolean.as.boolean = value;
+
+    return boolean;
+}
+
+// Runs whichever collection is due. Allocation sites call this first,
+// with every live value reachable from the stack or the globals.
+static void collectIfDue(JankyVm *vm) {
+    // malloc'd storage owned by young objects is only freed by a minor
+    // collection, so enough of it brings one forward
+    size_t nurserySize = vm->heap.nursery_end - vm->heap.nursery;
+    if (vm->heap.young_external_bytes > nurserySize) minorCollect(vm);
+
+    if (vm->heap.concurrent) {
+        collectConcurrently(vm);
+    } else if (majorCollectionDue(&vm->heap)) {
+        collectGarbage(vm);
+    }
+}
+
+static Value copyString(JankyVm *vm, const char *chars, int length) {
+    collectIfDue(vm);
+
+    Object *object = newYoungString(&vm->heap, chars, length);
+    if (!object) {
+        minorCollect(vm);
+        object = newYoungString(&vm->heap, chars, length);
+    }
+
+    Value string;
+    string.type = TYPE_STRING;
+    string.as.object = object;
+
+    return string;
+}
+
+static Value newString(JankyVm *vm, char *value) {
+    return copyString(vm, value, strlen(value));
+}
+
+static Value newUndefined() {
+    Value undefined;
+    undefined.type = TYPE_UNDEFINED;
+
+    return undefined;
+}
+
+static int tryGetIntValue(Value val) {
+    if (val.type == TYPE_BOOL) return val.as.boolean;
+    else if (val.type == TYPE_NUMBER) return val.as.number;
+
+    return 0;
+}
+
+static double tryGetNumber(Value val) {
+    if (val.type == TYPE_BOOL) return val.as.boolean;
+    else if (val.type == TYPE_NUMBER) return val.as.number;
+
+    return 0;
+}
+
+// The element a number indexes, or false for anything but a whole
+// number in int range: a fraction, NaN or an infinity index nothing.
+static bool elementIndex(Value val, int *index) {
+    if (val.type != TYPE_NUMBER) return false;
+
+    double number = val.as.number;
+    if (!(number >= 0 && number < INT_MAX) || number != (int)number) return false;
+
+    *index = (int)number;
+    return true;
+}
+
+// A position passed to a string method, truncated towards zero. NaN is
+// position 0, and anything outside int range is -1, which is past
+// either end.
+static int positionArgument(Value val) {
+    double number = tryGetNumber(val);
+    if (number != number) return 0;
+    if (number <= -1 || number >= INT_MAX) return -1;
+
+    return (int)number;
+}
+
+static bool isFalsey(Value val) {
+    switch (val.type) {
+        case TYPE_BOOL:      return !val.as.boolean;
+        case TYPE_NUMBER:    return val.as.number == 0;
+        case TYPE_STRING:    return stringLength(val.as.object) == 0;
+        case TYPE_UNDEFINED: return true;
+        default:             return false;
+    }
+}
+
+void flushOutput(JankyVm *vm) {
+    if (vm->keep_output) return;
+
+    fwrite(vm->output.chars, 1, vm->output.length, stdout);
+    fflush(stdout);
+    vm->output.length = 0;
+}
+
+static void writeOutput(JankyVm *vm, const char *chars) {
+    appendText(&vm->output, chars, strlen(chars));
+}
+
+// Objects are printed with their properties in slot order, and arrays
+// with their elements, down to a couple of levels; strings inside them
+// are quoted.
+static void printObject(JankyVm *vm, Value value, int depth) {
+    TextBuffer *out = &vm->output;
+
+    if (value.type == TYPE_BOOL) {
+        writeOutput(vm, value.as.boolean ? "true" : "false");
+    } else if (value.type == TYPE_NUMBER) {
+        out->length += formatNumber(value.as.number, reserveText(out, NUMBER_BUFFER_SIZE));
+    } else if (value.type == TYPE_STRING) {
+        ObjString *string = asFlatString(&vm->heap, value.as.object);
+        if (depth > 0) appendChar(out, '\'');
+        appendText(out, string->chars, string->length);
+        if (depth > 0) appendChar(out, '\'');
+    } else if (value.type == TYPE_FUNCTION) {
+        char *name = value.as.object->as.function.name;
+        writeOutput(vm, "[Function: ");
+        writeOutput(vm, name ? name : "(anonymous)");
+        appendChar(out, ']');
+    } else if (value.type == TYPE_UNDEFINED) {
+        writeOutput(vm, "undefined");
+    } else if (value.type == TYPE_OBJECT) {
+        ObjInstance *instance = &value.as.object->as.instance;
+        int count = instance->shape->count;
+
+        if (count == 0) {
+            writeOutput(vm, "{}");
+            return;
+        }
+        if (depth > 2) {
+            writeOutput(vm, "[Object]");
+            return;
+        }
+
+        // the keys are found walking up from the last one
+        Shape **keys = malloc(sizeof(Shape *) * count);
+        for (Shape *shape = instance->shape; shape->key; shape = shape->parent) {
+            keys[shape->count - 1] = shape;
+        }
+
+        writeOutput(vm, "{ ");
+        for (int i = 0; i < count; i++) {
+            if (i > 0) writeOutput(vm, ", ");
+            writeOutput(vm, keys[i]->key);
+            writeOutput(vm, ": ");
+            printObject(vm, *instanceSlot(instance, i), depth + 1);
+        }
+        writeOutput(vm, " }");
+        free(keys);
+    } else if (value.type == TYPE_ARRAY) {
+        ObjArray *array = &value.as.object->as.array;
+
+        if (array->count == 0) {
+            writeOutput(vm, "[]");
+            return;
+        }
+        if (depth > 2) {
+            writeOutput(vm, "[Array]");
+            return;
+        }
+
+        writeOutput(vm, "[ ");
+        for (int i = 0; i < array->count; i++) {
+            if (i > 0) writeOutput(vm, ", ");
+            printObject(vm, arrayElement(array, i), depth + 1);
+        }
+        writeOutput(vm, " ]");
+    } else if (value.type == TYPE_MAP) {
+        ObjMap *map = &value.as.object->as.map;
+        const char *kind = map->is_set ? "Set" : "Map";
+
+        if (depth > 2) {
+            appendChar(out, '[');
+            writeOutput(vm, kind);
+            appendChar(out, ']');
+            return;
+        }
+
+        char count[NUMBER_BUFFER_SIZE];
+        formatNumber(map->count, count);
+        writeOutput(vm, kind);
+        appendChar(out, '(');
+        writeOutput(vm, count);
+        writeOutput(vm, ") {");
+
+        int printed = 0;
+        for (int i = 0; i < map->entry_count; i++) {
+            if (!map->entries[i].live) continue;
+
+            writeOutput(vm, printed++ > 0 ? ", " : " ");
+            printObject(vm, map->entries[i].key, depth + 1);
+            if (!map->is_set) {
+                writeOutput(vm, " => ");
+                printObject(vm, map->entries[i].value, depth + 1);
+            }
+        }
+        writeOutput(vm, printed > 0 ? " }" : "}");
+    } else if (value.type == TYPE_WORKER) {
+        writeOutput(vm, "Worker {}");
+    }
+}
+
+// Results collect in the output buffer, which is written out whenever it
+// fills up and once the script is done, so printing a line is a copy
+// rather than a call into stdio.
+static void printValue(JankyVm *vm, Value value) {
+    printObject(vm, value, 0);
+    appendChar(&vm->output, '\n');
+
+    if (vm->output.length >= OUTPUT_BUFFER_SIZE) flushOutput(vm);
+}
+
+// Writes the elements separated by commas, as String(array) does in JS:
+// undefined is left empty and nested arrays are joined in turn. Nothing
+// is allocated on the heap until the whole text is ready.
+static void appendElements(JankyVm *vm, TextBuffer *text, Object *object, int depth) {
+    ObjArray *array = &object->as.array;
+
+    for (int i = 0; i < array->count; i++) {
+        if (i > 0) appendText(text, ",", 1);
+
+        Value value = arrayElement(array, i);
+        char buffer[64];
+        int length = 0;
+
+        switch (value.type) {
+            case TYPE_NUMBER:   length = formatNumber(value.as.number, buffer); break;
+            case TYPE_BOOL:     length = snprintf(buffer, sizeof(buffer), "%s", value.as.boolean ? "true" : "false"); break;
+            case TYPE_OBJECT:   length = snprintf(buffer, sizeof(buffer), "[object Object]"); break;
+            case TYPE_FUNCTION: length = snprintf(buffer, sizeof(buffer), "[Function]"); break;
+            case TYPE_MAP:      length = snprintf(buffer, sizeof(buffer), "[object %s]", value.as.object->as.map.is_set ? "Set" : "Map"); break;
+            case TYPE_WORKER:   length = snprintf(buffer, sizeof(buffer), "[object Worker]"); break;
+            case TYPE_STRING: {
+                ObjString *string = asFlatString(&vm->heap, value.as.object);
+                appendText(text, string->chars, string->length);
+                break;
+            }
+            case TYPE_ARRAY: {
+                if (depth < 64) appendElements(vm, text, value.as.object, depth + 1);
+                break;
+            }
+            default:
+                break;
+        }
+
+        appendText(text, buffer, length);
+    }
+}
+
+static Value joinArray(JankyVm *vm, Object *array) {
+    TextBuffer text = { NULL, 0, 0 };
+    appendText(&text, "", 0);
+    appendElements(vm, &text, array, 0);
+
+    Value result = newString(vm, text.chars);
+    free(text.chars);
+
+    return result;
+}
+
+// The string an operand of '+' turns into next to a string.
+static Value stringify(JankyVm *vm, Value value) {
+    char buffer[64];
+
+    switch (value.type) {
+        case TYPE_STRING:    return value;
+        case TYPE_NUMBER:    formatNumber(value.as.number, buffer); break;
+        case TYPE_BOOL:      return newString(vm, value.as.boolean ? "true" : "false");
+        case TYPE_FUNCTION: {
+            char *name = value.as.object->as.function.name;
+            snprintf(buffer, sizeof(buffer), "[Function: %s]", name ? name : "(anonymous)");
+            break;
+        }
+        case TYPE_OBJECT:    return newString(vm, "[object Object]");
+        case TYPE_ARRAY:     return joinArray(vm, value.as.object);
+        case TYPE_MAP:       return newString(vm, value.as.object->as.map.is_set ? "[object Set]" : "[object Map]");
+        case TYPE_WORKER:    return newString(vm, "[object Worker]");
+        default:             return newString(vm, "undefined");
+    }
+
+    return newString(vm, buffer);
+}
+
+// Joins the two strings on top of the stack, the left one topmost. Long
+// results become a rope over both sides; short ones are copied.
+static Object *joinStrings(JankyVm *vm, int length) {
+    Object *left = vm->stack_top[-1].as.object;
+    Object *right = vm->stack_top[-2].as.object;
+
+    int count = stringCount(left) + stringCount(right);
+
+    if (length >= ROPE_MIN_LENGTH) {
+        return newYoungRope(&vm->heap, left, right, length, count);
+    }
+
+    Object *object = reserveYoungString(&vm->heap, length);
+    if (!object) return NULL;
+
+    ObjString *a = asFlatString(&vm->heap, left);
+    ObjString *b = asFlatString(&vm->heap, right);
+    memcpy(object->as.string.chars, a->chars, a->length);
+    memcpy(object->as.string.chars + a->length, b->chars, b->length);
+    object->as.string.count = count;
+
+    return object;
+}
+
+// Operands stay on the stack until the result exists, since converting
+// them or allocating the result can move them.
+static VmResult concatenate(JankyVm *vm) {
+    vm->stack_top[-1] = stringify(vm, vm->stack_top[-1]);
+    vm->stack_top[-2] = stringify(vm, vm->stack_top[-2]);
+
+    long length = (long)stringLength(vm->stack_top[-1].as.object) + stringLength(vm->stack_top[-2].as.object);
+    if (length > INT_MAX) {
+        return runtimeError(vm, "Invalid string length.");
+    }
+
+    Value result;
+    result.type = TYPE_STRING;
+
+    if (stringLength(vm->stack_top[-1].as.object) == 0) {
+        result = vm->stack_top[-2];
+    } else if (stringLength(vm->stack_top[-2].as.object) == 0) {
+        result = vm->stack_top[-1];
+    } else {
+        collectIfDue(vm);
+
+        result.as.object = joinStrings(vm, length);
+        if (!result.as.object) {
+            minorCollect(vm);
+            result.as.object = joinStrings(vm, length);
+        }
+    }
+
+    vm->stack_top -= 2;
+    push(vm, result);
+
+    return VM_OK;
+}
+
+// The code point at 'index' of the string 'string' as a string of its own,
+// or NULL when the index is out of range.
+static Object *charAt(JankyVm *vm, Value string, int index) {
+    Object *flat = flatten(&vm->heap, string.as.object);
+    if (index < 0 || index >= flat->as.string.count) return NULL;
+
+    int offset = codepointOffset(&vm->utf8_cache, flat, index);
+    unsigned char lead = flat->as.string.chars[offset];
+    if (lead < 0x80) return vm->ascii_chars[lead];
+
+    // copied out first: allocating may move the string
+    char bytes[5] = { 0 };
+    memcpy(bytes, flat->as.string.chars + offset, utf8SequenceLength(lead));
+
+    return newString(vm, bytes).as.object;
+}
+
+// Remembers that objects of 'shape' keep the property in 'slot', and
+// move to 'transition' when a store adds it.
+static void cacheShape(JankyVm *vm, PropertyCache *cache, Shape *shape, int slot, Shape *transition) {
+    if (cache->count < PROPERTY_CACHE_WAYS) {
+        cache->shapes[cache->count] = shape;
+        cache->slots[cache->count] = slot;
+        cache->transitions[cache->count] = transition;
+        cache->count++;
+    } else if (!cache->megamorphic) {
+        cache->megamorphic = true;
+        vm->megamorphic_sites++;
+    }
+}
+
+static MegamorphicEntry *megamorphicEntry(JankyVm *vm, Shape *shape, char *name) {
+    uintptr_t hash = ((uintptr_t)shape >> 4) ^ ((uintptr_t)name >> 3);
+    return &vm->megamorphic[hash & (MEGAMORPHIC_ENTRIES - 1)];
+}
+
+// The slot holding 'name' on objects of 'shape', or -1. The site's cache
+// is tried before walking the shape chain, and after it the shared table
+// if the site has gone megamorphic.
+static int lookupSlot(JankyVm *vm, PropertyCache *cache, Shape *shape, char *name) {
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->shapes[i] == shape && !cache->transitions[i]) {
+            vm->property_hits++;
+            return cache->slots[i];
+        }
+    }
+
+    MegamorphicEntry *entry = NULL;
+    if (cache->megamorphic) {
+        entry = megamorphicEntry(vm, shape, name);
+        if (entry->shape == shape && entry->name == name && !entry->transition) {
+            vm->megamorphic_hits++;
+            return entry->slot;
+        }
+    }
+
+    vm->property_misses++;
+    int slot = shapeLookup(shape, name);
+    cacheShape(vm, cache, shape, slot, NULL);
+
+    if (entry) {
+        entry->shape = shape;
+        entry->name = name;
+        entry->slot = slot;
+        entry->transition = NULL;
+    }
+
+    return slot;
+}
+
+static Value getField(JankyVm *vm, Object *object, char *name, PropertyCache *cache) {
+    ObjInstance *instance = &object->as.instance;
+    int slot = lookupSlot(vm, cache, instance->shape, name);
+
+    return slot < 0 ? newUndefined() : *instanceSlot(instance, slot);
+}
+
+// Writes to an existing slot, or adds the property when 'transition' is
+// the shape that has it.
+static void putField(JankyVm *vm, Object *object, int slot, Shape *transition, Value value) {
+    if (transition) {
+        addField(&vm->heap, object, transition, value);
+    } else {
+        storeField(&vm->heap, object, slot, value);
+    }
+}
+
+// Assigns an existing property or adds a new one. A cached transition
+// skips both the lookup and the search for the next shape.
+static void setField(JankyVm *vm, Object *object, char *name, PropertyCache *cache, Value value) {
+    Shape *shape = object->as.instance.shape;
+
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->shapes[i] != shape || (cache->slots[i] < 0 && !cache->transitions[i])) continue;
+
+        vm->property_hits++;
+        putField(vm, object, cache->slots[i], cache->transitions[i], value);
+        return;
+    }
+
+    MegamorphicEntry *entry = NULL;
+    if (cache->megamorphic) {
+        entry = megamorphicEntry(vm, shape, name);
+        if (entry->shape == shape && entry->name == name && (entry->slot >= 0 || entry->transition)) {
+            vm->megamorphic_hits++;
+            putField(vm, object, entry->slot, entry->transition, value);
+            return;
+        }
+    }
+
+    vm->property_misses++;
+    int slot = shapeLookup(shape, name);
+    Shape *transition = NULL;
+    if (slot < 0) {
+        transition = shapeTransition(shape, name);
+        slot = transition->count - 1;
+    }
+    cacheShape(vm, cache, shape, slot, transition);
+
+    if (entry) {
+        entry->shape = shape;
+        entry->name = name;
+        entry->slot = slot;
+        entry->transition = transition;
+    }
+
+    putField(vm, object, slot, transition, value);
+}
+
+static VmResult getProperty(JankyVm *vm, char *name, PropertyCache *cache) {
+    Value receiver = pop(vm);
+
+    if (receiver.type == TYPE_UNDEFINED) {
+        return runtimeError(vm, "Cannot read properties of undefined.");
+    }
+
+    if (receiver.type == TYPE_OBJECT) {
+        push(vm, getField(vm, receiver.as.object, name, cache));
+    } else if (receiver.type == TYPE_ARRAY && strcmp(name, "length") == 0) {
+        push(vm, newNumber(receiver.as.object->as.array.count));
+    } else if (receiver.type == TYPE_STRING && strcmp(name, "length") == 0) {
+        push(vm, newNumber(stringCount(receiver.as.object)));
+    } else if (receiver.type == TYPE_MAP && strcmp(name, "size") == 0) {
+        push(vm, newNumber(receiver.as.object->as.map.count));
+    } else {
+        push(vm, newUndefined());
+    }
+
+    return VM_OK;
+}
+
+static VmResult getIndex(JankyVm *vm) {
+    Value receiver = vm->stack_top[-2];
+    int index;
+
+    if (receiver.type == TYPE_UNDEFINED) {
+        return runtimeError(vm, "Cannot read properties of undefined.");
+    }
+
+    Value result = newUndefined();
+    if (receiver.type == TYPE_STRING && elementIndex(vm->stack_top[-1], &index)) {
+        Object *object = charAt(vm, receiver, index);
+        if (object) {
+            result.type = TYPE_STRING;
+            result.as.object = object;
+        }
+    }
+
+    vm->stack_top -= 2;
+    push(vm, result);
+
+    return VM_OK;
+}
+
+// Built-in methods of strings. The receiver and arguments stay on the
+// stack until the result is ready.
+static VmResult invokeString(JankyVm *vm, char *name, int argCount) {
+    Value *receiver = vm->stack_top - argCount - 1;
+    int index = argCount > 0 ? positionArgument(receiver[1]) : 0;
+
+    Value result;
+    if (strcmp(name, "charAt") == 0) {
+        Object *object = charAt(vm, *receiver, index);
+        result.type = TYPE_STRING;
+        result.as.object = object ? object : newString(vm, "").as.object;
+    } else if (strcmp(name, "codePointAt") == 0) {
+        Object *flat = flatten(&vm->heap, receiver->as.object);
+        if (index < 0 || index >= flat->as.string.count) {
+            result = newUndefined();
+        } else {
+            int codepoint;
+            decodeUtf8(flat->as.string.chars + codepointOffset(&vm->utf8_cache, flat, index), &codepoint);
+            result = newNumber(codepoint);
+        }
+    } else {
+        return runtimeError(vm, "Undefined method.");
+    }
+
+    vm->stack_top = receiver;
+    push(vm, result);
+
+    return VM_OK;
+}
+
+// Stores 'value' into property 'name' of the object below it on the
+// stack. Other receivers, bar undefined, ignore the store.
+static VmResult setProperty(JankyVm *vm, char *name, PropertyCache *cache) {
+    Value receiver = vm->stack_top[-2];
+    Value value = vm->stack_top[-1];
+
+    if (receiver.type == TYPE_UNDEFINED) {
+        return runtimeError(vm, "Cannot set properties of undefined.");
+    }
+
+    if (receiver.type == TYPE_OBJECT) {
+        setField(vm, receiver.as.object, name, cache, value);
+    }
+
+    return VM_OK;
+}
+
+static VmResult callValue(JankyVm *vm, int argCount, bool tail);
+static VmResult evalOpCode(JankyVm *vm, OpCode op);
+static bool compileOnCall(JankyVm *vm, Object *function);
+
+// A new array with room for 'capacity' elements. Anything the caller
+// still needs must be on the stack, as this may collect.
+static Object *newArray(JankyVm *vm, ElementKind kind, int capacity) {
+    collectIfDue(vm);
+    Object *object = newYoungArray(&vm->heap, kind, capacity);
+    if (!object) {
+        minorCollect(vm);
+        object = newYoungArray(&vm->heap, kind, capacity);
+    }
+
+    return object;
+}
+
+// An empty object with room for 'count' properties inline, on the same
+// terms as newArray().
+static Value newObject(JankyVm *vm, int count) {
+    int capacity = count > INSTANCE_MIN_SLOTS ? count : INSTANCE_MIN_SLOTS;
+
+    collectIfDue(vm);
+    Object *object = newYoungInstance(&vm->heap, vm->root_shape, capacity);
+    if (!object) {
+        minorCollect(vm);
+        object = newYoungInstance(&vm->heap, vm->root_shape, capacity);
+    }
+
+    Value instance;
+    instance.type = TYPE_OBJECT;
+    instance.as.object = object;
+
+    return instance;
+}
+
+static Value arrayValue(Object *object) {
+    Value value;
+    value.type = TYPE_ARRAY;
+    value.as.object = object;
+
+    return value;
+}
+
+// Calls 'callee' with the arguments after it and runs it to completion,
+// leaving its result on the stack in their place.
+static VmResult callBack(JankyVm *vm, Value callee, Value *args, int argCount) {
+    int depth = vm->frame_count;
+
+    push(vm, callee);
+    for (int i = 0; i < argCount; i++) push(vm, args[i]);
+    if (vm->stack_overflow) return stackOverflow(vm);
+
+    VmResult result = callValue(vm, argCount, false);
+    while (result == VM_OK && vm->frame_count > depth) {
+        result = evalOpCode(vm, vm->bytecode->code[vm->ip++]);
+        if (vm->stack_overflow) return stackOverflow(vm);
+    }
+
+    return result;
+}
+
+// The elements as doubles: the array's own when they are packed doubles,
+// otherwise converted into a buffer the caller frees.
+static double *numbersOf(ObjArray *array, bool *owned) {
+    *owned = array->kind != ELEMENTS_DOUBLE;
+    if (!*owned) return array->elements.doubles;
+
+    double *numbers = malloc(sizeof(double) * (array->count > 0 ? array->count : 1));
+    for (int i = 0; i < array->count; i++) {
+        numbers[i] = tryGetNumber(arrayElement(array, i));
+    }
+
+    return numbers;
+}
+
+// A callback whose whole body is 'return <left> <op> <right>', with each
+// operand a parameter (slot 1 and up) or a numeric constant (slot 0).
+typedef struct {
+    OpCode op;
+    int    left;
+    int    right;
+    double constant;
+} Arithmetic;
+
+static bool operandOf(Bytecode *chunk, int at, int *slot, double *constant) {
+    if (chunk->code[at] == OP_GET_LOCAL) {
+        *slot = chunk->code[at + 1];
+        return *slot > 0;
+    }
+
+    if (chunk->code[at] != OP_CONSTANT) return false;
+
+    Value value = chunk->constants[chunk->code[at + 1]];
+    if (value.type != TYPE_NUMBER) return false;
+
+    *slot = 0;
+    *constant = value.as.number;
+    return true;
+}
+
+// The right operand is compiled first, so it comes first in the code.
+static bool matchArithmetic(JankyVm *vm, Value callee, int arity, Arithmetic *match) {
+    if (callee.type != TYPE_FUNCTION) return false;
+
+    Object *function = callee.as.object;
+    if (function->as.function.arity != arity) return false;
+    if (!function->as.function.chunk && !compileOnCall(vm, function)) return false;
+
+    Bytecode *chunk = function->as.function.chunk;
+    if (chunk->code_count < 6 || chunk->code[5] != OP_RETURN) return false;
+
+    match->op = chunk->code[4];
+    if (match->op != OP_PLUS && match->op != OP_MINUS && match->op != OP_MULTIPLY) return false;
+
+    return operandOf(chunk, 0, &match->right, &match->constant) &&
+           operandOf(chunk, 2, &match->left, &match->constant) &&
+           (match->left > 0 || match->right > 0);
+}
+
+// map() over packed numbers with an arithmetic callback of its one
+// parameter and a constant, done as out = x * scale + offset. Returns
+// false if the callback is anything else.
+static bool mapArithmetic(JankyVm *vm, Arithmetic *match, Value *receiver) {
+    if (match->left > 1 || match->right > 1) return false;
+    if (receiver->as.object->as.array.kind == ELEMENTS_GENERIC) return false;
+
+    double scale = 1, offset = 0;
+    bool both = match->left == 1 && match->right == 1;
+    switch (match->op) {
+        case OP_PLUS:
+            offset = match->constant;
+            break;
+        case OP_MINUS:
+            if (both) return false;
+            scale = match->left == 1 ? 1 : -1;
+            offset = match->left == 1 ? -match->constant : match->constant;
+            break;
+        default:
+            // adding -0 leaves every product as it is, -0 included
+            scale = match->constant;
+            offset = -0.0;
+            break;
+    }
+
+    int count = receiver->as.object->as.array.count;
+    Object *result = newArray(vm, ELEMENTS_DOUBLE, count);
+    ObjArray *array = &receiver->as.object->as.array;
+    double *out = result->as.array.elements.doubles;
+
+    // ints are widened into the result first and then mapped in place
+    double *x = array->elements.doubles;
+    if (array->kind == ELEMENTS_INT) {
+        for (int i = 0; i < count; i++) out[i] = array->elements.ints[i];
+        x = out;
+    }
+
+    // x + x and x * x
+    if (both && match->op == OP_PLUS) vm->settings.kernels->add(out, x, x, count);
+    else if (both) vm->settings.kernels->mul(out, x, x, count);
+    else vm->settings.kernels->affine(out, x, count, scale, offset);
+
+    result->as.array.count = count;
+    vm->kernel_calls++;
+
+    vm->stack_top = receiver;
+    push(vm, arrayValue(result));
+    return true;
+}
+
+// map(fn): arithmetic callbacks run natively, anything else is called
+// once per element with the element, its index and the array.
+static VmResult mapArray(JankyVm *vm, Value *receiver, Value callee) {
+    Arithmetic match;
+    if (matchArithmetic(vm, callee, 1, &match) && mapArithmetic(vm, &match, receiver)) {
+        return VM_OK;
+    }
+
+    // the result sits on the stack above the callee so that collections
+    // made by the callback keep and forward it
+    int count = receiver->as.object->as.array.count;
+    push(vm, arrayValue(newArray(vm, ELEMENTS_INT, count)));
+    Value *result = vm->stack_top - 1;
+
+    for (int i = 0; i < count && i < receiver->as.object->as.array.count; i++) {
+        Value args[] = { arrayElement(&receiver->as.object->as.array, i), newNumber(i), *receiver };
+
+        VmResult status = callBack(vm, receiver[1], args, 3);
+        if (status != VM_OK) return status;
+
+        setElement(&vm->heap, result->as.object, i, pop(vm));
+    }
+
+    Value mapped = *result;
+    vm->stack_top = receiver;
+    push(vm, mapped);
+
+    return VM_OK;
+}
+
+// reduce(fn, initial): a callback that adds or multiplies its two
+// parameters folds natively, anything else is called once per element
+// with the accumulator, the element, its index and the array. Without an
+// initial value the first element is used.
+static VmResult reduceArray(JankyVm *vm, Value *receiver, int argCount) {
+    ObjArray *array = &receiver->as.object->as.array;
+
+    int start = 0;
+    Value accumulator;
+    if (argCount >= 2) {
+        accumulator = receiver[2];
+    } else if (array->count > 0) {
+        accumulator = arrayElement(array, 0);
+        start = 1;
+    } else {
+        return runtimeError(vm, "Reduce of empty array with no initial value.");
+    }
+
+    Arithmetic match;
+    if (matchArithmetic(vm, receiver[1], 2, &match) && match.left > 0 && match.right > 0 &&
+        match.left != match.right && match.op != OP_MINUS &&
+        array->kind != ELEMENTS_GENERIC && accumulator.type == TYPE_NUMBER) {
+        array = &receiver->as.object->as.array;
+        const Kernels *kernels = vm->settings.kernels;
+        int count = array->count - start;
+        double value = accumulator.as.number;
+
+        if (match.op == OP_PLUS && array->kind == ELEMENTS_INT) {
+            value += kernels->sum_i32(array->elements.ints + start, count);
+        } else if (match.op == OP_PLUS) {
+            value += kernels->sum(array->elements.doubles + start, count);
+        } else {
+            for (int i = start; i < array->count; i++) value *= arrayElement(array, i).as.number;
+        }
+        vm->kernel_calls++;
+
+        vm->stack_top = receiver;
+        push(vm, newNumber(value));
+        return VM_OK;
+    }
+
+    push(vm, accumulator);
+    Value *result = vm->stack_top - 1;
+
+    for (int i = start; i < receiver->as.object->as.array.count; i++) {
+        Value args[] = { *result, arrayElement(&receiver->as.object->as.array, i), newNumber(i), *receiver };
+
+        VmResult status = callBack(vm, receiver[1], args, 4);
+        if (status != VM_OK) return status;
+
+        *result = pop(vm);
+    }
+
+    Value reduced = *result;
+    vm->stack_top = receiver;
+    push(vm, reduced);
+
+    return VM_OK;
+}
+
+// filter(fn) of an array that is not packed, as parallelFilter() runs
+// it on the calling thread: the callback gets the element, its index and
+// the array, and the elements it returns something truthy for are kept.
+static VmResult filterArray(JankyVm *vm, Value *receiver) {
+    push(vm, arrayValue(newArray(vm, ELEMENTS_INT, 0)));
+    Value *result = vm->stack_top - 1;
+
+    for (int i = 0; i < receiver->as.object->as.array.count; i++) {
+        Value args[] = { arrayElement(&receiver->as.object->as.array, i), newNumber(i), *receiver };
+
+        VmResult status = callBack(vm, receiver[1], args, 3);
+        if (status != VM_OK) return status;
+
+        // read again, as the call may have moved it
+        if (!isFalsey(pop(vm)) && i < receiver->as.object->as.array.count) {
+            Object *kept = result->as.object;
+            setElement(&vm->heap, kept, kept->as.array.count, arrayElement(&receiver->as.object->as.array, i));
+        }
+    }
+
+    Value filtered = *result;
+    vm->stack_top = receiver;
+    push(vm, filtered);
+
+    return VM_OK;
+}
+
+// The functions a callback can reach, through its constants and theirs
+// and through the globals they read, which are kept with their names.
+typedef struct {
+    Object **functions;
+    int      count;
+    int      capacity;
+
+    char   **names;
+    Object **bound;
+    int      bound_count;
+} CallbackReach;
+
+static void reachFunction(CallbackReach *reach, Object *function) {
+    for (int i = 0; i < reach->count; i++) {
+        if (reach->functions[i] == function) return;
+    }
+
+    if (reach->count == reach->capacity) {
+        reach->capacity = reach->capacity == 0 ? 8 : reach->capacity * 2;
+        reach->functions = realloc(reach->functions, sizeof(Object *) * reach->capacity);
+        reach->names = realloc(reach->names, sizeof(char *) * reach->capacity);
+        reach->bound = realloc(reach->bound, sizeof(Object *) * reach->capacity);
+    }
+    reach->functions[reach->count++] = function;
+}
+
+// A global read from a callback must hold a function, such as one the
+// callback calls by name, or be undefined, as reading it then fails
+// wherever it runs. There are never more names than functions, since a
+// name is only kept the first time it is read.
+static bool reachGlobal(JankyVm *vm, CallbackReach *reach, char *name) {
+    Value value;
+    if (!getSymbol(&vm->globals, name, &value)) return true;
+    if (value.type != TYPE_FUNCTION) return false;
+
+    for (int i = 0; i < reach->bound_count; i++) {
+        if (strcmp(reach->names[i], name) == 0) return true;
+    }
+
+    reachFunction(reach, value.as.object);
+    reach->names[reach->bound_count] = name;
+    reach->bound[reach->bound_count++] = value.as.object;
+    return true;
+}
+
+static void freeReach(CallbackReach *reach) {
+    free(reach->functions);
+    free(reach->names);
+    free(reach->bound);
+}
+
+// Compiles every function the callback can reach and returns false if
+// one would not compile. '*effect' is then what one of them could do
+// that is seen outside the call, or NULL if none can do anything.
+static bool callbackEffect(JankyVm *vm, Object *callback, CallbackReach *reach, const char **effect) {
+    memset(reach, 0, sizeof(CallbackReach));
+    reachFunction(reach, callback);
+
+    *effect = NULL;
+    for (int next = 0; next < reach->count && !*effect; next++) {
+        Object *function = reach->functions[next];
+        if (!function->as.function.chunk && !compileOnCall(vm, function)) return false;
+
+        Bytecode *chunk = function->as.function.chunk;
+        *effect = sideEffect(chunk);
+
+        for (int i = 0; i < chunk->const_count; i++) {
+            if (chunk->constants[i].type == TYPE_FUNCTION) reachFunction(reach, chunk->constants[i].as.object);
+        }
+
+        for (int i = 0; i < chunk->code_count && !*effect; i += 1 + operandCount(chunk->code[i])) {
+            if (chunk->code[i] != OP_GET_GLOBAL) continue;
+
+            char *name = chunk->constants[chunk->code[i + 1]].as.identifier;
+            if (!reachGlobal(vm, reach, name)) *effect = "reads a global that is not a function";
+        }
+    }
+
+    return true;
+}
+
+// Runs one task's elements through the callback: each element and its
+// index for a map or a filter, and for a reduce the fold so far and the
+// element, starting from the task's first element. The array and the
+// map's result are read through their stack slots each time, since a
+// callback on the calling thread may collect.
+static VmResult runTask(JankyVm *vm, Value callee, ParallelJob *job, int task) {
+    int start = task * job->grain;
+    int end = (long)start + job->grain < job->count ? start + job->grain : job->count;
+
+    double fold = 0;
+    if (job->op == PARALLEL_REDUCE) fold = arrayElement(&job->array->as.object->as.array, start++).as.number;
+
+    for (int i = start; i < end; i++) {
+        Value element = arrayElement(&job->array->as.object->as.array, i);
+        Value args[2] = { element, newNumber(i) };
+        if (job->op == PARALLEL_REDUCE) {
+            args[0] = newNumber(fold);
+            args[1] = element;
+        }
+
+        VmResult status = callBack(vm, callee, args, 2);
+        if (status != VM_OK) return status;
+        Value result = pop(vm);
+
+        switch (job->op) {
+            case PARALLEL_MAP:
+                if (result.type != TYPE_NUMBER) return runtimeError(vm, "The callback to parallelMap must return a number.");
+                job->mapped->as.object->as.array.elements.doubles[i] = result.as.number;
+                break;
+            case PARALLEL_FILTER:
+                job->kept[i] = !isFalsey(result);
+                break;
+            default:
+                if (result.type != TYPE_NUMBER) return runtimeError(vm, "The callback to parallelReduce must return a number.");
+                fold = result.as.number;
+                break;
+        }
+    }
+
+    if (job->op == PARALLEL_REDUCE) job->partials[task] = fold;
+
+    return VM_OK;
+}
+
+static int parallelThreads(JankyVm *vm) {
+    if (vm->settings.threads > 0) return vm->settings.threads;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 1 ? (int)cores : 1;
+}
+
+// Runs the job's tasks on the VM's pool with a frozen copy of the
+// callback and of the functions it calls by name, which every VM in the
+// pool can run at once.
+static VmResult runOnPool(JankyVm *vm, Object *callback, CallbackReach *reach, ParallelJob *job, int threads) {
+    Bytecode *chunk = bindingChunk(callback, reach->names, reach->bound, reach->bound_count);
+    Program *program = newProgram(chunk);
+    freeBytecode(chunk);
+    if (!program) return runtimeError(vm, "Could not freeze the callback.");
+
+    job->program = program;
+
+    if (!vm->pool) vm->pool = newPool(&vm->settings, threads);
+
+    VmResult result = runPool(vm->pool, job) ? VM_OK : runtimeError(vm, job->error);
+    vm->parallel_steals += job->steals;
+    freeProgram(program);
+
+    return result;
+}
+
+// The elements of a packed array the filter kept, in a new array of the
+// same kind.
+static Value keptElements(JankyVm *vm, Value *receiver, uint8_t *kept) {
+    int count = receiver->as.object->as.array.count;
+    int total = 0;
+    for (int i = 0; i < count; i++) total += kept[i];
+
+    ElementKind kind = receiver->as.object->as.array.kind;
+    Object *result = newArray(vm, kind, total);
+    ObjArray *array = &receiver->as.object->as.array;
+
+    int at = 0;
+    for (int i = 0; i < count; i++) {
+        if (!kept[i]) continue;
+
+        if (kind == ELEMENTS_INT) result->as.array.elements.ints[at++] = array->elements.ints[i];
+        else result->as.array.elements.doubles[at++] = array->elements.doubles[i];
+    }
+    result->as.array.count = total;
+
+    return arrayValue(result);
+}
+
+// Runs a checked callback over the array, on the pool or here.
+static VmResult runParallel(JankyVm *vm, Value *receiver, int argCount, ParallelOp op, CallbackReach *reach) {
+    ParallelJob job;
+    memset(&job, 0, sizeof(job));
+    job.op = op;
+
+    ObjArray *array = &receiver->as.object->as.array;
+    if (array->kind == ELEMENTS_GENERIC) {
+        if (job.op == PARALLEL_MAP) return mapArray(vm, receiver, receiver[1]);
+        if (job.op == PARALLEL_FILTER) return filterArray(vm, receiver);
+        return reduceArray(vm, receiver, argCount);
+    }
+
+    int count = array->count;
+    if (job.op == PARALLEL_REDUCE && count == 0) {
+        if (argCount < 2) return runtimeError(vm, "Reduce of empty array with no initial value.");
+
+        Value initial = receiver[2];
+        vm->stack_top = receiver;
+        push(vm, initial);
+        return VM_OK;
+    }
+
+    int threads = parallelThreads(vm);
+    bool pooled = threads > 1 && count >= PARALLEL_GRAIN * 2;
+
+    job.array = receiver;
+    job.count = count;
+    job.grain = count > 0 ? count : 1;
+    if (pooled) {
+        long grain = count / ((long)threads * PARALLEL_SPLIT);
+        job.grain = grain > PARALLEL_GRAIN ? (int)grain : PARALLEL_GRAIN;
+    }
+    job.task_count = (int)(((long)count + job.grain - 1) / job.grain);
+
+    if (job.op == PARALLEL_MAP) {
+        Object *mapped = newArray(vm, ELEMENTS_DOUBLE, count);
+        if (count > 0) memset(mapped->as.array.elements.doubles, 0, sizeof(double) * count);
+        mapped->as.array.count = count;
+        push(vm, arrayValue(mapped));
+        job.mapped = vm->stack_top - 1;
+    } else if (job.op == PARALLEL_FILTER) {
+        job.kept = malloc(count > 0 ? count : 1);
+    } else {
+        job.partials = malloc(sizeof(double) * job.task_count);
+    }
+
+    VmResult status = VM_OK;
+    if (pooled) {
+        status = runOnPool(vm, receiver[1].as.object, reach, &job, threads);
+    } else {
+        for (int task = 0; task < job.task_count && status == VM_OK; task++) {
+            status = runTask(vm, receiver[1], &job, task);
+        }
+    }
+    vm->parallel_calls++;
+
+    Value result = newUndefined();
+    if (status == VM_OK && job.op == PARALLEL_MAP) {
+        result = *job.mapped;
+    } else if (status == VM_OK && job.op == PARALLEL_FILTER) {
+        result = keptElements(vm, receiver, job.kept);
+    } else if (status == VM_OK) {
+        // the fold stays on the stack, as it may be an object
+        int first = argCount >= 2 ? 0 : 1;
+        push(vm, argCount >= 2 ? receiver[2] : newNumber(job.partials[0]));
+        Value *fold = vm->stack_top - 1;
+
+        for (int task = first; task < job.task_count && status == VM_OK; task++) {
+            Value args[] = { *fold, newNumber(job.partials[task]) };
+            status = callBack(vm, receiver[1], args, 2);
+            if (status == VM_OK) *fold = pop(vm);
+        }
+        result = *fold;
+    }
+
+    free(job.kept);
+    free(job.partials);
+    if (status != VM_OK) return status;
+
+    vm->stack_top = receiver;
+    push(vm, result);
+
+    return VM_OK;
+}
+
+// parallelMap(fn), parallelFilter(fn) and parallelReduce(fn, initial).
+// The callback has to be side-effect-free, so that its calls can run in
+// any order on any thread, and a reduce's has to be associative: each
+// task folds its own elements, and the folds are then folded together
+// after the initial value. A packed array big enough is cut into tasks
+// for the VM's pool, and the callbacks of a map or a reduce of one must
+// return numbers wherever they run. An array that is not packed goes
+// through map(), reduce() or a filter on the calling thread.
+static VmResult parallelArray(JankyVm *vm, Value *receiver, int argCount, char *name) {
+    if (argCount < 1 || receiver[1].type != TYPE_FUNCTION) return runtimeError(vm, "Expected a function.");
+
+    CallbackReach reach;
+    const char *effect;
+    if (!callbackEffect(vm, receiver[1].as.object, &reach, &effect)) {
+        freeReach(&reach);
+        return VM_COMPILE_ERROR;
+    }
+    if (effect) {
+        char message[ERROR_MESSAGE_MAX];
+        snprintf(message, sizeof(message), "The callback to %s is not side-effect-free: it %s.", name, effect);
+        freeReach(&reach);
+        return runtimeError(vm, message);
+    }
+
+    ParallelOp op = strcmp(name, "parallelMap") == 0 ? PARALLEL_MAP :
+                    strcmp(name, "parallelFilter") == 0 ? PARALLEL_FILTER : PARALLEL_REDUCE;
+    VmResult status = runParallel(vm, receiver, argCount, op, &reach);
+    freeReach(&reach);
+
+    return status;
+}
+
+// sum(), min() and max() of the elements as numbers.
+static Value foldArray(JankyVm *vm, ObjArray *array, const char *name) {
+    const Kernels *kernels = vm->settings.kernels;
+    vm->kernel_calls++;
+
+    if (array->kind == ELEMENTS_INT && array->count > 0) {
+        int32_t *ints = array->elements.ints;
+        if (name[1] == 'u') return newNumber(kernels->sum_i32(ints, array->count));
+        if (name[1] == 'i') return newNumber(kernels->min_i32(ints, array->count));
+        return newNumber(kernels->max_i32(ints, array->count));
+    }
+
+    bool owned;
+    double *numbers = numbersOf(array, &owned);
+    double value;
+    if (name[1] == 'u') value = kernels->sum(numbers, array->count);
+    else if (name[1] == 'i') value = kernels->min(numbers, array->count);
+    else value = kernels->max(numbers, array->count);
+    if (owned) free(numbers);
+
+    return newNumber(value);
+}
+
+// dot(other), add(other) and mul(other) pair up the elements of two
+// arrays of the same length.
+static VmResult pairArrays(JankyVm *vm, Value *receiver, int argCount, const char *name) {
+    if (argCount < 1 || receiver[1].type != TYPE_ARRAY) {
+        return runtimeError(vm, "Expected an array.");
+    }
+    if (receiver->as.object->as.array.count != receiver[1].as.object->as.array.count) {
+        return runtimeError(vm, "Array lengths differ.");
+    }
+
+    int count = receiver->as.object->as.array.count;
+    Object *result = name[0] == 'd' ? NULL : newArray(vm, ELEMENTS_DOUBLE, count);
+
+    bool ownedX, ownedY;
+    double *x = numbersOf(&receiver->as.object->as.array, &ownedX);
+    double *y = numbersOf(&receiver[1].as.object->as.array, &ownedY);
+
+    const Kernels *kernels = vm->settings.kernels;
+    Value value;
+    if (!result) {
+        value = newNumber(kernels->dot(x, y, count));
+    } else {
+        if (name[0] == 'a') kernels->add(result->as.array.elements.doubles, x, y, count);
+        else kernels->mul(result->as.array.elements.doubles, x, y, count);
+
+        result->as.array.count = count;
+        value = arrayValue(result);
+    }
+    vm->kernel_calls++;
+
+    if (ownedX) free(x);
+    if (ownedY) free(y);
+
+    vm->stack_top = receiver;
+    push(vm, value);
+
+    return VM_OK;
+}
+
+// concat(other): a new array holding both, as wide as the wider of them.
+static VmResult concatArrays(JankyVm *vm, Value *receiver, int argCount) {
+    if (argCount < 1 || receiver[1].type != TYPE_ARRAY) {
+        return runtimeError(vm, "Expected an array.");
+    }
+
+    ObjArray *first = &receiver->as.object->as.array;
+    ObjArray *second = &receiver[1].as.object->as.array;
+    ElementKind kind = first->kind > second->kind ? first->kind : second->kind;
+    int count = first->count + second->count;
+
+    Object *result = newArray(vm, kind, count);
+    first = &receiver->as.object->as.array;
+    second = &receiver[1].as.object->as.array;
+
+    if (kind == ELEMENTS_GENERIC) {
+        // setElement() takes care of the barriers
+        for (int i = 0; i < first->count; i++) setElement(&vm->heap, result, i, arrayElement(first, i));
+        for (int i = 0; i < second->count; i++) setElement(&vm->heap, result, first->count + i, arrayElement(second, i));
+    } else {
+        ObjArray *parts[] = { first, second };
+        int at = 0;
+
+        for (int p = 0; p < 2; p++) {
+            ObjArray *part = parts[p];
+            if (part->count == 0) continue;
+
+            if (part->kind == kind) {
+                memcpy((char *)result->as.array.elements.any + elementSize(kind) * at,
+                       part->elements.any, elementSize(kind) * part->count);
+            } else {
+                for (int i = 0; i < part->count; i++) {
+                    result->as.array.elements.doubles[at + i] = part->elements.ints[i];
+                }
+            }
+            at += part->count;
+        }
+        result->as.array.count = count;
+    }
+
+    vm->stack_top = receiver;
+    push(vm, arrayValue(result));
+
+    return VM_OK;
+}
+
+// The order sort() uses without a comparator on arrays holding more than
+// numbers: numbers first, smallest first and NaN last, then strings by
+// code point, then booleans, then everything else, with undefined at the
+// very end.
+static int typeRank(Value value) {
+    switch (value.type) {
+        case TYPE_NUMBER:    return 0;
+        case TYPE_STRING:    return 1;
+        case TYPE_BOOL:      return 2;
+        case TYPE_UNDEFINED: return 4;
+        default:             return 3;
+    }
+}
+
+static int compareNumbers(double a, double b) {
+    if (a < b) return -1;
+    if (a > b) return 1;
+    if (a == b) return 0;
+
+    return isnan(a) - isnan(b);
+}
+
+static int defaultCompare(Value a, Value b, void *context) {
+    if (a.type == TYPE_NUMBER && b.type == TYPE_NUMBER) return compareNumbers(a.as.number, b.as.number);
+
+    int rank = typeRank(a) - typeRank(b);
+    if (rank != 0) return rank;
+
+    switch (a.type) {
+        case TYPE_NUMBER: {
+            return compareNumbers(a.as.number, b.as.number);
+        }
+        case TYPE_STRING: {
+            // UTF-8 byte order is code point order
+            ObjString *x = asFlatString(context, a.as.object);
+            ObjString *y = asFlatString(context, b.as.object);
+            int length = x->length < y->length ? x->length : y->length;
+
+            int order = memcmp(x->chars, y->chars, length);
+            return order != 0 ? order : x->length - y->length;
+        }
+        case TYPE_BOOL: {
+            return a.as.boolean - b.as.boolean;
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+// The comparators (a, b) => a - b and (a, b) => b - a.
+static int ascendingCompare(Value a, Value b, void *context) {
+    (void)context;
+    return compareNumbers(tryGetNumber(a), tryGetNumber(b));
+}
+
+static int descendingCompare(Value a, Value b, void *context) {
+    (void)context;
+    return compareNumbers(tryGetNumber(b), tryGetNumber(a));
+}
+
+// Any other comparator is called through the interpreter. What gets
+// sorted is the elements' positions, since a collection run by the
+// comparator can move the elements themselves.
+typedef struct {
+    JankyVm  *vm;
+    Value    *receiver;
+    VmResult  status;
+} SortCall;
+
+static int callComparator(Value a, Value b, void *context) {
+    SortCall *call = context;
+    if (call->status != VM_OK) return 0;
+
+    ObjArray *array = &call->receiver->as.object->as.array;
+    int i = (int)a.as.number;
+    int j = (int)b.as.number;
+    if (i >= array->count || j >= array->count) return 0;
+
+    Value args[] = { arrayElement(array, i), arrayElement(array, j) };
+    call->status = callBack(call->vm, call->receiver[1], args, 2);
+    if (call->status != VM_OK) return 0;
+
+    double order = tryGetNumber(pop(call->vm));
+    return order < 0 ? -1 : order > 0;
+}
+
+static void reverseElements(ObjArray *array) {
+    size_t size = elementSize(array->kind);
+    char *elements = array->elements.any;
+    char swap[sizeof(Value)];
+
+    for (int i = 0, j = array->count - 1; i < j; i++, j--) {
+        memcpy(swap, elements + size * i, size);
+        memcpy(elements + size * i, elements + size * j, size);
+        memcpy(elements + size * j, swap, size);
+    }
+}
+
+// Replaces the elements with 'sorted', under the lock while the marker
+// might be scanning them. Nothing needs logging: the array holds the
+// same values as before, only in another order.
+static void storeSorted(Heap *heap, Object *object, void *sorted) {
+    ObjArray *array = &object->as.array;
+
+    bool locked = array->kind == ELEMENTS_GENERIC && lockForStore(heap);
+    ownElements(object);
+    memcpy(array->elements.any, sorted, elementSize(array->kind) * array->count);
+    unlockForStore(heap, locked);
+}
+
+// sort(compare): packed ints and doubles are radix sorted, numerically,
+// when there is no comparator or it is a - b or b - a; the rest goes
+// through pdqsort. Sorts in place and returns the array.
+static VmResult sortArray(JankyVm *vm, Value *receiver, int argCount) {
+    ValueComparator compare = defaultCompare;
+    bool descending = false;
+
+    if (argCount >= 1 && receiver[1].type != TYPE_UNDEFINED) {
+        Arithmetic match;
+        bool subtracts = matchArithmetic(vm, receiver[1], 2, &match) && match.op == OP_MINUS &&
+                         match.left > 0 && match.right > 0 && match.left != match.right;
+
+        compare = !subtracts ? callComparator : match.left == 1 ? ascendingCompare : descendingCompare;
+        descending = compare == descendingCompare;
+    }
+
+    Object *object = receiver->as.object;
+    ObjArray *array = &object->as.array;
+    int count = array->count;
+
+    if (compare != callComparator && array->kind != ELEMENTS_GENERIC) {
+        ownElements(object);
+        if (array->kind == ELEMENTS_INT) sortInts(array->elements.ints, count);
+        else sortDoubles(array->elements.doubles, count);
+
+        if (descending) reverseElements(array);
+    } else if (compare != callComparator) {
+        // sorted aside, as flattening a string may need the lock
+        Value *sorted = malloc(sizeof(Value) * (count > 0 ? count : 1));
+        memcpy(sorted, array->elements.values, sizeof(Value) * count);
+
+        sortValues(sorted, count, compare, compare == defaultCompare ? &vm->heap : NULL);
+        storeSorted(&vm->heap, object, sorted);
+        free(sorted);
+    } else {
+        ElementKind kind = array->kind;
+        Value *positions = malloc(sizeof(Value) * (count > 0 ? count : 1));
+        for (int i = 0; i < count; i++) positions[i] = newNumber(i);
+
+        SortCall call = { vm, receiver, VM_OK };
+        sortValues(positions, count, callComparator, &call);
+
+        // a comparator that resized the array or changed its kind leaves
+        // it as it is
+        object = receiver->as.object;
+        array = &object->as.array;
+        if (call.status == VM_OK && array->count == count && array->kind == kind) {
+            size_t size = elementSize(kind);
+            char *sorted = malloc(size * (count > 0 ? count : 1));
+
+            for (int i = 0; i < count; i++) {
+                memcpy(sorted + size * i, (char *)array->elements.any + size * (int)positions[i].as.number, size);
+            }
+
+            storeSorted(&vm->heap, object, sorted);
+            free(sorted);
+        }
+
+        free(positions);
+        if (call.status != VM_OK) return call.status;
+    }
+
+    Value sorted = *receiver;
+    vm->stack_top = receiver;
+    push(vm, sorted);
+
+    return VM_OK;
+}
+
+// Built-in methods of arrays. The numeric ones run the VM's kernels over
+// the packed elements, so each costs the script a single instruction.
+static VmResult invokeArray(JankyVm *vm, char *name, int argCount) {
+    Value *receiver = vm->stack_top - argCount - 1;
+    Object *array = receiver->as.object;
+
+    Value result;
+    if (strcmp(name, "push") == 0) {
+        for (int i = 1; i <= argCount; i++) {
+            setElement(&vm->heap, array, array->as.array.count, receiver[i]);
+        }
+        result = newNumber(array->as.array.count);
+    } else if (strcmp(name, "pop") == 0) {
+        result = popElement(&vm->heap, array);
+    } else if (strcmp(name, "sum") == 0 || strcmp(name, "min") == 0 || strcmp(name, "max") == 0) {
+        result = foldArray(vm, &array->as.array, name);
+    } else if (strcmp(name, "dot") == 0 || strcmp(name, "add") == 0 || strcmp(name, "mul") == 0) {
+        return pairArrays(vm, receiver, argCount, name);
+    } else if (strcmp(name, "concat") == 0) {
+        return concatArrays(vm, receiver, argCount);
+    } else if (strcmp(name, "map") == 0) {
+        if (argCount < 1) return runtimeError(vm, "Expected a function.");
+        return mapArray(vm, receiver, receiver[1]);
+    } else if (strcmp(name, "reduce") == 0) {
+        if (argCount < 1) return runtimeError(vm, "Expected a function.");
+        return reduceArray(vm, receiver, argCount);
+    } else if (strcmp(name, "sort") == 0) {
+        return sortArray(vm, receiver, argCount);
+    } else if (strcmp(name, "parallelMap") == 0 || strcmp(name, "parallelFilter") == 0 ||
+               strcmp(name, "parallelReduce") == 0) {
+        return parallelArray(vm, receiver, argCount, name);
+    } else {
+        return runtimeError(vm, "Undefined method.");
+    }
+
+    vm->stack_top = receiver;
+    push(vm, result);
+
+    return VM_OK;
+}
+
+static Value mapValue(Object *object) {
+    Value value;
+    value.type = TYPE_MAP;
+    value.as.object = object;
+
+    return value;
+}
+
+// A new, empty Map or Set. Anything the caller still needs must be on the
+// stack, as this may collect.
+static Object *newMap(JankyVm *vm, bool isSet) {
+    collectIfDue(vm);
+    Object *object = newYoungMap(&vm->heap, isSet);
+    if (!object) {
+        minorCollect(vm);
+        object = newYoungMap(&vm->heap, isSet);
+    }
+
+    return object;
+}
+
+// Adds the elements of 'source' to a new map: the values of a Set, or the
+// [key, value] pairs of a Map. Undefined leaves it empty.
+static VmResult fillMap(JankyVm *vm, Object *object, Value source) {
+    if (source.type == TYPE_UNDEFINED) return VM_OK;
+    if (source.type != TYPE_ARRAY) return runtimeError(vm, "Expected an array.");
+
+    ObjArray *array = &source.as.object->as.array;
+    for (int i = 0; i < array->count; i++) {
+        Value element = arrayElement(array, i);
+
+        if (object->as.map.is_set) {
+            mapSet(&vm->heap, object, element, newUndefined());
+            continue;
+        }
+
+        if (element.type != TYPE_ARRAY) return runtimeError(vm, "Iterator value is not an entry object.");
+
+        ObjArray *pair = &element.as.object->as.array;
+        Value key = pair->count > 0 ? arrayElement(pair, 0) : newUndefined();
+        Value value = pair->count > 1 ? arrayElement(pair, 1) : newUndefined();
+        mapSet(&vm->heap, object, key, value);
+    }
+
+    return VM_OK;
+}
+
+// The keys or the values of the map below the stack top, in insertion
+// order, packed when they are all numbers.
+static Object *mapItems(JankyVm *vm, Value *receiver, bool keys) {
+    ObjMap *map = &receiver->as.object->as.map;
+
+    ElementKind kind = ELEMENTS_INT;
+    for (int i = 0; i < map->entry_count; i++) {
+        if (!map->entries[i].live) continue;
+
+        ElementKind needed = elementKind(keys ? map->entries[i].key : map->entries[i].value);
+        if (needed > kind) kind = needed;
+    }
+
+    Object *array = newArray(vm, kind, map->count);
+    map = &receiver->as.object->as.map;
+
+    int index = 0;
+    for (int i = 0; i < map->entry_count; i++) {
+        if (!map->entries[i].live) continue;
+
+        setElement(&vm->heap, array, index++, keys ? map->entries[i].key : map->entries[i].value);
+    }
+
+    return array;
+}
+
+// [key, value] pairs, or [value, value] for a Set. The result stays on
+// the stack while the pairs are allocated.
+static Object *mapEntries(JankyVm *vm, Value *receiver) {
+    push(vm, arrayValue(newArray(vm, ELEMENTS_GENERIC, receiver->as.object->as.map.count)));
+    Value *result = vm->stack_top - 1;
+
+    int index = 0;
+    for (int i = 0; i < receiver->as.object->as.map.entry_count; i++) {
+        if (!receiver->as.object->as.map.entries[i].live) continue;
+
+        Object *pair = newArray(vm, ELEMENTS_GENERIC, 2);
+        ObjMap *map = &receiver->as.object->as.map;
+
+        setElement(&vm->heap, pair, 0, map->entries[i].key);
+        setElement(&vm->heap, pair, 1, map->is_set ? map->entries[i].key : map->entries[i].value);
+        setElement(&vm->heap, result->as.object, index++, arrayValue(pair));
+    }
+
+    return pop(vm).as.object;
+}
+
+// Calls 'callee' with (value, key, map) for each entry. The callback may
+// change the map, so the entries are copied into an array first, kept on
+// the stack while it runs.
+static VmResult forEachEntry(JankyVm *vm, Value *receiver, Value callee) {
+    int count = receiver->as.object->as.map.count;
+    Object *snapshot = newArray(vm, ELEMENTS_GENERIC, count * 2);
+
+    ObjMap *map = &receiver->as.object->as.map;
+    int index = 0;
+    for (int i = 0; i < map->entry_count; i++) {
+        if (!map->entries[i].live) continue;
+
+        setElement(&vm->heap, snapshot, index++, map->entries[i].key);
+        setElement(&vm->heap, snapshot, index++, map->is_set ? map->entries[i].key : map->entries[i].value);
+    }
+
+    push(vm, arrayValue(snapshot));
+    Value *items = vm->stack_top - 1;
+
+    for (int i = 0; i < count; i++) {
+        Value *pair = &items->as.object->as.array.elements.values[i * 2];
+        Value args[3] = { pair[1], pair[0], *receiver };
+
+        VmResult result = callBack(vm, callee, args, 3);
+        if (result != VM_OK) return result;
+        pop(vm);
+    }
+
+    vm->stack_top = receiver;
+    push(vm, newUndefined());
+
+    return VM_OK;
+}
+
+// Built-in methods of Maps and Sets. A Set has add() where a Map has
+// set() and get(); the rest are shared.
+static VmResult invokeMap(JankyVm *vm, char *name, int argCount) {
+    Value *receiver = vm->stack_top - argCount - 1;
+    Object *object = receiver->as.object;
+    bool isSet = object->as.map.is_set;
+    Value key = argCount > 0 ? receiver[1] : newUndefined();
+
+    Value result;
+    if (strcmp(name, isSet ? "add" : "set") == 0) {
+        mapSet(&vm->heap, object, key, !isSet && argCount > 1 ? receiver[2] : newUndefined());
+        result = *receiver;
+    } else if (!isSet && strcmp(name, "get") == 0) {
+        if (!mapGet(&vm->heap, object, key, &result)) result = newUndefined();
+    } else if (strcmp(name, "has") == 0) {
+        result = newBoolean(mapHas(&vm->heap, object, key));
+    } else if (strcmp(name, "delete") == 0) {
+        result = newBoolean(mapDelete(&vm->heap, object, key));
+    } else if (strcmp(name, "clear") == 0) {
+        mapClear(&vm->heap, object);
+        result = newUndefined();
+    } else if (strcmp(name, "keys") == 0 || strcmp(name, "values") == 0) {
+        result = arrayValue(mapItems(vm, receiver, isSet || strcmp(name, "keys") == 0));
+    } else if (strcmp(name, "entries") == 0) {
+        result = arrayValue(mapEntries(vm, receiver));
+    } else if (strcmp(name, "forEach") == 0) {
+        if (argCount < 1) return runtimeError(vm, "Expected a function.");
+        return forEachEntry(vm, receiver, receiver[1]);
+    } else {
+        return runtimeError(vm, "Undefined method.");
+    }
+
+    vm->stack_top = receiver;
+    push(vm, result);
+
+    return VM_OK;
+}
+
+// An open object or array while JSON is parsed. An object knows which
+// key its next value is for: the shape it moves to with it, or the slot
+// it overwrites if the key was seen before.
+typedef struct {
+    bool   object;
+    Shape *pending;
+    int    slot;
+} JsonFrame;
+
+typedef struct {
+    const char *text;
+    int         length;
+    JsonIndex   index;
+    int         next;
+    char       *scratch;
+} JsonParser;
+
+static VmResult jsonError(JankyVm *vm, JsonParser *parser, int position) {
+    char message[96];
+    if (position >= parser->length) {
+        snprintf(message, sizeof(message), "Unexpected end of JSON input.");
+    } else {
+        snprintf(message, sizeof(message), "Unexpected token '%c' in JSON at position %d.", parser->text[position], position);
+    }
+
+    return runtimeError(vm, message);
+}
+
+// Reads '"key":' for the object in 'frame', returning the position of
+// the first byte that does not fit, or -1.
+static int readJsonKey(JsonParser *parser, JsonFrame *frame, Object *object) {
+    int at = parser->index.positions[parser->next++];
+    if (parser->text[at] != '"') return at;
+
+    bool escaped;
+    int end = scanJsonString(parser->text, parser->length, at, &escaped);
+    if (end < 0) return at;
+
+    int length = end - at - 2;
+    if (escaped) {
+        length = unescapeJson(parser->text + at + 1, length, parser->scratch);
+        if (length < 0) return at;
+    } else {
+        memcpy(parser->scratch, parser->text + at + 1, length);
+    }
+    parser->scratch[length] = '\0';
+
+    // a key can only be repeated on a shape with no transition for it
+    Shape *shape = object->as.instance.shape;
+    frame->slot = -1;
+    frame->pending = findTransition(shape, parser->scratch);
+    if (!frame->pending) {
+        frame->slot = shapeLookup(shape, parser->scratch);
+        if (frame->slot < 0) frame->pending = shapeTransition(shape, parser->scratch);
+    }
+
+    int colon = parser->index.positions[parser->next++];
+    return parser->text[colon] == ':' ? -1 : colon;
+}
+
+// A string, number or literal starting at 'at'; null becomes undefined.
+static bool readJsonScalar(JankyVm *vm, JsonParser *parser, int at, Value *value) {
+    const char *text = parser->text;
+
+    switch (text[at]) {
+        case '"': {
+            bool escaped;
+            int end = scanJsonString(text, parser->length, at, &escaped);
+            if (end < 0) return false;
+
+            int length = end - at - 2;
+            if (!escaped) {
+                *value = copyString(vm, text + at + 1, length);
+                return true;
+            }
+
+            length = unescapeJson(text + at + 1, length, parser->scratch);
+            if (length < 0) return false;
+
+            *value = copyString(vm, parser->scratch, length);
+            return true;
+        }
+        case 't':
+            *value = newBoolean(true);
+            return strncmp(text + at, "true", 4) == 0 && isJsonDelimiter(text[at + 4]);
+        case 'f':
+            *value = newBoolean(false);
+            return strncmp(text + at, "false", 5) == 0 && isJsonDelimiter(text[at + 5]);
+        case 'n':
+            *value = newUndefined();
+            return strncmp(text + at, "null", 4) == 0 && isJsonDelimiter(text[at + 4]);
+        default: {
+            double number;
+            int end = parseJsonNumber(text, parser->length, at, &number);
+            *value = newNumber(number);
+            return end >= 0 && isJsonDelimiter(text[end]);
+        }
+    }
+}
+
+// Stage two: walks the tokens stage one found, building each value as
+// soon as it is read. Open objects and arrays wait on the VM stack, so
+// a collection set off by an allocation forwards them, and every value
+// is stored into the innermost one before anything else is allocated.
+// The text has a NUL after it, which the sentinel position points at.
+static VmResult parseJsonValue(JankyVm *vm, JsonParser *parser, Value *result) {
+    JsonFrame frames[JSON_DEPTH_MAX];
+    int depth = 0;
+    Value *containers = vm->stack_top;
+    uint32_t *positions = parser->index.positions;
+
+    for (;;) {
+        if (parser->next >= parser->index.count) return jsonError(vm, parser, parser->length);
+
+        int at = positions[parser->next++];
+        char c = parser->text[at];
+        Value value;
+
+        if (c == '{' || c == '[') {
+            if (depth == JSON_DEPTH_MAX || vm->stack_top >= vm->stack + STACK_MAX) {
+                return runtimeError(vm, "JSON nested too deeply.");
+            }
+
+            push(vm, c == '{' ? newObject(vm, 0) : arrayValue(newArray(vm, ELEMENTS_INT, 0)));
+            frames[depth++].object = c == '{';
+
+            if (parser->text[positions[parser->next]] == (c == '{' ? '}' : ']')) {
+                parser->next++;
+                depth--;
+                value = pop(vm);
+            } else if (c == '{') {
+                int error = readJsonKey(parser, &frames[depth - 1], containers[depth - 1].as.object);
+                if (error >= 0) return jsonError(vm, parser, error);
+                continue;
+            } else {
+                continue;
+            }
+        } else if (!readJsonScalar(vm, parser, at, &value)) {
+            return jsonError(vm, parser, at);
+        }
+
+        // store the value, then close whatever ends with it
+        for (;;) {
+            if (depth == 0) {
+                if (parser->next < parser->index.count) return jsonError(vm, parser, positions[parser->next]);
+
+                *result = value;
+                return VM_OK;
+            }
+
+            JsonFrame *frame = &frames[depth - 1];
+            Object *container = containers[depth - 1].as.object;
+
+            if (!frame->object) {
+                setElement(&vm->heap, container, container->as.array.count, value);
+            } else if (frame->slot >= 0) {
+                storeField(&vm->heap, container, frame->slot, value);
+            } else {
+                addField(&vm->heap, container, frame->pending, value);
+            }
+
+            int next = positions[parser->next++];
+            c = parser->text[next];
+
+            if (c == ',') {
+                if (frame->object) {
+                    int error = readJsonKey(parser, frame, container);
+                    if (error >= 0) return jsonError(vm, parser, error);
+                }
+                break;
+            }
+            if (c != (frame->object ? '}' : ']')) return jsonError(vm, parser, next);
+
+            depth--;
+            value = pop(vm);
+        }
+    }
+}
+
+// JSON.parse() on the string in 'source', a stack slot. The text is read
+// in place unless it is young and could be moved by a collection.
+static VmResult parseJson(JankyVm *vm, Value *source, Value *result) {
+    Object *string = flatten(&vm->heap, source->as.object);
+
+    JsonParser parser;
+    parser.length = string->as.string.length;
+    parser.text = string->as.string.chars;
+    parser.next = 0;
+
+    char *copy = NULL;
+    if (isYoung(&vm->heap, string)) {
+        copy = malloc(parser.length + 1);
+        memcpy(copy, parser.text, parser.length + 1);
+        parser.text = copy;
+    }
+
+    VmResult status;
+    if (!buildJsonIndex(parser.text, parser.length, &parser.index)) {
+        status = runtimeError(vm, "Unterminated string in JSON.");
+    } else {
+        parser.scratch = malloc(parser.length + 1);
+        status = parseJsonValue(vm, &parser, result);
+        free(parser.scratch);
+    }
+
+    freeJsonIndex(&parser.index);
+    free(copy);
+
+    return status;
+}
+
+// JSON.parse(text) and JSON.stringify(value). Anything but a string is
+// parsed as the string it converts to.
+static VmResult invokeJson(JankyVm *vm, char *name, int argCount) {
+    Value *receiver = vm->stack_top - argCount - 1;
+    Value *argument = receiver + 1;
+    if (argCount == 0) push(vm, newUndefined());
+
+    Value result;
+    if (strcmp(name, "parse") == 0) {
+        if (argument->type != TYPE_STRING) *argument = stringify(vm, *argument);
+
+        VmResult status = parseJson(vm, argument, &result);
+        if (status != VM_OK) return status;
+    } else if (strcmp(name, "stringify") == 0) {
+        if (argument->type == TYPE_UNDEFINED || argument->type == TYPE_FUNCTION) {
+            result = newUndefined();
+        } else {
+            TextBuffer text = { NULL, 0, 0 };
+            const char *error = stringifyJson(&vm->heap, *argument, &text);
+            if (error) {
+                free(text.chars);
+                return runtimeError(vm, (char *)error);
+            }
+
+            result = copyString(vm, text.chars, text.length);
+            free(text.chars);
+        }
+    } else {
+        return runtimeError(vm, "Undefined method.");
+    }
+
+    vm->stack_top = receiver;
+    push(vm, result);
+
+    return VM_OK;
+}
+
+// Clones the argument into a new message, or fails as structured
+// cloning does on what it cannot copy.
+static VmResult packArgument(JankyVm *vm, Value *receiver, int argCount, Message **message) {
+    Value value = argCount > 0 ? receiver[1] : newUndefined();
+
+    *message = malloc(sizeof(Message));
+    const char *error = packMessage(&vm->heap, value, *message);
+    if (error) {
+        free(*message);
+        return runtimeError(vm, (char *)error);
+    }
+
+    return VM_OK;
+}
+
+// postMessage(value) and terminate() on a handle from new Worker().
+static VmResult invokeWorker(JankyVm *vm, char *name, int argCount) {
+    Value *receiver = vm->stack_top - argCount - 1;
+    int index = (int)receiver->as.number;
+
+    if (strcmp(name, "postMessage") == 0) {
+        Message *message;
+        VmResult status = packArgument(vm, receiver, argCount, &message);
+        if (status != VM_OK) return status;
+
+        postToWorker(vm, index, message);
+    } else if (strcmp(name, "terminate") == 0) {
+        terminateWorker(vm, index);
+    } else {
+        return runtimeError(vm, "Undefined method.");
+    }
+
+    vm->stack_top = receiver;
+    push(vm, newUndefined());
+
+    return VM_OK;
+}
+
+// self.receive() waits for the next message from the parent or any of
+// the script's own workers, and is undefined once none can come.
+// self.postMessage(value) sends a worker's message to its parent.
+static VmResult invokeSelf(JankyVm *vm, char *name, int argCount) {
+    Value *receiver = vm->stack_top - argCount - 1;
+
+    Value result = newUndefined();
+    if (strcmp(name, "receive") == 0) {
+        Message *message = receiveMessage(vm);
+        if (message) {
+            result = unpackMessage(&vm->heap, vm->root_shape, message);
+            freeMessage(message);
+            free(message);
+        }
+    } else if (strcmp(name, "postMessage") == 0) {
+        Message *message;
+        VmResult status = packArgument(vm, receiver, argCount, &message);
+        if (status != VM_OK) return status;
+
+        if (!postToParent(vm, message)) {
+            freeMessage(message);
+            free(message);
+            return runtimeError(vm, "Only a worker has a parent to post to.");
+        }
+    } else {
+        return runtimeError(vm, "Undefined method.");
+    }
+
+    vm->stack_top = receiver;
+    push(vm, result);
+
+    return VM_OK;
+}
+
+// Stores the value on top of the stack at an index of the array below
+// it. Indexes that are not whole numbers in range are ignored.
+static VmResult setIndex(JankyVm *vm) {
+    Value receiver = vm->stack_top[-3];
+    Value index = vm->stack_top[-2];
+    Value value = vm->stack_top[-1];
+
+    if (receiver.type == TYPE_UNDEFINED) {
+        return runtimeError(vm, "Cannot set properties of undefined.");
+    }
+
+    int i;
+    if (receiver.type == TYPE_ARRAY && elementIndex(index, &i)) {
+        setElement(&vm->heap, receiver.as.object, i, value);
+    }
+
+    vm->stack_top -= 3;
+    push(vm, value);
+
+    return VM_OK;
+}
+
+static VmResult invoke(JankyVm *vm, char *name, int argCount, PropertyCache *cache) {
+    Value receiver = vm->stack_top[-argCount - 1];
+
+    if (receiver.type == TYPE_UNDEFINED) {
+        return runtimeError(vm, "Cannot read properties of undefined.");
+    }
+    if (receiver.type == TYPE_STRING) {
+        return invokeString(vm, name, argCount);
+    }
+    if (receiver.type == TYPE_ARRAY) {
+        return invokeArray(vm, name, argCount);
+    }
+    if (receiver.type == TYPE_MAP) {
+        return invokeMap(vm, name, argCount);
+    }
+
+    if (receiver.type == TYPE_WORKER) {
+        return invokeWorker(vm, name, argCount);
+    }
+
+    if (receiver.type == TYPE_OBJECT && receiver.as.object == vm->json) {
+        return invokeJson(vm, name, argCount);
+    }
+    if (receiver.type == TYPE_OBJECT && receiver.as.object == vm->self) {
+        return invokeSelf(vm, name, argCount);
+    }
+
+    // a function stored on an object is called in the receiver's place
+    if (receiver.type == TYPE_OBJECT) {
+        Value method = getField(vm, receiver.as.object, name, cache);
+        if (method.type != TYPE_FUNCTION) {
+            return runtimeError(vm, "Undefined method.");
+        }
+
+        vm->stack_top[-argCount - 1] = method;
+        return callValue(vm, argCount, false);
     }
 
-    return false;
+    return runtimeError(vm, "Undefined method.");
 }
 
-static VmResult runtimeError(char *error) {
-    printf("Error: %s\n", error);
-    return VM_RUNTIME_ERROR;
+static bool compileOnCall(JankyVm *vm, Object *function) {
+    Compiler compiler;
+    initCompiler(&compiler, NULL);
+    compiler.statics = vm->statics;
+    compiler.heap = &vm->heap;
+    compiler.inline_threshold = vm->settings.inline_threshold;
+    compiler.errors = vm->errors;
+
+    bool ok = compileDeferred(&compiler, function);
+    freeBytecode(compiler.bytecode);
+    freeSymbolTable(&compiler.identifiers);
+    vm->deferred_count++;
+
+    return ok;
 }
 
-static Value newNumber(int value) {
-    Value number;
-    number.type = TYPE_NUMBER;
-    number.as.number = value;
+// Calls the function sitting below 'argCount' arguments on the stack. A
+// tail call slides the callee and its arguments down over the current
+// frame and reuses it; a regular call saves the caller in the next frame.
+static VmResult callValue(JankyVm *vm, int argCount, bool tail) {
+    Value *callee = vm->stack_top - argCount - 1;
 
-    return number;
-}
+    if (callee->type != TYPE_FUNCTION) {
+        return runtimeError(vm, "Can only call functions.");
+    }
 
-static Value newBoolean(bool value) {
-    Value boolean;
-    boolean.type = TYPE_BOOL;
-    boolean.as.boolean = value;
+    ObjFunction *function = &callee->as.object->as.function;
+    if (!function->chunk && !compileOnCall(vm, callee->as.object)) {
+        return VM_COMPILE_ERROR;
+    }
 
-    return boolean;
-}
+    Bytecode *chunk = function->chunk;
 
-static Value newString(char *value) {
-    Value string;
-    string.type = TYPE_STRING;
-    
-    string.as.object = malloc(sizeof(Object));
+    if (tail) {
+        memmove(vm->base, callee, sizeof(Value) * (argCount + 1));
+        vm->stack_top = vm->base + argCount + 1;
+    } else {
+        if (vm->frame_count >= FRAMES_MAX) {
+            return runtimeError(vm, "Maximum call stack size exceeded.");
+        }
 
-    string.as.object->as.string.chars = strdup(value);
-    string.as.object->as.string.length = strlen(value);
-    string.as.object->type = OBJ_STRING;
+        CallFrame *frame = &vm->frames[vm->frame_count++];
+        frame->chunk = vm->bytecode;
+        frame->return_ip = vm->ip;
+        frame->base = vm->base;
 
-    return string;
-}
+        vm->base = callee;
+    }
 
-static int tryGetIntValue(Value val) {
-    if (val.type == TYPE_BOOL) return val.as.boolean;
-    else if (val.type == TYPE_NUMBER) return val.as.number;
+    if (vm->base + chunk->local_count >= vm->stack + STACK_MAX) {
+        return runtimeError(vm, "Maximum call stack size exceeded.");
+    }
 
-    return 0;
+    // missing arguments read as undefined and extra ones are dropped so
+    // that the locals after the parameters land in their own slots
+    if (argCount > function->arity) {
+        vm->stack_top = vm->base + function->arity + 1;
+    }
+    while (vm->stack_top < vm->base + chunk->local_count) {
+        *vm->stack_top++ = newUndefined();
+    }
+
+    vm->bytecode = chunk;
+    vm->caches = chunkCaches(vm, chunk);
+    vm->ip = 0;
+    vm->call_count++;
+
+    return VM_OK;
 }
 
 static VmResult evalOpCode(JankyVm *vm, OpCode op) {
@@ -131,11 +2456,15 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             break;
         }
         case OP_PLUS: {
+            if (vm->stack_top[-1].type == TYPE_STRING || vm->stack_top[-2].type == TYPE_STRING) {
+                return concatenate(vm);
+            }
+
             Value a = pop(vm);
             Value b = pop(vm);
 
-            int aVal = tryGetIntValue(a);
-            int bVal = tryGetIntValue(b);
+            double aVal = tryGetNumber(a);
+            double bVal = tryGetNumber(b);
 
             Value number = newNumber(aVal + bVal);
             push(vm, number);
@@ -146,8 +2475,8 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value a = pop(vm);
             Value b = pop(vm);
 
-            int aVal = tryGetIntValue(a);
-            int bVal = tryGetIntValue(b);
+            double aVal = tryGetNumber(a);
+            double bVal = tryGetNumber(b);
 
             Value number = newNumber(aVal - bVal);
             push(vm, number);
@@ -158,8 +2487,8 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value a = pop(vm);
             Value b = pop(vm);
 
-            int aVal = tryGetIntValue(a);
-            int bVal = tryGetIntValue(b);
+            double aVal = tryGetNumber(a);
+            double bVal = tryGetNumber(b);
 
             Value number = newNumber(aVal * bVal);
             push(vm, number);
@@ -170,9 +2499,10 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value a = pop(vm);
             Value b = pop(vm);
 
-            int aVal = tryGetIntValue(a);
-            int bVal = tryGetIntValue(b);
+            double aVal = tryGetNumber(a);
+            double bVal = tryGetNumber(b);
 
+            // a zero divisor gives an infinity or NaN, as in JavaScript
             Value number = newNumber(aVal / bVal);
             push(vm, number);
 
@@ -182,12 +2512,10 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value a = pop(vm);
             Value b = pop(vm);
 
-            int aVal = tryGetIntValue(a);
-            int bVal = tryGetIntValue(b);
-
-            int result = aVal % bVal;
+            double aVal = tryGetNumber(a);
+            double bVal = tryGetNumber(b);
 
-            Value number = newNumber(result);
+            Value number = newNumber(fmod(aVal, bVal));
             push(vm, number);
 
             break;
@@ -195,7 +2523,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
         case OP_NEGATE: {
             Value a = pop(vm);
 
-            int aVal = tryGetIntValue(a);
+            double aVal = tryGetNumber(a);
 
             Value number = newNumber(-aVal);
             push(vm, number);
@@ -241,7 +2569,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             
             if (a.type != TYPE_NUMBER || b.type != TYPE_NUMBER) {
-                return runtimeError("Can only apply bitwise and to number values.");
+                return runtimeError(vm, "Can only apply bitwise and to number values.");
             }
 
             Value number = newNumber((int)a.as.number & (int)b.as.number);
@@ -253,7 +2581,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value a = pop(vm);
             
             if (a.type != TYPE_NUMBER) {
-                return runtimeError("Can only apply bitwise not to number values.");
+                return runtimeError(vm, "Can only apply bitwise not to number values.");
             }
 
             Value number = newNumber(~(int)a.as.number );
@@ -266,7 +2594,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             
             if (a.type != TYPE_NUMBER || b.type != TYPE_NUMBER) {
-                return runtimeError("Can only apply bitwise xor to number values.");
+                return runtimeError(vm, "Can only apply bitwise xor to number values.");
             }
 
             Value number = newNumber((int)a.as.number ^ (int)b.as.number);
@@ -279,7 +2607,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             
             if (a.type != TYPE_NUMBER || b.type != TYPE_NUMBER) {
-                return runtimeError("Can only apply bitwise xor to number values.");
+                return runtimeError(vm, "Can only apply bitwise xor to number values.");
             }
 
             Value number = newNumber((int)a.as.number << (int)b.as.number);
@@ -292,7 +2620,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             
             if (a.type != TYPE_NUMBER || b.type != TYPE_NUMBER) {
-                return runtimeError("Can only apply bitwise xor to number values.");
+                return runtimeError(vm, "Can only apply bitwise xor to number values.");
             }
 
             Value number = newNumber((int)a.as.number >> (int)b.as.number);
@@ -304,64 +2632,26 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             Value a = pop(vm);
 
-            push(vm, newBoolean(looselyEqual(a, b)));
+            push(vm, newBoolean(looselyEqual(vm, a, b)));
             break;
         }
         case OP_NOT_EQUALS: {
             Value b = pop(vm);
             Value a = pop(vm);
 
-            push(vm, newBoolean(!looselyEqual(a, b)));
+            push(vm, newBoolean(!looselyEqual(vm, a, b)));
             break;
         }
         case OP_TRIPLE_EQUALS: {
             Value a = pop(vm);
             Value b = pop(vm);
-            
-            if (a.type != b.type) {
-                push(vm, newBoolean(false));
-                break;
-            }
-
-            Value result;
-            if (a.type == TYPE_NUMBER) {
-                result = newBoolean(a.as.number == b.as.number);
-            } else if (a.type == TYPE_BOOL) {
-                result = newBoolean(a.as.boolean == b.as.boolean);
-            } else if (a.type == TYPE_STRING) {
-                result = newBoolean(strcmp(a.as.object->as.string.chars, b.as.object->as.string.chars) == 0);
-            } else {
-                fprintf(stderr, "Unknown type in vm, exiting.\n");
-                exit(EXIT_FAILURE);
-            }
-
-            push(vm, result);
-            
+            push(vm, newBoolean(valuesEqual(vm, a, b)));
             break;
         }
         case OP_TRIPLE_NOT_EQUALS: {
             Value a = pop(vm);
             Value b = pop(vm);
-            
-            if (a.type != b.type) {
-                push(vm, newBoolean(false));
-                break;
-            }
-
-            Value result;
-            if (a.type == TYPE_NUMBER) {
-                result = newBoolean(a.as.number == b.as.number);
-            } else if (a.type == TYPE_BOOL) {
-                result = newBoolean(a.as.boolean == b.as.boolean);
-            } else if (a.type == TYPE_STRING) {
-                result = newBoolean(strcmp(a.as.object->as.string.chars, b.as.object->as.string.chars) == 0);
-            } else {
-                fprintf(stderr, "Unknown type in vm, exiting.\n");
-                exit(EXIT_FAILURE);
-            }
-
-            push(vm, result);
-            
+            push(vm, newBoolean(!valuesEqual(vm, a, b)));
             break;
         }
         case OP_LESS_THAN: {
@@ -369,7 +2659,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             
             if (a.type != b.type) {
-                return runtimeError("Can only apply less than to number values.");
+                return runtimeError(vm, "Can only apply less than to number values.");
             }
 
             Value result = newBoolean(a.as.number < b.as.number);
@@ -382,7 +2672,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             
             if (a.type != b.type) {
-                return runtimeError("Can only apply less than equals to number values.");
+                return runtimeError(vm, "Can only apply less than equals to number values.");
             }
 
             Value result = newBoolean(a.as.number <= b.as.number);
@@ -395,7 +2685,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             
             if (a.type != b.type) {
-                return runtimeError("Can only apply greater than to number values.");
+                return runtimeError(vm, "Can only apply greater than to number values.");
             }
 
             Value result = newBoolean(a.as.number > b.as.number);
@@ -408,7 +2698,7 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             Value b = pop(vm);
             
             if (a.type != b.type) {
-                return runtimeError("Can only apply greater than to number values.");
+                return runtimeError(vm, "Can only apply greater than to number values.");
             }
 
             Value result = newBoolean(a.as.number >= b.as.number);
@@ -416,25 +2706,11 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
             
             break;
         }
+        case OP_PRINT: {
+            printValue(vm, pop(vm));
+            break;
+        }
         case OP_END: {
-            if (vm->stack_top == 0) {
-                return VM_OK;
-            }
-
-            Value result = pop(vm);
-
-            if (result.type == TYPE_BOOL) {
-                printf("%s\n", result.as.boolean ? "true" : "false");
-            } else if (result.type == TYPE_NUMBER) {
-                printf("%f\n", result.as.number);
-            } else if (result.type == TYPE_STRING) {
-                printf("%s\n", result.as.object->as.string.chars);
-            }
-            else {
-                fprintf(stderr, "Unknown end result type in vm.\n");
-                exit(EXIT_FAILURE);
-            }
-
             break;
         }
         case OP_TYPEOF: {
@@ -442,54 +2718,285 @@ static VmResult evalOpCode(JankyVm *vm, OpCode op) {
 
             
             if (a.type == TYPE_BOOL) {
-                Value val = newString("\"boolean\"");
+                Value val = newString(vm, "\"boolean\"");
                 push(vm, val);
             } else if (a.type == TYPE_NUMBER) {
-                Value val = newString("\"number\"");
+                Value val = newString(vm, "\"number\"");
                 push(vm, val);
             } else if (a.type == TYPE_STRING) {
-                Value val = newString("\"string\"");
+                Value val = newString(vm, "\"string\"");
+                push(vm, val);
+            } else if (a.type == TYPE_FUNCTION) {
+                Value val = newString(vm, "\"function\"");
+                push(vm, val);
+            } else if (a.type == TYPE_OBJECT || a.type == TYPE_ARRAY || a.type == TYPE_MAP || a.type == TYPE_WORKER) {
+                Value val = newString(vm, "\"object\"");
                 push(vm, val);
             } else {
-                Value val = newString("\"undefined\"");
+                Value val = newString(vm, "\"undefined\"");
                 push(vm, val);
             }
 
             break;
         }
         case OP_DEFINE_GLOBAL: {
-            
+            OpCode constIdx = vm->bytecode->code[vm->ip++];
+            Value value = pop(vm);
+
+            // write barrier: the globals table now points into the nursery
+            if (isObjectValue(value) && isYoung(&vm->heap, value.as.object)) {
+                vm->globals_remembered = true;
+            }
+
+            setSymbol(&vm->globals, vm->bytecode->constants[constIdx].as.identifier, value);
+            break;
         }
-        default: {
-            fprintf(stderr, "Halting VM execution: unknown opcode '%d'\n", op);
-            exit(EXIT_FAILURE);
+        case OP_GET_GLOBAL: {
+            OpCode constIdx = vm->bytecode->code[vm->ip++];
+
+            Value value;
+            if (!getSymbol(&vm->globals, vm->bytecode->constants[constIdx].as.identifier, &value)) {
+                return runtimeError(vm, "Undefined variable.");
+            }
+
+            push(vm, value);
+            break;
+        }
+        case OP_GET_LOCAL: {
+            OpCode slot = vm->bytecode->code[vm->ip++];
+
+            push(vm, vm->base[slot]);
+            break;
+        }
+        case OP_SET_LOCAL: {
+            OpCode slot = vm->bytecode->code[vm->ip++];
+
+            vm->base[slot] = vm->stack_top[-1];
+            break;
+        }
+        case OP_UNDEFINED: {
+            push(vm, newUndefined());
+            break;
+        }
+        case OP_POP: {
+            pop(vm);
+            break;
+        }
+        case OP_JUMP: {
+            OpCode offset = vm->bytecode->code[vm->ip++];
+
+            vm->ip += offset;
+            break;
+        }
+        case OP_JUMP_IF_FALSE: {
+            OpCode offset = vm->bytecode->code[vm->ip++];
+
+            if (isFalsey(pop(vm))) vm->ip += offset;
+            break;
+        }
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            OpCode argCount = vm->bytecode->code[vm->ip++];
+
+            return callValue(vm, argCount, op == OP_TAIL_CALL);
+        }
+        case OP_GET_PROPERTY: {
+            OpCode constIdx = vm->bytecode->code[vm->ip++];
+            OpCode cacheIdx = vm->bytecode->code[vm->ip++];
+            return getProperty(vm, vm->bytecode->constants[constIdx].as.identifier, &vm->caches[cacheIdx]);
+        }
+        case OP_GET_INDEX: {
+            // in-range array reads skip the generic path, one per kind
+            Value receiver = vm->stack_top[-2];
+            Value index = vm->stack_top[-1];
+
+            if (receiver.type == TYPE_ARRAY && index.type == TYPE_NUMBER) {
+                ObjArray *array = &receiver.as.object->as.array;
+                double number = index.as.number;
+                int i = number >= 0 && number < array->count ? (int)number : -1;
+
+                if (i >= 0 && i == number) {
+                    Value *slot = vm->stack_top - 2;
+                    switch (array->kind) {
+                        case ELEMENTS_INT:     slot->type = TYPE_NUMBER; slot->as.number = array->elements.ints[i]; break;
+                        case ELEMENTS_DOUBLE:  slot->type = TYPE_NUMBER; slot->as.number = array->elements.doubles[i]; break;
+                        case ELEMENTS_GENERIC: *slot = array->elements.values[i]; break;
+                    }
+                    vm->stack_top--;
+                    break;
+                }
+            }
+
+            return getIndex(vm);
+        }
+        case OP_SET_INDEX: {
+            return setIndex(vm);
+        }
+        case OP_NEW_ARRAY: {
+            int count = vm->bytecode->code[vm->ip++];
+            Value *values = vm->stack_top - count;
+
+            ElementKind kind = ELEMENTS_INT;
+            for (int i = 0; i < count; i++) {
+                ElementKind needed = elementKind(values[i]);
+                if (needed > kind) kind = needed;
+            }
+
+            // the elements stay on the stack until the array exists
+            Object *object = newArray(vm, kind, count);
+            for (int i = 0; i < count; i++) {
+                setElement(&vm->heap, object, i, values[i]);
+            }
+
+            vm->stack_top = values;
+            push(vm, arrayValue(object));
+            break;
+        }
+        case OP_APPEND_ARRAY: {
+            int count = vm->bytecode->code[vm->ip++];
+            Value *values = vm->stack_top - count;
+
+            // the array under construction is just below the batch
+            Object *object = values[-1].as.object;
+            for (int i = 0; i < count; i++) {
+                setElement(&vm->heap, object, object->as.array.count, values[i]);
+            }
+
+            vm->stack_top = values;
+            break;
+        }
+        case OP_NEW_MAP: {
+            bool isSet = vm->bytecode->code[vm->ip++] == 1;
+            int argCount = vm->bytecode->code[vm->ip++];
+            Value *args = vm->stack_top - argCount;
+
+            // the initial contents stay on the stack until the map exists
+            Object *object = newMap(vm, isSet);
+            if (argCount > 0) {
+                VmResult result = fillMap(vm, object, args[0]);
+                if (result != VM_OK) return result;
+            }
+
+            vm->stack_top = args;
+            push(vm, mapValue(object));
+            break;
+        }
+        case OP_NEW_WORKER: {
+            Value path = pop(vm);
+            if (path.type != TYPE_STRING) {
+                return runtimeError(vm, "A Worker needs the path of a script.");
+            }
+
+            ObjString *string = asFlatString(&vm->heap, path.as.object);
+            int index = startWorker(vm, string->chars);
+            if (index < 0) {
+                char message[ERROR_MESSAGE_MAX];
+                snprintf(message, sizeof(message), "Could not read the worker script '%s'.", string->chars);
+                return runtimeError(vm, message);
+            }
+
+            Value worker;
+            worker.type = TYPE_WORKER;
+            worker.as.number = index;
+            push(vm, worker);
+            break;
+        }
+        case OP_INVOKE: {
+            OpCode constIdx = vm->bytecode->code[vm->ip++];
+            OpCode argCount = vm->bytecode->code[vm->ip++];
+            OpCode cacheIdx = vm->bytecode->code[vm->ip++];
+            return invoke(vm, vm->bytecode->constants[constIdx].as.identifier, argCount, &vm->caches[cacheIdx]);
+        }
+        case OP_NEW_OBJECT: {
+            OpCode count = vm->bytecode->code[vm->ip++];
+            push(vm, newObject(vm, count));
+            break;
+        }
+        case OP_INIT_PROPERTY:
+        case OP_SET_PROPERTY: {
+            OpCode constIdx = vm->bytecode->code[vm->ip++];
+            OpCode cacheIdx = vm->bytecode->code[vm->ip++];
+
+            VmResult result = setProperty(vm, vm->bytecode->constants[constIdx].as.identifier, &vm->caches[cacheIdx]);
+            if (result != VM_OK) return result;
+
+            // an initializer leaves the object for the next one; an
+            // assignment evaluates to the value assigned
+            Value value = pop(vm);
+            if (op == OP_SET_PROPERTY) {
+                pop(vm);
+                push(vm, value);
+            }
+            break;
+        }
+        case OP_RETURN: {
+            Value result = pop(vm);
+            CallFrame *frame = &vm->frames[--vm->frame_count];
+
+            vm->stack_top = vm->base;
+            vm->bytecode = frame->chunk;
+            vm->caches = chunkCaches(vm, frame->chunk);
+            vm->ip = frame->return_ip;
+            vm->base = frame->base;
+
+            push(vm, result);
+            break;
         }
+        default:
+            return runtimeError(vm, "Unknown opcode.");
     }
 
     return VM_OK;
 }
 
-VmResult run(JankyVm *vm, char *source, int debug) {
-    Lexer lexer;
-    initLexer(&lexer, source);
-    tokenize(&lexer);
+static void printBytecode(Bytecode *bytecode, char *name) {
+    printf("%s:\n", name);
+    for (int i = 0; i < bytecode->code_count; i++) {
+        printf("OpCode: %d\n", bytecode->code[i]);
+    }
+
+    for (int i = 0; i < bytecode->const_count; i++) {
+        Value constant = bytecode->constants[i];
+        if (constant.type != TYPE_FUNCTION) continue;
+
+        char *fnName = constant.as.object->as.function.name;
+        printf("\n");
+        if (!constant.as.object->as.function.chunk) {
+            printf("%s: deferred\n", fnName ? fnName : "<anonymous>");
+            continue;
+        }
+        printBytecode(constant.as.object->as.function.chunk, fnName ? fnName : "<anonymous>");
+    }
+}
+
+// Lexes, parses and compiles the script into 'script', leaving the
+// tokens and the static functions on the VM for deferred bodies. With
+// 'eager' every function body is compiled now, as a cache file needs.
+static VmResult compileSource(JankyVm *vm, char *source, int debug, bool eager, Bytecode **script) {
+    Lexer *lexer = &vm->lexer;
+    initLexer(lexer, source);
+    tokenize(lexer);
     
     if (debug) {
         printf("\nTOKENS:\n");
-        for (int i = 0; i < lexer.token_count; i++) {
-            Token t = lexer.tokens[i];
+        for (int i = 0; i < lexer->token_count; i++) {
+            Token t = lexer->tokens[i];
             printf("Token: %d | '%s'\n", t.type, t.lexeme);
         }
         printf("\n");
     }
 
-    if (lexer.hadError) {
-        printf("Error: %s\n", lexer.tokens[lexer.token_count - 2].lexeme);
+    if (lexer->hadError) {
+        reportError(vm->errors, lexer->error);
+        freeLexer(lexer);
         return VM_COMPILE_ERROR;
     }
 
     Parser parser;
-    initParser(&parser, lexer.tokens);
+    initParser(&parser, lexer->tokens);
+    parser.lazy = vm->settings.lazy_compile && !eager && !vm->session;
+    parser.heap = &vm->heap;
+    parser.errors = vm->errors;
     parse(&parser);
 
     if (debug) {
@@ -499,34 +3006,304 @@ VmResult run(JankyVm *vm, char *source, int debug) {
     }
 
     if (parser.hadError) {
+        freeParser(&parser);
+        freeLexer(lexer);
         return VM_COMPILE_ERROR;
     }
 
     Compiler compiler;
     initCompiler(&compiler, parser.ast);
+    compiler.heap = &vm->heap;
+    compiler.inline_threshold = vm->settings.inline_threshold;
+    compiler.debug = debug;
+    compiler.incremental = vm->session;
+    compiler.errors = vm->errors;
+
+    if (debug) printf("\nINLINING:\n");
     compile(&compiler);
 
     if (debug) {
         printf("\nBYTECODE: \n");
-        for (int i = 0; i < compiler.bytecode->code_count; i++) {
-            printf("OpCode: %d\n", compiler.bytecode->code[i]);
-        }
+        printBytecode(compiler.bytecode, "<script>");
         printf("\n");
     }
 
+    // the declarations are freed with the AST, but the compiled functions
+    // stay valid for inlining into bodies compiled later
+    for (int i = 0; i < compiler.statics.count; i++) {
+        compiler.statics.functions[i].ast = NULL;
+        compiler.statics.functions[i].name = NULL;
+    }
+    vm->statics = compiler.statics;
+    compiler.statics.functions = NULL;
+    initSymbolTable(&compiler.statics.index);
+
+    freeCompiler(&compiler);
     freeParser(&parser);
-    freeLexer(&lexer);
 
-    initVm(vm, compiler.bytecode);
+    if (compiler.hadError) {
+        freeBytecode(compiler.bytecode);
+        freeStaticTable(&vm->statics);
+        freeLexer(lexer);
+        return VM_COMPILE_ERROR;
+    }
+
+    *script = compiler.bytecode;
+    return VM_OK;
+}
+
+// With a cache path set, a script whose cache file matches its source
+// starts from that file, and any other is compiled whole and written
+// there. Nothing is cached under --debug, which wants to see the stages.
+// The lexer and statics of a script with no deferred bodies.
+static void clearSource(JankyVm *vm) {
+    initLexer(&vm->lexer, "");
+    vm->statics.functions = NULL;
+    vm->statics.count = 0;
+    initSymbolTable(&vm->statics.index);
+}
+
+// The script occupies frame slot zero, followed by its block locals.
+static void enterScript(JankyVm *vm, Bytecode *bytecode) {
+    vm->bytecode = bytecode;
+    vm->caches = chunkCaches(vm, bytecode);
+    vm->ip = 0;
+    vm->stack_top = vm->stack;
+    vm->base = vm->stack;
+    vm->frame_count = 0;
+
+    // a program's script brings its own, so running it again and again
+    // allocates nothing
+    Value script;
+    script.type = TYPE_FUNCTION;
+    if (bytecode->program) {
+        script.as.object = bytecode->program->function;
+    } else {
+        script.as.object = newFunctionObject(&vm->heap);
+        script.as.object->as.function.chunk = bytecode;
+    }
+    push(vm, script);
+
+    while (vm->stack_top < vm->base + vm->bytecode->local_count) {
+        push(vm, newUndefined());
+    }
+}
 
+static VmResult execute(JankyVm *vm) {
     while (vm->ip < vm->bytecode->code_count) {
         OpCode op = vm->bytecode->code[vm->ip++];
         VmResult result = evalOpCode(vm, op);
-        
+
+        if (vm->stack_overflow) return stackOverflow(vm);
         if (result != VM_OK) return result;
     }
 
+    flushOutput(vm);
+
+    return VM_OK;
+}
+
+VmResult run(JankyVm *vm, char *source, int debug) {
+    double start = seconds();
+
+    vm->session = false;
+    initHeap(&vm->heap, vm->settings.gc_threshold, vm->settings.nursery_size, vm->settings.concurrent_gc);
+
+    const char *cachePath = debug ? NULL : vm->settings.cache_path;
+    uint64_t key = cachePath ? cacheKey(source, vm->settings.inline_threshold) : 0;
+
+    Bytecode *bytecode = cachePath ? loadCache(cachePath, key, &vm->heap, &vm->cache) : NULL;
+    vm->cache_hit = bytecode != NULL;
+    if (bytecode) {
+        clearSource(vm);
+    } else {
+        vm->cache.base = NULL;
+
+        VmResult result = compileSource(vm, source, debug, cachePath != NULL, &bytecode);
+        if (result != VM_OK) {
+            freeHeap(&vm->heap);
+            return result;
+        }
+
+        if (cachePath && !writeCache(cachePath, key, bytecode) && vm->settings.compile_only) {
+            char message[ERROR_MESSAGE_MAX];
+            snprintf(message, sizeof(message), "Could not write the cache file '%s'.", cachePath);
+            reportError(vm->errors, message);
+            freeBytecode(bytecode);
+            freeStaticTable(&vm->statics);
+            freeHeap(&vm->heap);
+            freeLexer(&vm->lexer);
+            return VM_COMPILE_ERROR;
+        }
+    }
+
+    initVm(vm, bytecode);
+    enterScript(vm, bytecode);
+
+    vm->startup_time = seconds() - start;
+
+    VmResult result = vm->settings.compile_only ? VM_OK : execute(vm);
     freeVm(vm);
-    
+
+    return result;
+}
+
+void startSession(JankyVm *vm) {
+    vm->session = true;
+    vm->cache.base = NULL;
+    vm->cache_hit = false;
+
+    initHeap(&vm->heap, vm->settings.gc_threshold, vm->settings.nursery_size, vm->settings.concurrent_gc);
+    clearSource(vm);
+    initVm(vm, NULL);
+}
+
+// Each line is a script of its own, compiled with every body in it, so
+// its tokens go as soon as it is compiled and the cost of a line does
+// not depend on the ones before it. What it defines lives on in the
+// globals; the rest of its chunk is collected with the function in slot
+// zero once the line is done.
+VmResult compileLine(JankyVm *vm, char *source, int debug, Bytecode **chunk) {
+    freeLexer(&vm->lexer);
+    freeStaticTable(&vm->statics);
+
+    VmResult result = compileSource(vm, source, debug, true, chunk);
+    if (result == VM_OK) {
+        freeLexer(&vm->lexer);
+        freeStaticTable(&vm->statics);
+    }
+
+    clearSource(vm);
+
+    return result;
+}
+
+VmResult runChunk(JankyVm *vm, Bytecode *chunk) {
+    enterScript(vm, chunk);
+    VmResult result = execute(vm);
+
+    vm->stack_top = vm->stack;
+    vm->frame_count = 0;
+
+    return result;
+}
+
+VmResult compileScript(JankyVm *vm, char *source, Bytecode **chunk) {
+    freeLexer(&vm->lexer);
+    freeStaticTable(&vm->statics);
+
+    // a whole script, so its own functions can still resolve statically
+    vm->session = false;
+    VmResult result = compileSource(vm, source, 0, true, chunk);
+    vm->session = true;
+
+    if (result == VM_OK) {
+        freeLexer(&vm->lexer);
+        freeStaticTable(&vm->statics);
+    }
+
+    clearSource(vm);
+
+    return result;
+}
+
+VmResult compileProgram(JankyVm *vm, char *source, Program **program) {
+    Bytecode *script;
+    VmResult result = compileScript(vm, source, &script);
+
+    if (result == VM_OK) {
+        // the frozen copy shares nothing with the heap's
+        *program = newProgram(script);
+        freeBytecode(script);
+        if (!*program) {
+            reportError(vm->errors, "Could not freeze the program.");
+            result = VM_COMPILE_ERROR;
+        }
+    }
+
+    return result;
+}
+
+VmResult runProgram(JankyVm *vm, Program *program) {
+    return runChunk(vm, program->script);
+}
+
+VmResult runParallelTask(JankyVm *vm, ParallelJob *job, int task) {
+    enterScript(vm, job->program->script);
+
+    // see bindingChunk()
+    VmResult result = runTask(vm, job->program->script->constants[0], job, task);
+
+    vm->stack_top = vm->stack;
+    vm->frame_count = 0;
+
+    return result;
+}
+
+void forgetProgram(JankyVm *vm, Program *program) {
+    for (int i = 0; i < vm->program_cache_count; i++) {
+        if (vm->program_caches[i].program != program) continue;
+
+        free(vm->program_caches[i].caches);
+        vm->program_caches[i] = vm->program_caches[--vm->program_cache_count];
+        return;
+    }
+}
+
+void resetGlobals(JankyVm *vm) {
+    freeSymbolTable(&vm->globals);
+    vm->globals_remembered = false;
+
+    Value json;
+    json.type = TYPE_OBJECT;
+    json.as.object = vm->json;
+    setSymbol(&vm->globals, "JSON", json);
+
+    Value self;
+    self.type = TYPE_OBJECT;
+    self.as.object = vm->self;
+    setSymbol(&vm->globals, "self", self);
+}
+
+VmResult defineJsonGlobal(JankyVm *vm, char *name, const char *json, int length) {
+    // on the stack, so the text and the values parsed from it are roots
+    Value text;
+    text.type = TYPE_STRING;
+    text.as.object = newStringObject(&vm->heap, json, length);
+    push(vm, text);
+
+    Value value;
+    VmResult result = parseJson(vm, vm->stack_top - 1, &value);
+    vm->stack_top = vm->stack;
+    if (result != VM_OK) return result;
+
+    if (isObjectValue(value) && isYoung(&vm->heap, value.as.object)) {
+        vm->globals_remembered = true;
+    }
+    setSymbol(&vm->globals, name, value);
+
     return VM_OK;
-}
\ No newline at end of file
+}
+
+void defineTextGlobal(JankyVm *vm, char *name, const char *chars, int length, bool number) {
+    Value value;
+    if (number) {
+        value = newNumber(stringToNumber(chars, length));
+    } else {
+        value = copyString(vm, chars, length);
+        if (isYoung(&vm->heap, value.as.object)) vm->globals_remembered = true;
+    }
+
+    setSymbol(&vm->globals, name, value);
+}
+
+VmResult runLine(JankyVm *vm, char *source, int debug) {
+    Bytecode *chunk;
+    VmResult result = compileLine(vm, source, debug, &chunk);
+
+    return result == VM_OK ? runChunk(vm, chunk) : result;
+}
+
+void endSession(JankyVm *vm) {
+    freeVm(vm);
+}
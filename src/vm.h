@@ -1,19 +1,200 @@
 #ifndef vm_h
 #define vm_h
 
+#include "buffer.h"
+#include "cache.h"
 #include "compiler.h"
+#include "error.h"
+#include "kernels.h"
+#include "memory.h"
+#include "shape.h"
+#include "symbols.h"
+#include "utf8.h"
 #include "value.h"
 
-#define STACK_MAX 256
+typedef struct Isolate Isolate;
+typedef struct Pool Pool;
+typedef struct ParallelJob ParallelJob;
 
+#define FRAMES_MAX 256
+#define STACK_MAX  (FRAMES_MAX * 64)
+// Slots past STACK_MAX for the instruction that overflows to finish in,
+// so that every value it pushed is still there; no instruction pushes
+// this many before it would call back into the script.
+#define STACK_RESERVE 64
+
+#define MEGAMORPHIC_ENTRIES 1024
+#define OUTPUT_BUFFER_SIZE  (1 << 20)
+
+// The caller's state saved by a call. Frames live in a fixed array on the
+// VM, so entering a function is an index bump rather than an allocation.
+typedef struct {
+    Bytecode *chunk;
+    int       return_ip;
+    Value    *base;
+} CallFrame;
+
+// A property lookup made at a megamorphic site, keyed by the shape and
+// the site's name constant, which is shared by every site in a chunk.
+typedef struct {
+    Shape *shape;
+    char  *name;
+    int    slot;
+    Shape *transition;
+} MegamorphicEntry;
+
+// The inline caches a VM keeps for the frozen chunks of one program.
+typedef struct {
+    Program       *program;
+    PropertyCache *caches;
+} ProgramCaches;
+
+// Tunables read by run(). Set them after defaultSettings() and before the
+// first run; they are left alone by the VM itself.
 typedef struct {
-    Bytecode *bytecode;
-    int       ip;
-    Value     stack[STACK_MAX];
-    Value    *stack_top;
+    int    inline_threshold;
+    bool   lazy_compile;
+    size_t gc_threshold;
+    size_t nursery_size;
+    bool   concurrent_gc;
+    const Kernels *kernels;
+
+    // where the compiled script is cached, or NULL to always compile;
+    // 'compile_only' stops once the cache file is written
+    const char *cache_path;
+    bool   compile_only;
+
+    // threads for parallelMap() and the like: 0 for one per core, and 1
+    // to run them on the calling thread
+    int    threads;
+} VmSettings;
+
+typedef struct {
+    VmSettings  settings;
+
+    Bytecode   *bytecode;
+    int         ip;
+    Value      *base;
+    // the running chunk's inline caches; see chunkCaches()
+    PropertyCache *caches;
+
+    CallFrame   frames[FRAMES_MAX];
+    int         frame_count;
+
+    Value       stack[STACK_MAX + STACK_RESERVE];
+    Value      *stack_top;
+    // a push found the stack full; see push()
+    bool        stack_overflow;
+
+    SymbolTable globals;
+    Heap        heap;
+    bool        globals_remembered;
+
+    // one-character strings for every ASCII byte, so indexing an ASCII
+    // string never allocates
+    Object     *ascii_chars[128];
+    Utf8Cache   utf8_cache;
+
+    // printed results not yet written to stdout; see flushOutput()
+    TextBuffer  output;
+
+    // the global JSON object, whose methods invoke() runs natively
+    Object     *json;
+
+    // the global 'self', through which a script receives messages and a
+    // worker posts them to its parent; and the mailbox and workers behind
+    // it, made when first needed (see worker.h)
+    Object     *self;
+    Isolate    *isolate;
+
+    // the threads parallelMap() and the like run on, started by the
+    // first call that needs them (see parallel.h)
+    Pool       *pool;
+
+    // the empty shape every object literal starts from, and the lookups
+    // that sites with too many shapes for their own cache share
+    Shape      *root_shape;
+    MegamorphicEntry megamorphic[MEGAMORPHIC_ENTRIES];
+
+    // kept alive for deferred function bodies, compiled on first call
+    Lexer       lexer;
+    StaticTable statics;
+
+    // the cache file the script was loaded from, if it was
+    CacheMapping cache;
+    bool        cache_hit;
+
+    // set between startSession() and endSession()
+    bool        session;
+
+    ProgramCaches *program_caches;
+    int         program_cache_count;
+
+    // set by an embedder: errors go to the sink instead of stdout, and
+    // printed results stay in 'output' for it to read
+    ErrorSink  *errors;
+    bool        keep_output;
+
+    long        call_count;
+    long        deferred_count;
+    long        property_hits;
+    long        property_misses;
+    long        megamorphic_sites;
+    long        megamorphic_hits;
+    long        kernel_calls;
+    long        parallel_calls;
+    long        parallel_steals;
+    double      startup_time;
 } JankyVm;
 
+void     defaultSettings(VmSettings *settings);
 VmResult run(JankyVm *vm, char *source, int debug);
 void     freeVm(JankyVm *vm);
 
-#endif
\ No newline at end of file
+// A REPL session keeps one heap, globals table and set of shapes for
+// all of its lines. Each line is compiled on its own into a new chunk
+// and run against the globals the earlier ones defined; an error ends
+// the line but not the session.
+void     startSession(JankyVm *vm);
+VmResult runLine(JankyVm *vm, char *source, int debug);
+void     endSession(JankyVm *vm);
+
+// runLine() in two steps. A compiled chunk is run at most once, and is
+// freed with its script once it has; one that is never run is freed by
+// the caller.
+VmResult compileLine(JankyVm *vm, char *source, int debug, Bytecode **chunk);
+VmResult runChunk(JankyVm *vm, Bytecode *chunk);
+
+// compileLine() of a whole script rather than a line, compiled as run()
+// compiles it but with every body.
+VmResult compileScript(JankyVm *vm, char *source, Bytecode **chunk);
+
+// Compiles 'source' in a session as a whole script, with every body, and
+// freezes it into a program that any VM in any session can run, each
+// with its own stack and globals.
+VmResult compileProgram(JankyVm *vm, char *source, Program **program);
+VmResult runProgram(JankyVm *vm, Program *program);
+
+// Between the scripts of a session that should not see each other's
+// globals: drops all but JSON and self, keeping the heap and shapes.
+void     resetGlobals(JankyVm *vm);
+
+// Parses 'json' as JSON.parse() does and defines the result as the
+// global 'name', such as the input of a batch job.
+VmResult defineJsonGlobal(JankyVm *vm, char *name, const char *json, int length);
+
+// Defines the global 'name' as a string of the given bytes, copied into
+// the nursery, or as the number Number() would make of them.
+void     defineTextGlobal(JankyVm *vm, char *name, const char *chars, int length, bool number);
+
+// Runs one task of a parallel call on a pool thread's session VM, calling
+// the job's frozen callback for each element of the task; and drops the
+// inline caches the VM kept for the program once the call is done.
+VmResult runParallelTask(JankyVm *vm, ParallelJob *job, int task);
+void     forgetProgram(JankyVm *vm, Program *program);
+
+// Writes out whatever the script has printed so far. run() does this
+// itself before it returns and before any error message.
+void     flushOutput(JankyVm *vm);
+
+#endif
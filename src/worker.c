@@ -0,0 +1,253 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "worker.h"
+
+// How many times a waiting isolate checks for an event before it goes
+// to sleep, when there is another core to send one.
+#define SPIN_LIMIT 4000
+
+static Isolate *newIsolate(WorkerThread *self) {
+    Isolate *isolate = aligned_alloc(CACHE_LINE, sizeof(Isolate));
+    memset(isolate, 0, sizeof(Isolate));
+
+    initSpsc(&isolate->from_parent, WORKER_RING_SIZE);
+    initMpsc(&isolate->from_workers, WORKER_RING_SIZE);
+    pthread_mutex_init(&isolate->lock, NULL);
+    pthread_cond_init(&isolate->wake, NULL);
+    isolate->spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    isolate->self = self;
+
+    return isolate;
+}
+
+static void dropMessage(Message *message) {
+    freeMessage(message);
+    free(message);
+}
+
+static void freeIsolate(Isolate *isolate) {
+    void *message;
+    while (popSpsc(&isolate->from_parent, &message)) dropMessage(message);
+    while (popMpsc(&isolate->from_workers, &message)) dropMessage(message);
+
+    freeSpsc(&isolate->from_parent);
+    freeMpsc(&isolate->from_workers);
+    pthread_mutex_destroy(&isolate->lock);
+    pthread_cond_destroy(&isolate->wake);
+    free(isolate->workers);
+    free(isolate);
+}
+
+static Isolate *isolateOf(JankyVm *vm) {
+    if (!vm->isolate) vm->isolate = newIsolate(NULL);
+
+    return vm->isolate;
+}
+
+// The sleeper sets 'sleeping' before it checks 'events' one last time,
+// and a waker bumps 'events' before it checks 'sleeping', so at least
+// one of them sees the other; the lock then makes sure the signal comes
+// after the sleeper is waiting.
+static void notify(Isolate *isolate) {
+    __atomic_add_fetch(&isolate->events, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&isolate->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&isolate->lock);
+        pthread_cond_signal(&isolate->wake);
+        pthread_mutex_unlock(&isolate->lock);
+    }
+}
+
+// Returns once 'events' has moved on from 'seen'. With another core to
+// send it, the event usually comes sooner than a sleep and a wake-up
+// would take, so it is watched for a while first.
+static void waitForEvent(Isolate *isolate, long seen) {
+    for (int i = 0; i < isolate->spins; i++) {
+        if (__atomic_load_n(&isolate->events, __ATOMIC_SEQ_CST) != seen) return;
+#ifdef __SSE2__
+        _mm_pause();
+#endif
+    }
+
+    pthread_mutex_lock(&isolate->lock);
+    __atomic_store_n(&isolate->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&isolate->events, __ATOMIC_SEQ_CST) == seen) {
+        pthread_cond_wait(&isolate->wake, &isolate->lock);
+    }
+    __atomic_store_n(&isolate->sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&isolate->lock);
+}
+
+// A full ring is rare and can take the consumer a while to drain, so
+// the producer yields at first and then sleeps between tries rather
+// than spin against a consumer that may need its core.
+static void backOff(int *tries) {
+    if ((*tries)++ < 64) {
+        sched_yield();
+        return;
+    }
+
+    struct timespec pause = { 0, 50000 };
+    nanosleep(&pause, NULL);
+}
+
+static bool isLeaving(Isolate *isolate) {
+    return __atomic_load_n(&isolate->leaving, __ATOMIC_SEQ_CST);
+}
+
+static char *readScript(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char *source = malloc(size + 1);
+    size_t read = fread(source, 1, size, file);
+    source[read] = '\0';
+    fclose(file);
+
+    return source;
+}
+
+static void *workerMain(void *arg) {
+    WorkerThread *worker = arg;
+
+    JankyVm *vm = calloc(1, sizeof(JankyVm));
+    vm->settings = worker->settings;
+    vm->isolate = worker->isolate;
+    run(vm, worker->source, 0);
+    free(vm);
+
+    Isolate *parent = worker->parent;
+    __atomic_sub_fetch(&parent->running, 1, __ATOMIC_SEQ_CST);
+    notify(parent);
+
+    return NULL;
+}
+
+int startWorker(JankyVm *vm, const char *path) {
+    char *source = readScript(path);
+    if (!source) return -1;
+
+    Isolate *isolate = isolateOf(vm);
+    if (isolate->worker_count == isolate->worker_capacity) {
+        isolate->worker_capacity = isolate->worker_capacity == 0 ? 8 : isolate->worker_capacity * 2;
+        isolate->workers = realloc(isolate->workers, sizeof(WorkerThread *) * isolate->worker_capacity);
+    }
+
+    WorkerThread *worker = calloc(1, sizeof(WorkerThread));
+    worker->source = source;
+    worker->parent = isolate;
+    worker->isolate = newIsolate(worker);
+
+    // the cache file is the main script's
+    worker->settings = vm->settings;
+    worker->settings.cache_path = NULL;
+    worker->settings.compile_only = false;
+
+    __atomic_add_fetch(&isolate->running, 1, __ATOMIC_SEQ_CST);
+    pthread_create(&worker->thread, NULL, workerMain, worker);
+
+    isolate->workers[isolate->worker_count] = worker;
+    return isolate->worker_count++;
+}
+
+void postToWorker(JankyVm *vm, int index, Message *message) {
+    WorkerThread *worker = vm->isolate->workers[index];
+    Isolate *target = worker->isolate;
+    int tries = 0;
+
+    while (!worker->ended && !isLeaving(target)) {
+        if (pushSpsc(&target->from_parent, message)) {
+            notify(target);
+            return;
+        }
+        backOff(&tries);
+    }
+
+    dropMessage(message);
+}
+
+bool postToParent(JankyVm *vm, Message *message) {
+    if (!vm->isolate || !vm->isolate->self) return false;
+
+    Isolate *parent = vm->isolate->self->parent;
+    int tries = 0;
+
+    // a parent terminating this worker may be waiting on it, not receiving
+    while (!isLeaving(parent) && !__atomic_load_n(&vm->isolate->closed, __ATOMIC_SEQ_CST)) {
+        if (pushMpsc(&parent->from_workers, message)) {
+            notify(parent);
+            return true;
+        }
+        backOff(&tries);
+    }
+
+    dropMessage(message);
+    return true;
+}
+
+// Whether anything more can come is read before the rings are, so a
+// message posted just before the last sender finished is still seen.
+Message *receiveMessage(JankyVm *vm) {
+    Isolate *isolate = isolateOf(vm);
+
+    for (;;) {
+        long seen = __atomic_load_n(&isolate->events, __ATOMIC_SEQ_CST);
+        bool open = isolate->self && !__atomic_load_n(&isolate->closed, __ATOMIC_SEQ_CST);
+        bool finished = !open && __atomic_load_n(&isolate->running, __ATOMIC_SEQ_CST) == 0;
+
+        void *message;
+        if (popSpsc(&isolate->from_parent, &message) || popMpsc(&isolate->from_workers, &message)) {
+            return message;
+        }
+        if (finished) return NULL;
+
+        waitForEvent(isolate, seen);
+    }
+}
+
+static void endWorker(WorkerThread *worker) {
+    if (worker->ended) return;
+
+    __atomic_store_n(&worker->isolate->closed, 1, __ATOMIC_SEQ_CST);
+    notify(worker->isolate);
+    pthread_join(worker->thread, NULL);
+
+    worker->ended = true;
+    freeIsolate(worker->isolate);
+    free(worker->source);
+}
+
+void terminateWorker(JankyVm *vm, int index) {
+    endWorker(vm->isolate->workers[index]);
+}
+
+void stopWorkers(JankyVm *vm) {
+    Isolate *isolate = vm->isolate;
+    if (!isolate) return;
+
+    // workers blocked on a full mailbox here give up on it
+    __atomic_store_n(&isolate->leaving, 1, __ATOMIC_SEQ_CST);
+
+    for (int i = 0; i < isolate->worker_count; i++) {
+        endWorker(isolate->workers[i]);
+        free(isolate->workers[i]);
+    }
+    isolate->worker_count = 0;
+
+    // a worker's isolate goes with its thread, once the parent has joined it
+    if (!isolate->self) freeIsolate(isolate);
+    vm->isolate = NULL;
+}
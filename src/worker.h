@@ -0,0 +1,80 @@
+#ifndef worker_h
+#define worker_h
+
+#include <pthread.h>
+
+#include "message.h"
+#include "ring.h"
+#include "vm.h"
+
+// Messages a ring holds before its producer has to wait.
+#define WORKER_RING_SIZE 1024
+
+typedef struct WorkerThread WorkerThread;
+
+// What a VM needs to take part in message passing: its mailbox, and the
+// workers it has started. The main script's is made when it first
+// starts a worker or receives; a worker's comes with it.
+//
+// Only the parent posts into 'from_parent', so it is single-producer;
+// any of the isolate's own workers post into 'from_workers' at once.
+// Every arrival, and every change that can end a wait for one, bumps
+// 'events' and wakes the isolate if it went to sleep on it.
+struct Isolate {
+    SpscRing        from_parent;
+    MpscRing        from_workers;
+
+    long            events;
+    int             sleeping;
+    int             spins;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+    // the parent has let go, so receiving stops at an empty mailbox once
+    // no worker of this isolate's is left running either
+    int             closed;
+    // the isolate is ending, and posts to it are dropped
+    int             leaving;
+    int             running;
+
+    // NULL for the main script
+    WorkerThread   *self;
+    WorkerThread  **workers;
+    int             worker_count;
+    int             worker_capacity;
+};
+
+// A worker as its parent sees it. The thread runs 'source' in a VM of
+// its own, as the command line runs a script, printing what it prints.
+struct WorkerThread {
+    pthread_t   thread;
+    char       *source;
+    VmSettings  settings;
+    Isolate    *isolate;
+    Isolate    *parent;
+    bool        ended;
+};
+
+// Starts the script at 'path' on a new worker. Returns the worker's
+// index, which a handle holds, or -1 if the script could not be read.
+int      startWorker(JankyVm *vm, const char *path);
+
+// Hand a message on, waiting while the ring is full. A message for an
+// isolate that is ending is dropped. postToParent() is false, keeping
+// the message, when the VM is not a worker.
+void     postToWorker(JankyVm *vm, int index, Message *message);
+bool     postToParent(JankyVm *vm, Message *message);
+
+// Waits for the next message from the parent or any of the VM's own
+// workers. NULL once none can come: the parent has let go, or there is
+// none, and no worker is left running.
+Message *receiveMessage(JankyVm *vm);
+
+// Lets the worker go and waits for its script to end. A worker that
+// never receives runs to its end first.
+void     terminateWorker(JankyVm *vm, int index);
+
+// Terminates every worker the VM started, at the end of its script.
+void     stopWorkers(JankyVm *vm);
+
+#endif
@@ -0,0 +1,35 @@
+function add(a, b) { return a + b; }
+function twice(f, x) { return f(f(x, 1), 1); }
+function missing(a, b) { return typeof b; }
+function noReturn() { let x = 1; }
+function fact(n) {
+    if (n <= 1) return 1;
+    return n * fact(n - 1);
+}
+function count(n, acc) {
+    if (n == 0) return acc;
+    return count(n - 1, acc + 1);
+}
+function isEven(n) {
+    if (n == 0) return true;
+    return isOdd(n - 1);
+}
+function isOdd(n) {
+    if (n == 0) return false;
+    return isEven(n - 1);
+}
+function deep(n) {
+    if (n == 0) return 0;
+    return 1 + deep(n - 1);
+}
+add(2, 3);
+add(1, 2, 3);
+twice(add, 5);
+missing(1);
+noReturn();
+fact(10);
+deep(200);
+count(100000, 0);
+isEven(100001);
+deep(100000);
+"not reached";
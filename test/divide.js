@@ -0,0 +1,17 @@
+10 / 4;
+1 / 3;
+1.5 / 0.5;
+3000000000 / 2;
+-2147483648 / -1;
+1 / 0;
+-1 / 0;
+0 / 0;
+7 % 3;
+-7.5 % 2;
+7 % -3;
+5.5 % 0;
+3000000000 % 7;
+
+let halves = [0.5, 1.5, 2.5];
+halves[2] / halves[0];
+halves[1] % 1;
@@ -0,0 +1,77 @@
+// Runs scripts that used to take the host down with them through the
+// embedding API, and checks that each comes back as a status and that
+// the isolate carries on after it.
+// Usage: embed
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/jank.h"
+
+static int failures = 0;
+
+// Builds 'count' copies of 'item' joined by 'separator' between 'open'
+// and 'close'.
+static char *repeat(const char *open, const char *item, const char *separator, const char *close, int count) {
+    size_t size = strlen(open) + strlen(close) + (strlen(item) + strlen(separator)) * count + 1;
+    char *source = malloc(size);
+
+    strcpy(source, open);
+    for (int i = 0; i < count; i++) {
+        if (i > 0) strcat(source, separator);
+        strcat(source, item);
+    }
+    strcat(source, close);
+
+    return source;
+}
+
+static void expect(JankIsolate *isolate, const char *name, const char *source, JankStatus expected, const char *output) {
+    JankStatus status = jankCompile(isolate, source);
+    if (status == JANK_OK) status = jankRun(isolate);
+
+    int length = 0;
+    const char *printed = status == JANK_OK ? jankOutput(isolate, &length) : jankError(isolate);
+    if (!printed) printed = "";
+    if (status == JANK_OK) length = length > 0 && printed[length - 1] == '\n' ? length - 1 : length;
+    else length = strlen(printed);
+
+    if (status == expected && (int)strlen(output) == length && strncmp(printed, output, length) == 0) {
+        printf("ok   %s\n", name);
+        return;
+    }
+
+    printf("FAIL %s: status %d, '%.*s'\n", name, status, length, printed);
+    failures++;
+}
+
+int main(void) {
+    JankIsolate *isolate;
+    if (jankCreateIsolate(&isolate) != JANK_OK) {
+        printf("FAIL could not create an isolate\n");
+        return 1;
+    }
+
+    expect(isolate, "divide by zero", "1 / 0;", JANK_OK, "Infinity");
+    expect(isolate, "remainder by zero", "5 % 0;", JANK_OK, "NaN");
+    expect(isolate, "int divide overflow", "-2147483648 / -1;", JANK_OK, "2147483648");
+
+    char *deep = repeat("", "1", " + ", ";", 20000);
+    expect(isolate, "deep expression", deep, JANK_RUNTIME_ERROR, "Maximum call stack size exceeded.");
+    free(deep);
+
+    char *literal = repeat("let big = [", "1", ", ", "]; big.length;", 40000);
+    expect(isolate, "long array literal", literal, JANK_OK, "40000");
+    free(literal);
+
+    char *args = repeat("function f(a) { return a; } f(", "7", ", ", ");", 20000);
+    expect(isolate, "many arguments", args, JANK_RUNTIME_ERROR, "Maximum call stack size exceeded.");
+    free(args);
+
+    expect(isolate, "carries on", "1 + 1;", JANK_OK, "2");
+
+    jankDestroyIsolate(isolate);
+
+    return failures > 0;
+}
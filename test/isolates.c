@@ -0,0 +1,146 @@
+// Runs isolates on many threads at once through the embedding API and
+// checks every result, so it doubles as a race test when built with
+// -fsanitize=thread ('make tsan', which 'make test' runs). Each thread
+// creates an isolate per round, builds and round-trips a list of records
+// through JSON, reads the results back, then makes a runtime and a
+// compile error and checks that the isolate carries on after both.
+// Usage: isolates [threads] [rounds] [records]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/jank.h"
+
+typedef struct {
+    int  id;
+    int  rounds;
+    int  records;
+    long failures;
+} Worker;
+
+static const char *script =
+    "function build(i, n, list) {\n"
+    "    if (i == n) return list;\n"
+    "    list.push({ id: i, name: 'item' + i, seed: %d });\n"
+    "    return build(i + 1, n, list);\n"
+    "}\n"
+    "function total(list, i, n, acc) {\n"
+    "    if (i == n) return acc;\n"
+    "    return total(list, i + 1, n, acc + list[i].id);\n"
+    "}\n"
+    "let records = build(0, %d, []);\n"
+    "let parsed = JSON.parse(JSON.stringify(records));\n"
+    "let sum = total(parsed, 0, %d, 0) + %d;\n"
+    "let label = 'isolate' + %d;\n"
+    "let last = parsed[%d];\n"
+    "sum\n";
+
+static bool check(Worker *worker, bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "isolate %d: %s\n", worker->id, what);
+        worker->failures++;
+    }
+    return ok;
+}
+
+static void runRound(Worker *worker, char *source, int round) {
+    JankIsolate *isolate;
+    if (!check(worker, jankCreateIsolate(&isolate) == JANK_OK, "create failed")) return;
+
+    int seed = worker->id * 1000 + round;
+    int n = worker->records;
+    snprintf(source, 2048, script, seed, n, n, seed, seed, n - 1);
+
+    JankStatus status = jankCompile(isolate, source);
+    if (status == JANK_OK) status = jankRun(isolate);
+    if (!check(worker, status == JANK_OK, jankError(isolate) ? jankError(isolate) : "script failed")) {
+        jankDestroyIsolate(isolate);
+        return;
+    }
+
+    double expected = (double)n * (n - 1) / 2 + seed;
+    char text[64];
+
+    JankValue value;
+    jankGetGlobal(isolate, "sum", &value);
+    check(worker, value.type == JANK_NUMBER && value.number == expected, "wrong sum");
+
+    int length;
+    const char *output = jankOutput(isolate, &length);
+    snprintf(text, sizeof(text), "%.0f\n", expected);
+    check(worker, strcmp(output, text) == 0, "wrong output");
+
+    jankGetGlobal(isolate, "label", &value);
+    snprintf(text, sizeof(text), "isolate%d", seed);
+    check(worker, value.type == JANK_STRING && strcmp(value.chars, text) == 0, "wrong label");
+
+    jankGetGlobal(isolate, "last", &value);
+    snprintf(text, sizeof(text), "{\"id\":%d,\"name\":\"item%d\",\"seed\":%d}", n - 1, n - 1, seed);
+    check(worker, value.type == JANK_OBJECT && strcmp(value.chars, text) == 0, "wrong record");
+
+    // the session goes on after errors, keeping what ran before them
+    status = jankCompile(isolate, "let again = sum + 1;\nmissing(1);\n");
+    if (status == JANK_OK) status = jankRun(isolate);
+    check(worker, status == JANK_RUNTIME_ERROR && jankError(isolate) != NULL, "no runtime error");
+
+    check(worker, jankCompile(isolate, "1 +;\n") == JANK_COMPILE_ERROR, "no compile error");
+    check(worker, jankRun(isolate) == JANK_NO_SCRIPT, "ran a failed script");
+    check(worker, jankGetGlobal(isolate, "nothing", &value) == JANK_NOT_FOUND, "found an undefined global");
+
+    jankGetGlobal(isolate, "again", &value);
+    check(worker, value.type == JANK_NUMBER && value.number == expected + 1, "lost a global");
+
+    jankDestroyIsolate(isolate);
+}
+
+static void *workerMain(void *arg) {
+    Worker *worker = arg;
+    char *source = malloc(2048);
+
+    for (int round = 0; round < worker->rounds; round++) {
+        runRound(worker, source, round);
+    }
+
+    free(source);
+    return NULL;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 64;
+    int rounds = argc > 2 ? atoi(argv[2]) : 4;
+    int records = argc > 3 ? atoi(argv[3]) : 2000;
+
+    pthread_t *ids = malloc(sizeof(pthread_t) * threads);
+    Worker *workers = calloc(threads, sizeof(Worker));
+
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (Worker){ i, rounds, records, 0 };
+        pthread_create(&ids[i], NULL, workerMain, &workers[i]);
+    }
+
+    long failures = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        failures += workers[i].failures;
+    }
+    double elapsed = now() - start;
+
+    printf("%-8d %8d %10.1f %12.1f %10ld\n", threads, threads * rounds, elapsed * 1e3,
+           threads * rounds / elapsed, failures);
+
+    free(ids);
+    free(workers);
+
+    return failures > 0;
+}
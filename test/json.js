@@ -0,0 +1,19 @@
+let text = '{"name":"jank","list":[1,-2.5,1e+21,true,false,null],"nested":{"empty":{},"none":[]},"escape":"a\"b\\c\né"}';
+let value = JSON.parse(text);
+value.name;
+value.list;
+value.list.length;
+value.nested;
+value.escape;
+value.escape.length;
+JSON.stringify(value);
+JSON.stringify(value) == text;
+JSON.stringify(JSON.parse(JSON.stringify(value))) == JSON.stringify(value);
+JSON.parse('  [ 1 , [ 2 , [ 3 ] ] ]  ');
+JSON.parse('"A\t"');
+JSON.parse('0.1');
+JSON.parse('-0');
+JSON.stringify([0.1, 1 / 3, -0, 1e-7]);
+JSON.stringify('quote " slash \ ');
+JSON.stringify({ a: [1, { b: 2 }], c: "d" });
+JSON.parse('[1, 2,]');
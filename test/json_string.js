@@ -0,0 +1 @@
+JSON.parse('["open]');
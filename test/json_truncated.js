@@ -0,0 +1 @@
+JSON.parse('{"a": [1, 2');
@@ -0,0 +1,52 @@
+function fill(map, i, n) {
+    if (i == n) return map;
+    map.set(i, i * i);
+    return fill(map, i + 1, n);
+}
+function drop(map, i, n, step) {
+    if (i >= n) return map;
+    map.delete(i);
+    return drop(map, i + step, n, step);
+}
+let m = new Map();
+m.set("b", 1);
+m.set("a", 2);
+m.set("c", 3);
+m.keys();
+m.delete("a");
+m.keys();
+m.set("a", 4);
+m.entries();
+m.set("b", 5);
+m.entries();
+m.get("b");
+m.has("a");
+m.delete("missing");
+m.size;
+let s = new Set([3, 1, 2, 1]);
+s.keys();
+s.delete(3);
+s.add(3);
+s.add(1);
+s.keys();
+s.size;
+let big = drop(fill(new Map(), 0, 1000), 0, 1000, 2);
+big.size;
+big.get(999);
+big.get(998);
+big.set(0, "back").size;
+big.keys()[0];
+big.keys()[499];
+big.keys()[500];
+big.clear();
+big.size;
+big.set("after", 1);
+big.keys();
+let mixed = new Map();
+mixed.set(1, "int");
+mixed.set("1", "string");
+mixed.set(1.5, "double");
+mixed.set(true, "bool");
+mixed.get(1);
+mixed.get("1");
+mixed.keys();
@@ -0,0 +1,29 @@
+0.1 + 0.2;
+1 / 3;
+2 / 3;
+0.1;
+100;
+-1.5;
+123.456;
+5e-324;
+1.7976931348623157e308;
+2.2250738585072014e-308;
+9007199254740993;
+4294967296 * 4294967296;
+1e21;
+1e20;
+123e20;
+1.5e300;
+1e-6;
+1e-7;
+0.000001234;
+0.0000001234;
+-1e-7;
+1 / 0;
+-1 / 0;
+0 / 0;
+-0;
+0 * -1;
+"n = " + 1e21;
+"n = " + 0.1;
+[0.1 + 0.2, 1e-7, 1e21];
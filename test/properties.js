@@ -0,0 +1,44 @@
+function getX(o) { return o.x; }
+function setX(o, v) { o.x = v; return o.x; }
+function sumX(list, i, acc) {
+    if (i == list.length) return acc;
+    return sumX(list, i + 1, acc + list[i].x);
+}
+function bump(list, i) {
+    if (i == list.length) return list;
+    list[i].x = list[i].x * 10;
+    return bump(list, i + 1);
+}
+let one = { x: 1 };
+let two = { a: 0, x: 2 };
+let three = { a: 0, b: 0, x: 3 };
+let four = { b: 0, x: 4, c: 0 };
+let five = { c: 0, d: 0, e: 0, x: 5 };
+let six = { x: 6, f: 0 };
+let seven = { g: 0, h: 0, i: 0, j: 0, x: 7 };
+let none = { y: 1 };
+let poly = [one, two, three];
+let mega = [one, two, three, four, five, six, seven];
+sumX(poly, 0, 0);
+sumX(mega, 0, 0);
+sumX(mega, 0, 0);
+getX(one);
+getX(seven);
+getX(none);
+bump(mega, 0);
+sumX(mega, 0, 0);
+setX(none, 9);
+none.x;
+none.y;
+setX(five, 50);
+five.x;
+five.e;
+let added = { k: 1 };
+added.m = 2;
+added.n = 3;
+added.k + added.m + added.n;
+let again = { k: 4 };
+again.m = 5;
+again.n = 6;
+again.k + again.m + again.n;
+sumX([one, seven, { x: 100 }], 0, 0);
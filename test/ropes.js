@@ -0,0 +1,29 @@
+function build(s, i, n) {
+    if (i == n) return s;
+    return build(s + i, i + 1, n);
+}
+function prepend(s, i, n) {
+    if (i == n) return s;
+    return prepend(i + s, i + 1, n);
+}
+let long = build("", 0, 1000);
+long.length;
+long.charAt(0);
+long.charAt(10);
+long[2889];
+let front = prepend("", 0, 100);
+front.length;
+front[0] + front[1] + front[189];
+let parts = "ab" + "cd" + "" + "ef";
+parts;
+parts == "abcdef";
+parts === "ab" + "cdef";
+"x" + 1 + 2.5 + true;
+let nested = ("a" + "b") + ("c" + ("d" + "e"));
+nested;
+nested.length;
+let a = build("", 0, 50);
+let b = build("", 0, 50);
+a == b;
+a + "!" == b;
+typeof long;
@@ -0,0 +1,17 @@
+# Runs each test/*.js and compares what it prints with test/*.out.
+# Usage: sh test/run.sh [jank]
+JANK=${1:-build/jank}
+failed=0
+
+for script in test/*.js; do
+    expected="${script%.js}.out"
+    if "$JANK" "$script" 2>&1 | diff -u "$expected" - > /dev/null; then
+        echo "ok   $script"
+    else
+        echo "FAIL $script"
+        "$JANK" "$script" 2>&1 | diff -u "$expected" -
+        failed=1
+    fi
+done
+
+exit $failed
@@ -0,0 +1,32 @@
+function up(a, b) { return a - b; }
+function down(a, b) { return b - a; }
+function fill(array, i, n, seed) {
+    if (i == n) return array;
+    array.push((seed * 7919) % 1000 - 500);
+    return fill(array, i + 1, n, (seed * 7919) % 1000003);
+}
+function sorted(array, i) {
+    if (i >= array.length - 1) return true;
+    if (array[i] > array[i + 1]) return false;
+    return sorted(array, i + 1);
+}
+[3, 1, 2].sort();
+[5, -1, 2147483647, -2147483648, 0].sort();
+[2.5, 1, -0.5, 3, 1.25].sort();
+[1.5, 0 / 0, -1 / 0, 2, 1 / 0, -3].sort();
+[0, -0, 1, -1, -0.5].sort();
+1 / [0, -0].sort()[0];
+1 / [0, -0].sort()[1];
+[3, 1.5, 2, 0.5].sort(up);
+[3, 1.5, 2, 0.5].sort(down);
+[3, 1, 2].sort(down);
+[3, true, 1.5, 2, false].sort(up);
+let ints = fill([], 0, 5000, 1);
+sorted(ints.sort(), 0);
+ints.length;
+let doubles = fill([0.5], 0, 5000, 2);
+sorted(doubles.sort(up), 0);
+doubles[0];
+doubles[5000];
+let same = [2, 1, 3];
+same.sort() == same;
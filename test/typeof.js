@@ -0,0 +1,11 @@
+function f() { return 1; }
+let g = f;
+typeof f;
+typeof g;
+typeof 1.5;
+typeof "text";
+typeof true;
+typeof { a: 1 };
+typeof [1, 2];
+typeof new Map();
+typeof undefined;
@@ -0,0 +1,26 @@
+let s = "añb€c😀d";
+s.length;
+s[0];
+s[1];
+s[3];
+s[5];
+s[6];
+s[7];
+s.charAt(5);
+s.charAt(100);
+s.codePointAt(1);
+s.codePointAt(3);
+s.codePointAt(5);
+let ascii = "plain";
+ascii.length;
+ascii[4];
+let mixed = "日本語" + "テキスト" + "!";
+mixed.length;
+mixed[2];
+mixed[3];
+mixed[7];
+s[1e20];
+s[0 / 0];
+s[1.5];
+s.charAt(1e20);
+s.charAt(2.9);